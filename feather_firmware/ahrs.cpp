@@ -0,0 +1,203 @@
+// ahrs.cpp
+// Carson Powers
+// Source file for the onboard attitude filter fusing MPU6050 samples on the AHSR robot
+
+#include "ahrs.hpp"
+#include "pico/divider.h"
+#include <cmath>
+
+// Gains in fixed point
+#define AHRS_KP_Q16 ((int32_t)(AHRS_KP * 65536.0f))
+#define AHRS_KI_Q16 ((int32_t)(AHRS_KI * 65536.0f))
+#define AHRS_MAX_GYRO_BIAS_Q30 ((int64_t)(AHRS_MAX_GYRO_BIAS * 1073741824.0))
+
+// 2^14 / 2000000 in Q20: a Q16 rate times dt in us times this, shifted down
+// by 20, is the Q30 half angle turned through in dt
+#define AHRS_HALF_ANGLE_SCALE 8590
+
+// 1 / 1000000 in Q32, to scale by dt in seconds
+#define AHRS_US_TO_S_Q32 4295
+
+#define AHRS_PI 3.14159265f
+
+static int16_t read_be16(const uint8_t* data) {
+    return (int16_t)((data[0] << 8) | data[1]);
+}
+
+// Integer square root, rounded down
+static uint32_t isqrt32(uint32_t value) {
+    uint32_t root = 0;
+    uint32_t bit = 1u << 30;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return root;
+}
+
+AHRS::AHRS() {
+    set_sensor_scales(IMU_GYRO_LSB_PER_DPS, IMU_ACCEL_LSB_PER_G);
+    reset();
+}
+
+void AHRS::reset() {
+    seeded_ = false;
+    last_us_ = 0;
+    q_[0] = AHRS_QUATERNION_ONE;
+    q_[1] = 0;
+    q_[2] = 0;
+    q_[3] = 0;
+    integral_[0] = 0;
+    integral_[1] = 0;
+    integral_[2] = 0;
+}
+
+void AHRS::set_sensor_scales(float gyro_lsb_per_dps, float accel_lsb_per_g) {
+    // Only runs on a range change, so floating point is fine here
+    gyro_scale_ = (int32_t)lroundf(AHRS_PI / 180.0f / gyro_lsb_per_dps * 65536.0f * 65536.0f);
+
+    float low = AHRS_ACCEL_GATE_LOW * accel_lsb_per_g;
+    float high = AHRS_ACCEL_GATE_HIGH * accel_lsb_per_g;
+    accel_gate_low_ = (uint32_t)(low * low);
+    accel_gate_high_ = (uint32_t)fminf(high * high, 4294967295.0f);
+}
+
+void AHRS::seed(int32_t ax, int32_t ay, int32_t az) {
+    float roll = atan2f((float)ay, (float)az);
+    float pitch = atan2f((float)-ax, sqrtf((float)ay * ay + (float)az * az));
+    float cr = cosf(roll / 2), sr = sinf(roll / 2);
+    float cp = cosf(pitch / 2), sp = sinf(pitch / 2);
+
+    q_[0] = (int32_t)(cr * cp * AHRS_QUATERNION_ONE);
+    q_[1] = (int32_t)(sr * cp * AHRS_QUATERNION_ONE);
+    q_[2] = (int32_t)(cr * sp * AHRS_QUATERNION_ONE);
+    q_[3] = (int32_t)(-sr * sp * AHRS_QUATERNION_ONE);
+}
+
+bool AHRS::update(const IMUSample& sample) {
+    int32_t ax = read_be16(&sample.data[0]);
+    int32_t ay = read_be16(&sample.data[2]);
+    int32_t az = read_be16(&sample.data[4]);
+    int32_t gx = read_be16(&sample.data[8]);
+    int32_t gy = read_be16(&sample.data[10]);
+    int32_t gz = read_be16(&sample.data[12]);
+
+    if (sample.timestamp_us == last_us_) {
+        return false;
+    }
+
+    if (!seeded_) {
+        if (ax == 0 && ay == 0 && az == 0) {
+            return false;
+        }
+        seed(ax, ay, az);
+        seeded_ = true;
+        last_us_ = sample.timestamp_us;
+        return true;
+    }
+
+    uint64_t dt_us = sample.timestamp_us - last_us_;
+    last_us_ = sample.timestamp_us;
+    if (dt_us > AHRS_MAX_DT_US) {
+        return true;
+    }
+
+    // Angular rate in Q16 rad/s
+    int32_t g[3] = {
+        (int32_t)(((int64_t)gx * gyro_scale_) >> 16),
+        (int32_t)(((int64_t)gy * gyro_scale_) >> 16),
+        (int32_t)(((int64_t)gz * gyro_scale_) >> 16)
+    };
+
+    // Steer towards the measured gravity direction when the accelerometer
+    // reads about 1 g. Squares of int16 sum to less than 2^32
+    uint32_t accel_squared = (uint32_t)(ax * ax) + (uint32_t)(ay * ay) + (uint32_t)(az * az);
+    if (accel_squared >= accel_gate_low_ && accel_squared <= accel_gate_high_) {
+        int32_t norm = (int32_t)isqrt32(accel_squared);
+
+        // Unit accelerometer vector in Q30, divided to Q14 on the hardware divider
+        int32_t a[3] = {
+            div_s32s32(ax << 14, norm) << 16,
+            div_s32s32(ay << 14, norm) << 16,
+            div_s32s32(az << 14, norm) << 16
+        };
+
+        // Gravity direction predicted by the quaternion, in Q30
+        int32_t v[3] = {
+            (int32_t)(((int64_t)q_[1] * q_[3] - (int64_t)q_[0] * q_[2]) >> 29),
+            (int32_t)(((int64_t)q_[0] * q_[1] + (int64_t)q_[2] * q_[3]) >> 29),
+            (int32_t)(((int64_t)q_[0] * q_[0] - (int64_t)q_[1] * q_[1] -
+                       (int64_t)q_[2] * q_[2] + (int64_t)q_[3] * q_[3]) >> 30)
+        };
+
+        // Error is the cross product of measured and predicted gravity (Q30)
+        int32_t e[3] = {
+            (int32_t)(((int64_t)a[1] * v[2] - (int64_t)a[2] * v[1]) >> 30),
+            (int32_t)(((int64_t)a[2] * v[0] - (int64_t)a[0] * v[2]) >> 30),
+            (int32_t)(((int64_t)a[0] * v[1] - (int64_t)a[1] * v[0]) >> 30)
+        };
+
+        for (int i = 0; i < 3; i++) {
+            // Integral term, clamped so a long disturbance cannot wind it up
+            int64_t rate = ((int64_t)e[i] * AHRS_KI_Q16) >> 16;
+            integral_[i] += (rate * (int64_t)dt_us * AHRS_US_TO_S_Q32) >> 32;
+            if (integral_[i] > AHRS_MAX_GYRO_BIAS_Q30) {
+                integral_[i] = AHRS_MAX_GYRO_BIAS_Q30;
+            } else if (integral_[i] < -AHRS_MAX_GYRO_BIAS_Q30) {
+                integral_[i] = -AHRS_MAX_GYRO_BIAS_Q30;
+            }
+
+            g[i] += (int32_t)(((int64_t)e[i] * AHRS_KP_Q16) >> 30) + (int32_t)(integral_[i] >> 14);
+        }
+    }
+
+    // Half angles turned through in dt, Q30
+    int32_t h[3];
+    for (int i = 0; i < 3; i++) {
+        h[i] = (int32_t)(((int64_t)g[i] * (int64_t)dt_us * AHRS_HALF_ANGLE_SCALE) >> 20);
+    }
+
+    // q += q * (0, h)
+    int32_t q0 = q_[0], q1 = q_[1], q2 = q_[2], q3 = q_[3];
+    q_[0] = q0 - (int32_t)(((int64_t)q1 * h[0] + (int64_t)q2 * h[1] + (int64_t)q3 * h[2]) >> 30);
+    q_[1] = q1 + (int32_t)(((int64_t)q0 * h[0] + (int64_t)q2 * h[2] - (int64_t)q3 * h[1]) >> 30);
+    q_[2] = q2 + (int32_t)(((int64_t)q0 * h[1] - (int64_t)q1 * h[2] + (int64_t)q3 * h[0]) >> 30);
+    q_[3] = q3 + (int32_t)(((int64_t)q0 * h[2] + (int64_t)q1 * h[1] - (int64_t)q2 * h[0]) >> 30);
+
+    // The quaternion stays close to unit length, so scale by the first order
+    // inverse square root 1.5 - |q|^2 / 2 instead of dividing by the norm
+    int64_t norm_squared = ((int64_t)q_[0] * q_[0] + (int64_t)q_[1] * q_[1] +
+                            (int64_t)q_[2] * q_[2] + (int64_t)q_[3] * q_[3]) >> 30;
+    int64_t scale = (3LL << 29) - (norm_squared >> 1);
+    for (int i = 0; i < 4; i++) {
+        q_[i] = (int32_t)(((int64_t)q_[i] * scale) >> 30);
+    }
+
+    return true;
+}
+
+AHRSState AHRS::get_state() const {
+    AHRSState state;
+
+    state.timestamp_us = last_us_;
+    for (int i = 0; i < 4; i++) {
+        state.quaternion[i] = q_[i];
+    }
+
+    // The integral term cancels the bias, so the bias is its negation
+    for (int i = 0; i < 3; i++) {
+        state.gyro_bias[i] = (int32_t)(-integral_[i] >> 14);
+    }
+
+    return state;
+}
@@ -0,0 +1,104 @@
+// ahrs.hpp
+// Carson Powers
+// Header file for the onboard attitude filter fusing MPU6050 samples on the AHSR robot
+
+#ifndef AHRS_HPP
+#define AHRS_HPP
+
+// Standard Libraries
+#include <cstdint>
+
+#include "imu.hpp"
+
+// Fixed point formats
+#define AHRS_QUATERNION_ONE (1 << 30) // Quaternion components are Q30
+#define AHRS_RATE_ONE (1 << 16) // Angular rates (gyro bias) are Q16 rad/s
+
+// Filter gains
+#define AHRS_KP 1.0f // Proportional gain, rad/s of correction per rad of gravity error
+#define AHRS_KI 0.05f // Integral gain, sets how fast the gyro bias estimate moves
+#define AHRS_MAX_GYRO_BIAS 0.2f // Gyro bias estimate limit in rad/s (about 11 dps)
+
+// Accelerometer corrections are skipped outside these magnitudes (g), where
+// the reading is dominated by linear acceleration rather than gravity
+#define AHRS_ACCEL_GATE_LOW 0.75f
+#define AHRS_ACCEL_GATE_HIGH 1.25f
+
+// Longer gaps between samples are not integrated
+#define AHRS_MAX_DT_US 100000
+
+/**
+ * @brief Attitude estimate at one IMU sample.
+ */
+struct AHRSState {
+    uint64_t timestamp_us; // Time of the last fused IMU sample (0 before the first).
+    int32_t quaternion[4]; // Body to earth rotation w, x, y, z in Q30.
+    int32_t gyro_bias[3]; // Estimated gyro bias x, y, z in Q16 rad/s.
+};
+
+/**
+ * @class AHRS
+ * @brief Mahony complementary filter in fixed point.
+ *
+ * Integrates the gyro into a Q30 quaternion and steers it towards the
+ * accelerometer's gravity direction with a PI controller, whose integral
+ * term is the gyro bias estimate. Yaw drifts at the residual z gyro bias, as
+ * there is no magnetometer to correct it.
+ *
+ * The RP2040 has no FPU, so the update only uses integer multiplies, shifts
+ * and the hardware divider (to normalize the accelerometer). The quaternion
+ * is renormalized with a first order correction that needs no square root.
+ * The first sample seeds roll and pitch from the accelerometer.
+ */
+class AHRS {
+    public:
+        /**
+         * @brief Construct a new AHRS object for the default MPU6050 ranges.
+         */
+        AHRS();
+
+        /**
+         * @brief Restart from the next sample, clearing the gyro bias estimate.
+         */
+        void reset();
+
+        /**
+         * @brief Set the raw sensor scales (after a full scale range change).
+         * @param gyro_lsb_per_dps Gyro LSB per degree per second.
+         * @param accel_lsb_per_g Accelerometer LSB per g.
+         */
+        void set_sensor_scales(float gyro_lsb_per_dps, float accel_lsb_per_g);
+
+        /**
+         * @brief Fuse an IMU sample.
+         *
+         * Samples with the same timestamp as the last one are ignored.
+         *
+         * @param sample The MPU6050 register sample.
+         * @return true if the sample was new.
+         */
+        bool update(const IMUSample& sample);
+
+        /**
+         * @brief Get the current attitude estimate.
+         * @return AHRSState The estimate.
+         */
+        AHRSState get_state() const;
+
+    private:
+        /**
+         * @brief Set roll and pitch from an accelerometer reading, with zero yaw.
+         */
+        void seed(int32_t ax, int32_t ay, int32_t az);
+
+        int32_t gyro_scale_; // Raw gyro to Q16 rad/s, in Q16.
+        uint32_t accel_gate_low_; // Lowest accepted squared raw accel magnitude.
+        uint32_t accel_gate_high_; // Highest accepted squared raw accel magnitude.
+
+        bool seeded_; // Set once the first sample set the attitude.
+        uint64_t last_us_; // Timestamp of the last fused sample.
+        int32_t q_[4]; // Attitude quaternion w, x, y, z in Q30.
+        int64_t integral_[3]; // Integral feedback in Q30 rad/s (minus the gyro bias).
+};
+
+#endif // AHRS_HPP
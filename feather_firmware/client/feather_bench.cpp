@@ -0,0 +1,364 @@
+// feather_bench.cpp
+// Carson Powers
+// Round trip and streaming latency benchmark for the Feather protocol through FeatherClient
+//
+// Usage: feather_bench (--device PATH | --sim FEATHER_PTY) [--edge-rate N] [--iterations N]
+//                      [--stream-ms N] [--rate HZ] [--delta] [--callback]
+//
+// --device opens a real board (/dev/ttyACM0) or a running host/feather_pty.
+// --sim starts the given feather_pty build on a pseudo terminal for the run.
+//
+// Round trips are timed from the host send to the reader thread receiving
+// the response. Streaming latency is the age of each telemetry sample when
+// the reader received it: the sample's device timestamp is mapped to the
+// host clock with the MSG_TIME_SYNC offset of the lowest delay exchange.
+// Telemetry is taken with poll(), or with --callback on the reader thread.
+
+// Client
+#include "feather_client.hpp"
+
+// Standard Libraries
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BENCH_DEFAULT_ITERATIONS 1000
+#define BENCH_DEFAULT_STREAM_MS 2000
+#define BENCH_DEFAULT_RATE_HZ 2000 // The firmware's STREAM_RATE_MAX_HZ
+#define BENCH_CLOCK_SYNC_EXCHANGES 100
+#define BENCH_SIM_START_TIMEOUT_MS 5000 // Time allowed for feather_pty to boot and make its link
+#define BENCH_POLL_TIMEOUT_MS 10
+
+/**
+ * @brief Latency statistics of one measurement.
+ */
+struct LatencyStats {
+    std::string name;
+    std::vector<double> samples_us;
+    uint32_t failures = 0;
+
+    void print() {
+        if (samples_us.empty()) {
+            printf("  %-28s no samples (%u failed)\n", name.c_str(), failures);
+            return;
+        }
+
+        std::sort(samples_us.begin(), samples_us.end());
+        double sum = 0;
+        for (double sample : samples_us) {
+            sum += sample;
+        }
+
+        size_t n = samples_us.size();
+        printf("  %-28s min %8.2f  med %8.2f  p99 %8.2f  max %8.2f  mean %8.2f us  (%zu ok, %u failed)\n",
+               name.c_str(), samples_us[0], samples_us[n / 2], samples_us[std::min(n - 1, n * 99 / 100)],
+               samples_us[n - 1], sum / n, n, failures);
+    }
+};
+
+/**
+ * @brief Telemetry samples seen while streaming.
+ */
+struct StreamResult {
+    std::mutex mutex; // Guards the fields in callback mode.
+    bool recording = false;
+    uint32_t frames = 0;
+    uint32_t gaps = 0;
+    uint16_t next_seq = 0;
+    uint64_t last_receive_us = 0;
+    LatencyStats latency;
+    LatencyStats interval;
+};
+
+/**
+ * @brief Start feather_pty with its terminal linked at link_path.
+ * @return pid_t The simulator's pid, or -1 if it did not come up.
+ */
+static pid_t start_simulator(const char* path, const char* link_path, const char* edge_rate) {
+    unlink(link_path);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The terminal path is printed on stdout; the link is all that is needed
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        if (edge_rate) {
+            execl(path, path, "--link", link_path, "--edge-rate", edge_rate, (char*)nullptr);
+        } else {
+            execl(path, path, "--link", link_path, (char*)nullptr);
+        }
+        _exit(127);
+    }
+    if (pid < 0) {
+        return -1;
+    }
+
+    for (uint32_t waited_ms = 0; waited_ms < BENCH_SIM_START_TIMEOUT_MS; waited_ms += 10) {
+        if (access(link_path, F_OK) == 0) {
+            return pid;
+        }
+        if (waitpid(pid, nullptr, WNOHANG) == pid) {
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+    return -1;
+}
+
+/**
+ * @brief Estimate the device clock offset from the lowest delay MSG_TIME_SYNC exchange.
+ * @param offset_us Set to device minus host time.
+ * @return true if any exchange succeeded.
+ */
+static bool sync_clock(FeatherClient& client, double* offset_us) {
+    double best_delay_us = INFINITY;
+
+    for (uint32_t i = 0; i < BENCH_CLOCK_SYNC_EXCHANGES; i++) {
+        uint64_t t1 = FeatherClient::clock_us(), t4;
+        Frame response;
+
+        if (!client.request(MSG_TIME_SYNC, reinterpret_cast<const uint8_t*>(&t1), sizeof(t1), &response, &t4) ||
+            response.type != (MSG_TIME_SYNC | MSG_RESPONSE_FLAG) || response.length != TIME_SYNC_PAYLOAD_LENGTH) {
+            continue;
+        }
+
+        uint64_t t2, t3;
+        memcpy(&t2, &response.payload[8], sizeof(t2));
+        memcpy(&t3, &response.payload[16], sizeof(t3));
+
+        double delay_us = (double)(t4 - t1) - (double)(t3 - t2);
+        if (delay_us < best_delay_us) {
+            best_delay_us = delay_us;
+            *offset_us = (((double)t2 - (double)t1) + ((double)t3 - (double)t4)) / 2.0;
+        }
+    }
+
+    if (std::isinf(best_delay_us)) {
+        return false;
+    }
+    printf("Clock sync: offset %.1f us at %.1f us delay (best of %u)\n", *offset_us, best_delay_us,
+           BENCH_CLOCK_SYNC_EXCHANGES);
+    return true;
+}
+
+/**
+ * @brief Time request() round trips of one message type.
+ * @return true if every request was answered.
+ */
+static bool run_round_trips(FeatherClient& client, const char* name, uint8_t type, const uint8_t* payload,
+                            uint16_t length, uint32_t iterations) {
+    LatencyStats stats;
+    stats.name = name;
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint64_t start_us = FeatherClient::clock_us(), receive_us;
+        Frame response;
+
+        if (client.request(type, payload, length, &response, &receive_us) &&
+            response.type == (type | MSG_RESPONSE_FLAG)) {
+            stats.samples_us.push_back((double)(receive_us - start_us));
+        } else {
+            stats.failures++;
+        }
+    }
+    stats.print();
+
+    return stats.failures == 0;
+}
+
+/**
+ * @brief Record one telemetry frame.
+ */
+static void record_telemetry(StreamResult* result, const FrameView& frame, double offset_us) {
+    if (frame.type != MSG_TELEMETRY || frame.length != TELEMETRY_PAYLOAD_LENGTH || !result->recording) {
+        return;
+    }
+
+    uint64_t sample_us;
+    memcpy(&sample_us, frame.payload, sizeof(sample_us));
+    result->latency.samples_us.push_back((double)frame.receive_us - ((double)sample_us - offset_us));
+
+    if (result->frames > 0) {
+        if (frame.seq != result->next_seq) {
+            result->gaps++;
+        }
+        result->interval.samples_us.push_back((double)(frame.receive_us - result->last_receive_us));
+    }
+    result->next_seq = frame.seq + 1;
+    result->last_receive_us = frame.receive_us;
+    result->frames++;
+}
+
+/**
+ * @brief Stream telemetry for a while and time each sample.
+ * @return true if telemetry arrived.
+ */
+static bool run_stream(FeatherClient& client, StreamResult* result, bool callback, uint32_t stream_ms,
+                       uint16_t rate_hz, bool delta, double offset_us) {
+    Frame response;
+    uint8_t rate[STREAM_RATE_PAYLOAD_LENGTH] = {(uint8_t)rate_hz, (uint8_t)(rate_hz >> 8)};
+    uint8_t mode = delta ? STREAM_ENCODING_DELTA : STREAM_ENCODING_RAW;
+    uint8_t encoding[STREAM_ENCODING_PAYLOAD_LENGTH] = {mode, STREAM_KEYFRAME_INTERVAL_DEFAULT & 0xFF,
+                                                        STREAM_KEYFRAME_INTERVAL_DEFAULT >> 8};
+
+    if (!client.request(MSG_SET_STREAM_RATE, rate, sizeof(rate), &response) ||
+        response.type != (MSG_SET_STREAM_RATE | MSG_RESPONSE_FLAG) ||
+        !client.request(MSG_SET_STREAM_ENCODING, encoding, sizeof(encoding), &response) ||
+        response.type != (MSG_SET_STREAM_ENCODING | MSG_RESPONSE_FLAG)) {
+        printf("Streaming: the device refused %u Hz %s telemetry\n", rate_hz, delta ? "delta" : "raw");
+        return false;
+    }
+
+    FeatherClientStats before = client.get_stats();
+    {
+        std::lock_guard<std::mutex> lock(result->mutex);
+        result->recording = true;
+    }
+    client.request(MSG_START_STREAM, nullptr, 0, &response);
+
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(stream_ms);
+    if (callback) {
+        std::this_thread::sleep_until(end);
+    } else {
+        FrameView frame;
+        while (std::chrono::steady_clock::now() < end) {
+            if (client.poll(&frame, BENCH_POLL_TIMEOUT_MS)) {
+                record_telemetry(result, frame, offset_us);
+            }
+        }
+        client.release();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(result->mutex);
+        result->recording = false;
+    }
+    client.request(MSG_STOP_STREAM, nullptr, 0, &response);
+    FeatherClientStats after = client.get_stats();
+
+    // Leave the link as a fresh client expects it
+    encoding[0] = STREAM_ENCODING_RAW;
+    client.request(MSG_SET_STREAM_ENCODING, encoding, sizeof(encoding), &response);
+
+    uint32_t expected = rate_hz * stream_ms / 1000;
+    printf("Streaming (%u Hz %s for %u ms, %s): %u frames (about %u expected), %u sequence gaps, "
+           "%.1f wire bytes per frame\n", rate_hz, delta ? "delta" : "raw", stream_ms, callback ? "callback" : "poll",
+           result->frames, expected, result->gaps,
+           result->frames ? (double)(after.bytes - before.bytes) / result->frames : 0.0);
+    printf("  client: %u bad frames, %u ring overruns, %u delta frames dropped\n",
+           after.bad_frames - before.bad_frames, after.overruns - before.overruns,
+           after.delta_dropped - before.delta_dropped);
+    result->latency.print();
+    result->interval.print();
+
+    return result->frames > 0;
+}
+
+int main(int argc, char** argv) {
+    const char* device_path = nullptr;
+    const char* sim_path = nullptr;
+    const char* edge_rate = nullptr;
+    uint32_t iterations = BENCH_DEFAULT_ITERATIONS;
+    uint32_t stream_ms = BENCH_DEFAULT_STREAM_MS;
+    uint16_t rate_hz = BENCH_DEFAULT_RATE_HZ;
+    bool delta = false;
+    bool callback = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--device") && i + 1 < argc) {
+            device_path = argv[++i];
+        } else if (!strcmp(argv[i], "--sim") && i + 1 < argc) {
+            sim_path = argv[++i];
+        } else if (!strcmp(argv[i], "--edge-rate") && i + 1 < argc) {
+            edge_rate = argv[++i];
+        } else if (!strcmp(argv[i], "--iterations") && i + 1 < argc) {
+            iterations = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "--stream-ms") && i + 1 < argc) {
+            stream_ms = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "--rate") && i + 1 < argc) {
+            rate_hz = (uint16_t)strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "--delta")) {
+            delta = true;
+        } else if (!strcmp(argv[i], "--callback")) {
+            callback = true;
+        } else {
+            device_path = sim_path = nullptr;
+            break;
+        }
+    }
+    if (!device_path == !sim_path) {
+        fprintf(stderr, "Usage: %s (--device PATH | --sim FEATHER_PTY) [--edge-rate N] [--iterations N]\n"
+                        "       [--stream-ms N] [--rate HZ] [--delta] [--callback]\n", argv[0]);
+        return 2;
+    }
+
+    // Simulated device on a pseudo terminal
+    pid_t sim_pid = -1;
+    std::string link_path;
+    if (sim_path) {
+        link_path = "/tmp/feather_bench_" + std::to_string(getpid());
+        sim_pid = start_simulator(sim_path, link_path.c_str(), edge_rate);
+        if (sim_pid < 0) {
+            fprintf(stderr, "feather_bench: %s did not start\n", sim_path);
+            return 1;
+        }
+        device_path = link_path.c_str();
+    }
+
+    StreamResult stream;
+    stream.latency.name = "sample to host latency";
+    stream.interval.name = "frame interval";
+    double offset_us = 0;
+
+    FeatherClient client;
+    if (callback) {
+        client.set_callback([&stream, &offset_us](const FrameView& frame) {
+            std::lock_guard<std::mutex> lock(stream.mutex);
+            record_telemetry(&stream, frame, offset_us);
+        });
+    }
+
+    bool pass = client.open(device_path);
+    if (!pass) {
+        perror("feather_bench: open");
+    } else {
+        printf("Feather at %s\n", device_path);
+
+        uint8_t reset = 0;
+        uint64_t t1 = FeatherClient::clock_us();
+        pass = sync_clock(client, &offset_us);
+        printf("Round trips (%u each)\n", iterations);
+        pass = run_round_trips(client, "GET_ENCODERS", MSG_GET_ENCODERS, nullptr, 0, iterations) && pass;
+        pass = run_round_trips(client, "GET_ALL_SENSORS", MSG_GET_ALL_SENSORS, nullptr, 0, iterations) && pass;
+        pass = run_round_trips(client, "GET_STATS", MSG_GET_STATS, &reset, sizeof(reset), iterations) && pass;
+        pass = run_round_trips(client, "TIME_SYNC", MSG_TIME_SYNC, reinterpret_cast<const uint8_t*>(&t1),
+                               sizeof(t1), iterations) && pass;
+        pass = run_stream(client, &stream, callback, stream_ms, rate_hz, delta, offset_us) && pass;
+
+        client.close();
+    }
+
+    if (sim_pid > 0) {
+        kill(sim_pid, SIGTERM);
+        waitpid(sim_pid, nullptr, 0);
+    }
+
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,422 @@
+// feather_client.cpp
+// Carson Powers
+// Source file for the Linux host client of the framed USB protocol of the Adafruit Feather RP2040 on the AHSR robot
+
+#include "feather_client.hpp"
+
+// Standard Libraries
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+// POSIX
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+FeatherClient::FeatherClient(size_t ring_slots)
+    : fd_(-1),
+      running_(false),
+      slots_(std::max<size_t>(ring_slots, 1)),
+      head_(0),
+      tail_(0),
+      holding_(false),
+      poll_waiting_(false),
+      slot_(nullptr),
+      raw_length_(0),
+      block_remaining_(0),
+      block_zero_(false),
+      frame_error_(false),
+      telemetry_seq_(0),
+      telemetry_valid_(false),
+      next_seq_(0),
+      bytes_(0),
+      frames_(0),
+      bad_frames_(0),
+      overruns_(0),
+      delta_dropped_(0) {
+    memset(telemetry_, 0, sizeof(telemetry_));
+    memset(pending_, 0, sizeof(pending_));
+}
+
+FeatherClient::~FeatherClient() {
+    close();
+}
+
+bool FeatherClient::open(const char* path) {
+    close();
+
+    fd_ = ::open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    // Bytes pass unchanged; the baud rate means nothing to USB CDC
+    struct termios tio;
+    if (tcgetattr(fd_, &tio) == 0) {
+        cfmakeraw(&tio);
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 0;
+        tcsetattr(fd_, TCSANOW, &tio);
+    }
+
+    // Drop whatever the port held from an earlier client
+    tcflush(fd_, TCIOFLUSH);
+
+    head_ = 0;
+    tail_ = 0;
+    holding_ = false;
+    slot_ = nullptr;
+    telemetry_valid_ = false;
+    bytes_ = 0;
+    frames_ = 0;
+    bad_frames_ = 0;
+    overruns_ = 0;
+    delta_dropped_ = 0;
+
+    // In framed mode the two bytes are an empty bad frame, in legacy mode the delimiter is ignored
+    const uint8_t start[2] = {FRAMED_MODE_BYTE, PROTOCOL_DELIMITER};
+    if (write(fd_, start, sizeof(start)) != (ssize_t)sizeof(start)) {
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    running_ = true;
+    reader_ = std::thread(&FeatherClient::reader_loop, this);
+
+    return true;
+}
+
+void FeatherClient::close() {
+    if (fd_ < 0) {
+        return;
+    }
+
+    running_ = false;
+    if (reader_.joinable()) {
+        reader_.join();
+    }
+    ::close(fd_);
+    fd_ = -1;
+}
+
+bool FeatherClient::is_open() const {
+    return fd_ >= 0;
+}
+
+void FeatherClient::set_callback(FrameCallback callback) {
+    callback_ = callback;
+}
+
+bool FeatherClient::send(uint8_t type, const uint8_t* payload, uint16_t length, uint16_t* seq) {
+    uint16_t frame_seq = next_seq_++;
+
+    if (seq) {
+        *seq = frame_seq;
+    }
+    return write_frame(type, frame_seq, payload, length);
+}
+
+bool FeatherClient::request(uint8_t type, const uint8_t* payload, uint16_t length, Frame* response,
+                            uint64_t* receive_us, uint32_t timeout_ms) {
+    uint16_t seq = next_seq_++;
+    PendingRequest* pending = nullptr;
+
+    // Wait for the response before it can arrive
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        for (PendingRequest& entry : pending_) {
+            if (!entry.active) {
+                pending = &entry;
+                break;
+            }
+        }
+        if (!pending) {
+            return false;
+        }
+        pending->active = true;
+        pending->done = false;
+        pending->seq = seq;
+        pending->response = response;
+    }
+
+    bool answered = write_frame(type, seq, payload, length);
+
+    std::unique_lock<std::mutex> lock(pending_mutex_);
+    if (answered) {
+        answered = pending_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [pending]() {
+            return pending->done;
+        });
+    }
+    if (answered && receive_us) {
+        *receive_us = pending->receive_us;
+    }
+    pending->active = false;
+
+    return answered;
+}
+
+bool FeatherClient::poll(FrameView* frame, uint32_t timeout_ms) {
+    release();
+
+    uint32_t tail = tail_.load();
+    if (head_.load() == tail) {
+        if (timeout_ms == 0) {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lock(ring_mutex_);
+        poll_waiting_ = true;
+        bool queued = ring_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, tail]() {
+            return head_.load() != tail;
+        });
+        poll_waiting_ = false;
+        if (!queued) {
+            return false;
+        }
+    }
+
+    *frame = slots_[tail % slots_.size()].view;
+    holding_ = true;
+
+    return true;
+}
+
+void FeatherClient::release() {
+    if (holding_) {
+        holding_ = false;
+        tail_++;
+    }
+}
+
+FeatherClientStats FeatherClient::get_stats() const {
+    FeatherClientStats stats;
+
+    stats.bytes = bytes_;
+    stats.frames = frames_;
+    stats.bad_frames = bad_frames_;
+    stats.overruns = overruns_;
+    stats.delta_dropped = delta_dropped_;
+
+    return stats;
+}
+
+uint64_t FeatherClient::clock_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void FeatherClient::reader_loop() {
+    std::vector<uint8_t> buffer(FEATHER_CLIENT_READ_CHUNK_LENGTH);
+    struct pollfd fds = {fd_, POLLIN, 0};
+
+    while (running_) {
+        if (::poll(&fds, 1, FEATHER_CLIENT_POLL_MS) <= 0) {
+            continue;
+        }
+
+        ssize_t count = read(fd_, buffer.data(), buffer.size());
+        if (count <= 0) {
+            if (count < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            break; // Unplugged, or the simulator exited
+        }
+
+        uint64_t receive_us = clock_us();
+        bytes_ += (uint64_t)count;
+        for (ssize_t i = 0; i < count; i++) {
+            push_byte(buffer[i], receive_us);
+        }
+    }
+}
+
+void FeatherClient::push_byte(uint8_t byte, uint64_t receive_us) {
+    if (byte == PROTOCOL_DELIMITER) {
+        finish_frame(receive_us);
+        return;
+    }
+
+    if (!slot_) {
+        slot_ = start_frame();
+        raw_length_ = 0;
+        block_remaining_ = 0;
+        block_zero_ = false;
+        frame_error_ = false;
+    }
+    if (frame_error_) {
+        return;
+    }
+
+    uint8_t data = byte;
+    if (block_remaining_ == 0) {
+        // Code byte: the block before it stood for a zero unless it was full
+        block_remaining_ = byte - 1;
+        bool zero = block_zero_;
+        block_zero_ = byte != 0xFF;
+        if (!zero) {
+            return;
+        }
+        data = 0;
+    } else {
+        block_remaining_--;
+    }
+
+    if (raw_length_ >= sizeof(slot_->raw)) {
+        frame_error_ = true;
+        return;
+    }
+    slot_->raw[raw_length_++] = data;
+}
+
+FeatherClient::Slot* FeatherClient::start_frame() {
+    // The held slot is the tail, so the head is free while the ring is not full
+    if (!callback_ && head_.load() - tail_.load() < slots_.size()) {
+        return &slots_[head_.load() % slots_.size()];
+    }
+    return &scratch_;
+}
+
+void FeatherClient::finish_frame(uint64_t receive_us) {
+    Slot* slot = slot_;
+    bool malformed = frame_error_ || block_remaining_ != 0;
+    size_t raw_length = raw_length_;
+    slot_ = nullptr;
+
+    // Back-to-back delimiters are empty frames and are ignored
+    if (!slot) {
+        return;
+    }
+
+    // Check the length field against the received size, then the CRC
+    uint16_t length = 0;
+    uint32_t crc = 0;
+    if (!malformed && raw_length >= PROTOCOL_HEADER_LENGTH + PROTOCOL_CRC_LENGTH) {
+        memcpy(&length, &slot->raw[3], sizeof(length));
+        malformed = (size_t)(PROTOCOL_HEADER_LENGTH + length + PROTOCOL_CRC_LENGTH) != raw_length;
+        if (!malformed) {
+            memcpy(&crc, &slot->raw[PROTOCOL_HEADER_LENGTH + length], sizeof(crc));
+            malformed = protocol_crc32(slot->raw, PROTOCOL_HEADER_LENGTH + length) != crc;
+        }
+    } else {
+        malformed = true;
+    }
+    if (malformed) {
+        bad_frames_++;
+        return;
+    }
+
+    FrameView& view = slot->view;
+    view.type = slot->raw[0];
+    memcpy(&view.seq, &slot->raw[1], sizeof(view.seq));
+    view.length = length;
+    view.payload = &slot->raw[PROTOCOL_HEADER_LENGTH];
+    view.receive_us = receive_us;
+    frames_++;
+
+    if (view.type & MSG_RESPONSE_FLAG) {
+        if (complete_request(view)) {
+            return;
+        }
+    } else if (!handle_telemetry(&view, &slot->raw[PROTOCOL_HEADER_LENGTH])) {
+        return;
+    }
+
+    if (callback_) {
+        callback_(view);
+        return;
+    }
+    if (slot == &scratch_) {
+        overruns_++;
+        return;
+    }
+
+    head_++;
+    if (poll_waiting_) {
+        std::lock_guard<std::mutex> lock(ring_mutex_);
+        ring_cv_.notify_one();
+    }
+}
+
+bool FeatherClient::handle_telemetry(FrameView* view, uint8_t* payload) {
+    if (view->type == MSG_TELEMETRY) {
+        // Keyframe: deltas after it decode against it
+        if (view->length == TELEMETRY_PAYLOAD_LENGTH) {
+            memcpy(telemetry_, payload, TELEMETRY_PAYLOAD_LENGTH);
+            telemetry_seq_ = view->seq;
+            telemetry_valid_ = true;
+        }
+        return true;
+    }
+    if (view->type != MSG_TELEMETRY_DELTA) {
+        return true;
+    }
+
+    // A delta is only usable on top of the frame right before it
+    uint8_t current[TELEMETRY_PAYLOAD_LENGTH];
+    if (!telemetry_valid_ || view->seq != (uint16_t)(telemetry_seq_ + 1) ||
+        !decode_telemetry_delta(telemetry_, payload, view->length, current)) {
+        telemetry_valid_ = false;
+        delta_dropped_++;
+        return false;
+    }
+
+    memcpy(telemetry_, current, sizeof(current));
+    memcpy(payload, current, sizeof(current));
+    telemetry_seq_ = view->seq;
+    view->type = MSG_TELEMETRY;
+    view->length = TELEMETRY_PAYLOAD_LENGTH;
+
+    return true;
+}
+
+bool FeatherClient::complete_request(const FrameView& view) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+
+    for (PendingRequest& entry : pending_) {
+        if (entry.active && !entry.done && entry.seq == view.seq) {
+            entry.response->type = view.type;
+            entry.response->seq = view.seq;
+            entry.response->length = view.length;
+            memcpy(entry.response->payload, view.payload, view.length);
+            entry.receive_us = view.receive_us;
+            entry.done = true;
+            pending_cv_.notify_all();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool FeatherClient::write_frame(uint8_t type, uint16_t seq, const uint8_t* payload, uint16_t length) {
+    uint8_t encoded[PROTOCOL_MAX_ENCODED_FRAME];
+
+    if (fd_ < 0) {
+        return false;
+    }
+
+    // encode_frame() builds the frame in a buffer of its own, so it is serialized too
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    size_t encoded_length = encode_frame(type, seq, payload, length, encoded);
+    if (encoded_length == 0) {
+        return false; // Payload longer than PROTOCOL_MAX_PAYLOAD
+    }
+
+    size_t written = 0;
+    while (written < encoded_length) {
+        ssize_t count = write(fd_, &encoded[written], encoded_length - written);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        written += (size_t)count;
+    }
+
+    return true;
+}
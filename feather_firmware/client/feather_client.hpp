@@ -0,0 +1,281 @@
+// feather_client.hpp
+// Carson Powers
+// Header file for the Linux host client of the framed USB protocol of the Adafruit Feather RP2040 on the AHSR robot
+
+// The client opens the Feather's serial port (/dev/ttyACM*, or a
+// host/feather_pty simulator), switches it to framed mode and starts a reader
+// thread. The reader COBS decodes each frame as its bytes arrive, straight
+// into the next free slot of a preallocated ring, and checks its length and
+// CRC there; frames are handed out as views of their slot, never copied.
+// Delta telemetry (MSG_TELEMETRY_DELTA) is rebuilt in its slot, so consumers
+// only ever see MSG_TELEMETRY.
+//
+// Frames reach the application in one of two ways:
+//   - set_callback(): the callback runs on the reader thread for every frame
+//     and the slot is reused when it returns.
+//   - poll(): frames queue in the ring until taken, oldest first. When the
+//     ring is full, new frames are dropped and counted as overruns.
+// request() sends a frame and waits for the response with its sequence
+// number; that response is copied to the caller instead of being queued.
+//
+// Receive times are taken from the host steady clock (clock_us()) once per
+// read from the port, so frames that arrive in one USB transfer share it.
+
+#ifndef FEATHER_CLIENT_HPP
+#define FEATHER_CLIENT_HPP
+
+// Firmware Headers
+#include "protocol.hpp"
+
+// Standard Libraries
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define FEATHER_CLIENT_RING_SLOTS 256 // Default ring size, about 128 ms of telemetry at 2 kHz
+#define FEATHER_CLIENT_MAX_PENDING 16 // request() calls waiting at once
+#define FEATHER_CLIENT_TIMEOUT_MS 100 // Default request() timeout
+#define FEATHER_CLIENT_READ_CHUNK_LENGTH 16384 // Bytes taken from the port per read
+#define FEATHER_CLIENT_POLL_MS 20 // Reader wake-up period to notice close()
+
+/**
+ * @brief A received frame, valid while its slot is held.
+ */
+struct FrameView {
+    uint8_t type; // Message type.
+    uint16_t seq; // Sequence number.
+    uint16_t length; // Payload length in bytes.
+    const uint8_t* payload; // Payload data, in the ring slot.
+    uint64_t receive_us; // Host clock_us() when the frame's last byte was read.
+};
+
+/**
+ * @brief Reader counters since open().
+ */
+struct FeatherClientStats {
+    uint64_t bytes; // Bytes read from the port.
+    uint32_t frames; // Valid frames, delivered or not.
+    uint32_t bad_frames; // Frames dropped for bad COBS, length or CRC.
+    uint32_t overruns; // Frames dropped because the poll() ring was full.
+    uint32_t delta_dropped; // Delta telemetry frames that could not be rebuilt (missed keyframe or frame).
+};
+
+/**
+ * @class FeatherClient
+ * @brief Framed protocol link to the Feather with an asynchronous reader.
+ */
+class FeatherClient {
+    public:
+        typedef std::function<void(const FrameView&)> FrameCallback;
+
+        /**
+         * @brief Construct a new FeatherClient object.
+         * @param ring_slots The number of frames poll() can queue.
+         */
+        explicit FeatherClient(size_t ring_slots = FEATHER_CLIENT_RING_SLOTS);
+
+        /**
+         * @brief Destroy the FeatherClient object, closing the port.
+         */
+        ~FeatherClient();
+
+        FeatherClient(const FeatherClient&) = delete;
+        FeatherClient& operator=(const FeatherClient&) = delete;
+
+        /**
+         * @brief Open the serial port, switch the link to framed mode and start the reader.
+         *
+         * Sends FRAMED_MODE_BYTE followed by a delimiter, which is harmless
+         * if the link is already framed (after a warm restart, for example).
+         *
+         * @param path The serial device path.
+         * @return true if the port was opened.
+         */
+        bool open(const char* path);
+
+        /**
+         * @brief Stop the reader and close the port.
+         */
+        void close();
+
+        /**
+         * @brief Check if the port is open.
+         * @return true if open() succeeded and close() was not called since.
+         */
+        bool is_open() const;
+
+        /**
+         * @brief Deliver frames to a callback instead of the poll() ring.
+         *
+         * Set before open(). The callback runs on the reader thread and must
+         * not block; the view is only valid during the call.
+         *
+         * @param callback The frame callback, or an empty function for poll().
+         */
+        void set_callback(FrameCallback callback);
+
+        /**
+         * @brief Send a frame without waiting (thread safe).
+         *
+         * @param type The message type.
+         * @param payload The payload data (may be nullptr if length is 0).
+         * @param length The payload length.
+         * @param seq Set to the sequence number used, if not nullptr.
+         * @return true if the whole frame was written.
+         */
+        bool send(uint8_t type, const uint8_t* payload, uint16_t length, uint16_t* seq = nullptr);
+
+        /**
+         * @brief Send a frame and wait for its response (thread safe).
+         *
+         * @param type The message type.
+         * @param payload The payload data (may be nullptr if length is 0).
+         * @param length The payload length.
+         * @param response Filled with the response (type | MSG_RESPONSE_FLAG, or MSG_ERROR).
+         * @param receive_us Set to the response's receive time, if not nullptr.
+         * @param timeout_ms The time to wait for the response.
+         * @return true if a response arrived in time.
+         */
+        bool request(uint8_t type, const uint8_t* payload, uint16_t length, Frame* response,
+                     uint64_t* receive_us = nullptr, uint32_t timeout_ms = FEATHER_CLIENT_TIMEOUT_MS);
+
+        /**
+         * @brief Take the oldest queued frame (one consumer thread).
+         *
+         * The frame stays in its slot until release() or the next poll().
+         *
+         * @param frame Set to a view of the frame.
+         * @param timeout_ms The time to wait for a frame, 0 to return right away.
+         * @return true if a frame was taken.
+         */
+        bool poll(FrameView* frame, uint32_t timeout_ms);
+
+        /**
+         * @brief Hand the slot of the last polled frame back to the reader.
+         */
+        void release();
+
+        /**
+         * @brief Get the reader counters.
+         * @return FeatherClientStats The counters since open().
+         */
+        FeatherClientStats get_stats() const;
+
+        /**
+         * @brief Host clock used for receive times, in us.
+         * @return uint64_t The steady clock time.
+         */
+        static uint64_t clock_us();
+
+    private:
+        /**
+         * @brief One frame's storage: the decoded frame and its view.
+         */
+        struct Slot {
+            FrameView view; // View handed out for this slot.
+            uint8_t raw[PROTOCOL_MAX_FRAME]; // [type][seq][length][payload][crc], as decoded.
+        };
+
+        /**
+         * @brief A request() waiting for its response.
+         */
+        struct PendingRequest {
+            bool active; // Waiting.
+            bool done; // Response copied.
+            uint16_t seq; // Sequence number of the request.
+            Frame* response; // Where the response goes.
+            uint64_t receive_us; // Receive time of the response.
+        };
+
+        /**
+         * @brief Reader thread: read the port and parse until close().
+         */
+        void reader_loop();
+
+        /**
+         * @brief Decode one received byte into the current slot.
+         * @param byte The received byte.
+         * @param receive_us The receive time of the read it came in.
+         */
+        void push_byte(uint8_t byte, uint64_t receive_us);
+
+        /**
+         * @brief Pick the slot the next frame decodes into.
+         * @return Slot* The ring slot at the head, or the scratch slot.
+         */
+        Slot* start_frame();
+
+        /**
+         * @brief Validate the decoded frame and deliver it.
+         * @param receive_us The receive time of the read holding its delimiter.
+         */
+        void finish_frame(uint64_t receive_us);
+
+        /**
+         * @brief Keep keyframes and rebuild delta telemetry in its slot.
+         * @param view The frame's view (updated for rebuilt deltas).
+         * @param payload The frame's payload in its slot.
+         * @return true if the frame should be delivered.
+         */
+        bool handle_telemetry(FrameView* view, uint8_t* payload);
+
+        /**
+         * @brief Copy a response to the request() waiting for it.
+         * @return true if a request took it.
+         */
+        bool complete_request(const FrameView& view);
+
+        /**
+         * @brief Encode and write one frame.
+         * @return true if the whole frame was written.
+         */
+        bool write_frame(uint8_t type, uint16_t seq, const uint8_t* payload, uint16_t length);
+
+        int fd_; // Serial port descriptor, -1 when closed.
+        std::thread reader_; // Reader thread.
+        std::atomic<bool> running_; // Cleared to stop the reader.
+        FrameCallback callback_; // Frame callback, empty for poll().
+
+        // Ring (the reader fills the head, poll() takes the tail)
+        std::vector<Slot> slots_; // Ring slots.
+        Slot scratch_; // Decode target for frames that are not queued.
+        std::atomic<uint32_t> head_; // Frames queued since open().
+        std::atomic<uint32_t> tail_; // Frames released since open().
+        bool holding_; // A polled frame has not been released.
+        std::atomic<bool> poll_waiting_; // poll() is waiting for a frame.
+        std::mutex ring_mutex_; // Guards the poll() wait.
+        std::condition_variable ring_cv_; // Signals a queued frame.
+
+        // Streaming COBS decoder state
+        Slot* slot_; // Slot the current frame decodes into, nullptr between frames.
+        size_t raw_length_; // Decoded bytes of the current frame.
+        uint8_t block_remaining_; // Data bytes left in the current COBS block.
+        bool block_zero_; // The current block stands for a zero unless it is the last.
+        bool frame_error_; // The current frame is malformed or too long.
+
+        // Delta telemetry
+        uint8_t telemetry_[TELEMETRY_PAYLOAD_LENGTH]; // Last telemetry payload.
+        uint16_t telemetry_seq_; // Its sequence number.
+        bool telemetry_valid_; // Set once a keyframe arrived, cleared on a lost frame.
+
+        // Requests
+        std::atomic<uint16_t> next_seq_; // Next request sequence number.
+        std::mutex send_mutex_; // Serializes encode_frame() and writes.
+        std::mutex pending_mutex_; // Guards pending_.
+        std::condition_variable pending_cv_; // Signals a completed request.
+        PendingRequest pending_[FEATHER_CLIENT_MAX_PENDING]; // Waiting requests.
+
+        // Counters
+        std::atomic<uint64_t> bytes_;
+        std::atomic<uint32_t> frames_;
+        std::atomic<uint32_t> bad_frames_;
+        std::atomic<uint32_t> overruns_;
+        std::atomic<uint32_t> delta_dropped_;
+};
+
+#endif // FEATHER_CLIENT_HPP
@@ -4,34 +4,319 @@
 
 #include "encoder.hpp"
 #include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "hardware/clocks.h"
 #include <cstdio>
+#include <cstring>
 
-Encoder::Encoder(uint8_t pin_a, uint8_t pin_b)
-    : pin_a_(pin_a), pin_b_(pin_b), position_(0), last_a_(false), last_b_(false) {}
+// PIO program shared with pio/quadrature_encoder_substep
+#include "quadrature_encoder_substep.pio.h"
+
+// The quadrature program uses computed jumps and must live at offset 0, so it
+// is loaded once for every encoder on each block (ENCODER_PIO, ENCODER_PIO_OVERFLOW)
+static bool pio_program_loaded[2] = {false, false};
+
+// Maps the pin state (B << 1 | A) to the phase index used by the PIO program,
+// so the lower 2 bits of a raw step always match the current phase
+static const uint8_t phase_from_pins[4] = {0, 3, 1, 2};
+
+// Marks a transition where both pins changed in quadrature_table
+#define QUADRATURE_ILLEGAL 2
+
+// Position change indexed by the previous and current pin state
+// (previous << 2 | current, states are B << 1 | A). Counts up when A leads B
+static const int8_t quadrature_table[16] = {
+    0, 1, -1, QUADRATURE_ILLEGAL, // From 00
+    -1, 0, QUADRATURE_ILLEGAL, 1, // From 01
+    1, QUADRATURE_ILLEGAL, 0, -1, // From 10
+    QUADRATURE_ILLEGAL, -1, 1, 0  // From 11
+};
+
+// Compute speed in "sub-steps per 2^20 us" from a delta sub-step position and
+// delta time in microseconds. This unit is cheaper to compute and use, so we
+// only convert to "sub-steps per second" once per update, at most. Two
+// transitions in the same microsecond are treated as 1 us apart
+static int32_t substep_calc_speed(int32_t delta_substep, int32_t delta_us) {
+    if (delta_us == 0) {
+        delta_us = 1;
+    }
+    return ((int64_t) delta_substep << 20) / delta_us;
+}
+
+Encoder::Encoder(uint8_t pin_a, uint8_t pin_b, EncoderMode mode)
+    : pin_a_(pin_a), pin_b_(pin_b), mode_(mode), pio_(ENCODER_PIO), sm_(0), position_(0), last_state_(0), illegal_transitions_(0),
+      irq_step_(0), irq_transition_us_(0), irq_forward_(false) {
+    memset(&substep_, 0, sizeof(substep_));
+}
 
 void Encoder::initializeEncoder() {
-    this->position_ = 0;
+    if (mode_ == EncoderMode::PIO) {
+        // The program reads B from the pin after A and cannot take another
+        if (pin_b_ != pin_a_ + 1) {
+            panic("Encoder on GPIO %u: the PIO backend needs pin B on GPIO %u", pin_a_, pin_a_ + 1);
+        }
+
+        // Claim a state machine, on the second block once the first is full
+        int sm = pio_claim_unused_sm(ENCODER_PIO, false);
+        pio_ = ENCODER_PIO;
+        if (sm < 0) {
+            sm = pio_claim_unused_sm(ENCODER_PIO_OVERFLOW, true);
+            pio_ = ENCODER_PIO_OVERFLOW;
+        }
+        sm_ = (uint)sm;
+
+        // Load the program once per PIO block
+        bool& loaded = pio_program_loaded[pio_ == ENCODER_PIO ? 0 : 1];
+        if (!loaded) {
+            pio_add_program_at_offset(pio_, &quadrature_encoder_substep_program, 0);
+            loaded = true;
+        }
+
+        // Start counting at sysclk
+        quadrature_encoder_substep_program_init(pio_, sm_, pin_a_);
+
+        // Zero the position against the current count
+        this->position_ = read_pio_count();
+    } else {
+        // Initialize GPIOs for the interrupt decoder
+        gpio_init(pin_a_);
+        gpio_init(pin_b_);
+        gpio_set_dir(pin_a_, GPIO_IN);
+        gpio_set_dir(pin_b_, GPIO_IN);
+        gpio_pull_up(pin_a_);
+        gpio_pull_up(pin_b_);
+
+        // Seed the last state so the first edge is decoded correctly
+        last_state_ = (gpio_get(pin_b_) << 1) | gpio_get(pin_a_);
+        irq_step_ = phase_from_pins[last_state_];
+        irq_transition_us_ = time_us_32();
+
+        this->position_ = 0;
+    }
+
+    // Start the sub-step estimator with equal phase sizes
+    uint32_t step_us, transition_us;
+    bool forward;
+
+    memset(&substep_, 0, sizeof(substep_));
+    set_calibration_data(64, 128, 192);
+    substep_.idle_stop_samples = ENCODER_IDLE_STOP_SAMPLES;
+    substep_.clocks_per_us = (clock_get_hz(clk_sys) + 500000) / 1000000;
+
+    // Start "stopped" so that stale data is not used to compute speeds
+    substep_.stopped = true;
+
+    read_transition_data(&substep_.raw_step, &step_us, &transition_us, &forward);
+    substep_.prev_step_us = step_us;
+    substep_.prev_trans_us = transition_us;
+    substep_.position = get_step_start_transition_pos(substep_.raw_step) + 32;
 }
 
 int32_t Encoder::get_position() const {
+    if (mode_ == EncoderMode::PIO) {
+        return read_pio_count() - this->position_;
+    }
+
     return this->position_;
 }
 
 void Encoder::reset_position() {
+    if (mode_ == EncoderMode::PIO) {
+        // The state machine count cannot be written, so store an offset instead
+        this->position_ = read_pio_count();
+        return;
+    }
+
     this->position_ = 0;
 }
 
-void Encoder::handle_interrupt(uint gpio, uint32_t events) {
-    // Get current pin states
-    bool a = gpio_get(pin_a_);
-    bool b = gpio_get(pin_b_);
+void Encoder::set_position(int32_t position) {
+    if (mode_ == EncoderMode::PIO) {
+        this->position_ = read_pio_count() - position;
+        return;
+    }
+
+    this->position_ = position;
+}
+
+EncoderMode Encoder::get_mode() const {
+    return mode_;
+}
+
+int32_t Encoder::read_pio_count() const {
+    uint step, us;
+    int cycles;
+
+    // Both backends count every edge (4x), but the PIO program counts up when
+    // B leads A. Negate so both modes report the same direction.
+    quadrature_encoder_substep_get_counts(pio_, sm_, &step, &cycles, &us);
+    return -(int32_t)step;
+}
 
-     // Quadrature decoding logic
-    if (a != last_a_) {
-        position_ += (b != a) ? 1 : -1;
+void Encoder::read_transition_data(uint32_t* step, uint32_t* step_us, uint32_t* transition_us, bool* forward) const {
+    if (mode_ == EncoderMode::PIO) {
+        uint pio_step, pio_us;
+        int cycles;
+
+        quadrature_encoder_substep_get_counts(pio_, sm_, &pio_step, &cycles, &pio_us);
+
+        // When the PIO program detects a transition, it sets cycles to either
+        // zero (step incrementing) or 2^31 (step decrementing) and keeps
+        // decrementing it on each 13 clock loop
+        if (cycles < 0) {
+            cycles = -cycles;
+            *forward = true;
+        } else {
+            cycles = 0x80000000 - cycles;
+            *forward = false;
+        }
+
+        *step = pio_step;
+        *step_us = pio_us;
+        *transition_us = pio_us - ((cycles * 13) / substep_.clocks_per_us);
+        return;
     }
 
-    // Update last states
-    last_a_ = a;
-    last_b_ = b;
+    // Read the ISR state with interrupts disabled so the step and its
+    // timestamp belong to the same transition
+    uint32_t ints = save_and_disable_interrupts();
+    *step = irq_step_;
+    *transition_us = irq_transition_us_;
+    *forward = irq_forward_;
+    *step_us = time_us_32();
+    restore_interrupts(ints);
+}
+
+uint32_t Encoder::get_step_start_transition_pos(uint32_t step) const {
+    return ((step << 6) & 0xFFFFFF00) | substep_.calibration_data[step & 3];
+}
+
+void Encoder::set_calibration_data(uint32_t step0, uint32_t step1, uint32_t step2) {
+    substep_.calibration_data[0] = 0;
+    substep_.calibration_data[1] = step0;
+    substep_.calibration_data[2] = step1;
+    substep_.calibration_data[3] = step2;
+}
+
+void Encoder::update_velocity() {
+    EncoderSubstepState* state = &substep_;
+    uint32_t step, step_us, transition_us, transition_pos, low, high;
+    int32_t speed_high, speed_low;
+    bool forward;
+
+    // Read the current step and last transition
+    read_transition_data(&step, &step_us, &transition_us, &forward);
+
+    // From the current step we can get the low and high boundaries in
+    // sub-steps of the current position
+    low = get_step_start_transition_pos(step);
+    high = get_step_start_transition_pos(step + 1);
+
+    // If the last transition was more than idle_stop_samples ago, we are stopped
+    if (step == state->raw_step) {
+        state->idle_stop_sample_count++;
+    } else {
+        state->idle_stop_sample_count = 0;
+    }
+
+    if (!state->stopped && state->idle_stop_sample_count >= state->idle_stop_samples) {
+        state->speed = 0;
+        state->speed_2_20 = 0;
+        state->stopped = true;
+    }
+
+    // A different step means there was at least one transition
+    if (state->raw_step != step) {
+        // The transition position depends on the direction of the move
+        transition_pos = forward ? low : high;
+
+        // A previous transition is only valid to estimate speed if we were moving
+        if (!state->stopped) {
+            state->speed_2_20 = substep_calc_speed(transition_pos - state->prev_trans_pos, transition_us - state->prev_trans_us);
+        }
+
+        state->stopped = false;
+        state->prev_trans_pos = transition_pos;
+        state->prev_trans_us = transition_us;
+    }
+
+    if (!state->stopped) {
+        // The current step bounds the position, which together with the last
+        // transition bounds the speed. Use the slopes from the last sample to
+        // the transition if that transition is closer to now than the last
+        // sample, otherwise the slopes from the last transition to now
+        if (state->prev_trans_us > state->prev_step_us &&
+            (int32_t)(state->prev_trans_us - state->prev_step_us) > (int32_t)(step_us - state->prev_trans_us)) {
+            speed_high = substep_calc_speed(state->prev_trans_pos - state->prev_low, state->prev_trans_us - state->prev_step_us);
+            speed_low = substep_calc_speed(state->prev_trans_pos - state->prev_high, state->prev_trans_us - state->prev_step_us);
+        } else {
+            speed_high = substep_calc_speed(high - state->prev_trans_pos, step_us - state->prev_trans_us);
+            speed_low = substep_calc_speed(low - state->prev_trans_pos, step_us - state->prev_trans_us);
+        }
+
+        // Clamp the speed estimate between the step slopes
+        if (state->speed_2_20 > speed_high) {
+            state->speed_2_20 = speed_high;
+        }
+        if (state->speed_2_20 < speed_low) {
+            state->speed_2_20 = speed_low;
+        }
+
+        // Convert from "sub-steps per 2^20 us" to "sub-steps per second"
+        state->speed = (state->speed_2_20 * 62500LL) >> 16;
+
+        // Extrapolate the position from the last transition, clamped to the current step
+        state->position = state->prev_trans_pos + (((int64_t)state->speed_2_20 * (step_us - transition_us)) >> 20);
+
+        if ((int32_t)(state->position - high) > 0) {
+            state->position = high;
+        } else if ((int32_t)(state->position - low) < 0) {
+            state->position = low;
+        }
+    }
+
+    // Save the current values for the next sample
+    state->prev_low = low;
+    state->prev_high = high;
+    state->raw_step = step;
+    state->prev_step_us = step_us;
+}
+
+int32_t Encoder::get_speed() const {
+    // Raw steps count up when B leads A; negate to match get_position()
+    return -substep_.speed;
+}
+
+int32_t Encoder::get_substep_position() const {
+    return -(int32_t)substep_.position;
+}
+
+void Encoder::decode_state(uint8_t state, bool lost_edge) {
+    if (lost_edge) {
+        illegal_transitions_++;
+    }
+
+    // Table driven 4x quadrature decoding
+    int8_t delta = quadrature_table[(last_state_ << 2) | state];
+    last_state_ = state;
+
+    if (delta == QUADRATURE_ILLEGAL) {
+        // Both pins changed, so the direction is unknown
+        illegal_transitions_++;
+        return;
+    }
+    if (delta == 0) {
+        return;
+    }
+    position_ += delta;
+
+    // Track the raw step and transition time for the sub-step estimator.
+    // Raw steps follow the PIO convention, counting up when B leads A
+    irq_step_ = irq_step_ - delta;
+    irq_forward_ = delta < 0;
+    irq_transition_us_ = time_us_32();
+}
+
+uint32_t Encoder::get_illegal_transition_count() const {
+    return illegal_transitions_;
 }
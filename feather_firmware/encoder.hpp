@@ -8,6 +8,7 @@
 #include <cstdint>
 #include "pico/stdlib.h"
 #include "hardware/gpio.h"
+#include "hardware/pio.h"
 
 // Define encoder pins
 #define ENCODER1_PIN_A 9
@@ -15,39 +16,110 @@
 #define ENCODER2_PIN_A 11
 #define ENCODER2_PIN_B 12
 
+// PIO blocks used by the PIO counting backend, one state machine per
+// encoder: ENCODER_PIO first, then ENCODER_PIO_OVERFLOW once it is full. The
+// quadrature program must be loaded at offset 0, so the encoders of a block
+// share one copy of it.
+#define ENCODER_PIO pio0
+#define ENCODER_PIO_OVERFLOW pio1
+#define ENCODER_PIO_MAX_ENCODERS (2 * NUM_PIO_STATE_MACHINES)
+
+// Select the PIO counting backend by default. Build with ENCODER_USE_PIO=0
+// to fall back to the per-edge GPIO interrupt decoder.
+#ifndef ENCODER_USE_PIO
+#define ENCODER_USE_PIO 1
+#endif
+
 // Command Bytes for Encoder Operations
 #define RETURN_ENCODERS_BYTE 0x45 // 'E'
 #define RETURN_ENCODER_1_BYTE 0x31 // '1'
 #define RETURN_ENCODER_2_BYTE 0x32 // '2'
+#define RETURN_VELOCITIES_BYTE 0x56 // 'V'
+
+// Removed rpm function as it can be calculated faster on jetson side.
+// Speed is instead estimated on the Feather from transition timestamps
+// (see update_velocity), which stays smooth at low speeds and high poll rates.
 
-// Removed rpm function as it can be calculated faster on jetson side
+// Sub-step velocity estimation
+#define ENCODER_SUBSTEPS_PER_STEP 64 // Sub-steps per quadrature step (4 steps per pulse)
+#define VELOCITY_SAMPLE_PERIOD_US 1000 // Period between update_velocity() calls
+#define ENCODER_IDLE_STOP_SAMPLES 50 // Samples without a transition before the encoder is considered stopped
 
 // Define encoder data buffer length
 #define DUAL_ENCODER_DATA_BUFFER_LENGTH 8
 #define SINGLE_ENCODER_DATA_BUFFER_LENGTH 4
+#define VELOCITY_DATA_BUFFER_LENGTH 16
 
 // Number of pulses per revolution (configure based on your encoder)
 #define PULSES_PER_REVOLUTION 800
+#define COUNTS_PER_REVOLUTION (4 * PULSES_PER_REVOLUTION) // Positions count every edge of A and B
+
+/**
+ * @brief Counting backend used by an Encoder.
+ */
+enum class EncoderMode : uint8_t {
+    GPIO_IRQ, // Decode edges in the shared GPIO interrupt callback.
+    PIO       // Count edges in a PIO state machine with no CPU work per edge.
+};
+
+/**
+ * @brief Sub-step speed and position estimator state.
+ *
+ * Mirrors substep_state_t from pio/quadrature_encoder_substep. Steps are raw
+ * quadrature steps whose lower 2 bits match the current phase.
+ */
+struct EncoderSubstepState {
+    // Configuration
+    uint32_t calibration_data[4]; // Relative phase sizes in sub-steps (step 0 starts at 0).
+    uint32_t clocks_per_us; // clk_sys frequency in clocks per us.
+    uint32_t idle_stop_samples; // Samples without transitions before the encoder is stopped.
+
+    // Previous state
+    uint32_t prev_trans_pos, prev_trans_us;
+    uint32_t prev_step_us;
+    uint32_t prev_low, prev_high;
+    uint32_t idle_stop_sample_count;
+    int32_t speed_2_20; // Speed in sub-steps per 2^20 us.
+    bool stopped;
+
+    // Output
+    int32_t speed; // Estimated speed in sub-steps per second.
+    uint32_t position; // Estimated position in sub-steps.
+    uint32_t raw_step; // Raw step count.
+};
 
 /**
  * @class Encoder
  * @brief Manages a single quadrature encoder for a motor.
  * 
  * The Encoder class provides methods to initialize, read, and reset the 
- * position of a quadrature encoder. It uses GPIO interrupts to update 
- * the encoder position in real-time.
+ * position of a quadrature encoder. In PIO mode the count is kept by a
+ * state machine running the pio/quadrature_encoder_substep program; in GPIO_IRQ
+ * mode it is updated from GPIO interrupts. Channel B must be on pin_a + 1
+ * for PIO mode. Both backends count every edge of A and B (4x, so
+ * COUNTS_PER_REVOLUTION per revolution) and count up when A leads B.
+ *
+ * Both backends also record the time of the last phase transition, which
+ * update_velocity() uses to estimate speed and position to a fraction of a
+ * step, as in pio/quadrature_encoder_substep.
  */
 class Encoder {
     public:
         /**
          * @brief Construct a new Encoder object.
          * @param[in] pin_a The GPIO pin for the A channel (uint8_t).
-         * @param[in] pin_b The GPIO pin for the B channel (uint8_t).
+         * @param[in] pin_b The GPIO pin for the B channel (uint8_t); pin_a + 1 in PIO mode.
+         * @param[in] mode The counting backend to use (EncoderMode).
          */
-        Encoder(uint8_t pin_a, uint8_t pin_b);
+        Encoder(uint8_t pin_a, uint8_t pin_b, EncoderMode mode);
 
         /**
-         * @brief Initialize the encoder position.
+         * @brief Initialize the encoder pins, backend and position.
+         *
+         * In GPIO_IRQ mode the caller is responsible for reading both pins on
+         * their interrupts and passing the state to decode_state(). In PIO
+         * mode it panics unless pin B is pin A + 1, the only B pin the
+         * quadrature_encoder_substep program can read.
          */
         void initializeEncoder();
 
@@ -63,23 +135,102 @@ class Encoder {
         void reset_position();
 
         /**
-         * @brief Interrupt service routine for handling GPIO events.
-         * 
-         * This function is called when an encoder pin state changes. It updates
-         * the encoder position based on the quadrature decoding of channels A and B.
-         * 
-         * @param[in] gpio The GPIO pin that triggered the interrupt (uint).
-         * @param[in] events The events that occurred (uint32_t).
+         * @brief Continue counting from a position, e.g. one saved before a warm restart.
+         * @param position The position the encoder reports now.
+         */
+        void set_position(int32_t position);
+
+        /**
+         * @brief Decode a new pin state read by the caller (GPIO_IRQ mode).
+         *
+         * Used by EncoderBank, which reads the pins of every encoder at once.
+         * The position is updated from a table indexed by the previous and
+         * current AB state. Transitions where both pins changed are counted
+         * as illegal and leave the position unchanged.
+         *
+         * @param[in] state The pin state (B << 1 | A).
+         * @param[in] lost_edge True if a pin of this encoder had both edges pending.
          */
-        void handle_interrupt(uint gpio, uint32_t events);
+        void decode_state(uint8_t state, bool lost_edge);
+
+        /**
+         * @brief Get the counting backend of the encoder.
+         * @return EncoderMode The active backend.
+         */
+        EncoderMode get_mode() const;
+
+        /**
+         * @brief Update the sub-step speed and position estimate.
+         *
+         * Must be called every VELOCITY_SAMPLE_PERIOD_US; idle-stop detection
+         * counts calls to this function.
+         */
+        void update_velocity();
+
+        /**
+         * @brief Get the estimated speed.
+         * @return int32_t Speed in sub-steps per second, same direction as get_position().
+         */
+        int32_t get_speed() const;
+
+        /**
+         * @brief Get the estimated position with sub-step resolution.
+         * @return int32_t Position in sub-steps (ENCODER_SUBSTEPS_PER_STEP per quadrature step).
+         */
+        int32_t get_substep_position() const;
+
+        /**
+         * @brief Set the relative phase sizes of the encoder.
+         *
+         * Boundaries of steps 1 to 3 in sub-steps out of 4 * ENCODER_SUBSTEPS_PER_STEP.
+         * Use substep_calibrate_phases() from pio/quadrature_encoder_substep to measure them.
+         */
+        void set_calibration_data(uint32_t step0, uint32_t step1, uint32_t step2);
+
+        /**
+         * @brief Get the number of illegal transitions seen since initialization.
+         *
+         * Counts transitions where both pins changed and pin events with both
+         * edges pending, which mean edges were lost to interrupt latency. Always
+         * zero in PIO mode, where the state machine ignores illegal transitions.
+         *
+         * @return uint32_t The illegal transition count.
+         */
+        uint32_t get_illegal_transition_count() const;
 
     private:
+        /**
+         * @brief Read the raw count from the PIO state machine.
+         * @return int32_t Count in the same units and direction as the GPIO_IRQ decoder.
+         */
+        int32_t read_pio_count() const;
+
+        /**
+         * @brief Read the current step and the time and direction of the last transition.
+         */
+        void read_transition_data(uint32_t* step, uint32_t* step_us, uint32_t* transition_us, bool* forward) const;
+
+        /**
+         * @brief Get the sub-step position of the start of a step.
+         */
+        uint32_t get_step_start_transition_pos(uint32_t step) const;
+
         uint8_t pin_a_; // Pin number for channel A.
         uint8_t pin_b_; // Pin number for channel B.
-        volatile int32_t position_; // Encoder position.
+        EncoderMode mode_; // Counting backend.
+        PIO pio_; // PIO block of the state machine (PIO mode only).
+        uint sm_; // PIO state machine (PIO mode only).
+        volatile int32_t position_; // Encoder position (GPIO_IRQ mode), or count offset (PIO mode).
+
+        uint8_t last_state_; // Last pin state (B << 1 | A).
+        volatile uint32_t illegal_transitions_; // Illegal transitions and lost edges (GPIO_IRQ mode).
+
+        // Transition tracking for the GPIO_IRQ backend, in the PIO step convention
+        volatile uint32_t irq_step_; // Raw step count, lower 2 bits match the phase.
+        volatile uint32_t irq_transition_us_; // Timestamp of the last transition.
+        volatile bool irq_forward_; // Direction of the last transition.
 
-        bool last_a_; // Last state of pin A.
-        bool last_b_; // Last state of pin B.
+        EncoderSubstepState substep_; // Sub-step estimator state.
 };
 
 #endif // ENCODER_HPP
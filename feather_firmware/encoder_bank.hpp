@@ -0,0 +1,231 @@
+// encoder_bank.hpp
+// Carson Powers
+// Header file for the compile-time encoder bank that decodes every encoder from one GPIO read on the AHSR robot
+
+#ifndef ENCODER_BANK_HPP
+#define ENCODER_BANK_HPP
+
+// Standard Libraries
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "encoder.hpp"
+
+/**
+ * @brief Encoder index of each GPIO, or the encoder count for pins of no encoder.
+ */
+struct EncoderPinMap {
+    uint8_t encoder[32];
+};
+
+/**
+ * @brief Build the GPIO to encoder index map of (A, B) pin pairs.
+ */
+template <size_t N>
+constexpr EncoderPinMap make_encoder_pin_map(const uint8_t (&pins)[N]) {
+    EncoderPinMap map = {};
+
+    for (size_t pin = 0; pin < 32; pin++) {
+        map.encoder[pin] = N / 2;
+    }
+    for (size_t i = 0; i < N; i++) {
+        map.encoder[pins[i]] = i / 2;
+    }
+
+    return map;
+}
+
+/**
+ * @brief Check that encoder pins are distinct bank 0 GPIOs.
+ */
+template <size_t N>
+constexpr bool encoder_bank_pins_valid(const uint8_t (&pins)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        if (pins[i] >= NUM_BANK0_GPIOS) {
+            return false;
+        }
+        for (size_t j = i + 1; j < N; j++) {
+            if (pins[i] == pins[j]) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Check that each encoder's pin B is its pin A + 1, as the PIO program requires.
+ */
+template <size_t N>
+constexpr bool encoder_bank_pins_adjacent(const uint8_t (&pins)[N]) {
+    for (size_t i = 0; i + 1 < N; i += 2) {
+        if (pins[i + 1] != pins[i] + 1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @class EncoderBank
+ * @brief A fixed set of quadrature encoders decoded together.
+ *
+ * Pins are given as (A, B) pairs, one pair per encoder:
+ * EncoderBank<L_A, L_B, R_A, R_B> holds two encoders. The pin to encoder
+ * mapping is built at compile time, so dispatching an interrupt is a mask
+ * test and a table lookup whatever the encoder count.
+ *
+ * In GPIO_IRQ mode handle_interrupt() reads every pin with one
+ * gpio_get_all() and decodes each encoder whose pins changed since the last
+ * call, walking only the changed bits. Interrupts still pending for pins that
+ * were already decoded then find nothing changed and return at once.
+ *
+ * In builds with the PIO backend (ENCODER_USE_PIO) each encoder takes a state
+ * machine, at most ENCODER_PIO_MAX_ENCODERS, and its pin B must be pin A + 1.
+ *
+ * @tparam Pins Pin A and pin B of each encoder, in encoder order.
+ */
+template <uint8_t... Pins>
+class EncoderBank {
+    static_assert(sizeof...(Pins) > 0 && sizeof...(Pins) % 2 == 0, "EncoderBank takes (pin A, pin B) pairs");
+
+    public:
+        static constexpr size_t ENCODER_COUNT = sizeof...(Pins) / 2; // Number of encoders.
+        static constexpr uint32_t PIN_MASK = ((1u << Pins) | ...); // Every encoder pin.
+
+        /**
+         * @brief Construct the encoders.
+         * @param[in] mode The counting backend of every encoder (EncoderMode).
+         */
+        explicit EncoderBank(EncoderMode mode)
+            : EncoderBank(mode, std::make_index_sequence<ENCODER_COUNT>()) {}
+
+        /**
+         * @brief Initialize every encoder and route the pin interrupts to a callback.
+         *
+         * Interrupts are only enabled in GPIO_IRQ mode. The callback must pass
+         * events on bank pins (see owns_pin()) to handle_interrupt().
+         *
+         * @param[in] callback The shared GPIO interrupt callback.
+         */
+        void initialize(gpio_irq_callback_t callback) {
+            for (Encoder& encoder : encoders_) {
+                encoder.initializeEncoder();
+            }
+
+            if (mode_ != EncoderMode::GPIO_IRQ) {
+                return;
+            }
+
+            // Seed the pin state before the first edge can arrive
+            last_pins_ = gpio_get_all() & PIN_MASK;
+
+            for (uint8_t pin : PINS) {
+                gpio_set_irq_enabled_with_callback(pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, callback);
+            }
+        }
+
+        /**
+         * @brief Check whether a GPIO belongs to an encoder of the bank.
+         * @param[in] gpio The GPIO number.
+         * @return true if gpio is an encoder pin.
+         */
+        static constexpr bool owns_pin(uint gpio) {
+            return gpio < 32 && ((PIN_MASK >> gpio) & 1);
+        }
+
+        /**
+         * @brief Decode every encoder whose pins changed (GPIO_IRQ mode).
+         * @param[in] gpio The GPIO pin that triggered the interrupt, a bank pin (uint).
+         * @param[in] events The events that occurred (uint32_t).
+         */
+        void handle_interrupt(uint gpio, uint32_t events) {
+            uint32_t pins = gpio_get_all() & PIN_MASK;
+            uint32_t changed = pins ^ last_pins_;
+            last_pins_ = pins;
+
+            // Both edges pending on one pin means it toggled twice before we
+            // ran. Visit its encoder even if the pin is back where it was
+            uint8_t lost_edge_encoder = ENCODER_COUNT;
+            if ((events & (GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL)) == (GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL)) {
+                lost_edge_encoder = PIN_TO_ENCODER.encoder[gpio];
+                changed |= 1u << gpio;
+            }
+
+            while (changed) {
+                uint8_t index = PIN_TO_ENCODER.encoder[__builtin_ctz(changed)];
+                uint8_t pin_a = PINS[2 * index];
+                uint8_t pin_b = PINS[2 * index + 1];
+
+                // Clear both pins so an encoder is decoded once per pass
+                changed &= ~((1u << pin_a) | (1u << pin_b));
+
+                uint8_t state = (((pins >> pin_b) & 1) << 1) | ((pins >> pin_a) & 1);
+                encoders_[index].decode_state(state, index == lost_edge_encoder);
+            }
+        }
+
+        /**
+         * @brief Reset every encoder position to zero.
+         */
+        void reset_positions() {
+            for (Encoder& encoder : encoders_) {
+                encoder.reset_position();
+            }
+        }
+
+        /**
+         * @brief Update the sub-step estimate of every encoder.
+         */
+        void update_velocities() {
+            for (Encoder& encoder : encoders_) {
+                encoder.update_velocity();
+            }
+        }
+
+        /**
+         * @brief Get an encoder.
+         * @param[in] index The encoder index, in template pin order.
+         * @return Encoder& The encoder.
+         */
+        Encoder& operator[](size_t index) {
+            return encoders_[index];
+        }
+
+        const Encoder& operator[](size_t index) const {
+            return encoders_[index];
+        }
+
+        /**
+         * @brief Get the counting backend of the encoders.
+         * @return EncoderMode The active backend.
+         */
+        EncoderMode get_mode() const {
+            return mode_;
+        }
+
+    private:
+        static constexpr uint8_t PINS[] = {Pins...}; // Encoder pins, A then B for each encoder.
+
+        static_assert(encoder_bank_pins_valid(PINS), "EncoderBank pins must be distinct bank 0 GPIOs");
+#if ENCODER_USE_PIO
+        static_assert(ENCODER_COUNT <= ENCODER_PIO_MAX_ENCODERS,
+                      "EncoderBank has more encoders than PIO state machines, build with ENCODER_USE_PIO=0");
+        static_assert(encoder_bank_pins_adjacent(PINS), "EncoderBank pin B must be pin A + 1 with the PIO backend");
+#endif
+
+        static constexpr EncoderPinMap PIN_TO_ENCODER = make_encoder_pin_map(PINS); // GPIO to encoder index.
+
+        template <size_t... Index>
+        EncoderBank(EncoderMode mode, std::index_sequence<Index...>)
+            : mode_(mode), last_pins_(0), encoders_{Encoder(PINS[2 * Index], PINS[2 * Index + 1], mode)...} {}
+
+        EncoderMode mode_; // Counting backend of every encoder.
+        uint32_t last_pins_; // Encoder pin levels at the last interrupt (GPIO_IRQ mode).
+        Encoder encoders_[ENCODER_COUNT]; // Encoders, in template pin order.
+};
+
+#endif // ENCODER_BANK_HPP
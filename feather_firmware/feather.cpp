@@ -7,86 +7,575 @@
 
 // Pico Libraries
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+#include "hardware/watchdog.h"
 #include "tusb.h"
 
 // Initialize the static instance pointer
 Feather* Feather::feather_instance_ = nullptr;
 
+// Encoder payloads and the legacy byte commands have a slot per wheel of the two-wheel base
+static_assert(FeatherEncoderBank::ENCODER_COUNT == 2, "Protocol payloads carry exactly two encoders");
+
+// MSG_GET_STATS sends the whole dump in one frame
+static_assert(INSTRUMENTATION_DUMP_LENGTH <= PROTOCOL_MAX_PAYLOAD, "Instrumentation dump does not fit in a frame");
+
+// MSG_GET_HISTORY frames count their samples in one byte
+static_assert(HISTORY_MAX_ENTRIES <= 0xFF, "History frames count their samples in one byte");
+
 /**
  * @brief Construct a new Feather object.
  * Initializes the encoders and IMU.
  */
 Feather::Feather()
-    : encoder1_(ENCODER1_PIN_A, ENCODER1_PIN_B),
-      encoder2_(ENCODER2_PIN_A, ENCODER2_PIN_B),
-      imu_() {
+    : encoders_(ENCODER_USE_PIO ? EncoderMode::PIO : EncoderMode::GPIO_IRQ),
+      imu_(IMU_USE_SPI ? IMUBus::SPI : IMUBus::I2C),
+      ahrs_(),
+      odometry_(),
+      motors_{Motor(MOTOR1_DIR_PIN, MOTOR1_PWM_PIN, MOTOR1_INVERTED), Motor(MOTOR2_DIR_PIN, MOTOR2_PWM_PIN, MOTOR2_INVERTED)},
+      speed_controllers_(),
+      last_velocity_update_us_(0),
+      last_odometry_update_us_(0),
+      last_history_us_(0),
+      history_(),
+      warm_restart_(false),
+      warm_restart_state_(),
+      saved_link_state_(),
+      warm_restarts_(0),
+      acquisition_passes_(0),
+      watchdog_passes_(0),
+      legacy_link_started_(false),
+      framed_mode_(false),
+      reply_interface_(UsbInterface::CDC),
+      telemetry_interface_(UsbInterface::CDC),
+      tx_pending_{false, false},
+      rx_time_us_(0),
+      streaming_(false),
+      stream_resume_pending_(false),
+      stream_rate_hz_(STREAM_RATE_DEFAULT_HZ),
+      telemetry_seq_(0),
+      telemetry_last_us_(0),
+      telemetry_orientation_(),
+      telemetry_pose_(),
+      stream_encoding_(STREAM_ENCODING_RAW),
+      keyframe_interval_(STREAM_KEYFRAME_INTERVAL_DEFAULT),
+      frames_since_keyframe_(0),
+      keyframe_due_(true),
+      previous_telemetry_seq_(0),
+      previous_telemetry_(),
+      speed_setpoints_(),
+      motors_active_(false),
+      setpoint_us_(0),
+      motor_last_us_(0),
+      acquisition_alarm_pool_(nullptr) {
     
     // Set static instance pointer to current object
     feather_instance_ = this;
+
+    // Queue of samples from the telemetry timer (core1) to the main loop (core0)
+    queue_init(&telemetry_queue_, sizeof(TelemetrySample), TELEMETRY_QUEUE_LENGTH);
+
+    // Commands from core0 to core1 and their results
+    queue_init(&command_queue_, sizeof(AcquisitionCommand), ACQUISITION_COMMAND_QUEUE_LENGTH);
+    queue_init(&command_result_queue_, sizeof(bool), ACQUISITION_COMMAND_QUEUE_LENGTH);
 }
 
 /**
  * @brief Initialize the sensor array components (encoders, IMU, etc.).
  */
 void Feather::initializeFeather() {
-    // Initialize GPIOs for Encoder 1
-    gpio_init(ENCODER1_PIN_A);
-    gpio_init(ENCODER1_PIN_B);
-    gpio_set_dir(ENCODER1_PIN_A, GPIO_IN);
-    gpio_set_dir(ENCODER1_PIN_B, GPIO_IN);
-    gpio_pull_up(ENCODER1_PIN_A);
-    gpio_pull_up(ENCODER1_PIN_B);
-
-    // Initialize GPIOs for Encoder 2
-    gpio_init(ENCODER2_PIN_A);
-    gpio_init(ENCODER2_PIN_B);
-    gpio_set_dir(ENCODER2_PIN_A, GPIO_IN);
-    gpio_set_dir(ENCODER2_PIN_B, GPIO_IN);
-    gpio_pull_up(ENCODER2_PIN_A);
-    gpio_pull_up(ENCODER2_PIN_B);
-
-    // Attach a single interrupt callback to all encoder pins
-    gpio_set_irq_enabled_with_callback(ENCODER1_PIN_A, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, gpio_callback);
-    gpio_set_irq_enabled(ENCODER1_PIN_B, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
-    gpio_set_irq_enabled(ENCODER2_PIN_A, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
-    gpio_set_irq_enabled(ENCODER2_PIN_B, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
-
-    // Initialize the encoders
-    encoder1_.initializeEncoder();
-    encoder2_.initializeEncoder();
-
-    // Initialize the IMU
+    // Initialize the framed protocol (core0 does all USB I/O)
+    initializeProtocol();
+
+    // Cycle counter for the USB command probe
+    initializeInstrumentation();
+
+    // Pick up the link where it was before a warm restart; core1 restores the rest
+    warm_restart_ = persistence_load(&warm_restart_state_, sizeof(warm_restart_state_)) &&
+                    warm_restart_state_.version == WARM_RESTART_VERSION;
+    if (warm_restart_) {
+        warm_restart_state_.restarts++;
+        framed_mode_ = warm_restart_state_.framed_mode;
+        legacy_link_started_ = warm_restart_state_.legacy_link_started;
+        telemetry_interface_ = warm_restart_state_.telemetry_interface;
+        stream_encoding_ = warm_restart_state_.stream_encoding;
+        keyframe_interval_ = warm_restart_state_.keyframe_interval;
+        stream_resume_pending_ = warm_restart_state_.streaming;
+    } else {
+        warm_restart_state_.restarts = 0;
+    }
+    warm_restarts_ = warm_restart_state_.restarts;
+
+    // Core1 saves the link settings from its own copy, updated by send_link_state()
+    saved_link_state_ = get_link_state();
+
+    // Start acquisition on core1 and wait until its sensors are running
+    multicore_launch_core1(core1_entry);
+
+    uint32_t flag = multicore_fifo_pop_blocking();
+    if (flag != ACQUISITION_READY_FLAG) {
+        panic("Core1 acquisition failed to start");
+    }
+
+#if FEATHER_WATCHDOG_MS
+    // Paused while a debugger halts the cores
+    watchdog_passes_ = acquisition_passes_;
+    watchdog_enable(FEATHER_WATCHDOG_MS, true);
+#endif
+}
+
+void Feather::core1_entry() {
+    feather_instance_->initialize_acquisition();
+    multicore_fifo_push_blocking(ACQUISITION_READY_FLAG);
+    feather_instance_->acquisition_loop();
+}
+
+void Feather::initialize_acquisition() {
+    // Interrupts are enabled on the core that registers them, so everything
+    // below fires on core1 and never waits behind the USB stack on core0
+
+    // Cycle counter for the interrupt probes
+    initializeInstrumentation();
+
+    // Initialize the encoders (pins and counting backend) and, in GPIO_IRQ
+    // mode, attach the shared interrupt callback to every encoder pin
+    encoders_.initialize(gpio_callback);
+
+    // Start the IMU; the acquisition loop finishes its start-up, after which
+    // it is read with DMA on every data ready interrupt
     imu_.initializeIMU();
+
+    gpio_init(IMU_INT_PIN);
+    gpio_set_dir(IMU_INT_PIN, GPIO_IN);
+    gpio_set_irq_enabled_with_callback(IMU_INT_PIN, GPIO_IRQ_EDGE_RISE, true, gpio_callback);
+
+    // Telemetry timer alarms fire on core1 as well
+    acquisition_alarm_pool_ = alarm_pool_create_with_unused_hardware_alarm(ACQUISITION_ALARM_POOL_TIMERS);
+
+    // Motors start coasting; the speed loop runs next to the encoders it reads
+    for (Motor& motor : motors_) {
+        motor.initializeMotor();
+    }
+    motor_last_us_ = time_us_64();
+    if (!alarm_pool_add_repeating_timer_us(acquisition_alarm_pool_, -1000000 / MOTOR_CONTROL_RATE_HZ,
+                                           motor_timer_callback, this, &motor_timer_)) {
+        panic("Motor control timer failed to start");
+    }
+
+    // Publish a first snapshot before core0 starts answering requests and
+    // before a restored stream can read it
+    SensorSnapshot snapshot;
+    capture_snapshot(&snapshot);
+    snapshot.orientation = ahrs_.get_state();
+    snapshot.pose = odometry_.get_state();
+    snapshot_.write(snapshot);
+
+    // Carry on from before a warm restart (the next pass publishes the restored pose)
+    if (warm_restart_) {
+        restore_warm_restart_state();
+    }
+}
+
+void Feather::restore_warm_restart_state() {
+    const WarmRestartState& state = warm_restart_state_;
+
+    for (size_t i = 0; i < FeatherEncoderBank::ENCODER_COUNT; i++) {
+        encoders_[i].set_position(state.positions[i]);
+    }
+    odometry_.set_config(state.odometry_config);
+    odometry_.restore(state.pose, state.positions[0], state.positions[1]);
+
+    // The IMU start-up writes the restored configuration
+    set_imu_config(state.imu_config);
+
+    // Streaming resumes once the host sends a frame (see parse_frames)
+    set_stream_rate(state.stream_rate_hz);
+}
+
+void Feather::save_warm_restart_state(const SensorSnapshot& snapshot) {
+    WarmRestartState& state = warm_restart_state_;
+
+    state.version = WARM_RESTART_VERSION;
+    for (size_t i = 0; i < FeatherEncoderBank::ENCODER_COUNT; i++) {
+        state.positions[i] = snapshot.encoders.positions[i];
+    }
+    state.pose = snapshot.pose;
+    state.odometry_config = odometry_.get_config();
+    state.imu_config = snapshot.imu_config;
+    state.streaming = streaming_ || saved_link_state_.stream_resume_pending;
+    state.stream_rate_hz = stream_rate_hz_;
+    state.telemetry_interface = saved_link_state_.telemetry_interface;
+    state.stream_encoding = saved_link_state_.stream_encoding;
+    state.keyframe_interval = saved_link_state_.keyframe_interval;
+    state.framed_mode = saved_link_state_.framed_mode;
+    state.legacy_link_started = saved_link_state_.legacy_link_started;
+
+    persistence_save(&state, sizeof(state));
 }
 
 void Feather::resetFeather() {
     // Reset encoder positions
-    encoder1_.reset_position();
-    encoder2_.reset_position();
+    encoders_.reset_positions();
 
-    // Reset IMU
+    // Reset IMU and restart the attitude filter from the accelerometer
     imu_.resetIMU();
+    ahrs_.reset();
+
+    // Restart dead reckoning at the origin
+    odometry_.reset();
 }
 
 /**
- * @brief Main loop of the robot.
- * This will handle periodic tasks such as reading sensor data.
+ * @brief Main loop of the robot (core0).
+ * This will handle USB communication only; sensors are read on core1.
  */
 void Feather::loop() {
     while (true) {
+#if FEATHER_WATCHDOG_MS
+        // Only while core1 is also making progress
+        if (acquisition_passes_ != watchdog_passes_) {
+            watchdog_passes_ = acquisition_passes_;
+            watchdog_update();
+        }
+#endif
+        tud_task(); // TinyUSB device work (the firmware owns the USB stack)
         process_usb_communication(); // Process USB command
+        process_telemetry(); // Push streamed samples
         tight_loop_contents(); // Inline No-Op to keep compiler from optimizing out loop
     }
 }
 
+/**
+ * @brief Acquisition loop of the robot (core1).
+ * This will handle periodic tasks such as reading sensor data.
+ */
+void Feather::acquisition_loop() {
+    SensorSnapshot snapshot;
+
+    while (true) {
+        process_acquisition_commands(); // Commands queued by core0
+        update_velocities(); // Sample encoder transitions for speed estimation
+        imu_.service(); // Deferred IMU bus work
+
+        // Publish the current sensor state for core0
+        capture_snapshot(&snapshot);
+        update_attitude(&snapshot);
+        update_odometry(&snapshot);
+        snapshot_.write(snapshot);
+        record_history(snapshot);
+        acquisition_passes_ = acquisition_passes_ + 1;
+    }
+}
+
+void Feather::process_acquisition_commands() {
+    AcquisitionCommand command;
+
+    while (queue_try_remove(&command_queue_, &command)) {
+        bool result = true;
+
+        switch (command.type) {
+            case AcquisitionCommandType::RESET_SENSORS:
+                resetFeather();
+                break;
+            case AcquisitionCommandType::START_STREAM:
+                result = start_streaming();
+                break;
+            case AcquisitionCommandType::STOP_STREAM:
+                stop_streaming();
+                break;
+            case AcquisitionCommandType::SET_STREAM_RATE:
+                result = set_stream_rate((uint16_t)command.arg);
+                break;
+            case AcquisitionCommandType::SET_IMU_FIFO_MODE:
+                result = imu_.set_fifo_mode(command.arg != 0);
+                break;
+            case AcquisitionCommandType::SET_ODOMETRY_CONFIG:
+                result = odometry_.set_config(*static_cast<const OdometryConfig*>(command.data));
+                break;
+            case AcquisitionCommandType::SET_WHEEL_SPEEDS:
+                set_wheel_speeds(static_cast<const int32_t*>(command.data));
+                break;
+            case AcquisitionCommandType::SET_MOTOR_GAINS:
+                result = set_motor_gains(*static_cast<const VelocityPIDGains*>(command.data));
+                break;
+            case AcquisitionCommandType::SET_IMU_CONFIG:
+                result = set_imu_config(*static_cast<const IMUConfig*>(command.data));
+                break;
+            case AcquisitionCommandType::SET_LINK_STATE:
+                saved_link_state_ = *static_cast<const LinkState*>(command.data);
+                break;
+        }
+
+        queue_add_blocking(&command_result_queue_, &result);
+    }
+}
+
+bool Feather::run_acquisition_command(AcquisitionCommandType type, uint32_t arg, const void* data) {
+    AcquisitionCommand command = {type, arg, data};
+    bool result;
+
+    // Core1 runs queued commands on every loop pass, so this wait is short
+    queue_add_blocking(&command_queue_, &command);
+    queue_remove_blocking(&command_result_queue_, &result);
+
+    return result;
+}
+
+SensorSnapshot Feather::get_snapshot() const {
+    return snapshot_.read();
+}
+
+EncoderSnapshot Feather::get_encoder_snapshot() const {
+    return snapshot_.read().encoders;
+}
+
+void Feather::capture_encoders(EncoderSnapshot* snapshot) {
+    uint32_t start;
+
+    // In GPIO_IRQ mode an edge interrupt between the reads would give
+    // positions from different instants, so read again if one ran. PIO
+    // counts are read back to back from the state machines.
+    do {
+        start = encoder_sequence_.read_begin();
+        snapshot->timestamp_us = time_us_64();
+        for (size_t i = 0; i < FeatherEncoderBank::ENCODER_COUNT; i++) {
+            snapshot->positions[i] = encoders_[i].get_position();
+        }
+    } while (encoder_sequence_.read_retry(start));
+}
+
+void Feather::capture_snapshot(SensorSnapshot* snapshot) {
+    capture_encoders(&snapshot->encoders);
+    for (size_t i = 0; i < FeatherEncoderBank::ENCODER_COUNT; i++) {
+        snapshot->speeds[i] = encoders_[i].get_speed();
+        snapshot->substep_positions[i] = encoders_[i].get_substep_position();
+        snapshot->illegal_transitions[i] = encoders_[i].get_illegal_transition_count();
+    }
+
+    // Latest complete IMU sample (zeros while the IMU starts)
+    if (!imu_.get_latest_sample(&snapshot->imu)) {
+        memset(&snapshot->imu, 0, sizeof(snapshot->imu));
+    }
+    snapshot->imu_status = imu_.get_status();
+    snapshot->imu_config = imu_.get_config();
+
+    for (size_t i = 0; i < FeatherEncoderBank::ENCODER_COUNT; i++) {
+        snapshot->speed_setpoints[i] = speed_setpoints_[i];
+        snapshot->motor_duty[i] = motors_[i].get_duty();
+    }
+}
+
+void Feather::set_wheel_speeds(const int32_t* setpoints) {
+    // The motor timer interrupts this core, so update it all at once
+    uint32_t status = save_and_disable_interrupts();
+
+    for (size_t i = 0; i < FeatherEncoderBank::ENCODER_COUNT; i++) {
+        speed_setpoints_[i] = setpoints[i];
+    }
+
+    // Start from clean controllers after coasting
+    if (!motors_active_) {
+        for (VelocityPID& controller : speed_controllers_) {
+            controller.reset();
+        }
+        motors_active_ = true;
+    }
+    setpoint_us_ = time_us_64();
+
+    restore_interrupts(status);
+}
+
+bool Feather::set_motor_gains(const VelocityPIDGains& gains) {
+    uint32_t status = save_and_disable_interrupts();
+    bool result = true;
+
+    for (VelocityPID& controller : speed_controllers_) {
+        result = controller.set_gains(gains) && result;
+    }
+
+    restore_interrupts(status);
+
+    return result;
+}
+
+LinkState Feather::get_link_state() const {
+    LinkState link;
+
+    link.telemetry_interface = telemetry_interface_;
+    link.stream_encoding = stream_encoding_;
+    link.keyframe_interval = keyframe_interval_;
+    link.framed_mode = framed_mode_;
+    link.legacy_link_started = legacy_link_started_;
+    link.stream_resume_pending = stream_resume_pending_;
+
+    return link;
+}
+
+void Feather::send_link_state() {
+    LinkState link = get_link_state();
+
+    run_acquisition_command(AcquisitionCommandType::SET_LINK_STATE, 0, &link);
+}
+
+bool Feather::set_imu_config(const IMUConfig& config) {
+    if (!imu_.set_config(config)) {
+        return false;
+    }
+
+    // No reset needed: the attitude filter keeps its state in physical units
+    ahrs_.set_sensor_scales(imu_gyro_lsb_per_dps(config), imu_accel_lsb_per_g(config));
+
+    return true;
+}
+
+void Feather::stop_motors() {
+    motors_active_ = false;
+
+    for (size_t i = 0; i < FeatherEncoderBank::ENCODER_COUNT; i++) {
+        speed_setpoints_[i] = 0;
+        motors_[i].set_duty(0.0f);
+    }
+}
+
+bool Feather::motor_timer_callback(repeating_timer_t* rt) {
+    Feather* feather = static_cast<Feather*>(rt->user_data);
+    uint32_t start_cycles = instrumentation_start();
+    uint64_t now_us = time_us_64();
+    float dt = (now_us - feather->motor_last_us_) * 1.0e-6f;
+    feather->motor_last_us_ = now_us;
+
+    // Coast if the host stopped sending setpoints
+    if (feather->motors_active_ && (now_us - feather->setpoint_us_) > MOTOR_SETPOINT_TIMEOUT_US) {
+        feather->stop_motors();
+        instrumentation_count(InstrumentationEvent::MOTOR_TIMEOUT);
+    }
+
+    if (feather->motors_active_) {
+        for (size_t i = 0; i < FeatherEncoderBank::ENCODER_COUNT; i++) {
+            float duty = feather->speed_controllers_[i].update((float)feather->speed_setpoints_[i],
+                                                               (float)feather->encoders_[i].get_speed(), dt);
+            feather->motors_[i].set_duty(duty);
+        }
+    }
+
+    instrumentation_record(Probe::MOTOR_CONTROL, start_cycles);
+
+    return true; // Keep repeating
+}
+
+void Feather::update_attitude(SensorSnapshot* snapshot) {
+    // Fuse each new sample as soon as it is seen, at the full IMU rate
+    uint32_t start_cycles = instrumentation_start();
+    if (ahrs_.update(snapshot->imu)) {
+        instrumentation_record(Probe::AHRS_UPDATE, start_cycles);
+    }
+    snapshot->orientation = ahrs_.get_state();
+}
+
+void Feather::update_odometry(SensorSnapshot* snapshot) {
+    uint32_t now_us = time_us_32();
+
+    snapshot->pose = odometry_.get_state();
+    if ((now_us - last_odometry_update_us_) < ODOMETRY_UPDATE_PERIOD_US) {
+        return;
+    }
+    last_odometry_update_us_ = now_us;
+
+    // Gyro z in rad/s, less the bias the attitude filter estimated
+    int16_t gyro_z = (int16_t)((snapshot->imu.data[12] << 8) | snapshot->imu.data[13]);
+    float gyro_z_rad_s = gyro_z * (ODOMETRY_PI / 180.0f / imu_gyro_lsb_per_dps(snapshot->imu_config)) -
+                         (float)snapshot->orientation.gyro_bias[2] / AHRS_RATE_ONE;
+
+    // A gyro that stopped sampling leaves its last rate behind, which must not be integrated
+    uint64_t gyro_max_age_us = (uint64_t)ODOMETRY_GYRO_MAX_AGE_PERIODS * imu_.get_sample_period_us();
+    bool gyro_valid = snapshot->imu.timestamp_us != 0 &&
+                      (int64_t)(snapshot->encoders.timestamp_us - snapshot->imu.timestamp_us) <= (int64_t)gyro_max_age_us;
+
+    // Integrate the captured counts so the pose matches the encoder timestamp
+    uint32_t start_cycles = instrumentation_start();
+    odometry_.update(snapshot->encoders.timestamp_us, snapshot->encoders.positions[0], snapshot->encoders.positions[1],
+                     gyro_z_rad_s, gyro_valid);
+    instrumentation_record(Probe::ODOMETRY_UPDATE, start_cycles);
+
+    snapshot->pose = odometry_.get_state();
+
+    // The counts the pose was integrated at, so a warm restart continues without a jump
+    save_warm_restart_state(*snapshot);
+}
+
+void Feather::record_history(const SensorSnapshot& snapshot) {
+    uint32_t now_us = time_us_32();
+
+    if ((now_us - last_history_us_) < 1000000 / HISTORY_RATE_HZ) {
+        return;
+    }
+    last_history_us_ = now_us;
+
+    HistorySample sample = {snapshot.encoders, snapshot.imu};
+    history_.push(sample);
+}
+
+void Feather::update_velocities() {
+    uint32_t now_us = time_us_32();
+
+    // Run the estimators at a fixed rate so idle-stop detection is time based
+    if ((now_us - last_velocity_update_us_) < VELOCITY_SAMPLE_PERIOD_US) {
+        return;
+    }
+    if ((now_us - last_velocity_update_us_) >= 2 * VELOCITY_SAMPLE_PERIOD_US) {
+        instrumentation_count(InstrumentationEvent::VELOCITY_LATE);
+    }
+    last_velocity_update_us_ = now_us;
+
+    encoders_.update_velocities();
+}
+
 void Feather::process_usb_communication() {
-    // Check if data is available
-    if (!tud_cdc_available()) {
-        return; // Escape function
+    // The vendor interface only carries frames
+    process_framed_communication(UsbInterface::VENDOR);
+
+    // Framed link
+    if (framed_mode_) {
+        process_framed_communication(UsbInterface::CDC);
+    } else {
+        process_legacy_communication();
+    }
+
+    // Everything answered this pass goes out in one transfer per interface
+    usb_flush();
+}
+
+void Feather::process_legacy_communication() {
+    uint8_t rx_buffer[USB_RX_CHUNK_LENGTH];
+    uint32_t count;
+
+    // Handle every command byte that has arrived, not just the first
+    while ((count = usb_read(UsbInterface::CDC, rx_buffer, sizeof(rx_buffer))) > 0) {
+        for (uint32_t i = 0; i < count; i++) {
+            // Bytes after FRAMED_MODE_BYTE are already frames
+            if (framed_mode_) {
+                rx_time_us_ = time_us_64();
+                parse_frames(UsbInterface::CDC, &rx_buffer[i], count - i);
+                break;
+            }
+            handle_legacy_command(rx_buffer[i]);
+        }
     }
+}
 
-    // Read byte from USB
-    uint8_t recievedByte = tud_cdc_read_char();
+void Feather::handle_legacy_command(uint8_t recievedByte) {
+    uint32_t start_cycles = instrumentation_start();
+
+    // Sensors start at boot now; older hosts still open the link with the
+    // start handshake, which shares its byte with RETURN_IMU_DATA_BYTE
+    if (!legacy_link_started_) {
+        legacy_link_started_ = true;
+        send_link_state();
+        if (recievedByte == INITIALIZE_SENSORS_BYTE) {
+            return;
+        }
+    }
 
     // Process byte
     switch (recievedByte) {
@@ -95,19 +584,15 @@ void Feather::process_usb_communication() {
             // Initialize buffer for encoder positions
             uint8_t encoder_positions_buffer[DUAL_ENCODER_DATA_BUFFER_LENGTH];
 
-            // Get encoder positions
-            int32_t encoder1_position = encoder1_.get_position();
-            int32_t encoder2_position = encoder2_.get_position();
+            // Get both encoder positions from the same instant
+            EncoderSnapshot snapshot = get_encoder_snapshot();
 
             // Copy encoder positions to buffer
-            memcpy(&encoder_positions_buffer[0], &encoder1_position, sizeof(encoder1_position));
-            memcpy(&encoder_positions_buffer[4], &encoder2_position, sizeof(encoder2_position));
+            memcpy(&encoder_positions_buffer[0], &snapshot.positions[0], sizeof(snapshot.positions[0]));
+            memcpy(&encoder_positions_buffer[4], &snapshot.positions[1], sizeof(snapshot.positions[1]));
 
-            // Write encoder positions to USB
-            tud_cdc_write(encoder_positions_buffer, DUAL_ENCODER_DATA_BUFFER_LENGTH);
-
-            // Flush write buffer
-            tud_cdc_write_flush();
+            // Queue encoder positions for this pass's transfer
+            usb_write(UsbInterface::CDC, encoder_positions_buffer, DUAL_ENCODER_DATA_BUFFER_LENGTH);
 
             break;
         }
@@ -118,16 +603,13 @@ void Feather::process_usb_communication() {
             uint8_t encoder_position_buffer[SINGLE_ENCODER_DATA_BUFFER_LENGTH];
 
             // Get encoder position
-            int32_t encoder1_position = encoder1_.get_position();
+            SensorSnapshot snapshot = get_snapshot();
 
             // Copy encoder position to buffer
-            memcpy(encoder_position_buffer, &encoder1_position, sizeof(encoder1_position));
-
-            // Write encoder position to USB
-            tud_cdc_write(encoder_position_buffer, SINGLE_ENCODER_DATA_BUFFER_LENGTH);
+            memcpy(encoder_position_buffer, &snapshot.encoders.positions[0], sizeof(snapshot.encoders.positions[0]));
 
-            // Flush write buffer
-            tud_cdc_write_flush();
+            // Queue encoder position for this pass's transfer
+            usb_write(UsbInterface::CDC, encoder_position_buffer, SINGLE_ENCODER_DATA_BUFFER_LENGTH);
 
             break;
         }
@@ -138,61 +620,766 @@ void Feather::process_usb_communication() {
             uint8_t encoder_position_buffer[SINGLE_ENCODER_DATA_BUFFER_LENGTH];
 
             // Get encoder position
-            int32_t encoder2_position = encoder2_.get_position();
+            SensorSnapshot snapshot = get_snapshot();
 
             // Copy encoder position to buffer
-            memcpy(encoder_position_buffer, &encoder2_position, sizeof(encoder2_position));
-
-            // Write encoder position to USB
-            tud_cdc_write(encoder_position_buffer, SINGLE_ENCODER_DATA_BUFFER_LENGTH);
+            memcpy(encoder_position_buffer, &snapshot.encoders.positions[1], sizeof(snapshot.encoders.positions[1]));
 
-            // Flush write buffer
-            tud_cdc_write_flush();
+            // Queue encoder position for this pass's transfer
+            usb_write(UsbInterface::CDC, encoder_position_buffer, SINGLE_ENCODER_DATA_BUFFER_LENGTH);
 
             break;
         }
         
+        case RETURN_VELOCITIES_BYTE:
+        {
+            // Initialize buffer for encoder velocities
+            uint8_t velocity_buffer[VELOCITY_DATA_BUFFER_LENGTH];
+
+            // Get speeds (sub-steps per second) and sub-step positions
+            SensorSnapshot snapshot = get_snapshot();
+
+            // Copy speeds then sub-step positions to buffer
+            memcpy(&velocity_buffer[0], snapshot.speeds, sizeof(snapshot.speeds));
+            memcpy(&velocity_buffer[8], snapshot.substep_positions, sizeof(snapshot.substep_positions));
+
+            // Queue velocities for this pass's transfer
+            usb_write(UsbInterface::CDC, velocity_buffer, VELOCITY_DATA_BUFFER_LENGTH);
+
+            break;
+        }
+
         case RESET_SENSORS_BYTE:
         {
-            // Reset sensors
-            resetFeather();
+            // Reset sensors (on core1, which owns them)
+            run_acquisition_command(AcquisitionCommandType::RESET_SENSORS, 0);
             
             break;
         }
 
+        case FRAMED_MODE_BYTE:
+        {
+            // Switch the link to framed mode, starting from a clean parser
+            parser_.reset();
+            if (!framed_mode_) {
+                framed_mode_ = true;
+                send_link_state();
+            }
+
+            break;
+        }
+
         case RETURN_IMU_DATA_BYTE:
         {
-            // Initialize buffer for IMU data
-            uint8_t imu_data_buffer[IMU_DATA_BUFFER_LENGTH];
-            
-            // Read IMU data registers (0x38 - 0x48)
+            // Copy the latest IMU data registers (0x3B - 0x48)
             // Data is 2 bytes per DOF, little endian
             // Indicies:
             // 0 - 5 : Accelerometer (X, Y, Z)
             // 6 - 7 : Temperature
             // 8 - 13 : Gyroscope (X, Y, Z)
-            imu_.readIMU(IMU_READ_START_BYTE, imu_data_buffer, IMU_DATA_BUFFER_LENGTH);
+            SensorSnapshot snapshot = get_snapshot();
 
-            // Write IMU data buffer to USB
-            tud_cdc_write(imu_data_buffer, IMU_DATA_BUFFER_LENGTH);
-            
-            // Flush write buffer
-            tud_cdc_write_flush();
+            // Queue IMU data buffer for this pass's transfer
+            usb_write(UsbInterface::CDC, snapshot.imu.data, IMU_DATA_BUFFER_LENGTH);
             
             break;
         }
     }
+
+    instrumentation_record(Probe::USB_COMMAND, start_cycles);
+}
+
+void Feather::process_framed_communication(UsbInterface interface) {
+    uint8_t rx_buffer[USB_RX_CHUNK_LENGTH];
+    uint32_t count;
+
+    // Drain the receive FIFO through the parser
+    while ((count = usb_read(interface, rx_buffer, sizeof(rx_buffer))) > 0) {
+        rx_time_us_ = time_us_64(); // Receive time for MSG_TIME_SYNC
+        parse_frames(interface, rx_buffer, count);
+    }
+}
+
+void Feather::parse_frames(UsbInterface interface, const uint8_t* data, uint32_t length) {
+    FrameParser& parser = interface == UsbInterface::VENDOR ? vendor_parser_ : parser_;
+
+    reply_interface_ = interface;
+    for (uint32_t i = 0; i < length; i++) {
+        if (parser.push_byte(data[i])) {
+            // A stream from before a warm restart only resumes once its host is
+            // back, ahead of the request in case that stops it again
+            if (stream_resume_pending_ && interface == telemetry_interface_) {
+                if (run_acquisition_command(AcquisitionCommandType::START_STREAM, 0)) {
+                    keyframe_due_ = true;
+                }
+                stream_resume_pending_ = false;
+                send_link_state();
+            }
+
+            uint32_t start_cycles = instrumentation_start();
+            handle_frame(parser.get_frame());
+            instrumentation_record(Probe::USB_COMMAND, start_cycles);
+        }
+    }
+}
+
+uint32_t Feather::usb_read(UsbInterface interface, uint8_t* buffer, uint32_t length) {
+    if (interface == UsbInterface::VENDOR) {
+        return tud_vendor_available() ? tud_vendor_read(buffer, length) : 0;
+    }
+
+    return tud_cdc_available() ? tud_cdc_read(buffer, length) : 0;
+}
+
+void Feather::usb_write(UsbInterface interface, const uint8_t* data, uint32_t length) {
+    bool vendor = interface == UsbInterface::VENDOR;
+
+    // Nobody to read the frame
+    if (vendor && !tud_vendor_mounted()) {
+        return;
+    }
+
+    uint64_t progress_us = time_us_64();
+    while (length > 0) {
+        uint32_t written = vendor ? tud_vendor_write(data, length) : tud_cdc_write(data, length);
+        data += written;
+        length -= written;
+
+        if (written > 0) {
+            progress_us = time_us_64();
+        } else if ((time_us_64() - progress_us) > USB_WRITE_TIMEOUT_US) {
+            break;
+        }
+
+        // The FIFO is full: send what is queued and let TinyUSB complete it
+        if (length > 0) {
+            if (vendor) {
+                tud_vendor_write_flush();
+            } else {
+                tud_cdc_write_flush();
+            }
+            tud_task();
+        }
+    }
+    tx_pending_[(size_t)interface] = true;
+}
+
+bool Feather::usb_try_write(UsbInterface interface, const uint8_t* data, uint32_t length) {
+    bool vendor = interface == UsbInterface::VENDOR;
+
+    if (vendor && !tud_vendor_mounted()) {
+        return false;
+    }
+
+    // Mounted does not mean anyone is reading, so go by the room in the FIFO
+    uint32_t available = vendor ? tud_vendor_write_available() : tud_cdc_write_available();
+    if (available < length) {
+        return false;
+    }
+
+    if (vendor) {
+        tud_vendor_write(data, length);
+    } else {
+        tud_cdc_write(data, length);
+    }
+    tx_pending_[(size_t)interface] = true;
+
+    return true;
+}
+
+void Feather::usb_flush() {
+    if (tx_pending_[(size_t)UsbInterface::CDC]) {
+        tud_cdc_write_flush();
+        tx_pending_[(size_t)UsbInterface::CDC] = false;
+    }
+    if (tx_pending_[(size_t)UsbInterface::VENDOR]) {
+        tud_vendor_write_flush();
+        tx_pending_[(size_t)UsbInterface::VENDOR] = false;
+    }
+}
+
+void Feather::handle_frame(const Frame& frame) {
+    uint8_t response_type = frame.type | MSG_RESPONSE_FLAG;
+
+    // Check the payload length of the request
+    int expected_length = request_payload_length(frame.type);
+    if (expected_length < 0) {
+        send_error(frame.type, frame.seq, PROTOCOL_ERROR_UNKNOWN_TYPE);
+        return;
+    }
+    if (frame.length != expected_length) {
+        send_error(frame.type, frame.seq, PROTOCOL_ERROR_BAD_LENGTH);
+        return;
+    }
+
+    switch (frame.type) {
+        case MSG_GET_ENCODERS:
+        {
+            uint8_t payload[DUAL_ENCODER_DATA_BUFFER_LENGTH];
+            EncoderSnapshot snapshot = get_encoder_snapshot();
+
+            memcpy(payload, snapshot.positions, sizeof(snapshot.positions));
+            send_frame(response_type, frame.seq, payload, sizeof(payload));
+            break;
+        }
+
+        case MSG_GET_ENCODER_SNAPSHOT:
+        {
+            uint8_t payload[ENCODER_SNAPSHOT_PAYLOAD_LENGTH];
+            EncoderSnapshot snapshot = get_encoder_snapshot();
+
+            memcpy(&payload[0], &snapshot.timestamp_us, sizeof(snapshot.timestamp_us));
+            memcpy(&payload[8], snapshot.positions, sizeof(snapshot.positions));
+            send_frame(response_type, frame.seq, payload, sizeof(payload));
+            break;
+        }
+
+        case MSG_GET_ENCODER_ERRORS:
+        {
+            uint8_t payload[ENCODER_ERRORS_PAYLOAD_LENGTH];
+            SensorSnapshot snapshot = get_snapshot();
+
+            memcpy(payload, snapshot.illegal_transitions, sizeof(snapshot.illegal_transitions));
+            send_frame(response_type, frame.seq, payload, sizeof(payload));
+            break;
+        }
+
+        case MSG_GET_ORIENTATION:
+        {
+            uint8_t payload[ORIENTATION_PAYLOAD_LENGTH];
+            AHRSState orientation = get_snapshot().orientation;
+
+            memcpy(&payload[0], &orientation.timestamp_us, sizeof(orientation.timestamp_us));
+            memcpy(&payload[8], orientation.quaternion, sizeof(orientation.quaternion));
+            memcpy(&payload[24], orientation.gyro_bias, sizeof(orientation.gyro_bias));
+            send_frame(response_type, frame.seq, payload, sizeof(payload));
+            break;
+        }
+
+        case MSG_GET_ODOMETRY:
+        {
+            uint8_t payload[ODOMETRY_PAYLOAD_LENGTH];
+            OdometryState pose = get_snapshot().pose;
+
+            memcpy(&payload[0], &pose.timestamp_us, sizeof(pose.timestamp_us));
+            memcpy(&payload[8], &pose.x_m, sizeof(pose.x_m));
+            memcpy(&payload[12], &pose.y_m, sizeof(pose.y_m));
+            memcpy(&payload[16], &pose.heading_rad, sizeof(pose.heading_rad));
+            memcpy(&payload[20], pose.covariance, sizeof(pose.covariance));
+            send_frame(response_type, frame.seq, payload, sizeof(payload));
+            break;
+        }
+
+        case MSG_SET_ODOMETRY_CONFIG:
+        {
+            OdometryConfig config;
+            memcpy(&config.wheel_radius_m, &frame.payload[0], sizeof(config.wheel_radius_m));
+            memcpy(&config.wheel_base_m, &frame.payload[4], sizeof(config.wheel_base_m));
+            config.fuse_gyro = frame.payload[8] != 0;
+
+            if (!run_acquisition_command(AcquisitionCommandType::SET_ODOMETRY_CONFIG, 0, &config)) {
+                send_error(frame.type, frame.seq, PROTOCOL_ERROR_BAD_VALUE);
+                break;
+            }
+            send_frame(response_type, frame.seq, frame.payload, ODOMETRY_CONFIG_PAYLOAD_LENGTH);
+            break;
+        }
+
+        case MSG_SET_WHEEL_SPEEDS:
+        {
+            int32_t setpoints[FeatherEncoderBank::ENCODER_COUNT];
+            memcpy(setpoints, frame.payload, sizeof(setpoints));
+
+            run_acquisition_command(AcquisitionCommandType::SET_WHEEL_SPEEDS, 0, setpoints);
+            send_frame(response_type, frame.seq, frame.payload, WHEEL_SPEEDS_PAYLOAD_LENGTH);
+            break;
+        }
+
+        case MSG_SET_MOTOR_GAINS:
+        {
+            VelocityPIDGains gains;
+            memcpy(&gains.kp, &frame.payload[0], sizeof(gains.kp));
+            memcpy(&gains.ki, &frame.payload[4], sizeof(gains.ki));
+            memcpy(&gains.kd, &frame.payload[8], sizeof(gains.kd));
+            memcpy(&gains.kff, &frame.payload[12], sizeof(gains.kff));
+            memcpy(&gains.ks, &frame.payload[16], sizeof(gains.ks));
+
+            if (!run_acquisition_command(AcquisitionCommandType::SET_MOTOR_GAINS, 0, &gains)) {
+                send_error(frame.type, frame.seq, PROTOCOL_ERROR_BAD_VALUE);
+                break;
+            }
+            send_frame(response_type, frame.seq, frame.payload, MOTOR_GAINS_PAYLOAD_LENGTH);
+            break;
+        }
+
+        case MSG_SET_IMU_CONFIG:
+        {
+            IMUConfig config = {frame.payload[0], frame.payload[1], frame.payload[2], frame.payload[3]};
+
+            if (!run_acquisition_command(AcquisitionCommandType::SET_IMU_CONFIG, 0, &config)) {
+                send_error(frame.type, frame.seq, PROTOCOL_ERROR_BAD_VALUE);
+                break;
+            }
+            send_imu_config(response_type, frame.seq, config);
+            break;
+        }
+
+        case MSG_GET_IMU_CONFIG:
+        {
+            send_imu_config(response_type, frame.seq, get_snapshot().imu_config);
+            break;
+        }
+
+        case MSG_GET_MOTORS:
+        {
+            uint8_t payload[MOTORS_PAYLOAD_LENGTH];
+            SensorSnapshot snapshot = get_snapshot();
+
+            memcpy(&payload[0], &snapshot.encoders.timestamp_us, sizeof(snapshot.encoders.timestamp_us));
+            memcpy(&payload[8], snapshot.speed_setpoints, sizeof(snapshot.speed_setpoints));
+            memcpy(&payload[16], snapshot.speeds, sizeof(snapshot.speeds));
+            memcpy(&payload[24], snapshot.motor_duty, sizeof(snapshot.motor_duty));
+            send_frame(response_type, frame.seq, payload, sizeof(payload));
+            break;
+        }
+
+        case MSG_GET_STATUS:
+        {
+            uint8_t payload[STATUS_PAYLOAD_LENGTH];
+            uint64_t uptime_us = time_us_64();
+            IMUStatus status = get_snapshot().imu_status;
+
+            memcpy(&payload[0], &uptime_us, sizeof(uptime_us));
+            payload[8] = (uint8_t)status.state;
+            memcpy(&payload[9], &status.attempts, sizeof(status.attempts));
+            memcpy(&payload[11], &status.started_us, sizeof(status.started_us));
+            payload[19] = warm_restart_;
+            memcpy(&payload[20], &warm_restarts_, sizeof(warm_restarts_));
+            send_frame(response_type, frame.seq, payload, sizeof(payload));
+            break;
+        }
+
+        case MSG_GET_VELOCITIES:
+        {
+            uint8_t payload[VELOCITIES_PAYLOAD_LENGTH];
+            SensorSnapshot snapshot = get_snapshot();
+
+            memcpy(&payload[0], &snapshot.encoders.timestamp_us, sizeof(snapshot.encoders.timestamp_us));
+            memcpy(&payload[8], snapshot.speeds, sizeof(snapshot.speeds));
+            memcpy(&payload[16], snapshot.substep_positions, sizeof(snapshot.substep_positions));
+            send_frame(response_type, frame.seq, payload, sizeof(payload));
+            break;
+        }
+
+        case MSG_GET_IMU:
+        {
+            uint8_t payload[IMU_SAMPLE_PAYLOAD_LENGTH];
+            SensorSnapshot snapshot = get_snapshot();
+
+            memcpy(&payload[0], &snapshot.imu.timestamp_us, sizeof(snapshot.imu.timestamp_us));
+            memcpy(&payload[8], snapshot.imu.data, IMU_DATA_BUFFER_LENGTH);
+            send_frame(response_type, frame.seq, payload, sizeof(payload));
+            break;
+        }
+
+        case MSG_TIME_SYNC:
+        {
+            uint8_t payload[TIME_SYNC_PAYLOAD_LENGTH];
+            uint64_t receive_us = rx_time_us_;
+
+            // Echo the host time and stamp the reply as late as possible
+            memcpy(&payload[0], frame.payload, TIME_SYNC_REQUEST_PAYLOAD_LENGTH);
+            memcpy(&payload[8], &receive_us, sizeof(receive_us));
+            uint64_t transmit_us = time_us_64();
+            memcpy(&payload[16], &transmit_us, sizeof(transmit_us));
+            send_frame(response_type, frame.seq, payload, sizeof(payload));
+            break;
+        }
+
+        case MSG_GET_ALL_SENSORS:
+        {
+            uint8_t payload[ALL_SENSORS_PAYLOAD_LENGTH];
+
+            fill_all_sensors(payload, get_snapshot());
+            send_frame(response_type, frame.seq, payload, sizeof(payload));
+            break;
+        }
+
+        case MSG_RESET_SENSORS:
+        {
+            run_acquisition_command(AcquisitionCommandType::RESET_SENSORS, 0);
+            send_frame(response_type, frame.seq, nullptr, 0);
+            break;
+        }
+
+        case MSG_START_STREAM:
+        {
+            if (!run_acquisition_command(AcquisitionCommandType::START_STREAM, 0)) {
+                send_error(frame.type, frame.seq, PROTOCOL_ERROR_BAD_VALUE);
+                break;
+            }
+            if (telemetry_interface_ != reply_interface_) {
+                telemetry_interface_ = reply_interface_;
+                send_link_state();
+            }
+            keyframe_due_ = true;
+            send_frame(response_type, frame.seq, nullptr, 0);
+            break;
+        }
+
+        case MSG_SET_STREAM_ENCODING:
+        {
+            uint16_t keyframe_interval;
+            memcpy(&keyframe_interval, &frame.payload[1], sizeof(keyframe_interval));
+
+            if (frame.payload[0] > STREAM_ENCODING_DELTA || keyframe_interval == 0) {
+                send_error(frame.type, frame.seq, PROTOCOL_ERROR_BAD_VALUE);
+                break;
+            }
+
+            // Telemetry is sent from this core; core1 only saves the settings
+            stream_encoding_ = frame.payload[0];
+            keyframe_interval_ = keyframe_interval;
+            keyframe_due_ = true;
+            send_link_state();
+            send_frame(response_type, frame.seq, frame.payload, STREAM_ENCODING_PAYLOAD_LENGTH);
+            break;
+        }
+
+        case MSG_STOP_STREAM:
+        {
+            run_acquisition_command(AcquisitionCommandType::STOP_STREAM, 0);
+            send_frame(response_type, frame.seq, nullptr, 0);
+            break;
+        }
+
+        case MSG_SET_STREAM_RATE:
+        {
+            uint16_t rate_hz;
+            memcpy(&rate_hz, frame.payload, sizeof(rate_hz));
+
+            if (!run_acquisition_command(AcquisitionCommandType::SET_STREAM_RATE, rate_hz)) {
+                send_error(frame.type, frame.seq, PROTOCOL_ERROR_BAD_VALUE);
+                break;
+            }
+
+            // Echo the applied rate
+            send_frame(response_type, frame.seq, frame.payload, STREAM_RATE_PAYLOAD_LENGTH);
+            break;
+        }
+
+        case MSG_SET_IMU_FIFO_MODE:
+        {
+            if (!run_acquisition_command(AcquisitionCommandType::SET_IMU_FIFO_MODE, frame.payload[0] != 0)) {
+                send_error(frame.type, frame.seq, PROTOCOL_ERROR_BAD_VALUE);
+                break;
+            }
+            send_frame(response_type, frame.seq, frame.payload, IMU_FIFO_MODE_PAYLOAD_LENGTH);
+            break;
+        }
+
+        case MSG_GET_HISTORY:
+        {
+            uint32_t since;
+            uint16_t max_samples;
+            memcpy(&since, &frame.payload[0], sizeof(since));
+            memcpy(&max_samples, &frame.payload[4], sizeof(max_samples));
+
+            send_history(frame.seq, since, max_samples);
+            break;
+        }
+
+        case MSG_GET_IMU_FIFO:
+        {
+            send_imu_fifo(frame.seq);
+            break;
+        }
+
+        case MSG_GET_STATS:
+        {
+            size_t length = instrumentation_dump(payload_buffer_);
+
+            // Clear after reading so the next dump covers one interval
+            if (frame.payload[0] != 0) {
+                instrumentation_reset();
+            }
+            send_frame(response_type, frame.seq, payload_buffer_, length);
+            break;
+        }
+
+        default:
+        {
+            send_error(frame.type, frame.seq, PROTOCOL_ERROR_UNKNOWN_TYPE);
+            break;
+        }
+    }
+}
+
+void Feather::send_error(uint8_t type, uint16_t seq, uint8_t error_code) {
+    uint8_t payload[2] = {type, error_code};
+    send_frame(MSG_ERROR, seq, payload, sizeof(payload));
+}
+
+void Feather::send_frame(uint8_t type, uint16_t seq, const uint8_t* payload, uint16_t length) {
+    size_t encoded_length = encode_frame(type, seq, payload, length, tx_buffer_);
+
+    // A reply too long for a frame is answered with an error instead
+    if (encoded_length == 0) {
+        send_error(type & ~MSG_RESPONSE_FLAG, seq, PROTOCOL_ERROR_BAD_LENGTH);
+        return;
+    }
+
+    usb_write(reply_interface_, tx_buffer_, encoded_length);
+}
+
+bool Feather::try_send_frame(uint8_t type, uint16_t seq, const uint8_t* payload, uint16_t length) {
+    size_t encoded_length = encode_frame(type, seq, payload, length, tx_buffer_);
+
+    return encoded_length > 0 && usb_try_write(reply_interface_, tx_buffer_, encoded_length);
+}
+
+void Feather::send_imu_config(uint8_t type, uint16_t seq, const IMUConfig& config) {
+    uint8_t payload[IMU_CONFIG_PAYLOAD_LENGTH];
+    float gyro_lsb_per_dps = imu_gyro_lsb_per_dps(config);
+    float accel_lsb_per_g = imu_accel_lsb_per_g(config);
+    float sample_rate_hz = imu_sample_rate_hz(config);
+
+    payload[0] = config.gyro_range;
+    payload[1] = config.accel_range;
+    payload[2] = config.dlpf;
+    payload[3] = config.sample_rate_divider;
+    memcpy(&payload[4], &gyro_lsb_per_dps, sizeof(gyro_lsb_per_dps));
+    memcpy(&payload[8], &accel_lsb_per_g, sizeof(accel_lsb_per_g));
+    memcpy(&payload[12], &sample_rate_hz, sizeof(sample_rate_hz));
+    send_frame(type, seq, payload, sizeof(payload));
+}
+
+void Feather::send_history(uint16_t seq, uint32_t since, uint16_t max_samples) {
+    uint8_t* payload = payload_buffer_;
+    uint32_t end = history_.get_next_seq();
+    uint32_t remaining = max_samples ? max_samples : HISTORY_LENGTH;
+    bool more = true;
+
+    // A sequence from before a reboot: start from the oldest sample
+    if ((int32_t)(end - since) < 0) {
+        since = end > HISTORY_LENGTH ? end - HISTORY_LENGTH : 0;
+    }
+
+    // Up to the newest sample at the time of the request, so a fast writer
+    // cannot keep the reply going
+    while (more) {
+        HistorySample sample;
+        uint32_t first = since;
+        uint32_t sample_seq;
+        size_t count = 0;
+
+        uint8_t* entry = &payload[HISTORY_HEADER_LENGTH];
+        while (count < HISTORY_MAX_ENTRIES && remaining > 0 && (int32_t)(end - since) > 0 &&
+               history_.read(since, &sample, 1, &sample_seq)) {
+            // A gap (overwritten samples) starts a new frame
+            if (count == 0) {
+                first = sample_seq;
+            } else if (sample_seq != since) {
+                break;
+            }
+            memcpy(&entry[0], &sample.encoders.timestamp_us, sizeof(sample.encoders.timestamp_us));
+            memcpy(&entry[8], sample.encoders.positions, sizeof(sample.encoders.positions));
+            memcpy(&entry[16], &sample.imu.timestamp_us, sizeof(sample.imu.timestamp_us));
+            memcpy(&entry[24], sample.imu.data, IMU_DATA_BUFFER_LENGTH);
+            entry += HISTORY_ENTRY_LENGTH;
+            since = sample_seq + 1;
+            remaining--;
+            count++;
+        }
+        more = count > 0 && remaining > 0 && (int32_t)(end - since) > 0;
+
+        memcpy(&payload[0], &first, sizeof(first));
+        payload[4] = (uint8_t)count;
+        payload[5] = more;
+
+        send_frame(MSG_GET_HISTORY | MSG_RESPONSE_FLAG, seq, payload, HISTORY_HEADER_LENGTH + count * HISTORY_ENTRY_LENGTH);
+    }
+}
+
+void Feather::send_imu_fifo(uint16_t seq) {
+    uint8_t* payload = payload_buffer_;
+    uint32_t dropped = imu_.get_fifo_dropped_count();
+    uint32_t overflows = imu_.get_fifo_overflow_count();
+    IMUSample sample;
+    size_t count = 0;
+
+    // Oldest buffered samples first; the host repeats the request until count is 0
+    uint8_t* entry = &payload[IMU_FIFO_HEADER_LENGTH];
+    while (count < IMU_FIFO_MAX_ENTRIES && imu_.read_fifo_samples(&sample, 1)) {
+        memcpy(&entry[0], &sample.timestamp_us, sizeof(sample.timestamp_us));
+        memcpy(&entry[8], sample.data, IMU_DATA_BUFFER_LENGTH);
+        entry += IMU_FIFO_ENTRY_LENGTH;
+        count++;
+    }
+
+    memcpy(&payload[0], &dropped, sizeof(dropped));
+    memcpy(&payload[4], &overflows, sizeof(overflows));
+    payload[8] = (uint8_t)count;
+
+    send_frame(MSG_GET_IMU_FIFO | MSG_RESPONSE_FLAG, seq, payload, IMU_FIFO_HEADER_LENGTH + count * IMU_FIFO_ENTRY_LENGTH);
+}
+
+void Feather::fill_all_sensors(uint8_t* buffer, const SensorSnapshot& snapshot) {
+    // Encoder positions and speeds, and the time they were captured
+    memcpy(&buffer[0], &snapshot.encoders.timestamp_us, sizeof(snapshot.encoders.timestamp_us));
+    memcpy(&buffer[8], snapshot.encoders.positions, sizeof(snapshot.encoders.positions));
+    memcpy(&buffer[16], snapshot.speeds, sizeof(snapshot.speeds));
+
+    // Latest IMU data registers (0x3B - 0x48) and their data ready time
+    memcpy(&buffer[24], &snapshot.imu.timestamp_us, sizeof(snapshot.imu.timestamp_us));
+    memcpy(&buffer[32], snapshot.imu.data, IMU_DATA_BUFFER_LENGTH);
+}
+
+bool Feather::start_streaming() {
+    if (streaming_) {
+        return true;
+    }
+
+    // The first callback has nothing to be late against
+    telemetry_last_us_ = 0;
+
+    // Negative delay means exact period between callbacks rather than delay between them
+    if (!alarm_pool_add_repeating_timer_us(acquisition_alarm_pool_, -1000000 / stream_rate_hz_,
+                                           telemetry_timer_callback, this, &telemetry_timer_)) {
+        return false;
+    }
+    streaming_ = true;
+
+    return true;
+}
+
+void Feather::stop_streaming() {
+    if (!streaming_) {
+        return;
+    }
+
+    cancel_repeating_timer(&telemetry_timer_);
+    streaming_ = false;
+
+    // Drop samples that were not sent yet
+    TelemetrySample sample;
+    while (queue_try_remove(&telemetry_queue_, &sample)) {
+    }
+}
+
+bool Feather::set_stream_rate(uint16_t rate_hz) {
+    if (rate_hz < STREAM_RATE_MIN_HZ || rate_hz > STREAM_RATE_MAX_HZ) {
+        return false;
+    }
+    stream_rate_hz_ = rate_hz;
+
+    // Restart the timer with the new period
+    if (streaming_) {
+        stop_streaming();
+        return start_streaming();
+    }
+
+    return true;
+}
+
+bool Feather::telemetry_timer_callback(repeating_timer_t* rt) {
+    Feather* feather = static_cast<Feather*>(rt->user_data);
+    uint32_t start_cycles = instrumentation_start();
+    uint64_t now_us = time_us_64();
+    TelemetrySample sample;
+
+    // More than half a period late
+    uint64_t period_us = 1000000 / feather->stream_rate_hz_;
+    if (feather->telemetry_last_us_ != 0 && (now_us - feather->telemetry_last_us_) > period_us + period_us / 2) {
+        instrumentation_count(InstrumentationEvent::TELEMETRY_LATE);
+    }
+    feather->telemetry_last_us_ = now_us;
+
+    // Capture the sensors at the timer tick on core1; core0 sends the frame
+    sample.seq = feather->telemetry_seq_++;
+    feather->capture_snapshot(&sample.snapshot);
+
+    // Attitude and pose are only updated by the acquisition loop. This may
+    // have interrupted it publishing them, in which case the last ones stand
+    SensorSnapshot published;
+    if (feather->snapshot_.try_read(&published)) {
+        feather->telemetry_orientation_ = published.orientation;
+        feather->telemetry_pose_ = published.pose;
+    }
+    sample.snapshot.orientation = feather->telemetry_orientation_;
+    sample.snapshot.pose = feather->telemetry_pose_;
+
+    // If core0 falls behind the sample is dropped, leaving a gap in the sequence
+    if (!queue_try_add(&feather->telemetry_queue_, &sample)) {
+        instrumentation_count(InstrumentationEvent::TELEMETRY_DROPPED);
+    }
+
+    instrumentation_record(Probe::TELEMETRY_TIMER, start_cycles);
+
+    return true; // Keep repeating
+}
+
+void Feather::process_telemetry() {
+    TelemetrySample sample;
+    uint8_t payload[TELEMETRY_PAYLOAD_LENGTH];
+    uint8_t delta[TELEMETRY_DELTA_MAX_LENGTH];
+
+    // A few samples per pass; the rest wait in the queue (or the timer drops them)
+    reply_interface_ = telemetry_interface_;
+    for (uint32_t sent = 0; sent < TELEMETRY_MAX_FRAMES_PER_PASS && queue_try_remove(&telemetry_queue_, &sample);
+         sent++) {
+        // Sensor state and timestamps from the timer tick
+        fill_all_sensors(payload, sample.snapshot);
+
+        // Deltas need the previous sample; a dropped one forces a keyframe
+        bool keyframe = stream_encoding_ == STREAM_ENCODING_RAW || keyframe_due_ ||
+                        sample.seq != (uint16_t)(previous_telemetry_seq_ + 1) ||
+                        frames_since_keyframe_ + 1 >= keyframe_interval_;
+        bool written;
+        if (keyframe) {
+            written = try_send_frame(MSG_TELEMETRY, sample.seq, payload, sizeof(payload));
+        } else {
+            size_t length = encode_telemetry_delta(previous_telemetry_, payload, delta);
+            written = try_send_frame(MSG_TELEMETRY_DELTA, sample.seq, delta, length);
+        }
+
+        // Never wait for a host that is not reading; the gap makes the next sample a keyframe
+        if (!written) {
+            instrumentation_count(InstrumentationEvent::TELEMETRY_USB_FULL);
+            continue;
+        }
+
+        if (keyframe) {
+            frames_since_keyframe_ = 0;
+            keyframe_due_ = false;
+        } else {
+            frames_since_keyframe_++;
+        }
+
+        memcpy(previous_telemetry_, payload, sizeof(payload));
+        previous_telemetry_seq_ = sample.seq;
+    }
+
+    // Samples that piled up share one transfer
+    usb_flush();
 }
 
 /**
- * @brief Handle GPIO interrupts and delegate them to the correct encoder.
+ * @brief Handle GPIO interrupts and delegate them to the correct encoder or the IMU.
  * @param gpio GPIO pin that triggered the interrupt.
  * @param events Event flags associated with the interrupt.
  */
 void Feather::gpio_callback(uint gpio, uint32_t events) {
-    if (gpio == ENCODER1_PIN_A || gpio == ENCODER1_PIN_B) {
-        feather_instance_->encoder1_.handle_interrupt(gpio, events);
-    } else if (gpio == ENCODER2_PIN_A || gpio == ENCODER2_PIN_B) {
-        feather_instance_->encoder2_.handle_interrupt(gpio, events);
+    uint32_t start_cycles = instrumentation_start();
+
+    if (FeatherEncoderBank::owns_pin(gpio)) {
+        // Decodes every encoder that changed, not just the one on gpio
+        feather_instance_->encoder_sequence_.begin_write();
+        feather_instance_->encoders_.handle_interrupt(gpio, events);
+        feather_instance_->encoder_sequence_.end_write();
+        instrumentation_record(Probe::ENCODER_ISR, start_cycles);
+    } else if (gpio == IMU_INT_PIN) {
+        feather_instance_->imu_.handle_data_ready();
+        instrumentation_record(Probe::IMU_DATA_READY_ISR, start_cycles);
     }
 }
@@ -1,16 +1,185 @@
 #ifndef FEATHER_HPP
 #define FEATHER_HPP
 
-#include "encoder.hpp"
+#include "encoder_bank.hpp"
 #include "imu.hpp"
+#include "ahrs.hpp"
+#include "odometry.hpp"
+#include "motor.hpp"
+#include "protocol.hpp"
+#include "seqlock.hpp"
+#include "history.hpp"
+#include "persistence.hpp"
+#include "instrumentation.hpp"
+
+// Pico Libraries
+#include "pico/util/queue.h"
 
 // Command Bytes for Feather Operations
-#define INITIALIZE_SENSORS_BYTE 0x49 // 'I'
+#define INITIALIZE_SENSORS_BYTE 0x49 // 'I', old start handshake; swallowed if it is the first legacy byte
 #define RESET_SENSORS_BYTE 0x5A // 'Z'
 
+// USB receive chunk size
+#define USB_RX_CHUNK_LENGTH 64
+
+// A USB write that makes no progress for this long is dropped (the host
+// stopped reading)
+#define USB_WRITE_TIMEOUT_US 10000
+
+// Telemetry streaming
+#define STREAM_RATE_MIN_HZ 100
+#define STREAM_RATE_MAX_HZ 2000
+#define STREAM_RATE_DEFAULT_HZ 500
+#define TELEMETRY_QUEUE_LENGTH 32 // Samples buffered between the timer and the main loop
+#define TELEMETRY_MAX_FRAMES_PER_PASS 8 // Samples sent per main loop pass, so requests are not starved
+
+// Sample history the host can fetch after a stall (MSG_GET_HISTORY). Build
+// with FEATHER_HISTORY_MS to keep more or less; each sample takes 48 bytes
+#ifndef FEATHER_HISTORY_MS
+#define FEATHER_HISTORY_MS 1000
+#endif
+#define HISTORY_RATE_HZ 1000
+#define HISTORY_LENGTH (FEATHER_HISTORY_MS * HISTORY_RATE_HZ / 1000)
+
+// Warm restarts: the state below is saved with every odometry update to be
+// picked up again after any reset that keeps RAM. Build with
+// FEATHER_WATCHDOG_MS (e.g. 500) to also have the watchdog reset the board
+// if either core stops making progress for that long; it is off by default
+#ifndef FEATHER_WATCHDOG_MS
+#define FEATHER_WATCHDOG_MS 0
+#endif
+#define WARM_RESTART_VERSION 1 // Bump when WarmRestartState changes
+
+// The odometry fuses the gyro only while its latest sample is at most this
+// many IMU sample periods older than the encoder capture
+#define ODOMETRY_GYRO_MAX_AGE_PERIODS 2
+
+// Core1 acquisition
+#define ACQUISITION_COMMAND_QUEUE_LENGTH 4
+#define ACQUISITION_ALARM_POOL_TIMERS 4
+#define ACQUISITION_READY_FLAG 0xFEA7E001 // Pushed through the multicore FIFO once core1 is running
+
+// Wheel encoders as (A, B) pin pairs: left motor, right motor
+typedef EncoderBank<ENCODER1_PIN_A, ENCODER1_PIN_B, ENCODER2_PIN_A, ENCODER2_PIN_B> FeatherEncoderBank;
+
+/**
+ * @brief All encoder positions at one instant.
+ */
+struct EncoderSnapshot {
+    uint64_t timestamp_us; // Capture time in us since boot.
+    int32_t positions[FeatherEncoderBank::ENCODER_COUNT]; // Encoder positions at timestamp_us.
+};
+
+/**
+ * @brief Sensor state captured at one instant on the acquisition core.
+ */
+struct SensorSnapshot {
+    EncoderSnapshot encoders; // Encoder positions and the capture time.
+    int32_t speeds[FeatherEncoderBank::ENCODER_COUNT]; // Encoder speeds in sub-steps per second.
+    int32_t substep_positions[FeatherEncoderBank::ENCODER_COUNT]; // Encoder positions in sub-steps.
+    uint32_t illegal_transitions[FeatherEncoderBank::ENCODER_COUNT]; // Encoder illegal transition counts.
+    IMUSample imu; // Latest complete IMU sample.
+    AHRSState orientation; // Attitude estimate after fusing the latest IMU sample.
+    OdometryState pose; // Dead reckoned pose at the last odometry update.
+    int32_t speed_setpoints[FeatherEncoderBank::ENCODER_COUNT]; // Wheel speed setpoints in sub-steps per second.
+    float motor_duty[FeatherEncoderBank::ENCODER_COUNT]; // Motor outputs (0 while coasting).
+    IMUStatus imu_status; // IMU start-up progress.
+    IMUConfig imu_config; // IMU ranges, filter and sample rate the sample was taken with.
+};
+
+/**
+ * @brief Encoder and IMU state kept in the sample history.
+ */
+struct HistorySample {
+    EncoderSnapshot encoders; // Encoder positions and the capture time.
+    IMUSample imu; // Latest complete IMU sample at the capture time.
+};
+
+/**
+ * @brief Snapshot captured by the telemetry timer.
+ */
+struct TelemetrySample {
+    uint16_t seq; // Telemetry sequence number.
+    SensorSnapshot snapshot; // Sensor state at the timer tick.
+};
+
+/**
+ * @brief USB interfaces carrying protocol traffic.
+ */
+enum class UsbInterface : uint8_t {
+    CDC,   // Serial port shared with stdio: legacy bytes, or frames after FRAMED_MODE_BYTE.
+    VENDOR // Vendor bulk interface: frames only, never written by stdio.
+};
+
+/**
+ * @brief Link settings core0 owns, handed to core1 to be saved for a warm restart.
+ */
+struct LinkState {
+    UsbInterface telemetry_interface; // Interface the telemetry goes to.
+    uint8_t stream_encoding; // STREAM_ENCODING_* of the telemetry frames.
+    uint16_t keyframe_interval; // Frames per keyframe in delta encoding.
+    bool framed_mode; // Set if CDC switched to framed mode.
+    bool legacy_link_started; // Set if the legacy link started.
+    bool stream_resume_pending; // Set while a restored stream waits for its host.
+};
+
+/**
+ * @brief State saved with every odometry update and restored after a warm restart.
+ *
+ * Motor setpoints are left out on purpose: the wheels coast after any reset
+ * until the host commands them again.
+ */
+struct WarmRestartState {
+    uint32_t version; // WARM_RESTART_VERSION.
+    uint32_t restarts; // Warm restarts since the last cold boot.
+    int32_t positions[FeatherEncoderBank::ENCODER_COUNT]; // Encoder positions the pose was computed at.
+    OdometryState pose; // Dead reckoned pose.
+    OdometryConfig odometry_config; // Odometry geometry and gyro fusion.
+    IMUConfig imu_config; // IMU ranges, filter and sample rate.
+    bool streaming; // Set if telemetry was streaming.
+    uint16_t stream_rate_hz; // Telemetry rate.
+    UsbInterface telemetry_interface; // Interface the telemetry went to.
+    uint8_t stream_encoding; // STREAM_ENCODING_* of the telemetry frames.
+    uint16_t keyframe_interval; // Frames per keyframe in delta encoding.
+    bool framed_mode; // Set if CDC had switched to framed mode.
+    bool legacy_link_started; // Set if the legacy link had started (no 'I' handshake to swallow).
+};
+
+static_assert(sizeof(WarmRestartState) <= PERSISTENCE_MAX_LENGTH, "Warm restart state does not fit a persistence slot");
+
+/**
+ * @brief Commands run on the acquisition core on behalf of the USB core.
+ */
+enum class AcquisitionCommandType : uint8_t {
+    RESET_SENSORS,
+    START_STREAM,
+    STOP_STREAM,
+    SET_STREAM_RATE,  // arg: rate in Hz
+    SET_IMU_FIFO_MODE, // arg: enable
+    SET_ODOMETRY_CONFIG, // data: OdometryConfig
+    SET_WHEEL_SPEEDS, // data: int32_t setpoint per wheel
+    SET_MOTOR_GAINS, // data: VelocityPIDGains
+    SET_IMU_CONFIG, // data: IMUConfig
+    SET_LINK_STATE // data: LinkState
+};
+
+/**
+ * @brief A command queued from core0 to core1.
+ */
+struct AcquisitionCommand {
+    AcquisitionCommandType type; // Command to run.
+    uint32_t arg; // Command argument.
+    const void* data; // Command data (core0 waits for the result, so it may be on its stack).
+};
+
 /**
  * @class Feather
  * @brief Manages the Feather's components
+ *
+ * Core1 owns the sensors: encoder and IMU interrupts, velocity updates, the
+ * attitude filter, odometry, the wheel speed loop and the telemetry timer all run there, and every loop pass publishes a
+ * SensorSnapshot through a seqlock. Core0 only handles USB; it reads
+ * snapshots and queues commands that change sensor state to core1.
  */
 class Feather {
     public:
@@ -21,35 +190,398 @@ class Feather {
 
         /**
          * @brief Initialize the robot's components (encoders, IMU, etc.).
+         *
+         * Launches the acquisition loop on core1 and returns once it runs.
+         * After a warm restart the encoder counts, pose, configuration and
+         * telemetry stream carry on from the saved state.
          */
         void initializeFeather();
 
         /**
-         * @brief Reset the sensor values (encoders, IMU, etc.).
+         * @brief Reset the sensor values (encoders, IMU, etc.). Core1 only.
          */
         void resetFeather();
 
+        /**
+         * @brief Copy the latest sensor snapshot published by core1.
+         * @return SensorSnapshot The snapshot.
+         */
+        SensorSnapshot get_snapshot() const;
+
+        /**
+         * @brief Copy the latest encoder positions and their capture time.
+         *
+         * All positions are read between the same two encoder sequence
+         * values, so no encoder interrupt ran between them.
+         *
+         * @return EncoderSnapshot The encoder snapshot.
+         */
+        EncoderSnapshot get_encoder_snapshot() const;
+
         /**
          * @brief Process usb command words and return apporpriate responses.
+         *
+         * Frames on the vendor interface are always handled and answered
+         * there. On CDC, single byte commands are handled until
+         * FRAMED_MODE_BYTE is received, after which all received bytes are
+         * parsed as protocol frames.
+         *
+         * Every command received so far is handled in one call, and the
+         * responses are flushed together at the end, so commands the host
+         * pipelines cost one USB transfer per interface instead of one each.
          */
         void process_usb_communication();
 
+        /**
+         * @brief Update the encoder speed estimates every VELOCITY_SAMPLE_PERIOD_US. Core1 only.
+         */
+        void update_velocities();
+
+        /**
+         * @brief Add a snapshot to the sample history at HISTORY_RATE_HZ. Core1 only.
+         * @param snapshot The snapshot just captured.
+         */
+        void record_history(const SensorSnapshot& snapshot);
+
+        /**
+         * @brief Start pushing telemetry frames at the configured rate. Core1 only.
+         * @return true if the sampling timer was started.
+         */
+        bool start_streaming();
+
+        /**
+         * @brief Stop pushing telemetry frames. Core1 only.
+         */
+        void stop_streaming();
+
+        /**
+         * @brief Set the telemetry rate, restarting the timer if streaming. Core1 only.
+         * @param rate_hz The rate in Hz (STREAM_RATE_MIN_HZ to STREAM_RATE_MAX_HZ).
+         * @return true if the rate is valid and was applied.
+         */
+        bool set_stream_rate(uint16_t rate_hz);
+
+        /**
+         * @brief Send a telemetry frame for every sample captured by the timer.
+         *
+         * Frames go to the interface that started the stream. In
+         * STREAM_ENCODING_DELTA, samples between keyframes are sent as
+         * MSG_TELEMETRY_DELTA against the previous sample.
+         */
+        void process_telemetry();
+
         /**
          * @brief Handles the usb communication in an infinite loop.
          */
         void loop();
 
+        /**
+         * @brief Run a command on core1 and wait for its result. Core0 only.
+         * @param type The command.
+         * @param arg The command argument.
+         * @param data The command data, for commands that take more than arg.
+         * @return true if the command succeeded.
+         */
+        bool run_acquisition_command(AcquisitionCommandType type, uint32_t arg, const void* data = nullptr);
+
+        /**
+         * @brief Get the link settings core0 owns. Core0 only.
+         * @return LinkState The current settings.
+         */
+        LinkState get_link_state() const;
+
+        /**
+         * @brief Hand the link settings to core1 after one changed. Core0 only.
+         */
+        void send_link_state();
+
     private:
+        /**
+         * @brief Core1 entry point.
+         */
+        static void core1_entry();
+
+        /**
+         * @brief Initialize the sensors and their interrupts on core1.
+         */
+        void initialize_acquisition();
+
+        /**
+         * @brief Core1 loop: sample sensors, publish snapshots and run commands.
+         */
+        void acquisition_loop();
+
+        /**
+         * @brief Run queued commands from core0. Core1 only.
+         */
+        void process_acquisition_commands();
+
+        /**
+         * @brief Apply the state restored at boot to the sensors and stream. Core1 only.
+         */
+        void restore_warm_restart_state();
+
+        /**
+         * @brief Save the state to pick up after a warm restart. Core1 only.
+         *
+         * Link settings come from the last LinkState core0 sent with
+         * SET_LINK_STATE, never from core0's members.
+         *
+         * @param snapshot The snapshot whose pose was just updated.
+         */
+        void save_warm_restart_state(const SensorSnapshot& snapshot);
+
+        /**
+         * @brief Capture the current sensor state. Core1 only.
+         *
+         * Leaves the orientation and pose, which only the acquisition loop
+         * updates, to update_attitude() and update_odometry().
+         *
+         * @param snapshot The snapshot to fill.
+         */
+        void capture_snapshot(SensorSnapshot* snapshot);
+
+        /**
+         * @brief Set the wheel speed setpoints and start the speed loop. Core1 only.
+         * @param setpoints The setpoint of each wheel in sub-steps per second.
+         */
+        void set_wheel_speeds(const int32_t* setpoints);
+
+        /**
+         * @brief Set the gains of every wheel speed controller. Core1 only.
+         * @param gains The gains.
+         * @return true if the gains are valid and were applied.
+         */
+        bool set_motor_gains(const VelocityPIDGains& gains);
+
+        /**
+         * @brief Reconfigure the IMU and rescale the filters that read it. Core1 only.
+         * @param config The configuration.
+         * @return true if the configuration is valid and was applied.
+         */
+        bool set_imu_config(const IMUConfig& config);
+
+        /**
+         * @brief Let the motors coast until the next setpoint. Core1 only.
+         */
+        void stop_motors();
+
+        /**
+         * @brief Repeating timer callback running the wheel speed controllers.
+         */
+        static bool motor_timer_callback(repeating_timer_t* rt);
+
+        /**
+         * @brief Fuse a new IMU sample into the attitude estimate. Acquisition loop only.
+         * @param snapshot The snapshot just captured; its orientation is set.
+         */
+        void update_attitude(SensorSnapshot* snapshot);
+
+        /**
+         * @brief Advance the odometry every ODOMETRY_UPDATE_PERIOD_US. Core1 only.
+         * @param snapshot The snapshot just captured; its pose is set.
+         */
+        void update_odometry(SensorSnapshot* snapshot);
+
+        /**
+         * @brief Capture all encoder positions at one instant. Core1 only.
+         *
+         * Retries if an encoder interrupt updated a position during the read.
+         *
+         * @param snapshot The encoder snapshot to fill.
+         */
+        void capture_encoders(EncoderSnapshot* snapshot);
+
         /**
          * @brief Handle GPIO interrupts and delegate them to the correct encoder.
          */
         static void gpio_callback(uint gpio, uint32_t events);
+
+        /**
+         * @brief Repeating timer callback capturing a telemetry sample.
+         */
+        static bool telemetry_timer_callback(repeating_timer_t* rt);
+
+        /**
+         * @brief Send an error frame.
+         * @param type The request type that failed.
+         * @param seq The request sequence number.
+         * @param error_code The PROTOCOL_ERROR_* code.
+         */
+        void send_error(uint8_t type, uint16_t seq, uint8_t error_code);
+
+        /**
+         * @brief Feed received bytes to the frame parser and handle complete frames.
+         * @param interface The interface to read; responses are sent back on it.
+         */
+        void process_framed_communication(UsbInterface interface);
+
+        /**
+         * @brief Handle every received single byte command on CDC.
+         *
+         * Bytes after FRAMED_MODE_BYTE in the same read are parsed as frames.
+         */
+        void process_legacy_communication();
+
+        /**
+         * @brief Handle one single byte command, queueing its response.
+         * @param recievedByte The command byte.
+         */
+        void handle_legacy_command(uint8_t recievedByte);
+
+        /**
+         * @brief Push bytes through an interface's frame parser and handle complete frames.
+         * @param interface The interface the bytes came from; responses are sent back on it.
+         * @param data The received bytes.
+         * @param length The number of bytes.
+         */
+        void parse_frames(UsbInterface interface, const uint8_t* data, uint32_t length);
+
+        /**
+         * @brief Read received bytes from a USB interface.
+         * @return uint32_t The number of bytes read.
+         */
+        uint32_t usb_read(UsbInterface interface, uint8_t* buffer, uint32_t length);
+
+        /**
+         * @brief Write bytes to a USB interface.
+         *
+         * Writes are queued so that several responses share a transfer;
+         * usb_flush() sends them. A full FIFO is flushed early.
+         */
+        void usb_write(UsbInterface interface, const uint8_t* data, uint32_t length);
+
+        /**
+         * @brief Queue bytes on a USB interface only if the FIFO has room for all of them.
+         *
+         * Never waits, for data that is better lost than late (telemetry).
+         *
+         * @return true if the bytes were queued.
+         */
+        bool usb_try_write(UsbInterface interface, const uint8_t* data, uint32_t length);
+
+        /**
+         * @brief Send the bytes queued on each interface.
+         */
+        void usb_flush();
+
+        /**
+         * @brief Handle a decoded request frame and send its response.
+         * @param frame The request frame.
+         */
+        void handle_frame(const Frame& frame);
+
+        /**
+         * @brief Encode a frame and write it to the interface being answered.
+         *
+         * A payload over PROTOCOL_MAX_PAYLOAD is answered with
+         * PROTOCOL_ERROR_BAD_LENGTH instead.
+         *
+         * @param type The message type.
+         * @param seq The sequence number.
+         * @param payload The payload data.
+         * @param length The payload length.
+         */
+        void send_frame(uint8_t type, uint16_t seq, const uint8_t* payload, uint16_t length);
+
+        /**
+         * @brief Encode a frame and write it to the interface being answered if it fits right away.
+         * @return true if the frame was queued, false if the FIFO was full or the payload too long.
+         */
+        bool try_send_frame(uint8_t type, uint16_t seq, const uint8_t* payload, uint16_t length);
+
+        /**
+         * @brief Send an IMU configuration with its scale factors.
+         * @param type The response type.
+         * @param seq The request sequence number.
+         * @param config The configuration.
+         */
+        void send_imu_config(uint8_t type, uint16_t seq, const IMUConfig& config);
+
+        /**
+         * @brief Send history samples from a sequence on, in as many frames as needed.
+         *
+         * Every frame answers the request (same seq) and all but the last
+         * have their more flag set.
+         *
+         * @param seq The request sequence number.
+         * @param since The first sample sequence wanted.
+         * @param max_samples The maximum number of samples to send (0 for all).
+         */
+        void send_history(uint16_t seq, uint32_t since, uint16_t max_samples);
+
+        /**
+         * @brief Send the oldest buffered IMU FIFO samples.
+         * @param seq The request sequence number.
+         */
+        void send_imu_fifo(uint16_t seq);
+
+        /**
+         * @brief Fill a buffer with the combined sensor payload.
+         * @param buffer The buffer (at least ALL_SENSORS_PAYLOAD_LENGTH bytes).
+         * @param snapshot The sensor state to encode.
+         */
+        void fill_all_sensors(uint8_t* buffer, const SensorSnapshot& snapshot);
         
         static Feather* feather_instance_; // Static pointer to the current instance of the Feather class.
         
-        Encoder encoder1_; // Encoder object for the first encoder (left motor).
-        Encoder encoder2_; // Encoder object for the second encoder (right motor).
+        FeatherEncoderBank encoders_; // Wheel encoders, decoded together on one GPIO read.
         IMU imu_; // IMU object for reading IMU data.
+        AHRS ahrs_; // Attitude filter fed every new IMU sample (core1 only).
+        Odometry odometry_; // Wheel and gyro dead reckoning (core1 only).
+        Motor motors_[FeatherEncoderBank::ENCODER_COUNT]; // Wheel motors, in encoder order.
+        VelocityPID speed_controllers_[FeatherEncoderBank::ENCODER_COUNT]; // Wheel speed controllers (motor timer only).
+
+        uint32_t last_velocity_update_us_; // Time of the last encoder speed update.
+        uint32_t last_odometry_update_us_; // Time of the last odometry update.
+        uint32_t last_history_us_; // Time of the last history sample.
+        SampleHistory<HistorySample, HISTORY_LENGTH> history_; // Recent samples for the host to catch up on.
+
+        bool warm_restart_; // Set if this boot restored a saved state.
+        WarmRestartState warm_restart_state_; // State restored at boot, then the state being saved (core1).
+        LinkState saved_link_state_; // Link settings last sent by core0, saved with the state (core1 only).
+        uint32_t warm_restarts_; // Warm restarts since the last cold boot, for MSG_GET_STATUS (core0 only).
+        volatile uint32_t acquisition_passes_; // Core1 loop passes, for the watchdog on core0.
+        uint32_t watchdog_passes_; // acquisition_passes_ at the last watchdog update (core0 only).
+
+        bool legacy_link_started_; // Set once the first legacy byte has been read.
+        bool framed_mode_; // Set once the host switches the link to framed mode.
+        FrameParser parser_; // Frame parser for CDC bytes (framed mode).
+        FrameParser vendor_parser_; // Frame parser for vendor interface bytes.
+        UsbInterface reply_interface_; // Interface of the request being handled.
+        UsbInterface telemetry_interface_; // Interface that started the telemetry stream.
+        bool tx_pending_[2]; // Set per UsbInterface while bytes are queued but not flushed.
+        uint64_t rx_time_us_; // Time the bytes of the frame being handled were read from USB.
+        uint8_t tx_buffer_[PROTOCOL_MAX_ENCODED_FRAME]; // Encoded frame being sent.
+        uint8_t payload_buffer_[PROTOCOL_MAX_PAYLOAD]; // Payload of large responses.
+
+        bool streaming_; // Set while the telemetry timer is running.
+        bool stream_resume_pending_; // Restored stream waiting for its host to send a frame (core0 only).
+        uint16_t stream_rate_hz_; // Telemetry rate.
+        uint16_t telemetry_seq_; // Sequence number of the next telemetry sample (timer only).
+        uint64_t telemetry_last_us_; // Time of the last telemetry callback (timer only).
+        AHRSState telemetry_orientation_; // Last orientation the timer read from snapshot_ (timer only).
+        OdometryState telemetry_pose_; // Last pose the timer read from snapshot_ (timer only).
+        repeating_timer_t telemetry_timer_; // Telemetry sampling timer.
+        queue_t telemetry_queue_; // Samples from the timer to the main loop.
+        uint8_t stream_encoding_; // STREAM_ENCODING_* of the telemetry frames (core0 only).
+        uint16_t keyframe_interval_; // Frames per keyframe in delta encoding (core0 only).
+        uint16_t frames_since_keyframe_; // Delta frames sent since the last keyframe (core0 only).
+        bool keyframe_due_; // Set when the next frame must be a keyframe (core0 only).
+        uint16_t previous_telemetry_seq_; // Sequence of previous_telemetry_ (core0 only).
+        uint8_t previous_telemetry_[TELEMETRY_PAYLOAD_LENGTH]; // Last telemetry payload sent, for deltas (core0 only).
+
+        int32_t speed_setpoints_[FeatherEncoderBank::ENCODER_COUNT]; // Wheel speed setpoints in sub-steps per second.
+        bool motors_active_; // Set while the speed loop drives the motors.
+        uint64_t setpoint_us_; // Time of the last setpoint.
+        uint64_t motor_last_us_; // Time of the last motor timer callback (timer only).
+        repeating_timer_t motor_timer_; // Wheel speed loop timer.
+
+        alarm_pool_t* acquisition_alarm_pool_; // Alarm pool firing on core1.
+        Seqlock<SensorSnapshot> snapshot_; // Latest snapshot from core1.
+        SequenceCounter encoder_sequence_; // Odd while an encoder interrupt updates a position.
+        queue_t command_queue_; // Commands from core0 to core1.
+        queue_t command_result_queue_; // Command results from core1 to core0.
 };
 
 #endif // FEATHER_HPP
@@ -0,0 +1,123 @@
+// history.hpp
+// Carson Powers
+// Header file for the single writer sample history ring used to let the host catch up after stalls on the AHSR robot
+
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+// Standard Libraries
+#include <cstdint>
+#include <cstddef>
+
+// Pico Libraries
+#include "hardware/sync.h"
+
+#define HISTORY_SEQ_WRITING 0xFFFFFFFF // Slot sequence while the writer is replacing it
+
+/**
+ * @class SampleHistory
+ * @brief Keeps the last Length samples, numbered by a sequence, for lock-free bulk reads.
+ *
+ * The writer numbers every pushed sample. Each slot holds its sample's
+ * sequence, which the writer invalidates before overwriting the slot and sets
+ * again after. Readers copy a slot and keep it only if the slot held the
+ * expected sequence before and after the copy, so they never block the
+ * writer and never return a torn or overwritten sample. Only one core (or
+ * context) may call push().
+ *
+ * @tparam T A trivially copyable sample type.
+ * @tparam Length The number of samples kept.
+ */
+template <typename T, size_t Length>
+class SampleHistory {
+    public:
+        SampleHistory() : next_seq_(0), slots_() {}
+
+        /**
+         * @brief Store a sample, replacing the oldest (single writer only).
+         * @param sample The sample.
+         */
+        void push(const T& sample) {
+            uint32_t seq = next_seq_;
+            Slot& slot = slots_[seq % Length];
+
+            slot.seq = HISTORY_SEQ_WRITING;
+            __dmb();
+            slot.sample = sample;
+            __dmb();
+            slot.seq = seq;
+            __dmb();
+            next_seq_ = seq + 1;
+        }
+
+        /**
+         * @brief Get the sequence the next sample will get.
+         * @return uint32_t The number of samples pushed so far.
+         */
+        uint32_t get_next_seq() const {
+            return next_seq_;
+        }
+
+        /**
+         * @brief Copy consecutive samples starting at a sequence.
+         *
+         * Samples older than the ring are gone, so the copy then starts at the
+         * oldest sample still held; *first_seq tells the caller where.
+         *
+         * @param seq The first sequence wanted.
+         * @param samples The samples to fill.
+         * @param max_samples The maximum number of samples to copy.
+         * @param first_seq Set to the sequence of samples[0].
+         * @return size_t The number of samples copied.
+         */
+        size_t read(uint32_t seq, T* samples, size_t max_samples, uint32_t* first_seq) const {
+            size_t count = 0;
+
+            while (count < max_samples) {
+                uint32_t next = next_seq_;
+                __dmb();
+
+                // Skip what has been overwritten (sequences wrap, so compare distances)
+                if ((uint32_t)(next - seq) > Length) {
+                    seq = next - Length;
+                    count = 0;
+                }
+                if (seq + count == next) {
+                    break;
+                }
+
+                uint32_t expected = seq + count;
+                const Slot& slot = slots_[expected % Length];
+                uint32_t before = slot.seq;
+                __dmb();
+                samples[count] = slot.sample;
+                __dmb();
+                if (before != expected || slot.seq != expected) {
+                    // Overwritten while copying; keep what is consecutive
+                    if (count > 0) {
+                        break;
+                    }
+                    seq = expected + 1;
+                    continue;
+                }
+                count++;
+            }
+            *first_seq = seq;
+
+            return count;
+        }
+
+    private:
+        /**
+         * @brief A sample and the sequence it was pushed with.
+         */
+        struct Slot {
+            volatile uint32_t seq; // HISTORY_SEQ_WRITING while being replaced.
+            T sample; // Stored sample.
+        };
+
+        volatile uint32_t next_seq_; // Sequence of the next push.
+        Slot slots_[Length]; // Ring of the last Length samples.
+};
+
+#endif // HISTORY_HPP
@@ -0,0 +1,189 @@
+// feather_pty.cpp
+// Carson Powers
+// Pseudo terminal device simulator for the Feather firmware on the AHSR robot
+//
+// Runs the firmware sources against the mocks in host/include, as
+// feather_sim does, but hands the mocked CDC interface to a pseudo terminal
+// so host software (client/feather_bench, or anything that opens the robot's
+// /dev/ttyACM port) can talk to it like the real board. The vendor interface
+// is not connected.
+//
+// Usage: feather_pty [--link PATH] [--edge-rate N]
+//
+// The terminal's path is printed on stdout and, with --link, also made
+// available as a symlink at PATH once the firmware is up. --edge-rate turns
+// both wheels at N quadrature steps per second (the left one forwards, the
+// right one backwards) so the encoder fields change.
+
+// Firmware Headers
+#include "feather.hpp"
+#include "encoder.hpp"
+
+// Simulation Controls
+#include "sim.hpp"
+
+// Standard Libraries
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// POSIX
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define PTY_READ_CHUNK_LENGTH 4096
+#define PTY_POLL_TIMEOUT_NS 20000 // Latency added to each direction at most
+#define PTY_MAX_PENDING_LENGTH 65536 // Unread bytes kept for a slow client before they are dropped
+
+// Symlink to remove on exit
+static const char* link_path = nullptr;
+
+static void handle_signal(int signal) {
+    if (link_path) {
+        unlink(link_path);
+    }
+    _Exit(128 + signal);
+}
+
+/**
+ * @brief Open a pseudo terminal pair in raw mode.
+ * @param slave_fd Set to an open descriptor of the slave, which keeps the pair up while clients come and go.
+ * @param slave_path Set to the path clients open.
+ * @return int The master descriptor, or -1 on failure.
+ */
+static int open_pty(int* slave_fd, std::string* slave_path) {
+    int master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd < 0 || grantpt(master_fd) != 0 || unlockpt(master_fd) != 0) {
+        return -1;
+    }
+
+    *slave_path = ptsname(master_fd);
+    *slave_fd = open(slave_path->c_str(), O_RDWR | O_NOCTTY);
+    if (*slave_fd < 0) {
+        return -1;
+    }
+
+    // Never block the pump on a full terminal when no client is reading
+    fcntl(master_fd, F_SETFL, fcntl(master_fd, F_GETFL) | O_NONBLOCK);
+
+    // Bytes pass unchanged, as on the USB port
+    struct termios tio;
+    tcgetattr(*slave_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(*slave_fd, TCSANOW, &tio);
+
+    return master_fd;
+}
+
+/**
+ * @brief Move bytes between the pseudo terminal and the mocked CDC interface.
+ */
+static void run_pump(int master_fd) {
+    uint8_t buffer[PTY_READ_CHUNK_LENGTH];
+    struct pollfd fds = {master_fd, POLLIN, 0};
+    const struct timespec timeout = {0, PTY_POLL_TIMEOUT_NS};
+    std::vector<uint8_t> pending;
+
+    while (true) {
+        if (ppoll(&fds, 1, &timeout, nullptr) > 0 && (fds.revents & POLLIN)) {
+            ssize_t count = read(master_fd, buffer, sizeof(buffer));
+            if (count > 0) {
+                sim_usb_receive(buffer, (size_t)count);
+            }
+        }
+
+        std::vector<uint8_t> data = sim_usb_take_transmitted();
+        pending.insert(pending.end(), data.begin(), data.end());
+        if (pending.empty()) {
+            continue;
+        }
+
+        ssize_t count = write(master_fd, pending.data(), pending.size());
+        if (count > 0) {
+            pending.erase(pending.begin(), pending.begin() + count);
+        }
+
+        // Nobody is reading: drop the bytes like an unopened port
+        if (pending.size() > PTY_MAX_PENDING_LENGTH) {
+            pending.clear();
+        }
+    }
+}
+
+/**
+ * @brief Turn both wheels at a steady rate.
+ * @param steps_per_second Quadrature steps per second.
+ */
+static void run_wheels(uint32_t steps_per_second) {
+    // Cycle order when A leads B: 00, 01, 11, 10
+    static const uint8_t cycle[4] = {0, 1, 3, 2};
+    const uint32_t mask = (1u << ENCODER1_PIN_A) | (1u << ENCODER1_PIN_B) | (1u << ENCODER2_PIN_A) |
+                          (1u << ENCODER2_PIN_B);
+    auto period = std::chrono::nanoseconds(1000000000ull / steps_per_second);
+    auto next = std::chrono::steady_clock::now();
+
+    for (uint32_t step = 1;; step++) {
+        uint8_t left = cycle[step & 3];
+        uint8_t right = cycle[(0u - step) & 3];
+        uint32_t values = ((left & 1u) << ENCODER1_PIN_A) | (((left >> 1) & 1u) << ENCODER1_PIN_B) |
+                          ((right & 1u) << ENCODER2_PIN_A) | (((right >> 1) & 1u) << ENCODER2_PIN_B);
+        sim_gpio_set_levels(mask, values);
+
+        next += period;
+        std::this_thread::sleep_until(next);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t edge_rate = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--link") && i + 1 < argc) {
+            link_path = argv[++i];
+        } else if (!strcmp(argv[i], "--edge-rate") && i + 1 < argc) {
+            edge_rate = strtoul(argv[++i], nullptr, 0);
+        } else {
+            fprintf(stderr, "Usage: %s [--link PATH] [--edge-rate N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    int slave_fd;
+    std::string slave_path;
+    int master_fd = open_pty(&slave_fd, &slave_path);
+    if (master_fd < 0) {
+        perror("feather_pty: pseudo terminal");
+        return 1;
+    }
+
+    // Boot the firmware before clients can connect
+    static Feather feather;
+    feather.initializeFeather();
+
+    std::thread(run_pump, master_fd).detach();
+    if (edge_rate > 0) {
+        std::thread(run_wheels, edge_rate).detach();
+    }
+
+    if (link_path) {
+        unlink(link_path);
+        if (symlink(slave_path.c_str(), link_path) != 0) {
+            perror("feather_pty: symlink");
+            return 1;
+        }
+        signal(SIGINT, handle_signal);
+        signal(SIGTERM, handle_signal);
+    }
+    printf("%s\n", slave_path.c_str());
+    fflush(stdout);
+
+    // Core0 main loop, as on the board
+    feather.loop();
+}
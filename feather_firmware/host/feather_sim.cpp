@@ -0,0 +1,1815 @@
+// feather_sim.cpp
+// Carson Powers
+// Host simulation and benchmark harness for the Feather firmware on the AHSR robot
+//
+// Runs the firmware sources against the mocks in host/include: core1 is a
+// host thread, GPIO edges and MPU6050 registers are set from here, and USB
+// bytes go through mocked TinyUSB CDC and vendor interfaces.
+//
+// Usage: feather_sim [--edges FILE] [--imu FILE] [--irq-batch N] [--iterations N]
+//
+// Edge traces have one line per sample, "time_us enc1_ab enc2_ab", where ab is
+// the pin state (B << 1 | A). Samples are replayed as fast as possible.
+// MPU6050 dumps have one line per sample with the 14 data registers
+// (0x3B - 0x48) as hex bytes. Lines starting with '#' are ignored. Without
+// files, synthetic traces with known answers are used.
+
+// Firmware Headers
+#include "feather.hpp"
+#include "encoder.hpp"
+#include "imu.hpp"
+#include "protocol.hpp"
+#include "ahrs.hpp"
+
+// Simulation Controls
+#include "sim.hpp"
+
+// Standard Libraries
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SIM_DEFAULT_EDGE_SAMPLES 200000
+#define SIM_DEFAULT_IMU_SAMPLES 200
+#define SIM_DEFAULT_ITERATIONS 1000
+#define SIM_ILLEGAL_INTERVAL 9973 // Synthetic traces flip both pins of encoder 1 every this many samples
+#define SIM_SNAPSHOT_SETTLE_MS 20 // Time for core1 to publish after the last edge
+#define SIM_RESPONSE_TIMEOUT_US 100000
+#define SIM_BOOT_TIMEOUT_US 500000 // Time allowed for the IMU start-up to finish
+#define SIM_BOOT_FIRST_SAMPLE_MAX_US 20000 // Boot to first IMU sample budget
+#define SIM_PIPELINED_REQUESTS 16 // Requests sent in one USB write by the batching check
+#define SIM_CLOCK_SYNC_EXCHANGES 200
+#define SIM_CLOCK_SYNC_INTERVAL_US 1000
+#define SIM_CLOCK_SYNC_BEST_FRACTION 4 // Fit the offset through the lowest delay quarter of the exchanges
+#define SIM_CLOCK_SYNC_TOLERANCE_US 50.0
+#define SIM_AHRS_SPIN_MS 500 // Time the simulated gyro turns at SIM_AHRS_SPIN_DPS
+#define SIM_AHRS_SPIN_DPS 90.0
+#define SIM_AHRS_TOLERANCE_DEG 2.0
+#define SIM_ODOMETRY_RADIUS_M 0.05f
+#define SIM_ODOMETRY_BASE_M 0.30f
+#define SIM_ODOMETRY_RIGHT_STEPS 3200 // One right wheel turn; the left wheel turns half as far
+#define SIM_ODOMETRY_STEP_US 50
+#define SIM_ODOMETRY_TOLERANCE_M 0.002
+#define SIM_MOTOR_FULL_SPEED 5000.0 // Plant speed at full duty in counts per second
+#define SIM_MOTOR_TIME_CONSTANT_S 0.03
+#define SIM_MOTOR_PLANT_STEP_US 100
+#define SIM_MOTOR_LEFT_SETPOINT 128000 // Sub-steps per second (2000 counts per second)
+#define SIM_MOTOR_RIGHT_SETPOINT -64000
+#define SIM_MOTOR_SETTLE_MS 600
+#define SIM_MOTOR_SAMPLES 20
+#define SIM_MOTOR_TOLERANCE 0.05 // Relative speed error
+#define SIM_HISTORY_STALL_MS 50 // Host stall the history must cover
+#define SIM_WARM_RESTARTS 2 // Warm restarts in the record the simulation boots from
+#define SIM_WARM_STREAM_RATE_HZ 200
+#define SIM_WARM_GYRO_RANGE 2
+#define SIM_WARM_SILENT_MS 20 // Time the host stays away after the warm boot
+#define SIM_DELTA_ROUND_TRIPS 10000 // Random payload pairs pushed through the delta codec
+#define SIM_DELTA_STREAM_MS 100 // Streaming time per encoding
+#define SIM_DELTA_MAX_RATIO 0.6 // Delta wire bytes per sample relative to raw
+#define SIM_STALL_MS 100 // Time the host stops reading a telemetry stream
+#define SIM_STALL_FIFO_LENGTH 2048 // CFG_TUD_VENDOR_TX_BUFSIZE
+#define SIM_STALL_MIN_PASSES 100 // Main loop passes expected while the FIFO is full (blocked writes allow ~10)
+
+/**
+ * @brief One sample of a two encoder edge trace.
+ */
+struct EdgeSample {
+    uint32_t time_us; // Sample time (informational, replay is not paced).
+    uint8_t states[2]; // Pin state of each encoder (B << 1 | A).
+};
+
+/**
+ * @brief Quadrature reference decoder the firmware is checked against.
+ *
+ * Works from the position of each state in the Gray code cycle rather than
+ * a transition table, so it does not share mistakes with Encoder.
+ */
+struct ReferenceDecoder {
+    uint8_t state;
+    int32_t position;
+    uint32_t illegal;
+
+    void reset(uint8_t initial_state) {
+        state = initial_state;
+        position = 0;
+        illegal = 0;
+    }
+
+    void step(uint8_t next_state) {
+        // Cycle order when A leads B: 00, 01, 11, 10
+        static const uint8_t cycle_index[4] = {0, 1, 3, 2};
+        uint8_t delta = (cycle_index[next_state] - cycle_index[state]) & 3;
+
+        if (delta == 1) {
+            position++;
+        } else if (delta == 3) {
+            position--;
+        } else if (delta == 2) {
+            illegal++;
+        }
+        state = next_state;
+    }
+};
+
+/**
+ * @brief Latency statistics of one command.
+ */
+struct LatencyStats {
+    std::string name;
+    std::vector<double> samples_us;
+    uint32_t failures = 0;
+
+    void print() {
+        if (samples_us.empty()) {
+            printf("  %-28s no samples (%u failed)\n", name.c_str(), failures);
+            return;
+        }
+
+        std::sort(samples_us.begin(), samples_us.end());
+        double sum = 0;
+        for (double sample : samples_us) {
+            sum += sample;
+        }
+
+        size_t n = samples_us.size();
+        printf("  %-28s min %8.2f  med %8.2f  p99 %8.2f  max %8.2f  mean %8.2f us  (%zu ok, %u failed)\n",
+               name.c_str(), samples_us[0], samples_us[n / 2], samples_us[std::min(n - 1, n * 99 / 100)],
+               samples_us[n - 1], sum / n, n, failures);
+    }
+};
+
+// Interface carrying frames: CDC after FRAMED_MODE_BYTE, or the vendor interface
+static bool framed_vendor = false;
+
+static uint32_t encoder_pin_mask() {
+    return (1u << ENCODER1_PIN_A) | (1u << ENCODER1_PIN_B) | (1u << ENCODER2_PIN_A) | (1u << ENCODER2_PIN_B);
+}
+
+static uint32_t encoder_pin_values(const EdgeSample& sample) {
+    return ((sample.states[0] & 1u) << ENCODER1_PIN_A) | (((sample.states[0] >> 1) & 1u) << ENCODER1_PIN_B) |
+           ((sample.states[1] & 1u) << ENCODER2_PIN_A) | (((sample.states[1] >> 1) & 1u) << ENCODER2_PIN_B);
+}
+
+static double elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool load_edge_trace(const char* path, std::vector<EdgeSample>* trace) {
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        fprintf(stderr, "Cannot open edge trace %s\n", path);
+        return false;
+    }
+
+    char line[128];
+    while (fgets(line, sizeof(line), file)) {
+        unsigned time_us, state1, state2;
+
+        if (line[0] == '#' || sscanf(line, "%u %u %u", &time_us, &state1, &state2) != 3) {
+            continue;
+        }
+        trace->push_back(EdgeSample{time_us, {(uint8_t)(state1 & 3), (uint8_t)(state2 & 3)}});
+    }
+    fclose(file);
+
+    return !trace->empty();
+}
+
+static void generate_edge_trace(size_t count, std::vector<EdgeSample>* trace) {
+    static const uint8_t cycle[4] = {0, 1, 3, 2};
+    int32_t index[2] = {0, 0};
+    uint32_t time_us = 0;
+
+    // Encoder 1 sweeps forward and back, encoder 2 turns the other way at half rate
+    for (size_t i = 0; i < count; i++) {
+        bool reverse = ((i / 5000) & 1) != 0;
+
+        index[0] += reverse ? -1 : 1;
+        if ((i & 1) == 0) {
+            index[1] -= 1;
+        }
+
+        EdgeSample sample = {time_us, {cycle[index[0] & 3], cycle[index[1] & 3]}};
+
+        // Lose an edge on encoder 1 now and then
+        if (i % SIM_ILLEGAL_INTERVAL == SIM_ILLEGAL_INTERVAL - 1) {
+            index[0] += reverse ? -1 : 1;
+            sample.states[0] = cycle[index[0] & 3];
+        }
+
+        trace->push_back(sample);
+        time_us += 50 + (i % 37);
+    }
+}
+
+static bool load_imu_dump(const char* path, std::vector<IMUSample>* dump) {
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        fprintf(stderr, "Cannot open MPU6050 dump %s\n", path);
+        return false;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        IMUSample sample = {};
+        char* cursor = line;
+        int count = 0;
+
+        if (line[0] == '#') {
+            continue;
+        }
+        while (count < IMU_DATA_BUFFER_LENGTH) {
+            char* end;
+            unsigned long value = strtoul(cursor, &end, 16);
+            if (end == cursor) {
+                break;
+            }
+            sample.data[count++] = (uint8_t)value;
+            cursor = end;
+        }
+        if (count == IMU_DATA_BUFFER_LENGTH) {
+            dump->push_back(sample);
+        }
+    }
+    fclose(file);
+
+    return !dump->empty();
+}
+
+static void generate_imu_dump(size_t count, std::vector<IMUSample>* dump) {
+    for (size_t i = 0; i < count; i++) {
+        IMUSample sample = {};
+
+        // Big endian accel, temperature and gyro words
+        for (int axis = 0; axis < IMU_DATA_BUFFER_LENGTH / 2; axis++) {
+            int16_t value = (int16_t)(8000.0 * sin(0.05 * i + axis));
+            sample.data[axis * 2] = (uint8_t)(value >> 8);
+            sample.data[axis * 2 + 1] = (uint8_t)value;
+        }
+        dump->push_back(sample);
+    }
+}
+
+/**
+ * @brief Replay an edge trace through the encoder interrupt path.
+ * @return true if the decoded positions and error counts match the reference.
+ */
+static bool run_decode(Feather& feather, const std::vector<EdgeSample>& trace, uint32_t irq_batch) {
+    ReferenceDecoder reference[2];
+    SensorSnapshot before = feather.get_snapshot();
+    uint64_t edges = 0;
+
+    reference[0].reset(trace[0].states[0]);
+    reference[1].reset(trace[0].states[1]);
+    sim_gpio_set_levels(encoder_pin_mask(), encoder_pin_values(trace[0]));
+    feather.run_acquisition_command(AcquisitionCommandType::RESET_SENSORS, 0);
+
+    sim_gpio_set_irq_batch(irq_batch);
+    auto start = std::chrono::steady_clock::now();
+
+    for (const EdgeSample& sample : trace) {
+        uint32_t changed = (sample.states[0] ^ reference[0].state) | ((sample.states[1] ^ reference[1].state) << 2);
+        edges += __builtin_popcount(changed);
+
+        reference[0].step(sample.states[0]);
+        reference[1].step(sample.states[1]);
+        sim_gpio_set_levels(encoder_pin_mask(), encoder_pin_values(sample));
+    }
+    sim_gpio_service_irqs();
+
+    double replay_us = elapsed_us(start);
+    sim_gpio_set_irq_batch(1);
+
+    // Let core1 publish a snapshot with the final counts
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_SNAPSHOT_SETTLE_MS));
+    SensorSnapshot after = feather.get_snapshot();
+
+    bool pass = true;
+    printf("Decode (%zu samples, %llu edges, interrupt every %u pin changes)\n", trace.size(),
+           (unsigned long long)edges, irq_batch);
+    for (int i = 0; i < 2; i++) {
+        uint32_t illegal = after.illegal_transitions[i] - before.illegal_transitions[i];
+        bool match = after.encoders.positions[i] == reference[i].position && illegal == reference[i].illegal;
+
+        printf("  encoder %d: position %ld (expected %ld), illegal %lu (expected %lu) %s\n", i + 1,
+               (long)after.encoders.positions[i], (long)reference[i].position, (unsigned long)illegal,
+               (unsigned long)reference[i].illegal, irq_batch > 1 ? "" : match ? "ok" : "MISMATCH");
+        pass = pass && match;
+    }
+    printf("  throughput: %.0f edges/s (%.1f ns/edge, mocked interrupt dispatch included)\n",
+           edges / (replay_us * 1e-6), replay_us * 1e3 / (edges ? edges : 1));
+
+    return pass;
+}
+
+/**
+ * @brief Run process_usb_communication() until a response of the expected size is sent.
+ * @return true if the response arrived before the timeout.
+ */
+static bool exchange_legacy(Feather& feather, uint8_t command, size_t response_length,
+                            std::vector<uint8_t>* response, double* latency_us) {
+    response->clear();
+    sim_usb_take_transmitted();
+    sim_usb_receive(&command, 1);
+
+    auto start = std::chrono::steady_clock::now();
+    do {
+        feather.process_usb_communication();
+        std::vector<uint8_t> data = sim_usb_take_transmitted();
+        response->insert(response->end(), data.begin(), data.end());
+    } while (response->size() < response_length && elapsed_us(start) < SIM_RESPONSE_TIMEOUT_US);
+    *latency_us = elapsed_us(start);
+
+    return response->size() == response_length;
+}
+
+/**
+ * @brief Send a request frame and wait for the frame that answers it.
+ * @return true if a response with the same sequence number arrived before the timeout.
+ */
+static bool exchange_framed(Feather& feather, uint8_t type, uint16_t seq, const uint8_t* payload, uint16_t length,
+                            Frame* response, double* latency_us) {
+    static uint8_t encoded[PROTOCOL_MAX_ENCODED_FRAME];
+    FrameParser parser;
+
+    size_t encoded_length = encode_frame(type, seq, payload, length, encoded);
+    if (encoded_length == 0) {
+        return false;
+    }
+    sim_usb_take_transmitted(framed_vendor);
+    sim_usb_receive(encoded, encoded_length, framed_vendor);
+
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed_us(start) < SIM_RESPONSE_TIMEOUT_US) {
+        feather.process_usb_communication();
+
+        for (uint8_t byte : sim_usb_take_transmitted(framed_vendor)) {
+            if (parser.push_byte(byte) && parser.get_frame().seq == seq && parser.get_frame().type != MSG_TELEMETRY) {
+                *response = parser.get_frame();
+                *latency_us = elapsed_us(start);
+                return true;
+            }
+        }
+    }
+    *latency_us = elapsed_us(start);
+
+    return false;
+}
+
+/**
+ * @brief Time the boot to the first IMU sample and follow the start-up with MSG_GET_STATUS.
+ *
+ * Also sends the old 'I' start handshake, which must not be answered. The
+ * host stays silent and does not read at first, like one that stalled: the
+ * stream restored from the warm restart record must wait for it instead of
+ * filling the FIFO.
+ *
+ * @param boot_us The device time initializeFeather() was called.
+ * @return true if the IMU sampled within SIM_BOOT_FIRST_SAMPLE_MAX_US and became ready.
+ */
+static bool run_boot(Feather& feather, uint64_t boot_us) {
+    auto start = std::chrono::steady_clock::now();
+    while (feather.get_snapshot().imu.timestamp_us == 0 && elapsed_us(start) < SIM_BOOT_TIMEOUT_US) {
+        std::this_thread::yield();
+    }
+    uint64_t first_sample_us = feather.get_snapshot().imu.timestamp_us;
+
+    // Stalled host: nothing may be sent to it
+    sim_usb_set_tx_capacity(SIM_STALL_FIFO_LENGTH, true);
+    auto silent_start = std::chrono::steady_clock::now();
+    while (elapsed_us(silent_start) < SIM_WARM_SILENT_MS * 1000.0) {
+        feather.process_usb_communication();
+        feather.process_telemetry();
+    }
+    size_t silent_bytes = sim_usb_take_transmitted(true).size();
+    sim_usb_set_tx_capacity(0, true);
+
+    // Poll the start-up over the vendor interface until the gyro has settled
+    Frame response;
+    double latency_us;
+    uint16_t seq = 0xFFB0;
+    IMUInitState state = IMUInitState::NOT_STARTED;
+    uint16_t attempts = 0;
+    uint64_t started_us = 0, ready_us = 0;
+    bool status_ok = true;
+
+    framed_vendor = true;
+    while (state != IMUInitState::READY && elapsed_us(start) < SIM_BOOT_TIMEOUT_US) {
+        if (!exchange_framed(feather, MSG_GET_STATUS, seq++, nullptr, 0, &response, &latency_us) ||
+            response.type != (MSG_GET_STATUS | MSG_RESPONSE_FLAG) || response.length != STATUS_PAYLOAD_LENGTH) {
+            status_ok = false;
+            break;
+        }
+        state = (IMUInitState)response.payload[8];
+        memcpy(&attempts, &response.payload[9], sizeof(attempts));
+        memcpy(&started_us, &response.payload[11], sizeof(started_us));
+        memcpy(&ready_us, &response.payload[0], sizeof(ready_us));
+    }
+    framed_vendor = false;
+
+    // The old start handshake is swallowed
+    uint8_t handshake = INITIALIZE_SENSORS_BYTE;
+    sim_usb_take_transmitted();
+    sim_usb_receive(&handshake, 1);
+    feather.process_usb_communication();
+    size_t handshake_reply = sim_usb_take_transmitted().size();
+
+    bool ok = first_sample_us != 0 && (first_sample_us - boot_us) <= SIM_BOOT_FIRST_SAMPLE_MAX_US;
+    bool ready = status_ok && state == IMUInitState::READY && started_us != 0;
+    printf("Boot\n  first IMU sample %.2f ms after boot %s\n", first_sample_us ? (first_sample_us - boot_us) / 1000.0 : -1.0,
+           ok ? "ok" : "MISMATCH");
+    printf("  IMU ready by %.2f ms (%u attempt%s, sampling since %.2f ms) %s\n", (ready_us - boot_us) / 1000.0,
+           attempts, attempts == 1 ? "" : "s", (started_us - boot_us) / 1000.0, ready ? "ok" : "MISMATCH");
+    printf("  'I' handshake: %zu bytes answered %s\n", handshake_reply, handshake_reply == 0 ? "ok" : "MISMATCH");
+    printf("  restored stream held for a silent host: %zu bytes in %u ms %s\n", silent_bytes, SIM_WARM_SILENT_MS,
+           silent_bytes == 0 ? "ok" : "MISMATCH");
+
+    return ok && ready && handshake_reply == 0 && silent_bytes == 0;
+}
+
+/**
+ * @brief The record a previous run of the firmware would have left before a watchdog reset.
+ */
+static WarmRestartState warm_restart_record() {
+    WarmRestartState state = {};
+
+    state.version = WARM_RESTART_VERSION;
+    state.restarts = SIM_WARM_RESTARTS;
+    state.positions[0] = 123456;
+    state.positions[1] = -654321;
+    state.pose = {987654321, 1.25f, -0.5f, 0.75f, {1e-4f, 0.0f, 0.0f, 2e-4f, 0.0f, 3e-4f}};
+    state.odometry_config = {ODOMETRY_WHEEL_RADIUS_M, ODOMETRY_WHEEL_BASE_M, ODOMETRY_FUSE_GYRO_DEFAULT};
+    state.imu_config = {SIM_WARM_GYRO_RANGE, IMU_ACCEL_RANGE_DEFAULT, IMU_DLPF_DEFAULT, IMU_SAMPLE_RATE_DIVIDER};
+    state.streaming = true;
+    state.stream_rate_hz = SIM_WARM_STREAM_RATE_HZ;
+    state.telemetry_interface = UsbInterface::VENDOR;
+    state.stream_encoding = STREAM_ENCODING_RAW;
+    state.keyframe_interval = STREAM_KEYFRAME_INTERVAL_DEFAULT;
+    state.framed_mode = false;
+    state.legacy_link_started = false;
+
+    return state;
+}
+
+/**
+ * @brief Check the boot picked up the seeded warm restart record, then return to a cold state.
+ * @return true if the counts, pose, IMU range and telemetry stream carried on and the status reports the restart.
+ */
+static bool run_warm_restart(Feather& feather) {
+    WarmRestartState expected = warm_restart_record();
+    SensorSnapshot snapshot = feather.get_snapshot();
+    Frame response;
+    double latency_us;
+
+    bool counts_ok = snapshot.encoders.positions[0] == expected.positions[0] &&
+                     snapshot.encoders.positions[1] == expected.positions[1];
+    bool pose_ok = snapshot.pose.x_m == expected.pose.x_m && snapshot.pose.y_m == expected.pose.y_m &&
+                   fabsf(snapshot.pose.heading_rad - expected.pose.heading_rad) < 1e-3f &&
+                   snapshot.pose.covariance[5] >= expected.pose.covariance[5];
+    bool imu_ok = snapshot.imu_config.gyro_range == SIM_WARM_GYRO_RANGE &&
+                  sim_mpu6050_get_register(GYRO_CONFIG) == (SIM_WARM_GYRO_RANGE << FS_SEL_SHIFT);
+
+    framed_vendor = true;
+    bool status_ok = exchange_framed(feather, MSG_GET_STATUS, 0xFFB8, nullptr, 0, &response, &latency_us) &&
+                     response.length == STATUS_PAYLOAD_LENGTH;
+    uint32_t restarts = 0;
+    if (status_ok) {
+        memcpy(&restarts, &response.payload[20], sizeof(restarts));
+        status_ok = response.payload[19] == 1 && restarts == SIM_WARM_RESTARTS + 1;
+    }
+
+    // Telemetry flows to the vendor interface since run_boot() spoke, without MSG_START_STREAM
+    FrameParser parser;
+    uint32_t frames = 0;
+    bool frames_ok = true;
+    feather.process_usb_communication();
+    sim_usb_take_transmitted(true);
+    auto start = std::chrono::steady_clock::now();
+    while (frames < 5 && elapsed_us(start) < SIM_BOOT_TIMEOUT_US) {
+        feather.process_telemetry();
+        for (uint8_t byte : sim_usb_take_transmitted(true)) {
+            if (parser.push_byte(byte) && parser.get_frame().type == MSG_TELEMETRY) {
+                int32_t positions[2];
+                memcpy(positions, &parser.get_frame().payload[8], sizeof(positions));
+                frames_ok = frames_ok && positions[0] == expected.positions[0] && positions[1] == expected.positions[1];
+                frames++;
+            }
+        }
+    }
+    bool stream_ok = frames >= 5 && frames_ok;
+
+    printf("Warm restart\n  encoder counts %ld %ld (expected %ld %ld) %s\n", (long)snapshot.encoders.positions[0],
+           (long)snapshot.encoders.positions[1], (long)expected.positions[0], (long)expected.positions[1],
+           counts_ok ? "ok" : "MISMATCH");
+    printf("  pose x %.3f y %.3f m heading %.3f rad %s\n", snapshot.pose.x_m, snapshot.pose.y_m,
+           snapshot.pose.heading_rad, pose_ok ? "ok" : "MISMATCH");
+    printf("  IMU gyro range %u %s\n", snapshot.imu_config.gyro_range, imu_ok ? "ok" : "MISMATCH");
+    printf("  status: restored, %u warm restarts %s\n", restarts, status_ok ? "ok" : "MISMATCH");
+    printf("  telemetry resumed: %u frames with the restored counts %s\n", frames, stream_ok ? "ok" : "MISMATCH");
+
+    // Back to what a cold boot would have
+    uint8_t defaults[IMU_CONFIG_REQUEST_PAYLOAD_LENGTH] = {IMU_GYRO_RANGE_DEFAULT, IMU_ACCEL_RANGE_DEFAULT,
+                                                           IMU_DLPF_DEFAULT, IMU_SAMPLE_RATE_DIVIDER};
+    uint8_t rate[STREAM_RATE_PAYLOAD_LENGTH] = {STREAM_RATE_DEFAULT_HZ & 0xFF, STREAM_RATE_DEFAULT_HZ >> 8};
+    exchange_framed(feather, MSG_STOP_STREAM, 0xFFB9, nullptr, 0, &response, &latency_us);
+    exchange_framed(feather, MSG_SET_STREAM_RATE, 0xFFBA, rate, sizeof(rate), &response, &latency_us);
+    exchange_framed(feather, MSG_SET_IMU_CONFIG, 0xFFBB, defaults, sizeof(defaults), &response, &latency_us);
+    exchange_framed(feather, MSG_RESET_SENSORS, 0xFFBC, nullptr, 0, &response, &latency_us);
+    framed_vendor = false;
+    sim_usb_take_transmitted(true);
+
+    return counts_ok && pose_ok && imu_ok && status_ok && stream_ok;
+}
+
+/**
+ * @brief Check the saved record follows the counts, pose and configuration while running.
+ * @return true if the newest record matches the current snapshot.
+ */
+static bool run_warm_restart_record(Feather& feather) {
+    WarmRestartState state;
+    SensorSnapshot snapshot = feather.get_snapshot();
+
+    // Core1 keeps saving, so a record torn by a save in progress is skipped for the other slot
+    bool ok = persistence_load(&state, sizeof(state)) && state.version == WARM_RESTART_VERSION &&
+              state.positions[0] == snapshot.encoders.positions[0] &&
+              state.positions[1] == snapshot.encoders.positions[1] && state.pose.x_m == snapshot.pose.x_m &&
+              state.pose.y_m == snapshot.pose.y_m && state.pose.heading_rad == snapshot.pose.heading_rad &&
+              state.odometry_config.wheel_radius_m == SIM_ODOMETRY_RADIUS_M && !state.odometry_config.fuse_gyro &&
+              !state.streaming;
+    printf("Warm restart record\n  counts %ld %ld, pose x %.4f y %.4f m, wheel radius %.3f m %s\n",
+           (long)state.positions[0], (long)state.positions[1], state.pose.x_m, state.pose.y_m,
+           state.odometry_config.wheel_radius_m, ok ? "ok" : "MISMATCH");
+
+    return ok;
+}
+
+/**
+ * @brief Replay MPU6050 register dumps and check the 'I' byte returns them.
+ * @return true if every sample was returned unchanged.
+ */
+static bool run_imu_replay(Feather& feather, const std::vector<IMUSample>& dump) {
+    LatencyStats propagation{};
+    propagation.name = "register -> snapshot";
+    uint32_t mismatches = 0;
+
+    for (const IMUSample& sample : dump) {
+        sim_mpu6050_set_data(sample.data);
+
+        // Wait for core1 to read the new registers into a snapshot
+        auto start = std::chrono::steady_clock::now();
+        while (memcmp(feather.get_snapshot().imu.data, sample.data, IMU_DATA_BUFFER_LENGTH) != 0) {
+            if (elapsed_us(start) > SIM_RESPONSE_TIMEOUT_US) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+        propagation.samples_us.push_back(elapsed_us(start));
+
+        std::vector<uint8_t> response;
+        double latency_us;
+        if (!exchange_legacy(feather, RETURN_IMU_DATA_BYTE, IMU_DATA_BUFFER_LENGTH, &response, &latency_us) ||
+            memcmp(response.data(), sample.data, IMU_DATA_BUFFER_LENGTH) != 0) {
+            mismatches++;
+        }
+    }
+
+    printf("IMU replay (%zu samples): %u mismatched %s\n", dump.size(), mismatches, mismatches ? "MISMATCH" : "ok");
+    propagation.print();
+
+    return mismatches == 0;
+}
+
+/**
+ * @brief Measure the latency of each single byte command.
+ * @return true if every command answered.
+ */
+static bool run_legacy_latency(Feather& feather, uint32_t iterations) {
+    struct LegacyCommand {
+        const char* name;
+        uint8_t byte;
+        size_t response_length;
+    };
+    static const LegacyCommand commands[] = {
+        {"'E' encoders", RETURN_ENCODERS_BYTE, DUAL_ENCODER_DATA_BUFFER_LENGTH},
+        {"'1' encoder 1", RETURN_ENCODER_1_BYTE, SINGLE_ENCODER_DATA_BUFFER_LENGTH},
+        {"'2' encoder 2", RETURN_ENCODER_2_BYTE, SINGLE_ENCODER_DATA_BUFFER_LENGTH},
+        {"'V' velocities", RETURN_VELOCITIES_BYTE, VELOCITY_DATA_BUFFER_LENGTH},
+        {"'I' IMU", RETURN_IMU_DATA_BYTE, IMU_DATA_BUFFER_LENGTH},
+        {"'Z' reset (core1 round trip)", RESET_SENSORS_BYTE, 0},
+    };
+    bool pass = true;
+
+    printf("Single byte command latency (%u iterations)\n", iterations);
+    for (const LegacyCommand& command : commands) {
+        LatencyStats stats{};
+        stats.name = command.name;
+        std::vector<uint8_t> response;
+
+        for (uint32_t i = 0; i < iterations; i++) {
+            double latency_us;
+            if (exchange_legacy(feather, command.byte, command.response_length, &response, &latency_us)) {
+                stats.samples_us.push_back(latency_us);
+            } else {
+                stats.failures++;
+            }
+        }
+        stats.print();
+        pass = pass && stats.failures == 0;
+    }
+
+    return pass;
+}
+
+/**
+ * @brief Measure the latency of each request on one interface.
+ *
+ * CDC is switched to framed mode first; the vendor interface is always framed.
+ *
+ * @param vendor True to use the vendor interface.
+ * @return true if every request got a valid response.
+ */
+static bool run_framed_latency(Feather& feather, uint32_t iterations, bool vendor) {
+    struct FramedCommand {
+        const char* name;
+        uint8_t type;
+        uint16_t length;
+        uint8_t payload[2];
+    };
+    static const FramedCommand commands[] = {
+        {"GET_ENCODERS", MSG_GET_ENCODERS, 0, {0}},
+        {"GET_ENCODER_SNAPSHOT", MSG_GET_ENCODER_SNAPSHOT, 0, {0}},
+        {"GET_ENCODER_ERRORS", MSG_GET_ENCODER_ERRORS, 0, {0}},
+        {"GET_VELOCITIES", MSG_GET_VELOCITIES, 0, {0}},
+        {"GET_IMU", MSG_GET_IMU, 0, {0}},
+        {"GET_ALL_SENSORS", MSG_GET_ALL_SENSORS, 0, {0}},
+        {"SET_STREAM_RATE (core1)", MSG_SET_STREAM_RATE, STREAM_RATE_PAYLOAD_LENGTH,
+         {STREAM_RATE_DEFAULT_HZ & 0xFF, STREAM_RATE_DEFAULT_HZ >> 8}},
+        {"RESET_SENSORS (core1)", MSG_RESET_SENSORS, 0, {0}},
+    };
+    uint8_t framed_byte = FRAMED_MODE_BYTE;
+    uint16_t seq = 0;
+    bool pass = true;
+
+    framed_vendor = vendor;
+    if (!vendor) {
+        sim_usb_receive(&framed_byte, 1);
+        feather.process_usb_communication();
+    }
+
+    printf("Framed request latency over %s (%u iterations, CRC in software)\n", vendor ? "vendor" : "CDC", iterations);
+    for (const FramedCommand& command : commands) {
+        LatencyStats stats{};
+        stats.name = command.name;
+
+        for (uint32_t i = 0; i < iterations; i++) {
+            Frame response;
+            double latency_us;
+
+            seq++;
+            if (exchange_framed(feather, command.type, seq, command.payload, command.length, &response, &latency_us) &&
+                response.type == (command.type | MSG_RESPONSE_FLAG)) {
+                stats.samples_us.push_back(latency_us);
+            } else {
+                stats.failures++;
+            }
+        }
+        stats.print();
+        pass = pass && stats.failures == 0;
+    }
+
+    return pass;
+}
+
+/**
+ * @brief Send alternating 'E' and 'I' commands in one CDC write and count the transfers.
+ * @return true if every command was answered and the answers were flushed together.
+ */
+static bool run_legacy_pipelining(Feather& feather) {
+    uint8_t commands[SIM_PIPELINED_REQUESTS];
+    size_t expected = 0;
+
+    for (size_t i = 0; i < SIM_PIPELINED_REQUESTS; i++) {
+        commands[i] = (i & 1) ? RETURN_IMU_DATA_BYTE : RETURN_ENCODERS_BYTE;
+        expected += (i & 1) ? IMU_DATA_BUFFER_LENGTH : DUAL_ENCODER_DATA_BUFFER_LENGTH;
+    }
+
+    sim_usb_take_transmitted();
+    uint32_t flushes = sim_usb_get_flush_count();
+    sim_usb_receive(commands, sizeof(commands));
+    feather.process_usb_communication();
+    flushes = sim_usb_get_flush_count() - flushes;
+    size_t transmitted = sim_usb_take_transmitted().size();
+
+    bool pass = transmitted == expected && flushes == 1;
+    printf("Legacy pipelining: %u commands in one write, %zu bytes (expected %zu) in %u flush %s\n",
+           SIM_PIPELINED_REQUESTS, transmitted, expected, flushes, pass ? "ok" : "MISMATCH");
+
+    return pass;
+}
+
+/**
+ * @brief Send several requests in one write and count the transfers.
+ * @param vendor True to use the vendor interface (CDC must already be framed otherwise).
+ * @return true if every request was answered in order and the answers were flushed together.
+ */
+static bool run_framed_batching(Feather& feather, bool vendor) {
+    static uint8_t encoded[SIM_PIPELINED_REQUESTS * PROTOCOL_MAX_ENCODED_FRAME];
+    size_t encoded_length = 0;
+    FrameParser parser;
+    uint32_t responses = 0;
+
+    for (uint16_t i = 0; i < SIM_PIPELINED_REQUESTS; i++) {
+        encoded_length += encode_frame(MSG_GET_ENCODER_SNAPSHOT, 0xFE00 + i, nullptr, 0, &encoded[encoded_length]);
+    }
+
+    sim_usb_take_transmitted(vendor);
+    uint32_t flushes = sim_usb_get_flush_count(vendor);
+    sim_usb_receive(encoded, encoded_length, vendor);
+    feather.process_usb_communication();
+    flushes = sim_usb_get_flush_count(vendor) - flushes;
+
+    std::vector<uint8_t> transmitted = sim_usb_take_transmitted(vendor);
+    for (uint8_t byte : transmitted) {
+        if (parser.push_byte(byte) && parser.get_frame().type == (MSG_GET_ENCODER_SNAPSHOT | MSG_RESPONSE_FLAG) &&
+            parser.get_frame().seq == 0xFE00 + responses) {
+            responses++;
+        }
+    }
+
+    bool pass = responses == SIM_PIPELINED_REQUESTS && flushes == 1;
+    printf("%s batching: %u requests in one write, %u responses (%zu bytes) in %u flush %s\n", vendor ? "Vendor" : "CDC",
+           SIM_PIPELINED_REQUESTS, responses, transmitted.size(), flushes, pass ? "ok" : "MISMATCH");
+
+    return pass;
+}
+
+/**
+ * @brief Stream telemetry for a while and check the frames and their sequence.
+ * @return true if frames arrived at about the configured rate without gaps.
+ */
+static bool run_telemetry(Feather& feather) {
+    const uint32_t duration_ms = 200;
+    FrameParser parser;
+    Frame response;
+    double latency_us;
+    uint32_t frames = 0, gaps = 0;
+    uint16_t next_seq = 0;
+
+    if (!exchange_framed(feather, MSG_START_STREAM, 0xFFF0, nullptr, 0, &response, &latency_us)) {
+        printf("Telemetry: START_STREAM failed MISMATCH\n");
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed_us(start) < duration_ms * 1000.0) {
+        feather.process_telemetry();
+
+        for (uint8_t byte : sim_usb_take_transmitted(framed_vendor)) {
+            if (!parser.push_byte(byte) || parser.get_frame().type != MSG_TELEMETRY) {
+                continue;
+            }
+            if (frames > 0 && parser.get_frame().seq != next_seq) {
+                gaps++;
+            }
+            next_seq = parser.get_frame().seq + 1;
+            frames++;
+        }
+    }
+
+    exchange_framed(feather, MSG_STOP_STREAM, 0xFFF1, nullptr, 0, &response, &latency_us);
+
+    // Host timer threads are not hard real time, so allow a wide margin
+    uint32_t expected = STREAM_RATE_DEFAULT_HZ * duration_ms / 1000;
+    bool pass = frames >= expected / 2 && gaps == 0;
+    printf("Telemetry (%u Hz for %u ms): %u frames (about %u expected), %u sequence gaps %s\n", STREAM_RATE_DEFAULT_HZ,
+           duration_ms, frames, expected, gaps, pass ? "ok" : "MISMATCH");
+
+    return pass;
+}
+
+/**
+ * @brief Host clock for the clock sync exchange, in us.
+ */
+static int64_t host_clock_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Estimate the device clock offset and drift with MSG_TIME_SYNC.
+ *
+ * Fits a line through the offsets of the lowest delay exchanges, as a host
+ * would, and compares it with the mocked device clock read directly.
+ *
+ * @return true if the offset error is within SIM_CLOCK_SYNC_TOLERANCE_US.
+ */
+static bool run_clock_sync(Feather& feather) {
+    struct SyncPoint {
+        double host_us; // Midpoint of t1 and t4.
+        double offset_us; // Device minus host.
+        double delay_us; // Round trip minus device turnaround.
+    };
+    std::vector<SyncPoint> points;
+
+    for (uint16_t i = 0; i < SIM_CLOCK_SYNC_EXCHANGES; i++) {
+        Frame response;
+        double latency_us;
+        int64_t t1 = host_clock_us();
+        uint64_t host_send = (uint64_t)t1;
+
+        if (!exchange_framed(feather, MSG_TIME_SYNC, 0xFF00 + (i & 0xFF), (const uint8_t*)&host_send,
+                             sizeof(host_send), &response, &latency_us) ||
+            response.length != TIME_SYNC_PAYLOAD_LENGTH) {
+            printf("Clock sync: bad MSG_TIME_SYNC response MISMATCH\n");
+            return false;
+        }
+        int64_t t4 = host_clock_us();
+
+        uint64_t echo, t2, t3;
+        memcpy(&echo, &response.payload[0], sizeof(echo));
+        memcpy(&t2, &response.payload[8], sizeof(t2));
+        memcpy(&t3, &response.payload[16], sizeof(t3));
+        if (echo != host_send) {
+            printf("Clock sync: host time not echoed MISMATCH\n");
+            return false;
+        }
+
+        double offset = (((double)t2 - t1) + ((double)t3 - t4)) / 2;
+        double delay = (double)(t4 - t1) - ((double)t3 - (double)t2);
+        points.push_back(SyncPoint{(t1 + t4) / 2.0, offset, delay});
+
+        // Spread the exchanges out so the drift fit has a baseline
+        std::this_thread::sleep_for(std::chrono::microseconds(SIM_CLOCK_SYNC_INTERVAL_US));
+    }
+
+    // Least squares line through the lowest delay exchanges
+    std::sort(points.begin(), points.end(), [](const SyncPoint& a, const SyncPoint& b) { return a.delay_us < b.delay_us; });
+    size_t n = std::max<size_t>(2, points.size() / SIM_CLOCK_SYNC_BEST_FRACTION);
+    double mean_t = 0, mean_offset = 0;
+    for (size_t i = 0; i < n; i++) {
+        mean_t += points[i].host_us / n;
+        mean_offset += points[i].offset_us / n;
+    }
+    double covariance = 0, variance = 0;
+    for (size_t i = 0; i < n; i++) {
+        covariance += (points[i].host_us - mean_t) * (points[i].offset_us - mean_offset);
+        variance += (points[i].host_us - mean_t) * (points[i].host_us - mean_t);
+    }
+    double drift = variance > 0 ? covariance / variance : 0;
+
+    // The mocked device clock can be read directly for the true offset
+    int64_t now = host_clock_us();
+    double true_offset = (double)time_us_64() - now;
+    double estimate = mean_offset + drift * (now - mean_t);
+    double error = estimate - true_offset;
+
+    bool pass = fabs(error) < SIM_CLOCK_SYNC_TOLERANCE_US;
+    printf("Clock sync (%u exchanges, best %zu): min delay %.1f us, drift %.1f ppm, offset error %.1f us %s\n",
+           SIM_CLOCK_SYNC_EXCHANGES, n, points[0].delay_us, drift * 1e6, error, pass ? "ok" : "MISMATCH");
+
+    return pass;
+}
+
+/**
+ * @brief Set the MPU6050 registers to a still or turning sensor.
+ *
+ * Values are scaled by the full scale ranges the firmware configured.
+ *
+ * @param roll_deg Roll of the sensor, gravity in the y/z plane.
+ * @param gyro_z_dps Rate about the sensor z axis.
+ */
+static void set_mpu6050_motion(double roll_deg, double gyro_z_dps) {
+    IMUConfig ranges = {
+        (uint8_t)((sim_mpu6050_get_register(GYRO_CONFIG) >> FS_SEL_SHIFT) & 0x03),
+        (uint8_t)((sim_mpu6050_get_register(ACCEL_CONFIG) >> FS_SEL_SHIFT) & 0x03),
+        0,
+        0
+    };
+    double accel_lsb_per_g = imu_accel_lsb_per_g(ranges);
+    int16_t words[IMU_DATA_BUFFER_LENGTH / 2] = {
+        0,
+        (int16_t)lround(sin(roll_deg * M_PI / 180.0) * accel_lsb_per_g),
+        (int16_t)lround(cos(roll_deg * M_PI / 180.0) * accel_lsb_per_g),
+        0,
+        0,
+        0,
+        (int16_t)lround(gyro_z_dps * imu_gyro_lsb_per_dps(ranges))
+    };
+    uint8_t data[IMU_DATA_BUFFER_LENGTH];
+
+    for (int i = 0; i < IMU_DATA_BUFFER_LENGTH / 2; i++) {
+        data[i * 2] = (uint8_t)((uint16_t)words[i] >> 8);
+        data[i * 2 + 1] = (uint8_t)words[i];
+    }
+    sim_mpu6050_set_data(data);
+}
+
+/**
+ * @brief Fetch the attitude estimate as roll and yaw in degrees.
+ * @return true if the request succeeded.
+ */
+static bool get_orientation(Feather& feather, uint16_t seq, double* roll_deg, double* yaw_deg, double* latency_us) {
+    Frame response;
+    int32_t q[4];
+
+    if (!exchange_framed(feather, MSG_GET_ORIENTATION, seq, nullptr, 0, &response, latency_us) ||
+        response.length != ORIENTATION_PAYLOAD_LENGTH) {
+        return false;
+    }
+    memcpy(q, &response.payload[8], sizeof(q));
+
+    double w = (double)q[0] / AHRS_QUATERNION_ONE, x = (double)q[1] / AHRS_QUATERNION_ONE;
+    double y = (double)q[2] / AHRS_QUATERNION_ONE, z = (double)q[3] / AHRS_QUATERNION_ONE;
+    *roll_deg = atan2(2 * (w * x + y * z), 1 - 2 * (x * x + y * y)) * 180.0 / M_PI;
+    *yaw_deg = atan2(2 * (w * z + x * y), 1 - 2 * (y * y + z * z)) * 180.0 / M_PI;
+
+    return true;
+}
+
+/**
+ * @brief Check the attitude filter against a tilted and then a turning sensor.
+ * @return true if roll and the integrated yaw are within SIM_AHRS_TOLERANCE_DEG.
+ */
+static bool run_orientation(Feather& feather) {
+    double roll, yaw, latency_us;
+    bool pass = true;
+
+    // A still sensor rolled 30 degrees seeds the attitude from gravity
+    set_mpu6050_motion(30.0, 0.0);
+    feather.run_acquisition_command(AcquisitionCommandType::RESET_SENSORS, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_SNAPSHOT_SETTLE_MS));
+
+    if (!get_orientation(feather, 0xFFE0, &roll, &yaw, &latency_us)) {
+        printf("Orientation: bad MSG_GET_ORIENTATION response MISMATCH\n");
+        return false;
+    }
+    bool ok = fabs(roll - 30.0) < SIM_AHRS_TOLERANCE_DEG;
+    printf("Orientation (fetched in %.2f us)\n  tilt: roll %6.2f deg (expected 30.00) %s\n", latency_us, roll,
+           ok ? "ok" : "MISMATCH");
+    pass = pass && ok;
+
+    // Level the sensor and turn it about z for a while
+    set_mpu6050_motion(0.0, 0.0);
+    feather.run_acquisition_command(AcquisitionCommandType::RESET_SENSORS, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_SNAPSHOT_SETTLE_MS));
+
+    auto start = std::chrono::steady_clock::now();
+    set_mpu6050_motion(0.0, SIM_AHRS_SPIN_DPS);
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_AHRS_SPIN_MS));
+    set_mpu6050_motion(0.0, 0.0);
+    double expected = SIM_AHRS_SPIN_DPS * elapsed_us(start) / 1e6;
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_SNAPSHOT_SETTLE_MS));
+
+    if (!get_orientation(feather, 0xFFE1, &roll, &yaw, &latency_us)) {
+        printf("Orientation: bad MSG_GET_ORIENTATION response MISMATCH\n");
+        return false;
+    }
+    ok = fabs(yaw - expected) < SIM_AHRS_TOLERANCE_DEG && fabs(roll) < SIM_AHRS_TOLERANCE_DEG;
+    printf("  turn: yaw %6.2f deg (expected %.2f), roll %.2f deg %s\n", yaw, expected, roll, ok ? "ok" : "MISMATCH");
+
+    return pass && ok;
+}
+
+/**
+ * @brief Decode an IMU configuration reply.
+ * @return true if the reply has the expected type and length.
+ */
+static bool parse_imu_config(const Frame& response, uint8_t type, IMUConfig* config, float* gyro_lsb_per_dps,
+                             float* accel_lsb_per_g, float* sample_rate_hz) {
+    if (response.type != (type | MSG_RESPONSE_FLAG) || response.length != IMU_CONFIG_PAYLOAD_LENGTH) {
+        return false;
+    }
+    *config = {response.payload[0], response.payload[1], response.payload[2], response.payload[3]};
+    memcpy(gyro_lsb_per_dps, &response.payload[4], sizeof(*gyro_lsb_per_dps));
+    memcpy(accel_lsb_per_g, &response.payload[8], sizeof(*accel_lsb_per_g));
+    memcpy(sample_rate_hz, &response.payload[12], sizeof(*sample_rate_hz));
+
+    return true;
+}
+
+/**
+ * @brief Switch the IMU to its widest ranges and a filtered low rate at run time.
+ *
+ * Checks the reply scales and the device registers, then turns the sensor
+ * and checks the attitude filter followed the new gyro scale without a reset.
+ *
+ * @return true if the configuration was applied and the turn matched.
+ */
+static bool run_imu_config(Feather& feather) {
+    const uint8_t wide[IMU_CONFIG_REQUEST_PAYLOAD_LENGTH] = {3, 3, 3, 9}; // 2000 dps, 16 g, 44 Hz DLPF, 100 Hz
+    const uint8_t invalid[IMU_CONFIG_REQUEST_PAYLOAD_LENGTH] = {IMU_RANGE_MAX + 1, 0, 0, 0};
+    const uint8_t defaults[IMU_CONFIG_REQUEST_PAYLOAD_LENGTH] = {IMU_GYRO_RANGE_DEFAULT, IMU_ACCEL_RANGE_DEFAULT,
+                                                                 IMU_DLPF_DEFAULT, IMU_SAMPLE_RATE_DIVIDER};
+    Frame response;
+    IMUConfig config;
+    float gyro_lsb_per_dps, accel_lsb_per_g, sample_rate_hz;
+    double roll, yaw, start_yaw, latency_us;
+    bool pass = true;
+
+    printf("IMU configuration\n");
+    if (!exchange_framed(feather, MSG_GET_IMU_CONFIG, 0xFFA0, nullptr, 0, &response, &latency_us) ||
+        !parse_imu_config(response, MSG_GET_IMU_CONFIG, &config, &gyro_lsb_per_dps, &accel_lsb_per_g, &sample_rate_hz)) {
+        printf("  bad MSG_GET_IMU_CONFIG response MISMATCH\n");
+        return false;
+    }
+    bool ok = gyro_lsb_per_dps == IMU_GYRO_LSB_PER_DPS && accel_lsb_per_g == IMU_ACCEL_LSB_PER_G &&
+              sample_rate_hz == 1000.0f;
+    printf("  default: %.1f LSB/dps, %.0f LSB/g, %.0f Hz %s\n", gyro_lsb_per_dps, accel_lsb_per_g, sample_rate_hz,
+           ok ? "ok" : "MISMATCH");
+    pass = pass && ok;
+
+    if (!exchange_framed(feather, MSG_SET_IMU_CONFIG, 0xFFA1, wide, sizeof(wide), &response, &latency_us) ||
+        !parse_imu_config(response, MSG_SET_IMU_CONFIG, &config, &gyro_lsb_per_dps, &accel_lsb_per_g, &sample_rate_hz)) {
+        printf("  bad MSG_SET_IMU_CONFIG response MISMATCH\n");
+        return false;
+    }
+    ok = gyro_lsb_per_dps == 16.375f && accel_lsb_per_g == 2048.0f && sample_rate_hz == 100.0f &&
+         sim_mpu6050_get_register(GYRO_CONFIG) == 0x18 && sim_mpu6050_get_register(ACCEL_CONFIG) == 0x18 &&
+         sim_mpu6050_get_register(DLPF_CONFIG) == 3 && sim_mpu6050_get_register(SMPLRT_DIV) == 9;
+    printf("  wide: %.3f LSB/dps, %.0f LSB/g, %.0f Hz in %.2f us, registers %02X %02X %02X %02X %s\n",
+           gyro_lsb_per_dps, accel_lsb_per_g, sample_rate_hz, latency_us, sim_mpu6050_get_register(GYRO_CONFIG),
+           sim_mpu6050_get_register(ACCEL_CONFIG), sim_mpu6050_get_register(DLPF_CONFIG),
+           sim_mpu6050_get_register(SMPLRT_DIV), ok ? "ok" : "MISMATCH");
+    pass = pass && ok;
+
+    // Turn at the new scale; the filter state carries over without a reset
+    set_mpu6050_motion(0.0, 0.0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_SNAPSHOT_SETTLE_MS));
+    get_orientation(feather, 0xFFA2, &roll, &start_yaw, &latency_us);
+    auto start = std::chrono::steady_clock::now();
+    set_mpu6050_motion(0.0, SIM_AHRS_SPIN_DPS);
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_AHRS_SPIN_MS));
+    set_mpu6050_motion(0.0, 0.0);
+    double expected = SIM_AHRS_SPIN_DPS * elapsed_us(start) / 1e6;
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_SNAPSHOT_SETTLE_MS));
+    get_orientation(feather, 0xFFA3, &roll, &yaw, &latency_us);
+
+    double turned = remainder(yaw - start_yaw, 360.0);
+    ok = fabs(turned - expected) < SIM_AHRS_TOLERANCE_DEG;
+    printf("  turn at 2000 dps range: %.2f deg (expected %.2f) %s\n", turned, expected, ok ? "ok" : "MISMATCH");
+    pass = pass && ok;
+
+    ok = exchange_framed(feather, MSG_SET_IMU_CONFIG, 0xFFA4, invalid, sizeof(invalid), &response, &latency_us) &&
+         response.type == MSG_ERROR;
+    printf("  out of range config: %s %s\n", ok ? "rejected" : "accepted", ok ? "ok" : "MISMATCH");
+    pass = pass && ok;
+
+    ok = exchange_framed(feather, MSG_SET_IMU_CONFIG, 0xFFA5, defaults, sizeof(defaults), &response, &latency_us) &&
+         sim_mpu6050_get_register(GYRO_CONFIG) == (IMU_GYRO_RANGE_DEFAULT << FS_SEL_SHIFT);
+    pass = pass && ok;
+
+    return pass;
+}
+
+/**
+ * @brief Start an MPU6050 whose configuration fails once and check that it is retried.
+ *
+ * Runs before the firmware boots, since it resets the MPU6050 the firmware shares.
+ *
+ * @return true if the failed write sent it to NOT_FOUND and the retry made it READY.
+ */
+static bool run_imu_retry() {
+    static IMU imu(IMUBus::I2C);
+
+    // Last configuration write, so everything before it has gone through
+    sim_mpu6050_fail_write(INT_ENABLE);
+    imu.initializeIMU();
+    auto start = std::chrono::steady_clock::now();
+    while (imu.get_status().state == IMUInitState::RESETTING && elapsed_us(start) < SIM_BOOT_TIMEOUT_US) {
+        imu.service();
+        std::this_thread::yield();
+    }
+    IMUStatus failed = imu.get_status();
+    bool failed_ok = failed.state == IMUInitState::NOT_FOUND && failed.attempts == 1 &&
+                     sim_mpu6050_get_register(INT_ENABLE) == 0;
+
+    auto retry = std::chrono::steady_clock::now();
+    while (imu.get_status().state != IMUInitState::READY && elapsed_us(start) < SIM_BOOT_TIMEOUT_US) {
+        imu.service();
+        std::this_thread::yield();
+    }
+    double retry_ms = elapsed_us(retry) / 1000.0;
+    IMUStatus ready = imu.get_status();
+    bool ready_ok = ready.state == IMUInitState::READY && ready.attempts == 2 && retry_ms * 1000.0 >= IMU_INIT_RETRY_US &&
+                    sim_mpu6050_get_register(INT_ENABLE) == 0x01;
+
+    printf("IMU start-up retry\n  failed INT_ENABLE write: state %d after %u attempt(s) %s\n", (int)failed.state,
+           (unsigned)failed.attempts, failed_ok ? "ok" : "MISMATCH");
+    printf("  ready %.2f ms later after %u attempt(s) %s\n", retry_ms, (unsigned)ready.attempts,
+           ready_ok ? "ok" : "MISMATCH");
+
+    return failed_ok && ready_ok;
+}
+
+/**
+ * @brief Start an MPU9250 on SPI next to the firmware's IMU and sample it at the full gyro rate.
+ * @return true if it started, was set up for SPI and returned the register data at 8 kHz.
+ */
+static bool run_spi_imu() {
+    static IMU imu(IMUBus::SPI);
+    static const uint8_t data[IMU_DATA_BUFFER_LENGTH] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                                        0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E};
+
+    imu.initializeIMU();
+    auto start = std::chrono::steady_clock::now();
+    while (imu.get_status().state != IMUInitState::READY && elapsed_us(start) < SIM_BOOT_TIMEOUT_US) {
+        imu.service();
+        std::this_thread::yield();
+    }
+    double ready_ms = elapsed_us(start) / 1000.0;
+    bool ready = imu.get_status().state == IMUInitState::READY &&
+                 (sim_mpu9250_get_register(USER_CTRL) & USER_CTRL_I2C_IF_DIS) &&
+                 sim_mpu9250_get_register(ACCEL_CONFIG2) == ACCEL_CONFIG2_FCHOICE_B;
+
+    // Every gyro output: unfiltered at 8 kHz, no divider
+    IMUConfig config = {IMU_GYRO_RANGE_DEFAULT, IMU_ACCEL_RANGE_DEFAULT, 0, 0};
+    bool rate_ok = imu.set_config(config) && imu_sample_rate_hz(imu.get_config()) == IMU_GYRO_OUTPUT_RATE_HZ &&
+                   sim_mpu9250_get_register(SMPLRT_DIV) == 0 && sim_mpu9250_get_register(DLPF_CONFIG) == 0 &&
+                   sim_mpu9250_get_register(GYRO_CONFIG) == (IMU_GYRO_RANGE_DEFAULT << FS_SEL_SHIFT);
+
+    IMUSample sample;
+    sim_mpu9250_set_data(data);
+    imu.service();
+    bool sample_ok = imu.get_latest_sample(&sample) && memcmp(sample.data, data, sizeof(data)) == 0;
+
+    printf("SPI IMU (MPU9250)\n  ready in %.2f ms, I2C interface off, accelerometer at 4 kHz %s\n", ready_ms,
+           ready ? "ok" : "MISMATCH");
+    printf("  %.0f Hz sample rate, registers %02X %02X %s\n", imu_sample_rate_hz(imu.get_config()),
+           sim_mpu9250_get_register(DLPF_CONFIG), sim_mpu9250_get_register(SMPLRT_DIV), rate_ok ? "ok" : "MISMATCH");
+    printf("  register read over SPI %s\n", sample_ok ? "ok" : "MISMATCH");
+
+    return ready && rate_ok && sample_ok;
+}
+
+/**
+ * @brief Drive the wheels through an arc and check the dead reckoned pose.
+ * @return true if the pose matches the arc and the covariance is valid.
+ */
+static bool run_odometry(Feather& feather) {
+    static const uint8_t cycle[4] = {0, 1, 3, 2};
+    uint8_t config_payload[ODOMETRY_CONFIG_PAYLOAD_LENGTH];
+    float radius = SIM_ODOMETRY_RADIUS_M, base = SIM_ODOMETRY_BASE_M;
+    Frame response;
+    double latency_us;
+
+    // Wheels only, so the still simulated gyro does not hold the heading
+    memcpy(&config_payload[0], &radius, sizeof(radius));
+    memcpy(&config_payload[4], &base, sizeof(base));
+    config_payload[8] = 0;
+    if (!exchange_framed(feather, MSG_SET_ODOMETRY_CONFIG, 0xFFD0, config_payload, sizeof(config_payload), &response,
+                         &latency_us) || response.type != (MSG_SET_ODOMETRY_CONFIG | MSG_RESPONSE_FLAG)) {
+        printf("Odometry: MSG_SET_ODOMETRY_CONFIG rejected MISMATCH\n");
+        return false;
+    }
+
+    // A zero wheel base must be refused
+    float zero = 0.0f;
+    memcpy(&config_payload[4], &zero, sizeof(zero));
+    if (!exchange_framed(feather, MSG_SET_ODOMETRY_CONFIG, 0xFFD1, config_payload, sizeof(config_payload), &response,
+                         &latency_us) || response.type != MSG_ERROR) {
+        printf("Odometry: zero wheel base accepted MISMATCH\n");
+        return false;
+    }
+
+    // Start from the current pins at the origin
+    uint32_t levels = encoder_pin_values(EdgeSample{0, {cycle[0], cycle[0]}});
+    sim_gpio_set_levels(encoder_pin_mask(), levels);
+    feather.run_acquisition_command(AcquisitionCommandType::RESET_SENSORS, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_SNAPSHOT_SETTLE_MS));
+
+    // Right wheel steps every sample, left every other: a left turn at constant curvature
+    for (uint32_t i = 1; i <= SIM_ODOMETRY_RIGHT_STEPS; i++) {
+        sim_gpio_set_levels(encoder_pin_mask(), encoder_pin_values(EdgeSample{0, {cycle[(i / 2) & 3], cycle[i & 3]}}));
+        std::this_thread::sleep_for(std::chrono::microseconds(SIM_ODOMETRY_STEP_US));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_SNAPSHOT_SETTLE_MS));
+
+    if (!exchange_framed(feather, MSG_GET_ODOMETRY, 0xFFD2, nullptr, 0, &response, &latency_us) ||
+        response.length != ODOMETRY_PAYLOAD_LENGTH) {
+        printf("Odometry: bad MSG_GET_ODOMETRY response MISMATCH\n");
+        return false;
+    }
+    float pose[3], covariance[6];
+    memcpy(pose, &response.payload[8], sizeof(pose));
+    memcpy(covariance, &response.payload[20], sizeof(covariance));
+
+    // Exact arc for the final counts
+    double meters_per_count = 2.0 * M_PI * SIM_ODOMETRY_RADIUS_M / COUNTS_PER_REVOLUTION;
+    double left = (SIM_ODOMETRY_RIGHT_STEPS / 2) * meters_per_count, right = SIM_ODOMETRY_RIGHT_STEPS * meters_per_count;
+    double heading = (right - left) / SIM_ODOMETRY_BASE_M;
+    double arc_radius = (left + right) / 2.0 / heading;
+    double x = arc_radius * sin(heading), y = arc_radius * (1.0 - cos(heading));
+
+    bool ok = fabs(pose[0] - x) < SIM_ODOMETRY_TOLERANCE_M && fabs(pose[1] - y) < SIM_ODOMETRY_TOLERANCE_M &&
+              fabs(pose[2] - heading) < 0.01 && covariance[0] > 0 && covariance[3] > 0 && covariance[5] > 0;
+    printf("Odometry (fetched in %.2f us)\n  arc: x %.4f y %.4f m heading %.2f deg (expected %.4f %.4f m %.2f deg) %s\n"
+           "  sigma x %.4f y %.4f m heading %.3f deg\n", latency_us, pose[0], pose[1], pose[2] * 180.0 / M_PI, x, y,
+           heading * 180.0 / M_PI, ok ? "ok" : "MISMATCH", sqrt(covariance[0]), sqrt(covariance[3]),
+           sqrt(covariance[5]) * 180.0 / M_PI);
+
+    return ok;
+}
+
+/**
+ * @brief First order DC motor and encoder per wheel, driven by the PWM outputs.
+ *
+ * Steps the encoder pins one quadrature state at a time until stopped.
+ */
+static void run_motor_plant(std::atomic<bool>* running) {
+    static const uint8_t cycle[4] = {0, 1, 3, 2};
+    static const uint32_t pins[2][2] = {{MOTOR1_DIR_PIN, MOTOR1_PWM_PIN}, {MOTOR2_DIR_PIN, MOTOR2_PWM_PIN}};
+    double speed[2] = {0.0, 0.0}, position[2] = {0.0, 0.0};
+    int64_t steps[2] = {0, 0};
+    auto last = std::chrono::steady_clock::now();
+
+    while (*running) {
+        std::this_thread::sleep_for(std::chrono::microseconds(SIM_MOTOR_PLANT_STEP_US));
+        double dt = elapsed_us(last) / 1e6;
+        last = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < 2; i++) {
+            double target = sim_pwm_get_duty(pins[i][0], pins[i][1]) * SIM_MOTOR_FULL_SPEED;
+            speed[i] += (target - speed[i]) * std::min(1.0, dt / SIM_MOTOR_TIME_CONSTANT_S);
+            position[i] += speed[i] * dt;
+        }
+
+        // Emit the whole steps the shafts turned through
+        while (steps[0] != (int64_t)floor(position[0]) || steps[1] != (int64_t)floor(position[1])) {
+            for (int i = 0; i < 2; i++) {
+                int64_t whole = (int64_t)floor(position[i]);
+                steps[i] += steps[i] < whole ? 1 : (steps[i] > whole ? -1 : 0);
+            }
+            sim_gpio_set_levels(encoder_pin_mask(), encoder_pin_values(EdgeSample{0, {cycle[steps[0] & 3],
+                                                                                      cycle[steps[1] & 3]}}));
+        }
+    }
+}
+
+/**
+ * @brief Fetch the motor state.
+ * @return true if the request succeeded.
+ */
+static bool get_motors(Feather& feather, uint16_t seq, int32_t* setpoints, int32_t* speeds, float* duty) {
+    Frame response;
+    double latency_us;
+
+    if (!exchange_framed(feather, MSG_GET_MOTORS, seq, nullptr, 0, &response, &latency_us) ||
+        response.length != MOTORS_PAYLOAD_LENGTH) {
+        return false;
+    }
+    memcpy(setpoints, &response.payload[8], 2 * sizeof(int32_t));
+    memcpy(speeds, &response.payload[16], 2 * sizeof(int32_t));
+    memcpy(duty, &response.payload[24], 2 * sizeof(float));
+
+    return true;
+}
+
+/**
+ * @brief Close the speed loop around a simulated motor per wheel.
+ *
+ * Wheel speeds are measured from the encoder counts over a window after the
+ * loop settles, independent of the speed estimates the loop runs on.
+ *
+ * @return true if both wheels settle at their setpoints and coast after the setpoint timeout.
+ */
+static bool run_motor_control(Feather& feather) {
+    int32_t setpoints[2] = {SIM_MOTOR_LEFT_SETPOINT, SIM_MOTOR_RIGHT_SETPOINT};
+    int32_t reported_setpoints[2], speeds[2];
+    float duty[2];
+    EncoderSnapshot first = {}, last = {};
+    Frame response;
+    double latency_us;
+
+    // Feedforward for a faster motor than the simulated one, so feedback has work to do
+    float gains[5] = {5.0e-6f, 1.0e-4f, 0.0f, 2.5e-6f, 0.0f};
+    if (!exchange_framed(feather, MSG_SET_MOTOR_GAINS, 0xFFBF, (const uint8_t*)gains, sizeof(gains), &response,
+                         &latency_us) || response.type != (MSG_SET_MOTOR_GAINS | MSG_RESPONSE_FLAG)) {
+        printf("Motor control: MSG_SET_MOTOR_GAINS rejected MISMATCH\n");
+        return false;
+    }
+
+    // Start with both encoders at the first quadrature state
+    sim_gpio_set_levels(encoder_pin_mask(), encoder_pin_values(EdgeSample{0, {0, 0}}));
+    std::atomic<bool> running(true);
+    std::thread plant(run_motor_plant, &running);
+
+    // Keep sending the setpoint well inside the timeout, as a host would
+    auto start = std::chrono::steady_clock::now();
+    uint32_t samples = 0;
+    uint16_t seq = 0xFFC0;
+    while (samples < SIM_MOTOR_SAMPLES) {
+        if (!exchange_framed(feather, MSG_SET_WHEEL_SPEEDS, seq++, (const uint8_t*)setpoints, sizeof(setpoints),
+                             &response, &latency_us) || response.type != (MSG_SET_WHEEL_SPEEDS | MSG_RESPONSE_FLAG)) {
+            printf("Motor control: MSG_SET_WHEEL_SPEEDS failed MISMATCH\n");
+            running = false;
+            plant.join();
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        // Measure over the next samples once settled
+        if (elapsed_us(start) > SIM_MOTOR_SETTLE_MS * 1000.0) {
+            last = feather.get_encoder_snapshot();
+            if (samples++ == 0) {
+                first = last;
+            }
+        }
+    }
+    get_motors(feather, seq++, reported_setpoints, speeds, duty);
+
+    bool ok = true;
+    printf("Motor control (%d Hz, simulated motor at %.0f counts/s full duty)\n", MOTOR_CONTROL_RATE_HZ,
+           SIM_MOTOR_FULL_SPEED);
+    double window_s = (last.timestamp_us - first.timestamp_us) / 1e6;
+    for (int i = 0; i < 2; i++) {
+        double speed = (double)(last.positions[i] - first.positions[i]) * ENCODER_SUBSTEPS_PER_STEP / window_s;
+        bool wheel_ok = fabs(speed - setpoints[i]) < SIM_MOTOR_TOLERANCE * fabs((double)setpoints[i]);
+        printf("  wheel %d: speed %9.0f sub-steps/s (setpoint %d, estimate %d), duty %.3f %s\n", i, speed,
+               setpoints[i], speeds[i], duty[i], wheel_ok ? "ok" : "MISMATCH");
+        ok = ok && wheel_ok;
+    }
+
+    // Without setpoints the motors coast
+    std::this_thread::sleep_for(std::chrono::microseconds(MOTOR_SETPOINT_TIMEOUT_US + 50000));
+    bool coasting = get_motors(feather, seq++, reported_setpoints, speeds, duty) && duty[0] == 0.0f &&
+                    duty[1] == 0.0f && reported_setpoints[0] == 0 && reported_setpoints[1] == 0;
+    printf("  setpoint timeout: duty %.3f %.3f %s\n", duty[0], duty[1], coasting ? "ok" : "MISMATCH");
+
+    running = false;
+    plant.join();
+
+    return ok && coasting;
+}
+
+/**
+ * @brief Fetch history samples from a sequence on, following the more flag.
+ * @param since The first sample sequence wanted.
+ * @param first_seq Set to the sequence of the first sample received.
+ * @param timestamps Set to the encoder timestamps of the samples received, in order.
+ * @param frames Set to the number of response frames.
+ * @param contiguous Set to false if a frame did not continue where the last one ended.
+ * @return true if the reply ended with a frame without the more flag.
+ */
+static bool fetch_history(Feather& feather, uint16_t seq, uint32_t since, uint32_t* first_seq,
+                          std::vector<uint64_t>* timestamps, uint32_t* frames, bool* contiguous) {
+    static uint8_t encoded[PROTOCOL_MAX_ENCODED_FRAME];
+    uint8_t request[HISTORY_REQUEST_PAYLOAD_LENGTH] = {0};
+    FrameParser parser;
+    uint32_t next_seq = 0;
+
+    memcpy(&request[0], &since, sizeof(since));
+    timestamps->clear();
+    *frames = 0;
+    *contiguous = true;
+
+    // One request, answered in as many frames as needed
+    size_t encoded_length = encode_frame(MSG_GET_HISTORY, seq, request, sizeof(request), encoded);
+    sim_usb_take_transmitted(true);
+    sim_usb_receive(encoded, encoded_length, true);
+    feather.process_usb_communication();
+
+    for (uint8_t byte : sim_usb_take_transmitted(true)) {
+        if (!parser.push_byte(byte) || parser.get_frame().seq != seq) {
+            continue;
+        }
+        const Frame& frame = parser.get_frame();
+        if (frame.type != (MSG_GET_HISTORY | MSG_RESPONSE_FLAG) || frame.length < HISTORY_HEADER_LENGTH ||
+            frame.length != HISTORY_HEADER_LENGTH + frame.payload[4] * HISTORY_ENTRY_LENGTH) {
+            return false;
+        }
+
+        uint32_t frame_seq;
+        memcpy(&frame_seq, &frame.payload[0], sizeof(frame_seq));
+        if ((*frames)++ == 0) {
+            *first_seq = frame_seq;
+        } else if (frame_seq != next_seq) {
+            *contiguous = false;
+        }
+        next_seq = frame_seq + frame.payload[4];
+
+        for (uint8_t i = 0; i < frame.payload[4]; i++) {
+            uint64_t timestamp_us;
+            memcpy(&timestamp_us, &frame.payload[HISTORY_HEADER_LENGTH + i * HISTORY_ENTRY_LENGTH], sizeof(timestamp_us));
+            timestamps->push_back(timestamp_us);
+        }
+        if (!frame.payload[5]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Stall the host, then catch up from the sample history.
+ * @return true if the catch-up covered the stall without gaps and lost samples were reported.
+ */
+static bool run_history(Feather& feather) {
+    std::vector<uint64_t> timestamps;
+    uint32_t first_seq = 0, frames;
+    bool contiguous;
+
+    // Everything held so far, to find the newest sequence
+    if (!fetch_history(feather, 0xFF90, 0, &first_seq, &timestamps, &frames, &contiguous)) {
+        printf("History: bad MSG_GET_HISTORY response MISMATCH\n");
+        return false;
+    }
+    uint32_t since = first_seq + timestamps.size();
+    bool full_ok = contiguous && timestamps.size() >= HISTORY_LENGTH * 9 / 10;
+    printf("History\n  full ring: %zu samples in %u frames from seq %u %s\n", timestamps.size(), frames, first_seq,
+           full_ok ? "ok" : "MISMATCH");
+
+    // Stall, then catch up in one request
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_HISTORY_STALL_MS));
+    uint32_t flushes = sim_usb_get_flush_count(true);
+    if (!fetch_history(feather, 0xFF91, since, &first_seq, &timestamps, &frames, &contiguous) || timestamps.empty()) {
+        printf("  bad catch-up response MISMATCH\n");
+        return false;
+    }
+    flushes = sim_usb_get_flush_count(true) - flushes;
+
+    bool ordered = true;
+    double max_gap_us = 0.0;
+    for (size_t i = 1; i < timestamps.size(); i++) {
+        ordered = ordered && timestamps[i] > timestamps[i - 1];
+        max_gap_us = std::max(max_gap_us, (double)(timestamps[i] - timestamps[i - 1]));
+    }
+    double covered_ms = (timestamps.back() - timestamps.front()) / 1000.0;
+    bool catch_up_ok = first_seq == since && contiguous && ordered && covered_ms >= SIM_HISTORY_STALL_MS * 0.9 &&
+                       flushes == 1;
+    printf("  after a %u ms stall: %zu samples over %.1f ms from seq %u (asked %u), largest step %.0f us, "
+           "%u frames in %u flush %s\n", SIM_HISTORY_STALL_MS, timestamps.size(), covered_ms, first_seq, since,
+           max_gap_us, frames, flushes, catch_up_ok ? "ok" : "MISMATCH");
+
+    // Asking for overwritten samples starts at the oldest one held
+    uint32_t lost_since = first_seq - 2 * HISTORY_LENGTH;
+    bool lost_ok = fetch_history(feather, 0xFF92, lost_since, &first_seq, &timestamps, &frames, &contiguous) &&
+                   (int32_t)(first_seq - lost_since) > (int32_t)HISTORY_LENGTH;
+    printf("  overwritten range: asked %u, got from %u %s\n", lost_since, first_seq, lost_ok ? "ok" : "MISMATCH");
+
+    // A payload one byte over the largest frame is refused, not truncated
+    static uint8_t oversize[PROTOCOL_MAX_PAYLOAD + 1];
+    static uint8_t encoded[PROTOCOL_MAX_ENCODED_FRAME + 8];
+    size_t oversize_length = encode_frame(MSG_GET_HISTORY | MSG_RESPONSE_FLAG, 0, oversize, sizeof(oversize), encoded);
+    printf("  %zu byte payload: %zu bytes encoded %s\n", sizeof(oversize), oversize_length,
+           oversize_length == 0 ? "ok" : "MISMATCH");
+
+    return full_ok && catch_up_ok && lost_ok && oversize_length == 0;
+}
+
+/**
+ * @brief Stream with an encoding while the IMU jitters, decoding as the host would.
+ * @param[out] bytes_per_sample Wire bytes per telemetry sample, framing included.
+ * @param[out] keyframes Number of MSG_TELEMETRY frames.
+ * @param[out] bad Frames that could not be decoded, or decoded to a timestamp going back.
+ * @return uint32_t The number of samples decoded.
+ */
+static uint32_t stream_encoded(Feather& feather, uint8_t encoding, double* bytes_per_sample, uint32_t* keyframes,
+                               uint32_t* bad) {
+    uint8_t request[STREAM_ENCODING_PAYLOAD_LENGTH] = {encoding, STREAM_KEYFRAME_INTERVAL_DEFAULT & 0xFF,
+                                                       STREAM_KEYFRAME_INTERVAL_DEFAULT >> 8};
+    uint8_t previous[TELEMETRY_PAYLOAD_LENGTH], current[TELEMETRY_PAYLOAD_LENGTH];
+    bool have_previous = false;
+    uint16_t previous_seq = 0;
+    uint64_t previous_us = 0;
+    size_t wire_bytes = 0;
+    uint32_t samples = 0;
+    FrameParser parser;
+    Frame response;
+    double latency_us;
+
+    *keyframes = 0;
+    *bad = 0;
+    exchange_framed(feather, MSG_SET_STREAM_ENCODING, 0xFFD0, request, sizeof(request), &response, &latency_us);
+    exchange_framed(feather, MSG_START_STREAM, 0xFFD1, nullptr, 0, &response, &latency_us);
+    sim_usb_take_transmitted(framed_vendor);
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> jitter(-1.0, 1.0);
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed_us(start) < SIM_DELTA_STREAM_MS * 1000.0) {
+        set_mpu6050_motion(10.0 + 0.2 * jitter(rng), 30.0 + jitter(rng));
+        feather.process_telemetry();
+
+        std::vector<uint8_t> transmitted = sim_usb_take_transmitted(framed_vendor);
+        wire_bytes += transmitted.size();
+        for (uint8_t byte : transmitted) {
+            if (!parser.push_byte(byte)) {
+                continue;
+            }
+            const Frame& frame = parser.get_frame();
+            if (frame.type == MSG_TELEMETRY && frame.length == TELEMETRY_PAYLOAD_LENGTH) {
+                memcpy(current, frame.payload, TELEMETRY_PAYLOAD_LENGTH);
+                (*keyframes)++;
+            } else if (frame.type != MSG_TELEMETRY_DELTA) {
+                continue;
+            } else if (!have_previous || frame.seq != (uint16_t)(previous_seq + 1) ||
+                       !decode_telemetry_delta(previous, frame.payload, frame.length, current)) {
+                // Nothing to decode against until the next keyframe
+                (*bad)++;
+                have_previous = false;
+                continue;
+            }
+
+            uint64_t timestamp_us;
+            memcpy(&timestamp_us, current, sizeof(timestamp_us));
+            // Late timer ticks that catch up can share a microsecond, but never go back
+            if (have_previous && timestamp_us < previous_us) {
+                (*bad)++;
+            }
+            memcpy(previous, current, sizeof(current));
+            previous_seq = frame.seq;
+            previous_us = timestamp_us;
+            have_previous = true;
+            samples++;
+        }
+    }
+
+    exchange_framed(feather, MSG_STOP_STREAM, 0xFFD2, nullptr, 0, &response, &latency_us);
+    *bytes_per_sample = samples ? (double)wire_bytes / samples : 0.0;
+
+    return samples;
+}
+
+/**
+ * @brief Round trip the delta codec, then compare raw and delta streams at the maximum rate.
+ * @return true if every round trip matched and the delta stream decoded with fewer wire bytes.
+ */
+static bool run_telemetry_delta(Feather& feather) {
+    uint8_t previous[TELEMETRY_PAYLOAD_LENGTH], current[TELEMETRY_PAYLOAD_LENGTH], decoded[TELEMETRY_PAYLOAD_LENGTH];
+    uint8_t delta[TELEMETRY_DELTA_MAX_LENGTH];
+    size_t longest = 0;
+    uint32_t mismatches = 0;
+    std::mt19937 rng(3);
+
+    // Arbitrary payloads, including the largest possible differences, must survive exactly
+    for (uint32_t i = 0; i < SIM_DELTA_ROUND_TRIPS; i++) {
+        for (size_t j = 0; j < TELEMETRY_PAYLOAD_LENGTH; j++) {
+            previous[j] = (uint8_t)rng();
+            current[j] = (i & 1) ? (uint8_t)(previous[j] + rng() % 3) : (uint8_t)rng();
+        }
+        if (i == 0) {
+            memset(previous, 0x00, sizeof(previous));
+            memset(current, 0xFF, sizeof(current));
+        }
+        size_t length = encode_telemetry_delta(previous, current, delta);
+        longest = std::max(longest, length);
+        if (length > TELEMETRY_DELTA_MAX_LENGTH || !decode_telemetry_delta(previous, delta, length, decoded) ||
+            memcmp(decoded, current, sizeof(current)) != 0) {
+            mismatches++;
+        }
+    }
+    bool codec_ok = mismatches == 0;
+    printf("Delta telemetry\n  codec: %u round trips, %u mismatched, longest %zu bytes %s\n", SIM_DELTA_ROUND_TRIPS,
+           mismatches, longest, codec_ok ? "ok" : "MISMATCH");
+
+    uint8_t rate[STREAM_RATE_PAYLOAD_LENGTH] = {STREAM_RATE_MAX_HZ & 0xFF, STREAM_RATE_MAX_HZ >> 8};
+    Frame response;
+    double latency_us;
+    exchange_framed(feather, MSG_SET_STREAM_RATE, 0xFFD3, rate, sizeof(rate), &response, &latency_us);
+
+    double raw_bytes, delta_bytes;
+    uint32_t raw_keyframes, delta_keyframes, raw_bad, delta_bad;
+    uint32_t raw_samples = stream_encoded(feather, STREAM_ENCODING_RAW, &raw_bytes, &raw_keyframes, &raw_bad);
+    uint32_t delta_samples = stream_encoded(feather, STREAM_ENCODING_DELTA, &delta_bytes, &delta_keyframes, &delta_bad);
+
+    uint8_t restore[STREAM_ENCODING_PAYLOAD_LENGTH] = {STREAM_ENCODING_RAW, STREAM_KEYFRAME_INTERVAL_DEFAULT & 0xFF,
+                                                       STREAM_KEYFRAME_INTERVAL_DEFAULT >> 8};
+    exchange_framed(feather, MSG_SET_STREAM_ENCODING, 0xFFD4, restore, sizeof(restore), &response, &latency_us);
+    rate[0] = STREAM_RATE_DEFAULT_HZ & 0xFF;
+    rate[1] = STREAM_RATE_DEFAULT_HZ >> 8;
+    exchange_framed(feather, MSG_SET_STREAM_RATE, 0xFFD5, rate, sizeof(rate), &response, &latency_us);
+
+    bool stream_ok = raw_samples > 0 && delta_samples > 0 && raw_bad == 0 && delta_bad == 0 &&
+                     delta_keyframes < delta_samples && delta_bytes < raw_bytes * SIM_DELTA_MAX_RATIO;
+    printf("  raw at %u Hz: %u samples, %.1f wire bytes per sample (%.1f kB/s)\n", STREAM_RATE_MAX_HZ, raw_samples,
+           raw_bytes, raw_bytes * STREAM_RATE_MAX_HZ / 1000.0);
+    printf("  delta at %u Hz: %u samples (%u keyframes, %u undecodable), %.1f wire bytes per sample (%.1f kB/s), "
+           "%.0f%% of raw %s\n", STREAM_RATE_MAX_HZ, delta_samples, delta_keyframes, delta_bad, delta_bytes,
+           delta_bytes * STREAM_RATE_MAX_HZ / 1000.0, raw_bytes ? 100.0 * delta_bytes / raw_bytes : 0.0,
+           stream_ok ? "ok" : "MISMATCH");
+
+    return codec_ok && stream_ok;
+}
+
+/**
+ * @brief Read one event counter from the instrumentation dump.
+ */
+static uint32_t get_event_count(Feather& feather, InstrumentationEvent event) {
+    uint8_t reset = 0;
+    Frame response;
+    double latency_us;
+    uint32_t count = 0;
+
+    if (exchange_framed(feather, MSG_GET_STATS, 0xFFC0, &reset, sizeof(reset), &response, &latency_us) &&
+        response.length == INSTRUMENTATION_DUMP_LENGTH) {
+        memcpy(&count, &response.payload[INSTRUMENTATION_HEADER_LENGTH + (size_t)Probe::COUNT *
+                                         INSTRUMENTATION_PROBE_LENGTH + (size_t)event * 4], sizeof(count));
+    }
+    return count;
+}
+
+/**
+ * @brief Stream to a host that stops reading the vendor interface, then starts again.
+ * @return true if the main loop kept its pace by dropping telemetry, and the stream resumed.
+ */
+static bool run_stalled_reader(Feather& feather) {
+    uint8_t rate[STREAM_RATE_PAYLOAD_LENGTH] = {STREAM_RATE_MAX_HZ & 0xFF, STREAM_RATE_MAX_HZ >> 8};
+    bool previous_vendor = framed_vendor;
+    Frame response;
+    double latency_us;
+
+    framed_vendor = true;
+    uint32_t full_before = get_event_count(feather, InstrumentationEvent::TELEMETRY_USB_FULL);
+    exchange_framed(feather, MSG_SET_STREAM_RATE, 0xFFC1, rate, sizeof(rate), &response, &latency_us);
+    exchange_framed(feather, MSG_START_STREAM, 0xFFC2, nullptr, 0, &response, &latency_us);
+
+    // The FIFO fills and stays full: nothing takes the bytes
+    sim_usb_set_tx_capacity(SIM_STALL_FIFO_LENGTH, true);
+    std::vector<double> passes_us;
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed_us(start) < SIM_STALL_MS * 1000.0) {
+        auto pass_start = std::chrono::steady_clock::now();
+        feather.process_usb_communication();
+        feather.process_telemetry();
+        passes_us.push_back(elapsed_us(pass_start));
+    }
+    std::sort(passes_us.begin(), passes_us.end());
+
+    // The host reads again: telemetry resumes with a keyframe
+    sim_usb_take_transmitted(true);
+    FrameParser parser;
+    uint32_t frames = 0;
+    bool keyframe_first = false;
+    start = std::chrono::steady_clock::now();
+    while (elapsed_us(start) < SIM_STALL_MS * 1000.0) {
+        feather.process_telemetry();
+        for (uint8_t byte : sim_usb_take_transmitted(true)) {
+            if (parser.push_byte(byte) && (parser.get_frame().type == MSG_TELEMETRY ||
+                                           parser.get_frame().type == MSG_TELEMETRY_DELTA)) {
+                keyframe_first = frames > 0 ? keyframe_first : parser.get_frame().type == MSG_TELEMETRY;
+                frames++;
+            }
+        }
+    }
+    sim_usb_set_tx_capacity(0, true);
+
+    exchange_framed(feather, MSG_STOP_STREAM, 0xFFC3, nullptr, 0, &response, &latency_us);
+    rate[0] = STREAM_RATE_DEFAULT_HZ & 0xFF;
+    rate[1] = STREAM_RATE_DEFAULT_HZ >> 8;
+    exchange_framed(feather, MSG_SET_STREAM_RATE, 0xFFC4, rate, sizeof(rate), &response, &latency_us);
+    uint32_t full = get_event_count(feather, InstrumentationEvent::TELEMETRY_USB_FULL) - full_before;
+    framed_vendor = previous_vendor;
+
+    // Host threads preempt single passes, so judge by how many passes the loop made
+    bool pass = full > 0 && passes_us.size() >= SIM_STALL_MIN_PASSES && frames > 0 && keyframe_first;
+    printf("Stalled reader (%u ms at %u Hz): %u samples dropped at the full FIFO, %zu main loop passes "
+           "(median %.1f us), %u frames after (keyframe first: %s) %s\n", SIM_STALL_MS, STREAM_RATE_MAX_HZ, full,
+           passes_us.size(), passes_us.empty() ? 0.0 : passes_us[passes_us.size() / 2], frames,
+           keyframe_first ? "yes" : "no", pass ? "ok" : "MISMATCH");
+
+    return pass;
+}
+
+/**
+ * @brief Fetch and print the instrumentation dump.
+ * @return true if the dump is well formed and the probes that ran have samples.
+ */
+static bool run_stats(Feather& feather) {
+    static const char* probe_names[] = {"encoder ISR", "IMU data ready ISR", "IMU DMA ISR", "telemetry timer",
+                                        "USB command", "AHRS update", "odometry update",
+                                        "motor control"};
+    static const char* event_names[] = {"telemetry dropped", "telemetry late", "velocity late", "IMU overrun",
+                                        "motor timeout", "telemetry USB full"};
+    uint8_t reset = 0;
+    Frame response;
+    double latency_us;
+
+    if (!exchange_framed(feather, MSG_GET_STATS, 0xFFF2, &reset, sizeof(reset), &response, &latency_us) ||
+        response.length != INSTRUMENTATION_DUMP_LENGTH) {
+        printf("Stats: bad MSG_GET_STATS response MISMATCH\n");
+        return false;
+    }
+
+    uint32_t clock_hz;
+    memcpy(&clock_hz, &response.payload[4], sizeof(clock_hz));
+    printf("Stats (version %u, clk_sys %lu Hz, fetched in %.2f us)\n", response.payload[0], (unsigned long)clock_hz,
+           latency_us);
+
+    const uint8_t* probe = &response.payload[INSTRUMENTATION_HEADER_LENGTH];
+    uint32_t counts[(size_t)Probe::COUNT];
+    for (size_t i = 0; i < (size_t)Probe::COUNT; i++, probe += INSTRUMENTATION_PROBE_LENGTH) {
+        uint32_t values[3 + INSTRUMENTATION_BUCKETS];
+        memcpy(values, probe, sizeof(values));
+        counts[i] = values[0];
+
+        // Upper bound of the bucket holding the 99th percentile
+        uint32_t p99_bucket = 0, seen = 0;
+        for (uint32_t bucket = 0; bucket < INSTRUMENTATION_BUCKETS; bucket++) {
+            seen += values[3 + bucket];
+            if (values[0] && seen * 100ull >= values[0] * 99ull) {
+                p99_bucket = bucket;
+                break;
+            }
+        }
+
+        printf("  %-20s count %8lu  min %6lu  p99 < %6lu  max %8lu cycles\n", probe_names[i], (unsigned long)values[0],
+               (unsigned long)values[1], (unsigned long)(2u << p99_bucket), (unsigned long)values[2]);
+    }
+
+    const uint8_t* event = probe;
+    for (size_t i = 0; i < (size_t)InstrumentationEvent::COUNT; i++, event += 4) {
+        uint32_t count;
+        memcpy(&count, event, sizeof(count));
+        printf("  %-20s %lu\n", event_names[i], (unsigned long)count);
+    }
+
+    return counts[(size_t)Probe::ENCODER_ISR] > 0 && counts[(size_t)Probe::USB_COMMAND] > 0 &&
+           counts[(size_t)Probe::TELEMETRY_TIMER] > 0;
+}
+
+int main(int argc, char** argv) {
+    const char* edges_path = nullptr;
+    const char* imu_path = nullptr;
+    uint32_t irq_batch = 1;
+    uint32_t iterations = SIM_DEFAULT_ITERATIONS;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--edges") && i + 1 < argc) {
+            edges_path = argv[++i];
+        } else if (!strcmp(argv[i], "--imu") && i + 1 < argc) {
+            imu_path = argv[++i];
+        } else if (!strcmp(argv[i], "--irq-batch") && i + 1 < argc) {
+            irq_batch = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "--iterations") && i + 1 < argc) {
+            iterations = strtoul(argv[++i], nullptr, 0);
+        } else {
+            fprintf(stderr, "Usage: %s [--edges FILE] [--imu FILE] [--irq-batch N] [--iterations N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // Load or generate the traces
+    std::vector<EdgeSample> trace;
+    std::vector<IMUSample> dump;
+    if (edges_path ? !load_edge_trace(edges_path, &trace) : (generate_edge_trace(SIM_DEFAULT_EDGE_SAMPLES, &trace), false)) {
+        return 2;
+    }
+    if (imu_path ? !load_imu_dump(imu_path, &dump) : (generate_imu_dump(SIM_DEFAULT_IMU_SAMPLES, &dump), false)) {
+        return 2;
+    }
+
+    // Boot as after a watchdog reset of a running robot
+    WarmRestartState record = warm_restart_record();
+    persistence_save(&record, sizeof(record));
+
+    // Before the firmware takes the MPU6050 over
+    bool pass = run_imu_retry();
+
+    // Start the firmware with the encoder pins at the first trace sample
+    static Feather feather;
+    sim_gpio_set_levels(encoder_pin_mask(), encoder_pin_values(trace[0]));
+    uint64_t boot_us = time_us_64();
+    feather.initializeFeather();
+
+    pass = run_boot(feather, boot_us) && pass;
+    pass = run_warm_restart(feather) && pass;
+    pass = run_decode(feather, trace, 1) && pass;
+    if (irq_batch > 1) {
+        // Lost edges are expected here; only the illegal transition counters are of interest
+        run_decode(feather, trace, irq_batch);
+    }
+    pass = run_imu_replay(feather, dump) && pass;
+    pass = run_legacy_latency(feather, iterations) && pass;
+    pass = run_legacy_pipelining(feather) && pass;
+    pass = run_framed_latency(feather, iterations, false) && pass;
+    pass = run_framed_batching(feather, false) && pass;
+    pass = run_framed_latency(feather, iterations, true) && pass;
+    pass = run_framed_batching(feather, true) && pass;
+    pass = run_telemetry(feather) && pass;
+    pass = run_clock_sync(feather) && pass;
+    pass = run_orientation(feather) && pass;
+    pass = run_imu_config(feather) && pass;
+    pass = run_spi_imu() && pass;
+    pass = run_odometry(feather) && pass;
+    pass = run_warm_restart_record(feather) && pass;
+    pass = run_motor_control(feather) && pass;
+    pass = run_history(feather) && pass;
+    pass = run_telemetry_delta(feather) && pass;
+    pass = run_stalled_reader(feather) && pass;
+    pass = run_stats(feather) && pass;
+
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    fflush(stdout);
+
+    // Core1 and the timer threads never return, so skip static destructors
+    _Exit(pass ? 0 : 1);
+}
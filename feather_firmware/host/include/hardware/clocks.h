@@ -0,0 +1,16 @@
+// hardware/clocks.h
+// Carson Powers
+// Host mock of the Pico SDK clocks driver
+
+#ifndef MOCK_HARDWARE_CLOCKS_H
+#define MOCK_HARDWARE_CLOCKS_H
+
+#include <cstdint>
+
+enum clock_index {
+    clk_sys = 5,
+};
+
+uint32_t clock_get_hz(enum clock_index clk_index);
+
+#endif // MOCK_HARDWARE_CLOCKS_H
@@ -0,0 +1,46 @@
+// hardware/gpio.h
+// Carson Powers
+// Host mock of the Pico SDK GPIO driver: pin levels are set by the simulation
+
+#ifndef MOCK_HARDWARE_GPIO_H
+#define MOCK_HARDWARE_GPIO_H
+
+#include <cstdint>
+
+typedef unsigned int uint;
+
+#define GPIO_IN false
+#define GPIO_OUT true
+
+#define NUM_BANK0_GPIOS 30
+
+enum gpio_irq_level {
+    GPIO_IRQ_LEVEL_LOW = 0x1u,
+    GPIO_IRQ_LEVEL_HIGH = 0x2u,
+    GPIO_IRQ_EDGE_FALL = 0x4u,
+    GPIO_IRQ_EDGE_RISE = 0x8u,
+};
+
+enum gpio_function {
+    GPIO_FUNC_SPI = 1,
+    GPIO_FUNC_UART = 2,
+    GPIO_FUNC_I2C = 3,
+    GPIO_FUNC_PWM = 4,
+    GPIO_FUNC_SIO = 5,
+    GPIO_FUNC_PIO0 = 6,
+    GPIO_FUNC_NULL = 0x1f,
+};
+
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t event_mask);
+
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_set_function(uint gpio, enum gpio_function fn);
+void gpio_pull_up(uint gpio);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+uint32_t gpio_get_all();
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled);
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask, bool enabled, gpio_irq_callback_t callback);
+
+#endif // MOCK_HARDWARE_GPIO_H
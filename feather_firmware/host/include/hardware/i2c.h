@@ -0,0 +1,41 @@
+// hardware/i2c.h
+// Carson Powers
+// Host mock of the Pico SDK I2C driver, with an MPU6050 register model on i2c0
+
+#ifndef MOCK_HARDWARE_I2C_H
+#define MOCK_HARDWARE_I2C_H
+
+#include <cstdint>
+#include <cstddef>
+
+typedef unsigned int uint;
+
+// Registers touched by the DMA read path (which the simulation does not run)
+typedef struct {
+    volatile uint32_t tar;
+    volatile uint32_t data_cmd;
+    volatile uint32_t clr_tx_abrt;
+    volatile uint32_t enable;
+    volatile uint32_t dma_cr;
+} i2c_hw_t;
+
+typedef struct i2c_inst i2c_inst_t;
+extern i2c_inst_t i2c0_inst;
+
+#define i2c0 (&i2c0_inst)
+#define i2c_default i2c0
+
+#define I2C_IC_DATA_CMD_RESTART_BITS 0x00000400u
+#define I2C_IC_DATA_CMD_STOP_BITS 0x00000200u
+#define I2C_IC_DATA_CMD_CMD_BITS 0x00000100u
+#define I2C_IC_DMA_CR_TDMAE_BITS 0x00000002u
+#define I2C_IC_DMA_CR_RDMAE_BITS 0x00000001u
+
+uint i2c_init(i2c_inst_t* i2c, uint baudrate);
+int i2c_write_blocking(i2c_inst_t* i2c, uint8_t addr, const uint8_t* src, size_t len, bool nostop);
+int i2c_read_blocking(i2c_inst_t* i2c, uint8_t addr, uint8_t* dst, size_t len, bool nostop);
+i2c_hw_t* i2c_get_hw(i2c_inst_t* i2c);
+uint i2c_get_dreq(i2c_inst_t* i2c, bool is_tx);
+size_t i2c_get_read_available(i2c_inst_t* i2c);
+
+#endif // MOCK_HARDWARE_I2C_H
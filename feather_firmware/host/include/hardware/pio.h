@@ -0,0 +1,32 @@
+// hardware/pio.h
+// Carson Powers
+// Host mock of the Pico SDK PIO driver. State machines are not simulated:
+// build the simulation with ENCODER_USE_PIO=0.
+
+#ifndef MOCK_HARDWARE_PIO_H
+#define MOCK_HARDWARE_PIO_H
+
+#include <cstdint>
+
+typedef unsigned int uint;
+
+typedef struct pio_hw pio_hw_t;
+typedef pio_hw_t* PIO;
+extern pio_hw_t pio0_hw;
+extern pio_hw_t pio1_hw;
+
+#define pio0 (&pio0_hw)
+#define pio1 (&pio1_hw)
+
+#define NUM_PIO_STATE_MACHINES 4
+
+typedef struct {
+    const uint16_t* instructions;
+    uint8_t length;
+    int8_t origin;
+} pio_program_t;
+
+void pio_add_program_at_offset(PIO pio, const pio_program_t* program, uint offset);
+int pio_claim_unused_sm(PIO pio, bool required);
+
+#endif // MOCK_HARDWARE_PIO_H
@@ -0,0 +1,25 @@
+// hardware/pwm.h
+// Carson Powers
+// Host mock of the Pico SDK PWM driver (levels are stored per pin for the simulation)
+
+#ifndef MOCK_HARDWARE_PWM_H
+#define MOCK_HARDWARE_PWM_H
+
+#include <cstdint>
+
+typedef unsigned int uint;
+
+typedef struct {
+    uint32_t csr;
+    uint32_t div;
+    uint32_t top;
+} pwm_config;
+
+pwm_config pwm_get_default_config();
+void pwm_config_set_clkdiv_int(pwm_config* c, uint div);
+void pwm_config_set_wrap(pwm_config* c, uint16_t wrap);
+void pwm_init(uint slice_num, pwm_config* c, bool start);
+uint pwm_gpio_to_slice_num(uint gpio);
+void pwm_set_gpio_level(uint gpio, uint16_t level);
+
+#endif // MOCK_HARDWARE_PWM_H
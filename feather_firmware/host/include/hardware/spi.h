@@ -0,0 +1,48 @@
+// hardware/spi.h
+// Carson Powers
+// Host mock of the Pico SDK SPI driver, with an MPU9250 register model on spi0
+
+#ifndef MOCK_HARDWARE_SPI_H
+#define MOCK_HARDWARE_SPI_H
+
+#include <cstdint>
+#include <cstddef>
+
+typedef unsigned int uint;
+
+// Registers touched by the DMA read path (which the simulation does not run)
+typedef struct {
+    volatile uint32_t dr;
+} spi_hw_t;
+
+typedef struct spi_inst spi_inst_t;
+extern spi_inst_t spi0_inst;
+
+#define spi0 (&spi0_inst)
+
+typedef enum {
+    SPI_CPHA_0 = 0,
+    SPI_CPHA_1 = 1
+} spi_cpha_t;
+
+typedef enum {
+    SPI_CPOL_0 = 0,
+    SPI_CPOL_1 = 1
+} spi_cpol_t;
+
+typedef enum {
+    SPI_LSB_FIRST = 0,
+    SPI_MSB_FIRST = 1
+} spi_order_t;
+
+uint spi_init(spi_inst_t* spi, uint baudrate);
+uint spi_set_baudrate(spi_inst_t* spi, uint baudrate);
+void spi_set_format(spi_inst_t* spi, uint data_bits, spi_cpol_t cpol, spi_cpha_t cpha, spi_order_t order);
+int spi_write_blocking(spi_inst_t* spi, const uint8_t* src, size_t len);
+int spi_read_blocking(spi_inst_t* spi, uint8_t repeated_tx_data, uint8_t* dst, size_t len);
+spi_hw_t* spi_get_hw(spi_inst_t* spi);
+uint spi_get_dreq(spi_inst_t* spi, bool is_tx);
+bool spi_is_readable(const spi_inst_t* spi);
+bool spi_is_busy(const spi_inst_t* spi);
+
+#endif // MOCK_HARDWARE_SPI_H
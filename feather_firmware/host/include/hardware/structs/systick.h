@@ -0,0 +1,29 @@
+// hardware/structs/systick.h
+// Carson Powers
+// Host mock of the SysTick registers: cvr counts down at clk_sys from the host clock
+
+#ifndef MOCK_HARDWARE_STRUCTS_SYSTICK_H
+#define MOCK_HARDWARE_STRUCTS_SYSTICK_H
+
+#include <cstdint>
+
+/**
+ * @brief Current value register, a 24 bit down counter at clk_sys.
+ */
+struct MockSystickCurrentValue {
+    operator uint32_t() const;
+    MockSystickCurrentValue& operator=(uint32_t value);
+};
+
+typedef struct {
+    uint32_t csr;
+    uint32_t rvr;
+    MockSystickCurrentValue cvr;
+    uint32_t calib;
+} systick_hw_t;
+
+extern systick_hw_t mock_systick_hw;
+
+#define systick_hw (&mock_systick_hw)
+
+#endif // MOCK_HARDWARE_STRUCTS_SYSTICK_H
@@ -0,0 +1,24 @@
+// hardware/sync.h
+// Carson Powers
+// Host mock of the Pico SDK synchronization primitives
+
+#ifndef MOCK_HARDWARE_SYNC_H
+#define MOCK_HARDWARE_SYNC_H
+
+#include <atomic>
+#include <cstdint>
+
+static inline void __dmb() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+static inline void __compiler_memory_barrier() {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+// Interrupts are simulated by one recursive lock that is held while any
+// simulated interrupt handler runs, so disabling interrupts takes it too
+uint32_t save_and_disable_interrupts();
+void restore_interrupts(uint32_t status);
+
+#endif // MOCK_HARDWARE_SYNC_H
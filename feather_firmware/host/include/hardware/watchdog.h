@@ -0,0 +1,15 @@
+// hardware/watchdog.h
+// Carson Powers
+// Host mock of the Pico SDK watchdog for the feather_firmware simulation
+
+#ifndef MOCK_HARDWARE_WATCHDOG_H
+#define MOCK_HARDWARE_WATCHDOG_H
+
+#include <cstdint>
+
+// The simulation drives the firmware without its main loop, which feeds the
+// watchdog, so it never resets anything
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug);
+void watchdog_update();
+
+#endif // MOCK_HARDWARE_WATCHDOG_H
@@ -0,0 +1,10 @@
+// pico/binary_info.h
+// Carson Powers
+// Host mock of the Pico SDK binary info macros (no-ops)
+
+#ifndef MOCK_PICO_BINARY_INFO_H
+#define MOCK_PICO_BINARY_INFO_H
+
+#define bi_decl(x)
+
+#endif // MOCK_PICO_BINARY_INFO_H
@@ -0,0 +1,18 @@
+// pico/divider.h
+// Carson Powers
+// Host mock of the Pico SDK hardware divider functions
+
+#ifndef MOCK_PICO_DIVIDER_H
+#define MOCK_PICO_DIVIDER_H
+
+#include <cstdint>
+
+static inline int32_t div_s32s32(int32_t a, int32_t b) {
+    return a / b;
+}
+
+static inline uint32_t div_u32u32(uint32_t a, uint32_t b) {
+    return a / b;
+}
+
+#endif // MOCK_PICO_DIVIDER_H
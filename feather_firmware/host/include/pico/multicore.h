@@ -0,0 +1,15 @@
+// pico/multicore.h
+// Carson Powers
+// Host mock of the Pico SDK multicore library: core1 is a host thread
+
+#ifndef MOCK_PICO_MULTICORE_H
+#define MOCK_PICO_MULTICORE_H
+
+#include <cstdint>
+
+void multicore_launch_core1(void (*entry)());
+void multicore_fifo_push_blocking(uint32_t data);
+uint32_t multicore_fifo_pop_blocking();
+uint32_t get_core_num();
+
+#endif // MOCK_PICO_MULTICORE_H
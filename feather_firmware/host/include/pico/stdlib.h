@@ -0,0 +1,59 @@
+// pico/stdlib.h
+// Carson Powers
+// Host mock of the Pico SDK standard library for the feather_firmware simulation
+
+#ifndef MOCK_PICO_STDLIB_H
+#define MOCK_PICO_STDLIB_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+
+#define PICO_OK 0
+#define PICO_ERROR_GENERIC -1
+#define PICO_ERROR_TIMEOUT -1
+
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+
+// Host memory is never cleared by a reboot, it just is not placed specially
+#define __uninitialized_ram(group) group
+
+// Time (microseconds since the simulation started)
+typedef uint64_t absolute_time_t;
+uint64_t time_us_64();
+uint32_t time_us_32();
+absolute_time_t get_absolute_time();
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+
+static inline void tight_loop_contents() {}
+
+// Repeating timers, each run by a host thread holding the interrupt lock
+typedef int32_t alarm_id_t;
+typedef struct alarm_pool alarm_pool_t;
+typedef struct repeating_timer repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t* rt);
+
+struct repeating_timer {
+    int64_t delay_us;
+    alarm_pool_t* pool;
+    alarm_id_t alarm_id;
+    repeating_timer_callback_t callback;
+    void* user_data;
+};
+
+alarm_pool_t* alarm_pool_create_with_unused_hardware_alarm(uint max_timers);
+bool alarm_pool_add_repeating_timer_us(alarm_pool_t* pool, int64_t delay_us, repeating_timer_callback_t callback,
+                                       void* user_data, repeating_timer_t* out);
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void* user_data, repeating_timer_t* out);
+bool cancel_repeating_timer(repeating_timer_t* timer);
+
+// stdio
+bool stdio_init_all();
+
+[[noreturn]] void panic(const char* fmt, ...);
+
+#endif // MOCK_PICO_STDLIB_H
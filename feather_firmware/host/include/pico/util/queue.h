@@ -0,0 +1,25 @@
+// pico/util/queue.h
+// Carson Powers
+// Host mock of the Pico SDK multicore safe queue
+
+#ifndef MOCK_PICO_UTIL_QUEUE_H
+#define MOCK_PICO_UTIL_QUEUE_H
+
+#include <cstdint>
+
+typedef unsigned int uint;
+
+// Storage lives in the mock; the firmware only passes queue_t pointers around
+typedef struct {
+    void* impl;
+} queue_t;
+
+void queue_init(queue_t* q, uint element_size, uint element_count);
+void queue_free(queue_t* q);
+uint queue_get_level(queue_t* q);
+bool queue_try_add(queue_t* q, const void* data);
+bool queue_try_remove(queue_t* q, void* data);
+void queue_add_blocking(queue_t* q, const void* data);
+void queue_remove_blocking(queue_t* q, void* data);
+
+#endif // MOCK_PICO_UTIL_QUEUE_H
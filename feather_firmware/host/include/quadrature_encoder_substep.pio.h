@@ -0,0 +1,29 @@
+// quadrature_encoder_substep.pio.h
+// Carson Powers
+// Host stand-in for the header generated from pio/quadrature_encoder_substep
+
+#ifndef MOCK_QUADRATURE_ENCODER_SUBSTEP_PIO_H
+#define MOCK_QUADRATURE_ENCODER_SUBSTEP_PIO_H
+
+#include "hardware/pio.h"
+#include "pico/stdlib.h"
+
+static const pio_program_t quadrature_encoder_substep_program = {nullptr, 0, 0};
+
+static inline void quadrature_encoder_substep_program_init(PIO pio, uint sm, uint pin_A) {
+    (void)pio;
+    (void)sm;
+    (void)pin_A;
+    panic("PIO encoders are not simulated, build with ENCODER_USE_PIO=0");
+}
+
+static inline void quadrature_encoder_substep_get_counts(PIO pio, uint sm, uint* step, int* cycles, uint* us) {
+    (void)pio;
+    (void)sm;
+    (void)step;
+    (void)cycles;
+    (void)us;
+    panic("PIO encoders are not simulated, build with ENCODER_USE_PIO=0");
+}
+
+#endif // MOCK_QUADRATURE_ENCODER_SUBSTEP_PIO_H
@@ -0,0 +1,27 @@
+// tusb.h
+// Carson Powers
+// Host mock of the TinyUSB CDC and vendor device API: the simulation feeds
+// received bytes and collects written bytes
+
+#ifndef MOCK_TUSB_H
+#define MOCK_TUSB_H
+
+#include <cstdint>
+
+bool tusb_init();
+void tud_task();
+uint32_t tud_cdc_available();
+int32_t tud_cdc_read_char();
+uint32_t tud_cdc_read(void* buffer, uint32_t bufsize);
+uint32_t tud_cdc_write(const void* buffer, uint32_t bufsize);
+uint32_t tud_cdc_write_available();
+uint32_t tud_cdc_write_flush();
+
+bool tud_vendor_mounted();
+uint32_t tud_vendor_available();
+uint32_t tud_vendor_read(void* buffer, uint32_t bufsize);
+uint32_t tud_vendor_write(const void* buffer, uint32_t bufsize);
+uint32_t tud_vendor_write_available();
+uint32_t tud_vendor_write_flush();
+
+#endif // MOCK_TUSB_H
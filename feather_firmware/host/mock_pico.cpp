@@ -0,0 +1,991 @@
+// mock_pico.cpp
+// Carson Powers
+// Host implementations of the mocked Pico SDK, TinyUSB and MPU6050 used by the feather_firmware simulation
+
+#include "sim.hpp"
+
+// Mocked Pico Libraries
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/util/queue.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+#include "hardware/irq.h"
+#include "hardware/clocks.h"
+#include "hardware/i2c.h"
+#include "hardware/spi.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "hardware/pwm.h"
+#include "hardware/watchdog.h"
+#include "hardware/structs/systick.h"
+#include "tusb.h"
+
+// Standard Libraries
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#define MOCK_GPIO_COUNT 30
+#define MOCK_CLK_SYS_HZ 125000000
+#define MOCK_MAX_REPEATING_TIMERS 16
+
+// -----------------------------------------------------------------------------
+// Interrupts: one recursive lock held by every simulated handler
+// -----------------------------------------------------------------------------
+
+static std::recursive_mutex irq_mutex;
+
+uint32_t save_and_disable_interrupts() {
+    irq_mutex.lock();
+    return 0;
+}
+
+void restore_interrupts(uint32_t status) {
+    (void)status;
+    irq_mutex.unlock();
+}
+
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority) {
+    (void)num;
+    (void)handler;
+    (void)order_priority;
+}
+
+void irq_set_enabled(uint num, bool enabled) {
+    (void)num;
+    (void)enabled;
+}
+
+[[noreturn]] void panic(const char* fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    fputs("*** PANIC ***\n", stderr);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+
+    abort();
+}
+
+bool stdio_init_all() {
+    return true;
+}
+
+uint32_t clock_get_hz(enum clock_index clk_index) {
+    (void)clk_index;
+    return MOCK_CLK_SYS_HZ;
+}
+
+// -----------------------------------------------------------------------------
+// Time and repeating timers
+// -----------------------------------------------------------------------------
+
+static const std::chrono::steady_clock::time_point boot_time = std::chrono::steady_clock::now();
+
+uint64_t time_us_64() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot_time).count();
+}
+
+uint32_t time_us_32() {
+    return (uint32_t)time_us_64();
+}
+
+absolute_time_t get_absolute_time() {
+    return time_us_64();
+}
+
+void sleep_us(uint64_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void sleep_ms(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+systick_hw_t mock_systick_hw;
+
+MockSystickCurrentValue::operator uint32_t() const {
+    uint64_t cycles = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - boot_time).count() * (MOCK_CLK_SYS_HZ / 1000000) / 1000;
+    return (uint32_t)(0x00FFFFFF - (cycles & 0x00FFFFFF));
+}
+
+MockSystickCurrentValue& MockSystickCurrentValue::operator=(uint32_t value) {
+    (void)value;
+    return *this;
+}
+
+struct alarm_pool {
+    uint max_timers;
+};
+
+static alarm_pool default_alarm_pool = {MOCK_MAX_REPEATING_TIMERS};
+static std::atomic<bool> timer_cancelled[MOCK_MAX_REPEATING_TIMERS];
+static std::atomic<bool> timer_in_use[MOCK_MAX_REPEATING_TIMERS];
+
+alarm_pool_t* alarm_pool_create_with_unused_hardware_alarm(uint max_timers) {
+    return new alarm_pool{max_timers};
+}
+
+bool alarm_pool_add_repeating_timer_us(alarm_pool_t* pool, int64_t delay_us, repeating_timer_callback_t callback,
+                                       void* user_data, repeating_timer_t* out) {
+    (void)pool;
+
+    // Find a free timer slot
+    alarm_id_t id = -1;
+    for (int i = 0; i < MOCK_MAX_REPEATING_TIMERS; i++) {
+        bool expected = false;
+        if (timer_in_use[i].compare_exchange_strong(expected, true)) {
+            id = i;
+            break;
+        }
+    }
+    if (id < 0) {
+        return false;
+    }
+
+    timer_cancelled[id] = false;
+    out->delay_us = delay_us;
+    out->pool = pool;
+    out->alarm_id = id;
+    out->callback = callback;
+    out->user_data = user_data;
+
+    // Negative delays are the period between callbacks, positive ones the gap after each
+    std::thread([out, id]() {
+        uint64_t period_us = out->delay_us < 0 ? -out->delay_us : out->delay_us;
+        uint64_t next_us = time_us_64() + period_us;
+
+        while (!timer_cancelled[id]) {
+            std::this_thread::sleep_for(std::chrono::microseconds(next_us - std::min(next_us, time_us_64())));
+            if (timer_cancelled[id]) {
+                break;
+            }
+
+            bool keep;
+            {
+                std::lock_guard<std::recursive_mutex> lock(irq_mutex);
+                keep = out->callback(out);
+            }
+            if (!keep) {
+                break;
+            }
+            next_us = (out->delay_us < 0 ? next_us : time_us_64()) + period_us;
+        }
+        timer_in_use[id] = false;
+    }).detach();
+
+    return true;
+}
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void* user_data, repeating_timer_t* out) {
+    return alarm_pool_add_repeating_timer_us(&default_alarm_pool, delay_us, callback, user_data, out);
+}
+
+bool cancel_repeating_timer(repeating_timer_t* timer) {
+    if (timer->alarm_id < 0 || timer->alarm_id >= MOCK_MAX_REPEATING_TIMERS) {
+        return false;
+    }
+
+    // Wait for the timer thread so the callback does not run after this returns
+    timer_cancelled[timer->alarm_id] = true;
+    while (timer_in_use[timer->alarm_id]) {
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// Multicore: core1 is a detached host thread
+// -----------------------------------------------------------------------------
+
+struct MockFifo {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<uint32_t> data;
+};
+
+static MockFifo fifo_to_core0;
+static MockFifo fifo_to_core1;
+static thread_local uint32_t core_num = 0;
+
+void multicore_launch_core1(void (*entry)()) {
+    std::thread([entry]() {
+        core_num = 1;
+        entry();
+    }).detach();
+}
+
+uint32_t get_core_num() {
+    return core_num;
+}
+
+void multicore_fifo_push_blocking(uint32_t data) {
+    MockFifo& fifo = core_num ? fifo_to_core0 : fifo_to_core1;
+    std::lock_guard<std::mutex> lock(fifo.mutex);
+
+    fifo.data.push_back(data);
+    fifo.ready.notify_one();
+}
+
+uint32_t multicore_fifo_pop_blocking() {
+    MockFifo& fifo = core_num ? fifo_to_core1 : fifo_to_core0;
+    std::unique_lock<std::mutex> lock(fifo.mutex);
+
+    fifo.ready.wait(lock, [&fifo]() { return !fifo.data.empty(); });
+    uint32_t data = fifo.data.front();
+    fifo.data.pop_front();
+    return data;
+}
+
+// -----------------------------------------------------------------------------
+// Watchdog: never fires
+// -----------------------------------------------------------------------------
+
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug) {
+    (void)delay_ms;
+    (void)pause_on_debug;
+}
+
+void watchdog_update() {}
+
+// -----------------------------------------------------------------------------
+// Queues
+// -----------------------------------------------------------------------------
+
+struct MockQueue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> elements;
+    uint element_size;
+    uint element_count;
+};
+
+void queue_init(queue_t* q, uint element_size, uint element_count) {
+    MockQueue* queue = new MockQueue();
+
+    queue->element_size = element_size;
+    queue->element_count = element_count;
+    q->impl = queue;
+}
+
+void queue_free(queue_t* q) {
+    delete static_cast<MockQueue*>(q->impl);
+    q->impl = nullptr;
+}
+
+uint queue_get_level(queue_t* q) {
+    MockQueue* queue = static_cast<MockQueue*>(q->impl);
+    std::lock_guard<std::mutex> lock(queue->mutex);
+
+    return queue->elements.size();
+}
+
+bool queue_try_add(queue_t* q, const void* data) {
+    MockQueue* queue = static_cast<MockQueue*>(q->impl);
+    std::lock_guard<std::mutex> lock(queue->mutex);
+
+    if (queue->elements.size() >= queue->element_count) {
+        return false;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    queue->elements.emplace_back(bytes, bytes + queue->element_size);
+    queue->changed.notify_all();
+    return true;
+}
+
+bool queue_try_remove(queue_t* q, void* data) {
+    MockQueue* queue = static_cast<MockQueue*>(q->impl);
+    std::lock_guard<std::mutex> lock(queue->mutex);
+
+    if (queue->elements.empty()) {
+        return false;
+    }
+    memcpy(data, queue->elements.front().data(), queue->element_size);
+    queue->elements.pop_front();
+    queue->changed.notify_all();
+    return true;
+}
+
+void queue_add_blocking(queue_t* q, const void* data) {
+    MockQueue* queue = static_cast<MockQueue*>(q->impl);
+    std::unique_lock<std::mutex> lock(queue->mutex);
+
+    queue->changed.wait(lock, [queue]() { return queue->elements.size() < queue->element_count; });
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    queue->elements.emplace_back(bytes, bytes + queue->element_size);
+    queue->changed.notify_all();
+}
+
+void queue_remove_blocking(queue_t* q, void* data) {
+    MockQueue* queue = static_cast<MockQueue*>(q->impl);
+    std::unique_lock<std::mutex> lock(queue->mutex);
+
+    queue->changed.wait(lock, [queue]() { return !queue->elements.empty(); });
+    memcpy(data, queue->elements.front().data(), queue->element_size);
+    queue->elements.pop_front();
+    queue->changed.notify_all();
+}
+
+// -----------------------------------------------------------------------------
+// GPIO
+// -----------------------------------------------------------------------------
+
+static std::atomic<uint32_t> gpio_levels(0);
+static uint32_t gpio_irq_masks[MOCK_GPIO_COUNT];
+static uint32_t gpio_pending_events[MOCK_GPIO_COUNT];
+static uint32_t gpio_pending_changes = 0;
+static uint32_t gpio_irq_batch = 1;
+static gpio_irq_callback_t gpio_callback = nullptr;
+
+void gpio_init(uint gpio) {
+    gpio_irq_masks[gpio] = 0;
+}
+
+void gpio_set_dir(uint gpio, bool out) {
+    (void)gpio;
+    (void)out;
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn) {
+    (void)gpio;
+    (void)fn;
+}
+
+void gpio_pull_up(uint gpio) {
+    (void)gpio;
+}
+
+void gpio_put(uint gpio, bool value) {
+    if (value) {
+        gpio_levels |= (1u << gpio);
+    } else {
+        gpio_levels &= ~(1u << gpio);
+    }
+}
+
+bool gpio_get(uint gpio) {
+    return (gpio_levels >> gpio) & 1;
+}
+
+uint32_t gpio_get_all() {
+    return gpio_levels;
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled) {
+    std::lock_guard<std::recursive_mutex> lock(irq_mutex);
+
+    if (enabled) {
+        gpio_irq_masks[gpio] |= event_mask;
+    } else {
+        gpio_irq_masks[gpio] &= ~event_mask;
+    }
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask, bool enabled, gpio_irq_callback_t callback) {
+    std::lock_guard<std::recursive_mutex> lock(irq_mutex);
+
+    gpio_callback = callback;
+    gpio_set_irq_enabled(gpio, event_mask, enabled);
+}
+
+void sim_gpio_set_levels(uint32_t mask, uint32_t values) {
+    std::lock_guard<std::recursive_mutex> lock(irq_mutex);
+    uint32_t old_levels = gpio_levels;
+    uint32_t new_levels = (old_levels & ~mask) | (values & mask);
+    uint32_t changed = old_levels ^ new_levels;
+
+    gpio_levels = new_levels;
+
+    // Latch edge events like the IO bank interrupt status registers
+    for (uint gpio = 0; gpio < MOCK_GPIO_COUNT; gpio++) {
+        if (changed & (1u << gpio)) {
+            gpio_pending_events[gpio] |= (new_levels & (1u << gpio)) ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+            gpio_pending_changes++;
+        }
+    }
+
+    if (gpio_pending_changes >= gpio_irq_batch) {
+        sim_gpio_service_irqs();
+    }
+}
+
+void sim_gpio_set_irq_batch(uint32_t changes) {
+    std::lock_guard<std::recursive_mutex> lock(irq_mutex);
+
+    gpio_irq_batch = changes ? changes : 1;
+}
+
+void sim_gpio_service_irqs() {
+    std::lock_guard<std::recursive_mutex> lock(irq_mutex);
+
+    // The SDK handler calls the callback for each pin in ascending order
+    for (uint gpio = 0; gpio < MOCK_GPIO_COUNT; gpio++) {
+        uint32_t events = gpio_pending_events[gpio] & gpio_irq_masks[gpio];
+        gpio_pending_events[gpio] = 0;
+
+        if (events && gpio_callback) {
+            gpio_callback(gpio, events);
+        }
+    }
+    gpio_pending_changes = 0;
+}
+
+// -----------------------------------------------------------------------------
+// PWM: levels are only stored, the simulation reads them back
+// -----------------------------------------------------------------------------
+
+#define MOCK_PWM_SLICES 8
+
+static std::atomic<uint16_t> pwm_wraps[MOCK_PWM_SLICES];
+static std::atomic<uint16_t> pwm_levels[MOCK_GPIO_COUNT];
+
+pwm_config pwm_get_default_config() {
+    return pwm_config{0, 1 << 4, 0xFFFF};
+}
+
+void pwm_config_set_clkdiv_int(pwm_config* c, uint div) {
+    c->div = div << 4;
+}
+
+void pwm_config_set_wrap(pwm_config* c, uint16_t wrap) {
+    c->top = wrap;
+}
+
+void pwm_init(uint slice_num, pwm_config* c, bool start) {
+    (void)start;
+    pwm_wraps[slice_num] = (uint16_t)c->top;
+}
+
+uint pwm_gpio_to_slice_num(uint gpio) {
+    return (gpio >> 1) & 7;
+}
+
+void pwm_set_gpio_level(uint gpio, uint16_t level) {
+    pwm_levels[gpio] = level;
+}
+
+double sim_pwm_get_duty(uint32_t dir_pin, uint32_t pwm_pin) {
+    uint16_t wrap = pwm_wraps[pwm_gpio_to_slice_num(pwm_pin)];
+    double duty = wrap ? (double)pwm_levels[pwm_pin] / wrap : 0.0;
+
+    return gpio_get(dir_pin) ? -duty : duty;
+}
+
+// -----------------------------------------------------------------------------
+// I2C with an MPU6050 at 0x68, SPI with an MPU9250 on spi0
+// -----------------------------------------------------------------------------
+
+#define MOCK_MPU6050_ADDR 0x68
+#define MOCK_MPU_DATA_START 0x3B
+#define MOCK_MPU_DATA_LENGTH 14
+#define MOCK_MPU_PWR_MGMT_1 0x6B
+#define MOCK_MPU_WHO_AM_I 0x75
+#define MOCK_MPU_RESET_US 5000 // The device does not answer while it resets
+#define MOCK_MPU9250_WHO_AM_I_VALUE 0x71
+#define MOCK_MPU9250_CS_PIN 7
+#define MOCK_MPU9250_SPI_READ_BIT 0x80
+#define MOCK_MPU9250_WRITE_MAX_BAUD 1000000 // Register writes, and reads outside the sensor registers, above this fail
+#define MOCK_MPU9250_READ_MAX_BAUD 20000000 // Sensor and interrupt register reads
+#define MOCK_MPU9250_FAST_READ_START 0x3A // INT_STATUS, then the data registers
+#define MOCK_MPU9250_FAST_READ_END 0x61 // Past EXT_SENS_DATA_23
+
+/**
+ * @brief Register file shared by the MPU6050 and MPU9250 models.
+ */
+struct MockMPU {
+    std::mutex mutex;
+    uint8_t registers[128];
+    uint8_t pointer = 0;
+    uint64_t reset_until_us = 0;
+    int fail_write_reg = -1; // Register whose next write is refused, -1 for none
+    uint8_t who_am_i;
+
+    explicit MockMPU(uint8_t who_am_i_value) : who_am_i(who_am_i_value) {
+        power_on_reset();
+    }
+
+    void power_on_reset() {
+        memset(registers, 0, sizeof(registers));
+        registers[MOCK_MPU_PWR_MGMT_1] = 0x40;
+        registers[MOCK_MPU_WHO_AM_I] = who_am_i;
+    }
+
+    bool resetting() const {
+        return time_us_64() < reset_until_us;
+    }
+
+    // Bytes after the register address are written from there on
+    void write(uint8_t reg, const uint8_t* src, size_t len) {
+        pointer = reg & 0x7F;
+        for (size_t i = 0; i < len; i++) {
+            uint8_t address = pointer++ & 0x7F;
+
+            // Device reset restores the power on values (and clears the reset bit)
+            if (address == MOCK_MPU_PWR_MGMT_1 && (src[i] & 0x80)) {
+                power_on_reset();
+                reset_until_us = time_us_64() + MOCK_MPU_RESET_US;
+                continue;
+            }
+            registers[address] = src[i];
+        }
+    }
+
+    void read(uint8_t* dst, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            dst[i] = registers[pointer++ & 0x7F];
+        }
+    }
+};
+
+static MockMPU mpu6050(MOCK_MPU6050_ADDR);
+static MockMPU mpu9250(MOCK_MPU9250_WHO_AM_I_VALUE);
+
+struct i2c_inst {
+    i2c_hw_t hw;
+};
+
+i2c_inst_t i2c0_inst;
+
+uint i2c_init(i2c_inst_t* i2c, uint baudrate) {
+    (void)i2c;
+    return baudrate;
+}
+
+int i2c_write_blocking(i2c_inst_t* i2c, uint8_t addr, const uint8_t* src, size_t len, bool nostop) {
+    (void)i2c;
+    (void)nostop;
+    std::lock_guard<std::mutex> lock(mpu6050.mutex);
+
+    if (addr != MOCK_MPU6050_ADDR || len == 0 || mpu6050.resetting()) {
+        return PICO_ERROR_GENERIC;
+    }
+
+    // One-shot failure, as from a glitch on the bus
+    if (src[0] == mpu6050.fail_write_reg) {
+        mpu6050.fail_write_reg = -1;
+        return PICO_ERROR_GENERIC;
+    }
+
+    // First byte sets the register pointer
+    mpu6050.write(src[0], &src[1], len - 1);
+
+    return (int)len;
+}
+
+int i2c_read_blocking(i2c_inst_t* i2c, uint8_t addr, uint8_t* dst, size_t len, bool nostop) {
+    (void)i2c;
+    (void)nostop;
+    std::lock_guard<std::mutex> lock(mpu6050.mutex);
+
+    if (addr != MOCK_MPU6050_ADDR || mpu6050.resetting()) {
+        return PICO_ERROR_GENERIC;
+    }
+    mpu6050.read(dst, len);
+
+    return (int)len;
+}
+
+i2c_hw_t* i2c_get_hw(i2c_inst_t* i2c) {
+    return &i2c->hw;
+}
+
+uint i2c_get_dreq(i2c_inst_t* i2c, bool is_tx) {
+    (void)i2c;
+    return is_tx ? 32 : 33;
+}
+
+size_t i2c_get_read_available(i2c_inst_t* i2c) {
+    (void)i2c;
+    return 0;
+}
+
+// Every spi_write_blocking() with the chip select low starts a transaction:
+// the first byte is the register address, with the read bit for reads that
+// spi_read_blocking() then clocks in. A device that is resetting (or is not
+// selected) reads as all ones, like a floating MISO line, and so does a
+// register read at a clock above what the register allows
+struct spi_inst {
+    spi_hw_t hw;
+    uint baudrate;
+    bool reading;
+};
+
+spi_inst_t spi0_inst;
+
+uint spi_init(spi_inst_t* spi, uint baudrate) {
+    spi->reading = false;
+    return spi_set_baudrate(spi, baudrate);
+}
+
+uint spi_set_baudrate(spi_inst_t* spi, uint baudrate) {
+    spi->baudrate = baudrate;
+    return baudrate;
+}
+
+void spi_set_format(spi_inst_t* spi, uint data_bits, spi_cpol_t cpol, spi_cpha_t cpha, spi_order_t order) {
+    (void)spi;
+    (void)data_bits;
+    (void)cpol;
+    (void)cpha;
+    (void)order;
+}
+
+int spi_write_blocking(spi_inst_t* spi, const uint8_t* src, size_t len) {
+    std::lock_guard<std::mutex> lock(mpu9250.mutex);
+
+    spi->reading = false;
+    if (len == 0 || gpio_get(MOCK_MPU9250_CS_PIN) || mpu9250.resetting()) {
+        return (int)len;
+    }
+
+    if (src[0] & MOCK_MPU9250_SPI_READ_BIT) {
+        mpu9250.pointer = src[0] & 0x7F;
+        bool fast = mpu9250.pointer >= MOCK_MPU9250_FAST_READ_START && mpu9250.pointer < MOCK_MPU9250_FAST_READ_END;
+        spi->reading = spi->baudrate <= (fast ? MOCK_MPU9250_READ_MAX_BAUD : MOCK_MPU9250_WRITE_MAX_BAUD);
+    } else if (spi->baudrate <= MOCK_MPU9250_WRITE_MAX_BAUD) {
+        mpu9250.write(src[0], &src[1], len - 1);
+    }
+
+    return (int)len;
+}
+
+int spi_read_blocking(spi_inst_t* spi, uint8_t repeated_tx_data, uint8_t* dst, size_t len) {
+    (void)repeated_tx_data;
+    std::lock_guard<std::mutex> lock(mpu9250.mutex);
+
+    if (!spi->reading || gpio_get(MOCK_MPU9250_CS_PIN) || mpu9250.resetting()) {
+        memset(dst, 0xFF, len);
+        return (int)len;
+    }
+    mpu9250.read(dst, len);
+
+    return (int)len;
+}
+
+spi_hw_t* spi_get_hw(spi_inst_t* spi) {
+    return &spi->hw;
+}
+
+uint spi_get_dreq(spi_inst_t* spi, bool is_tx) {
+    (void)spi;
+    return is_tx ? 16 : 17;
+}
+
+bool spi_is_readable(const spi_inst_t* spi) {
+    (void)spi;
+    return false;
+}
+
+bool spi_is_busy(const spi_inst_t* spi) {
+    (void)spi;
+    return false;
+}
+
+void sim_mpu6050_set_data(const uint8_t* data) {
+    std::lock_guard<std::mutex> lock(mpu6050.mutex);
+
+    memcpy(&mpu6050.registers[MOCK_MPU_DATA_START], data, MOCK_MPU_DATA_LENGTH);
+}
+
+uint8_t sim_mpu6050_get_register(uint8_t reg) {
+    std::lock_guard<std::mutex> lock(mpu6050.mutex);
+
+    return mpu6050.registers[reg & 0x7F];
+}
+
+void sim_mpu6050_fail_write(uint8_t reg) {
+    std::lock_guard<std::mutex> lock(mpu6050.mutex);
+
+    mpu6050.fail_write_reg = reg & 0x7F;
+}
+
+void sim_mpu9250_set_data(const uint8_t* data) {
+    std::lock_guard<std::mutex> lock(mpu9250.mutex);
+
+    memcpy(&mpu9250.registers[MOCK_MPU_DATA_START], data, MOCK_MPU_DATA_LENGTH);
+}
+
+uint8_t sim_mpu9250_get_register(uint8_t reg) {
+    std::lock_guard<std::mutex> lock(mpu9250.mutex);
+
+    return mpu9250.registers[reg & 0x7F];
+}
+
+// -----------------------------------------------------------------------------
+// DMA and PIO: claimable, never run
+// -----------------------------------------------------------------------------
+
+static std::atomic<int> dma_next_channel(0);
+
+int dma_claim_unused_channel(bool required) {
+    int channel = dma_next_channel++;
+
+    if (channel >= 12) {
+        if (required) {
+            panic("No DMA channels are available");
+        }
+        return -1;
+    }
+    return channel;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel) {
+    (void)channel;
+    return dma_channel_config{0};
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size) {
+    (void)c;
+    (void)size;
+}
+
+void channel_config_set_read_increment(dma_channel_config* c, bool incr) {
+    (void)c;
+    (void)incr;
+}
+
+void channel_config_set_write_increment(dma_channel_config* c, bool incr) {
+    (void)c;
+    (void)incr;
+}
+
+void channel_config_set_dreq(dma_channel_config* c, uint dreq) {
+    (void)c;
+    (void)dreq;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* write_addr,
+                           const volatile void* read_addr, uint transfer_count, bool trigger) {
+    (void)channel;
+    (void)config;
+    (void)write_addr;
+    (void)read_addr;
+    (void)transfer_count;
+    if (trigger) {
+        panic("DMA transfers are not simulated");
+    }
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger) {
+    (void)channel;
+    (void)trans_count;
+    if (trigger) {
+        panic("DMA transfers are not simulated");
+    }
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void* read_addr, bool trigger) {
+    (void)channel;
+    (void)read_addr;
+    if (trigger) {
+        panic("DMA transfers are not simulated");
+    }
+}
+
+void dma_channel_set_write_addr(uint channel, volatile void* write_addr, bool trigger) {
+    (void)channel;
+    (void)write_addr;
+    if (trigger) {
+        panic("DMA transfers are not simulated");
+    }
+}
+
+void dma_channel_abort(uint channel) {
+    (void)channel;
+}
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled) {
+    (void)channel;
+    (void)enabled;
+}
+
+bool dma_channel_get_irq0_status(uint channel) {
+    (void)channel;
+    return false;
+}
+
+void dma_channel_acknowledge_irq0(uint channel) {
+    (void)channel;
+}
+
+struct pio_hw {
+    int unused;
+};
+
+pio_hw_t pio0_hw;
+pio_hw_t pio1_hw;
+
+void pio_add_program_at_offset(PIO pio, const pio_program_t* program, uint offset) {
+    (void)pio;
+    (void)program;
+    (void)offset;
+    panic("PIO is not simulated");
+}
+
+int pio_claim_unused_sm(PIO pio, bool required) {
+    (void)pio;
+    (void)required;
+    panic("PIO is not simulated");
+}
+
+// -----------------------------------------------------------------------------
+// TinyUSB CDC and vendor interfaces
+// -----------------------------------------------------------------------------
+
+/**
+ * @brief Bytes in flight on one mocked USB interface.
+ */
+struct MockUsbInterface {
+    std::deque<uint8_t> rx;
+    std::vector<uint8_t> tx;
+    size_t tx_capacity = 0; // Bytes tx holds before writes stop, 0 for no limit.
+    uint32_t flush_count = 0;
+
+    uint32_t read(void* buffer, uint32_t bufsize) {
+        uint8_t* bytes = static_cast<uint8_t*>(buffer);
+        uint32_t count = 0;
+
+        while (count < bufsize && !rx.empty()) {
+            bytes[count++] = rx.front();
+            rx.pop_front();
+        }
+        return count;
+    }
+
+    uint32_t write_available() const {
+        return tx_capacity ? (uint32_t)(tx_capacity - std::min(tx_capacity, tx.size())) : UINT32_MAX;
+    }
+
+    uint32_t write(const void* buffer, uint32_t bufsize) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(buffer);
+
+        bufsize = std::min(bufsize, write_available());
+        tx.insert(tx.end(), bytes, bytes + bufsize);
+        return bufsize;
+    }
+};
+
+static std::mutex usb_mutex;
+static MockUsbInterface usb_cdc;
+static MockUsbInterface usb_vendor;
+
+bool tusb_init() {
+    return true;
+}
+
+void tud_task() {
+}
+
+uint32_t tud_cdc_available() {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+
+    return usb_cdc.rx.size();
+}
+
+int32_t tud_cdc_read_char() {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+    uint8_t byte;
+
+    return usb_cdc.read(&byte, 1) ? byte : -1;
+}
+
+uint32_t tud_cdc_read(void* buffer, uint32_t bufsize) {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+
+    return usb_cdc.read(buffer, bufsize);
+}
+
+uint32_t tud_cdc_write(const void* buffer, uint32_t bufsize) {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+
+    return usb_cdc.write(buffer, bufsize);
+}
+
+uint32_t tud_cdc_write_available() {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+
+    return usb_cdc.write_available();
+}
+
+uint32_t tud_cdc_write_flush() {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+
+    usb_cdc.flush_count++;
+    return 0;
+}
+
+bool tud_vendor_mounted() {
+    return true;
+}
+
+uint32_t tud_vendor_available() {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+
+    return usb_vendor.rx.size();
+}
+
+uint32_t tud_vendor_read(void* buffer, uint32_t bufsize) {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+
+    return usb_vendor.read(buffer, bufsize);
+}
+
+uint32_t tud_vendor_write(const void* buffer, uint32_t bufsize) {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+
+    return usb_vendor.write(buffer, bufsize);
+}
+
+uint32_t tud_vendor_write_available() {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+
+    return usb_vendor.write_available();
+}
+
+uint32_t tud_vendor_write_flush() {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+
+    usb_vendor.flush_count++;
+    return 0;
+}
+
+static MockUsbInterface& sim_usb_interface(bool vendor) {
+    return vendor ? usb_vendor : usb_cdc;
+}
+
+void sim_usb_receive(const uint8_t* data, size_t length, bool vendor) {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+    MockUsbInterface& interface = sim_usb_interface(vendor);
+
+    interface.rx.insert(interface.rx.end(), data, data + length);
+}
+
+std::vector<uint8_t> sim_usb_take_transmitted(bool vendor) {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+    std::vector<uint8_t> data;
+
+    data.swap(sim_usb_interface(vendor).tx);
+    return data;
+}
+
+void sim_usb_set_tx_capacity(size_t capacity, bool vendor) {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+
+    sim_usb_interface(vendor).tx_capacity = capacity;
+}
+
+uint32_t sim_usb_get_flush_count(bool vendor) {
+    std::lock_guard<std::mutex> lock(usb_mutex);
+
+    return sim_usb_interface(vendor).flush_count;
+}
@@ -0,0 +1,104 @@
+// sim.hpp
+// Carson Powers
+// Header file for the controls the host simulation has over the mocked Pico hardware
+
+#ifndef SIM_HPP
+#define SIM_HPP
+
+// Standard Libraries
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Set GPIO input levels and raise edge events on the pins that changed.
+ *
+ * Events are delivered to the GPIO callback right away, or held until
+ * sim_gpio_service_irqs() while a batch is set with sim_gpio_set_irq_batch().
+ *
+ * @param mask The pins to set.
+ * @param values The new levels of the pins in mask.
+ */
+void sim_gpio_set_levels(uint32_t mask, uint32_t values);
+
+/**
+ * @brief Hold edge events until this many pin changes are pending.
+ *
+ * Models interrupt latency: pins that change more than once before the
+ * callback runs report both edges, and the callback only sees the last level.
+ *
+ * @param changes Pin changes per interrupt (1 delivers every change).
+ */
+void sim_gpio_set_irq_batch(uint32_t changes);
+
+/**
+ * @brief Deliver all pending edge events to the GPIO callback.
+ */
+void sim_gpio_service_irqs();
+
+/**
+ * @brief Get the signed motor drive of a direction and PWM pin pair.
+ * @param dir_pin The direction pin (high is reverse).
+ * @param pwm_pin The PWM pin.
+ * @return double The PWM level over the slice wrap, negative when dir_pin is high.
+ */
+double sim_pwm_get_duty(uint32_t dir_pin, uint32_t pwm_pin);
+
+/**
+ * @brief Set the MPU6050 data registers (0x3B - 0x48).
+ * @param data The 14 register values.
+ */
+void sim_mpu6050_set_data(const uint8_t* data);
+
+/**
+ * @brief Get an MPU6050 register value.
+ * @param reg The register address.
+ * @return uint8_t The register value.
+ */
+uint8_t sim_mpu6050_get_register(uint8_t reg);
+
+/**
+ * @brief Make the next I2C write to an MPU6050 register fail.
+ * @param reg The register address.
+ */
+void sim_mpu6050_fail_write(uint8_t reg);
+
+/**
+ * @brief Set the MPU9250 (SPI) data registers (0x3B - 0x48).
+ * @param data The 14 register values.
+ */
+void sim_mpu9250_set_data(const uint8_t* data);
+
+/**
+ * @brief Get an MPU9250 (SPI) register value.
+ * @param reg The register address.
+ * @return uint8_t The register value.
+ */
+uint8_t sim_mpu9250_get_register(uint8_t reg);
+
+/**
+ * @brief Queue bytes as if received from the USB host.
+ * @param vendor True for the vendor interface, false for CDC.
+ */
+void sim_usb_receive(const uint8_t* data, size_t length, bool vendor = false);
+
+/**
+ * @brief Take every byte written to a USB interface since the last call.
+ * @param vendor True for the vendor interface, false for CDC.
+ */
+std::vector<uint8_t> sim_usb_take_transmitted(bool vendor = false);
+
+/**
+ * @brief Model a transmit FIFO that only drains when sim_usb_take_transmitted() is called.
+ * @param capacity The FIFO size in bytes, 0 for no limit.
+ * @param vendor True for the vendor interface, false for CDC.
+ */
+void sim_usb_set_tx_capacity(size_t capacity, bool vendor = false);
+
+/**
+ * @brief Get the number of write flushes (USB transfers started) on an interface.
+ * @param vendor True for tud_vendor_write_flush(), false for tud_cdc_write_flush().
+ */
+uint32_t sim_usb_get_flush_count(bool vendor = false);
+
+#endif // SIM_HPP
@@ -3,17 +3,35 @@
 // Source file for the IMU functionality on the Adafruit Feather RP2040 on the AHSR robot
 
 #include "imu.hpp"
+#include "instrumentation.hpp"
 
 // Standard Libraries
 #include <cstdio>
 #include <iostream>
+#include <cstring>
 
 // Pico Libraries
 #include "pico/stdlib.h"
 #include "pico/binary_info.h"
 #include "hardware/i2c.h"
+#include "hardware/spi.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 
-IMU::IMU() {
+// Initialize the static instance pointer
+IMU* IMU::imu_instance_ = nullptr;
+
+IMU::IMU(IMUBus bus)
+    : bus_(bus), user_ctrl_(bus == IMUBus::SPI ? USER_CTRL_I2C_IF_DIS : 0x00), spi_read_baud_(false),
+      config_{IMU_GYRO_RANGE_DEFAULT, IMU_ACCEL_RANGE_DEFAULT, IMU_DLPF_DEFAULT, IMU_SAMPLE_RATE_DIVIDER},
+      init_state_(IMUInitState::NOT_STARTED), init_attempts_(0), init_step_us_(0), init_deadline_us_(0), started_us_(0),
+      async_(false), paused_(false), tx_channel_(-1), rx_channel_(-1), stop_index_(0), spi_tx_buffer_(),
+      spi_rx_buffer_(), read_buffer_(nullptr), read_length_(0),
+      latest_slot_(0), sample_count_(0), blocking_read_failed_(false), stage_(ReadStage::IDLE), read_start_us_(0), overrun_count_(0),
+      fifo_mode_(false), fifo_size_(bus == IMUBus::SPI ? IMU_FIFO_SIZE_MPU9250 : IMU_FIFO_SIZE),
+      fifo_sample_period_us_(IMU_FIFO_SAMPLE_PERIOD_US), fifo_ready_count_(0), fifo_drain_us_(0), fifo_burst_samples_(0),
+      fifo_reset_pending_(false), fifo_head_(0), fifo_tail_(0), fifo_dropped_(0), fifo_overflows_(0) {
     this->ax = 0;
     this->ay = 0;
     this->az = 0;
@@ -23,37 +41,260 @@ IMU::IMU() {
     this->temp = 0;
 }
 
-void IMU::readIMU(uint8_t reg, uint8_t* read_buffer, uint8_t bufferLength)
+bool IMU::readIMU(uint8_t reg, uint8_t* read_buffer, uint8_t bufferLength)
 {
-    i2c_write_blocking(i2c_default, MPU6050_ADDR, &reg, 1, true);  // Register address
-    i2c_read_blocking(i2c_default, MPU6050_ADDR, read_buffer, bufferLength, false);  // Read data
+    if (bus_ == IMUBus::SPI) {
+        // Address with the read bit, then clock the registers in
+        uint8_t address = reg | IMU_SPI_READ_BIT;
+        set_spi_baud(false);
+        gpio_put(IMU_SPI_CS_PIN, 0);
+        spi_write_blocking(IMU_SPI, &address, 1);
+        int read = spi_read_blocking(IMU_SPI, 0, read_buffer, bufferLength);
+        gpio_put(IMU_SPI_CS_PIN, 1);
+        return read == bufferLength;
+    }
+
+    if (i2c_write_blocking(i2c_default, MPU6050_ADDR, &reg, 1, true) != 1) {  // Register address
+        return false;
+    }
+    return i2c_read_blocking(i2c_default, MPU6050_ADDR, read_buffer, bufferLength, false) == bufferLength;  // Read data
 }
 
-void IMU::writeIMU(uint8_t reg, uint8_t data)
+bool IMU::writeIMU(uint8_t reg, uint8_t data)
 {
     uint8_t write_buffer[] = {reg, data};
-    i2c_write_blocking(i2c_default, MPU6050_ADDR, write_buffer, 2, false);
+
+    if (bus_ == IMUBus::SPI) {
+        set_spi_baud(false);
+        gpio_put(IMU_SPI_CS_PIN, 0);
+        int written = spi_write_blocking(IMU_SPI, write_buffer, 2);
+        gpio_put(IMU_SPI_CS_PIN, 1);
+        return written == 2;
+    }
+
+    return i2c_write_blocking(i2c_default, MPU6050_ADDR, write_buffer, 2, false) == 2;
 }
 
 void IMU::initializeIMU()
 {
-    // Reset device
-    writeIMU(0x6B, 0x80);
+    // I2C is shared and brought up by main(); the SPI bus is the IMU's own
+    if (bus_ == IMUBus::SPI) {
+        spi_init(IMU_SPI, IMU_SPI_CONFIG_BAUD);
+        spi_set_format(IMU_SPI, 8, SPI_CPOL_1, SPI_CPHA_1, SPI_MSB_FIRST);
+        gpio_set_function(IMU_SPI_SCK_PIN, GPIO_FUNC_SPI);
+        gpio_set_function(IMU_SPI_TX_PIN, GPIO_FUNC_SPI);
+        gpio_set_function(IMU_SPI_RX_PIN, GPIO_FUNC_SPI);
+
+        // Chip select is active low
+        gpio_init(IMU_SPI_CS_PIN);
+        gpio_set_dir(IMU_SPI_CS_PIN, GPIO_OUT);
+        gpio_put(IMU_SPI_CS_PIN, 1);
+        spi_read_baud_ = false;
+    }
+
+    begin_reset();
+}
+
+IMUBus IMU::get_bus() const
+{
+    return bus_;
+}
+
+bool IMU::who_am_i_valid(uint8_t who_am_i) const
+{
+    if (bus_ == IMUBus::SPI) {
+        return who_am_i == MPU9250_WHO_AM_I_VALUE || who_am_i == MPU9255_WHO_AM_I_VALUE ||
+               who_am_i == MPU6500_WHO_AM_I_VALUE;
+    }
 
-    sleep_ms(100); // Wait for reset
+    return (who_am_i & 0x7E) == MPU6050_WHO_AM_I_VALUE;
+}
+
+void IMU::set_spi_baud(bool read_baud)
+{
+    if (bus_ != IMUBus::SPI || spi_read_baud_ == read_baud) {
+        return;
+    }
+
+    spi_set_baudrate(IMU_SPI, read_baud ? IMU_SPI_READ_BAUD : IMU_SPI_CONFIG_BAUD);
+    spi_read_baud_ = read_baud;
+}
+
+void IMU::begin_reset()
+{
+    uint64_t now_us = time_us_64();
+
+    init_attempts_++;
+    init_step_us_ = now_us;
+
+    // Reset device; a device that does not answer is retried later
+    if (!writeIMU(PWR_MGMT_1, PWR_MGMT_1_DEVICE_RESET)) {
+        init_state_ = IMUInitState::NOT_FOUND;
+        init_deadline_us_ = now_us + IMU_INIT_RETRY_US;
+        return;
+    }
 
+    init_state_ = IMUInitState::RESETTING;
+    init_deadline_us_ = now_us + IMU_RESET_POLL_US;
+}
+
+void IMU::service_initialization()
+{
+    uint64_t now_us = time_us_64();
+
+    if (now_us < init_deadline_us_) {
+        return;
+    }
+
+    switch (init_state_) {
+        case IMUInitState::RESETTING:
+        {
+            // The device may not answer until the reset is done
+            uint8_t power = PWR_MGMT_1_DEVICE_RESET;
+            if (!readIMU(PWR_MGMT_1, &power, 1) || (power & PWR_MGMT_1_DEVICE_RESET)) {
+                if ((now_us - init_step_us_) > IMU_RESET_TIMEOUT_US) {
+                    init_state_ = IMUInitState::NOT_FOUND;
+                    init_deadline_us_ = now_us + IMU_INIT_RETRY_US;
+                } else {
+                    init_deadline_us_ = now_us + IMU_RESET_POLL_US;
+                }
+                break;
+            }
+
+            // Make sure it is the expected device before configuring it
+            uint8_t who_am_i = 0;
+            if (!readIMU(WHO_AM_I, &who_am_i, 1) || !who_am_i_valid(who_am_i)) {
+                init_state_ = IMUInitState::NOT_FOUND;
+                init_deadline_us_ = now_us + IMU_INIT_RETRY_US;
+                break;
+            }
+
+            configure();
+            break;
+        }
+
+        case IMUInitState::STARTING:
+        {
+            init_state_ = IMUInitState::READY;
+            break;
+        }
+
+        case IMUInitState::NOT_FOUND:
+        {
+            begin_reset();
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+void IMU::configure()
+{
     // Wake up device
-    writeIMU(0x6B, 0x00);
+    bool written = writeIMU(PWR_MGMT_1, 0x00);
+
+    // The MPU9250 leaves its I2C interface on after a reset, which can
+    // misread SPI traffic, and filters the accelerometer to 1 kHz by default
+    if (bus_ == IMUBus::SPI) {
+        written = written && writeIMU(USER_CTRL, user_ctrl_) && writeIMU(ACCEL_CONFIG2, ACCEL_CONFIG2_FCHOICE_B);
+    }
+
+    // Ranges, filter and sample rate (1 kHz at 500 dps, 4 g by default)
+    written = written && write_config();
+
+    // Active high, push-pull INT pulse on data ready
+    written = written && writeIMU(INT_PIN_CFG, 0x00) && writeIMU(INT_ENABLE, 0x01);
+
+    // A device that stopped answering is reset and configured again later
+    if (!written) {
+        init_state_ = IMUInitState::NOT_FOUND;
+        init_deadline_us_ = time_us_64() + IMU_INIT_RETRY_US;
+        return;
+    }
+
+    // Sample right away; the gyro settles while samples already flow
+    start_async_reads();
+    started_us_ = time_us_64();
+    init_state_ = IMUInitState::STARTING;
+    init_deadline_us_ = started_us_ + IMU_GYRO_STARTUP_US;
+}
+
+bool IMU::write_config()
+{
+    bool written = writeIMU(GYRO_CONFIG, config_.gyro_range << FS_SEL_SHIFT) &&
+                   writeIMU(ACCEL_CONFIG, config_.accel_range << FS_SEL_SHIFT);
+
+    // FIFO mode on I2C keeps its own filter and rate until it is turned off (set_config() refuses changes)
+    if (!fifo_mode_ || bus_ == IMUBus::SPI) {
+        written = written && writeIMU(DLPF_CONFIG, config_.dlpf) && writeIMU(SMPLRT_DIV, config_.sample_rate_divider);
+    }
+    if (fifo_mode_ && bus_ == IMUBus::SPI) {
+        fifo_sample_period_us_ = (uint32_t)(1000000.0f / imu_sample_rate_hz(config_));
+    }
+
+    return written;
+}
+
+bool IMU::set_config(const IMUConfig& config)
+{
+    if (config.gyro_range > IMU_RANGE_MAX || config.accel_range > IMU_RANGE_MAX || config.dlpf > IMU_DLPF_MAX) {
+        return false;
+    }
 
-    sleep_ms(100); // Wait for wake up
+    // FIFO mode on I2C runs its own filter and rate, so they cannot change under it
+    if (fifo_mode_ && bus_ == IMUBus::I2C &&
+        (config.dlpf != config_.dlpf || config.sample_rate_divider != config_.sample_rate_divider)) {
+        return false;
+    }
 
-    // Set gyro full scale range 500dps
-    writeIMU(0x1B, 0x08);
+    config_ = config;
 
-    sleep_ms(100); // Wait for change
+    // Before the start-up configures the device, it picks this up
+    if (init_state_ != IMUInitState::STARTING && init_state_ != IMUInitState::READY) {
+        return true;
+    }
 
-    // Set accel full scale range 4g
-    writeIMU(0x1C, 0x08);
+    // Between reads, so no sample mixes the old and new ranges' bytes
+    pause_async_reads();
+    bool written = write_config();
+    resume_async_reads();
+
+    return written;
+}
+
+IMUConfig IMU::get_config() const
+{
+    return config_;
+}
+
+float imu_gyro_lsb_per_dps(const IMUConfig& config)
+{
+    return IMU_GYRO_LSB_PER_DPS_MIN_RANGE / (1 << config.gyro_range);
+}
+
+float imu_accel_lsb_per_g(const IMUConfig& config)
+{
+    return IMU_ACCEL_LSB_PER_G_MIN_RANGE / (1 << config.accel_range);
+}
+
+float imu_sample_rate_hz(const IMUConfig& config)
+{
+    float output_rate_hz = config.dlpf == 0 ? IMU_GYRO_OUTPUT_RATE_HZ : IMU_GYRO_OUTPUT_RATE_DLPF_HZ;
+
+    return output_rate_hz / (1 + config.sample_rate_divider);
+}
+
+IMUStatus IMU::get_status() const
+{
+    IMUStatus status;
+
+    status.state = init_state_;
+    status.attempts = init_attempts_;
+    status.started_us = started_us_;
+
+    return status;
 }
 
 void IMU::resetIMU()
@@ -66,3 +307,478 @@ void IMU::resetIMU()
     this->gz = 0;
     this->temp = 0;
 }
+
+void IMU::start_async_reads()
+{
+#if IMU_ASYNC_READS
+    if (async_) {
+        return;
+    }
+
+    if (bus_ == IMUBus::SPI) {
+        start_spi_async_reads();
+        return;
+    }
+
+    i2c_hw_t* hw = i2c_get_hw(i2c_default);
+
+    // Register address, then one read command per byte: restart on the first.
+    // start_read() moves the stop bit to the last byte of each read
+    read_commands_[0] = IMU_READ_START_BYTE;
+    for (int i = 1; i <= IMU_MAX_READ_LENGTH; i++) {
+        read_commands_[i] = I2C_IC_DATA_CMD_CMD_BITS;
+    }
+    read_commands_[1] |= I2C_IC_DATA_CMD_RESTART_BITS;
+
+    // The blocking calls set the target address on every transfer; the DMA
+    // reads rely on the MPU6050 being the last (and only) target on the bus
+    hw->enable = 0;
+    hw->tar = MPU6050_ADDR;
+    hw->enable = 1;
+    hw->dma_cr = I2C_IC_DMA_CR_TDMAE_BITS | I2C_IC_DMA_CR_RDMAE_BITS;
+
+    // Get free channels, panic() if there are none
+    tx_channel_ = dma_claim_unused_channel(true);
+    rx_channel_ = dma_claim_unused_channel(true);
+
+    // Commands: 32 bit writes into the data/command register, paced by the I2C TX DREQ
+    dma_channel_config tx_config = dma_channel_get_default_config(tx_channel_);
+    channel_config_set_transfer_data_size(&tx_config, DMA_SIZE_32);
+    channel_config_set_read_increment(&tx_config, true);
+    channel_config_set_write_increment(&tx_config, false);
+    channel_config_set_dreq(&tx_config, i2c_get_dreq(i2c_default, true));
+    dma_channel_configure(tx_channel_, &tx_config, &hw->data_cmd, read_commands_, IMU_DATA_BUFFER_LENGTH + 1, false);
+
+    // Data: 8 bit reads from the data/command register, paced by the I2C RX DREQ
+    dma_channel_config rx_config = dma_channel_get_default_config(rx_channel_);
+    channel_config_set_transfer_data_size(&rx_config, DMA_SIZE_8);
+    channel_config_set_read_increment(&rx_config, false);
+    channel_config_set_write_increment(&rx_config, true);
+    channel_config_set_dreq(&rx_config, i2c_get_dreq(i2c_default, false));
+    dma_channel_configure(rx_channel_, &rx_config, slots_[1].data, &hw->data_cmd, IMU_DATA_BUFFER_LENGTH, false);
+
+    // Handle the read when the last byte has been received
+    imu_instance_ = this;
+    dma_channel_set_irq0_enabled(rx_channel_, true);
+    irq_add_shared_handler(DMA_IRQ_0, dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    async_ = true;
+#endif
+}
+
+void IMU::start_spi_async_reads()
+{
+#if IMU_ASYNC_READS
+    spi_hw_t* hw = spi_get_hw(IMU_SPI);
+
+    // Register address with the read bit, then zeros to clock the data in.
+    // start_read() sets the address of each read
+    memset(spi_tx_buffer_, 0, sizeof(spi_tx_buffer_));
+
+    // Snapshot reads of the sensor registers run fast; start_read() picks the clock of each read
+    set_spi_baud(true);
+
+    // Get free channels, panic() if there are none
+    tx_channel_ = dma_claim_unused_channel(true);
+    rx_channel_ = dma_claim_unused_channel(true);
+
+    // Transmit: address and dummy bytes into the data register, paced by the SPI TX DREQ
+    dma_channel_config tx_config = dma_channel_get_default_config(tx_channel_);
+    channel_config_set_transfer_data_size(&tx_config, DMA_SIZE_8);
+    channel_config_set_read_increment(&tx_config, true);
+    channel_config_set_write_increment(&tx_config, false);
+    channel_config_set_dreq(&tx_config, spi_get_dreq(IMU_SPI, true));
+    dma_channel_configure(tx_channel_, &tx_config, &hw->dr, spi_tx_buffer_, IMU_DATA_BUFFER_LENGTH + 1, false);
+
+    // Receive: every clocked byte, the first one (during the address) included,
+    // paced by the SPI RX DREQ
+    dma_channel_config rx_config = dma_channel_get_default_config(rx_channel_);
+    channel_config_set_transfer_data_size(&rx_config, DMA_SIZE_8);
+    channel_config_set_read_increment(&rx_config, false);
+    channel_config_set_write_increment(&rx_config, true);
+    channel_config_set_dreq(&rx_config, spi_get_dreq(IMU_SPI, false));
+    dma_channel_configure(rx_channel_, &rx_config, spi_rx_buffer_, &hw->dr, IMU_DATA_BUFFER_LENGTH + 1, false);
+
+    // Handle the read when the last byte has been received
+    imu_instance_ = this;
+    dma_channel_set_irq0_enabled(rx_channel_, true);
+    irq_add_shared_handler(DMA_IRQ_0, dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    async_ = true;
+#endif
+}
+
+void IMU::handle_data_ready()
+{
+    if (!async_ || paused_) {
+        return;
+    }
+
+    uint64_t now_us = time_us_64();
+
+    // In FIFO mode samples queue in the MPU6050, so only drain every few samples
+    if (fifo_mode_ && ++fifo_ready_count_ < IMU_FIFO_DRAIN_INTERVAL) {
+        return;
+    }
+
+    // Still reading: skip this one, or recover a stuck read
+    if (stage_ != ReadStage::IDLE) {
+        if (!fifo_mode_) {
+            overrun_count_++;
+            instrumentation_count(InstrumentationEvent::IMU_OVERRUN);
+        }
+        if ((now_us - read_start_us_) < IMU_DMA_TIMEOUT_US) {
+            return;
+        }
+        abort_read();
+    }
+
+    if (fifo_mode_) {
+        fifo_ready_count_ = 0;
+        fifo_drain_us_ = now_us;
+        start_read(ReadStage::FIFO_COUNT, FIFO_COUNTH, fifo_count_buffer_, sizeof(fifo_count_buffer_));
+        return;
+    }
+
+    // Read into the slot that is not published
+    uint8_t slot = latest_slot_ ^ 1;
+    slots_[slot].timestamp_us = now_us;
+    start_read(ReadStage::SNAPSHOT, IMU_READ_START_BYTE, slots_[slot].data, IMU_DATA_BUFFER_LENGTH);
+}
+
+void IMU::start_read(ReadStage stage, uint8_t reg, uint8_t* buffer, uint16_t length)
+{
+    if (bus_ == IMUBus::SPI) {
+        // Only the sensor registers read at the fast clock, not FIFO_COUNT or FIFO_R_W
+        set_spi_baud(stage == ReadStage::SNAPSHOT);
+        spi_tx_buffer_[0] = reg | IMU_SPI_READ_BIT;
+        read_buffer_ = buffer;
+        read_length_ = length;
+
+        stage_ = stage;
+        read_start_us_ = time_us_64();
+
+        // Select the device, arm the receive channel, then clock the bytes out
+        gpio_put(IMU_SPI_CS_PIN, 0);
+        dma_channel_set_trans_count(rx_channel_, length + 1, false);
+        dma_channel_set_write_addr(rx_channel_, spi_rx_buffer_, true);
+        dma_channel_set_trans_count(tx_channel_, length + 1, false);
+        dma_channel_set_read_addr(tx_channel_, spi_tx_buffer_, true);
+        return;
+    }
+
+    // Move the stop bit to the last byte of this read
+    read_commands_[stop_index_] &= ~I2C_IC_DATA_CMD_STOP_BITS;
+    read_commands_[length] |= I2C_IC_DATA_CMD_STOP_BITS;
+    stop_index_ = length;
+    read_commands_[0] = reg;
+
+    stage_ = stage;
+    read_start_us_ = time_us_64();
+
+    // Arm the receive channel, then start the commands
+    dma_channel_set_trans_count(rx_channel_, length, false);
+    dma_channel_set_write_addr(rx_channel_, buffer, true);
+    dma_channel_set_trans_count(tx_channel_, length + 1, false);
+    dma_channel_set_read_addr(tx_channel_, read_commands_, true);
+}
+
+void IMU::handle_read_complete()
+{
+    // Every byte is in, so the read is over; skip the byte clocked in with the address
+    if (bus_ == IMUBus::SPI) {
+        gpio_put(IMU_SPI_CS_PIN, 1);
+        memcpy(read_buffer_, &spi_rx_buffer_[1], read_length_);
+    }
+
+    switch (stage_) {
+        case ReadStage::SNAPSHOT:
+        {
+            // Publish the slot that was just filled
+            latest_slot_ ^= 1;
+            sample_count_++;
+            stage_ = ReadStage::IDLE;
+            break;
+        }
+
+        case ReadStage::FIFO_COUNT:
+        {
+            uint16_t count = (fifo_count_buffer_[0] << 8) | fifo_count_buffer_[1];
+
+            // A full FIFO has overflowed and lost sample alignment; reset it from the main loop
+            if (count > fifo_size_ - IMU_DATA_BUFFER_LENGTH) {
+                fifo_reset_pending_ = true;
+                stage_ = ReadStage::IDLE;
+                break;
+            }
+
+            uint16_t samples = count / IMU_DATA_BUFFER_LENGTH;
+            if (samples > IMU_FIFO_MAX_BURST) {
+                samples = IMU_FIFO_MAX_BURST;
+            }
+            if (samples == 0) {
+                stage_ = ReadStage::IDLE;
+                break;
+            }
+
+            fifo_burst_samples_ = samples;
+            start_read(ReadStage::FIFO_DATA, FIFO_R_W, burst_buffer_, samples * IMU_DATA_BUFFER_LENGTH);
+            break;
+        }
+
+        case ReadStage::FIFO_DATA:
+        {
+            IMUSample sample;
+
+            for (uint16_t i = 0; i < fifo_burst_samples_; i++) {
+                // The newest sample arrived with the data ready interrupt that started the drain
+                sample.timestamp_us = fifo_drain_us_ - (uint64_t)(fifo_burst_samples_ - 1 - i) * fifo_sample_period_us_;
+                memcpy(sample.data, &burst_buffer_[i * IMU_DATA_BUFFER_LENGTH], IMU_DATA_BUFFER_LENGTH);
+
+                if (fifo_head_ - fifo_tail_ >= IMU_FIFO_RING_LENGTH) {
+                    fifo_dropped_++;
+                    continue;
+                }
+                fifo_ring_[fifo_head_ & (IMU_FIFO_RING_LENGTH - 1)] = sample;
+                __dmb();
+                fifo_head_++;
+            }
+
+            // The newest sample is also the latest sample
+            publish_sample(sample);
+            stage_ = ReadStage::IDLE;
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+void IMU::publish_sample(const IMUSample& sample)
+{
+    uint8_t slot = latest_slot_ ^ 1;
+
+    slots_[slot] = sample;
+    latest_slot_ = slot;
+    sample_count_++;
+}
+
+void IMU::abort_read()
+{
+    dma_channel_abort(tx_channel_);
+    dma_channel_abort(rx_channel_);
+    dma_channel_acknowledge_irq0(rx_channel_);
+
+    if (bus_ == IMUBus::SPI) {
+        // Wait out the byte in flight, deselect and drop the stale received bytes
+        while (spi_is_busy(IMU_SPI)) {
+            tight_loop_contents();
+        }
+        gpio_put(IMU_SPI_CS_PIN, 1);
+        while (spi_is_readable(IMU_SPI)) {
+            (void)spi_get_hw(IMU_SPI)->dr;
+        }
+        stage_ = ReadStage::IDLE;
+        return;
+    }
+
+    i2c_hw_t* hw = i2c_get_hw(i2c_default);
+
+    // Clear the I2C abort and drop any stale received bytes
+    (void)hw->clr_tx_abrt;
+    while (i2c_get_read_available(i2c_default)) {
+        (void)hw->data_cmd;
+    }
+
+    stage_ = ReadStage::IDLE;
+}
+
+void IMU::dma_irq_handler()
+{
+    IMU* imu = imu_instance_;
+    uint32_t start_cycles = instrumentation_start();
+
+    // Shared handler: only act on our channel
+    if (imu == nullptr || !dma_channel_get_irq0_status(imu->rx_channel_)) {
+        return;
+    }
+    dma_channel_acknowledge_irq0(imu->rx_channel_);
+
+    imu->handle_read_complete();
+    instrumentation_record(Probe::IMU_DMA_ISR, start_cycles);
+}
+
+void IMU::pause_async_reads()
+{
+    paused_ = true;
+
+    // Wait for the running read (including a FIFO drain's second stage)
+    uint64_t start_us = time_us_64();
+    while (stage_ != ReadStage::IDLE) {
+        if ((time_us_64() - start_us) > IMU_DMA_TIMEOUT_US) {
+            uint32_t ints = save_and_disable_interrupts();
+            abort_read();
+            restore_interrupts(ints);
+        }
+        tight_loop_contents();
+    }
+}
+
+void IMU::resume_async_reads()
+{
+    paused_ = false;
+}
+
+bool IMU::get_latest_sample(IMUSample* sample)
+{
+    // Nothing to read before the device is configured
+    if (init_state_ != IMUInitState::STARTING && init_state_ != IMUInitState::READY) {
+        return false;
+    }
+
+    // No DMA engine: service() reads the registers, and its last read failed
+    if (!async_ && blocking_read_failed_) {
+        return false;
+    }
+
+    // Retry if a new sample was published while copying
+    uint32_t count;
+    do {
+        count = sample_count_;
+        __compiler_memory_barrier();
+        *sample = slots_[latest_slot_];
+        __compiler_memory_barrier();
+    } while (count != sample_count_);
+
+    return count > 0;
+}
+
+uint32_t IMU::get_sample_period_us() const
+{
+    if (fifo_mode_) {
+        return fifo_sample_period_us_ * IMU_FIFO_DRAIN_INTERVAL;
+    }
+
+    return (uint32_t)(1000000.0f / imu_sample_rate_hz(config_));
+}
+
+uint32_t IMU::get_overrun_count() const
+{
+    return overrun_count_;
+}
+
+bool IMU::set_fifo_mode(bool enable)
+{
+    // FIFO bursts are only read by the DMA engine
+    if (!async_) {
+        return false;
+    }
+
+    pause_async_reads();
+
+    // A device that missed a write is put back in the mode it was in
+    if (!write_fifo_registers(enable)) {
+        write_fifo_registers(fifo_mode_);
+        resume_async_reads();
+        return false;
+    }
+
+    // On I2C 1 kHz samples through the DLPF; SPI keeps up with the configured rate
+    if (enable) {
+        fifo_sample_period_us_ = bus_ == IMUBus::SPI ? (uint32_t)(1000000.0f / imu_sample_rate_hz(config_))
+                                                     : IMU_FIFO_SAMPLE_PERIOD_US;
+    }
+
+    // Start from an empty ring (no reads are running)
+    fifo_head_ = 0;
+    fifo_tail_ = 0;
+    fifo_ready_count_ = 0;
+    fifo_mode_ = enable;
+
+    resume_async_reads();
+
+    return true;
+}
+
+bool IMU::write_fifo_registers(bool enable)
+{
+    if (!enable) {
+        // Snapshot reads of the data registers at the configured rate
+        return writeIMU(USER_CTRL, user_ctrl_) && writeIMU(FIFO_EN, 0x00) && writeIMU(DLPF_CONFIG, config_.dlpf) &&
+               writeIMU(SMPLRT_DIV, config_.sample_rate_divider);
+    }
+
+    // On I2C the FIFO runs at its own filter and rate
+    bool written = true;
+    if (bus_ == IMUBus::I2C) {
+        written = writeIMU(DLPF_CONFIG, IMU_FIFO_DLPF_CFG) && writeIMU(SMPLRT_DIV, IMU_FIFO_SAMPLE_RATE_DIVIDER);
+    }
+
+    // All sensors queued in register order
+    return written && writeIMU(FIFO_EN, FIFO_EN_ALL_SENSORS) && writeIMU(USER_CTRL, user_ctrl_ | USER_CTRL_FIFO_RESET) &&
+           writeIMU(USER_CTRL, user_ctrl_ | USER_CTRL_FIFO_EN);
+}
+
+bool IMU::get_fifo_mode() const
+{
+    return fifo_mode_;
+}
+
+size_t IMU::read_fifo_samples(IMUSample* samples, size_t max_samples)
+{
+    size_t count = 0;
+    uint32_t head = fifo_head_;
+    __dmb();
+
+    while (fifo_tail_ != head && count < max_samples) {
+        samples[count++] = fifo_ring_[fifo_tail_ & (IMU_FIFO_RING_LENGTH - 1)];
+        __dmb();
+        fifo_tail_ = fifo_tail_ + 1;
+    }
+
+    return count;
+}
+
+uint32_t IMU::get_fifo_dropped_count() const
+{
+    return fifo_dropped_;
+}
+
+uint32_t IMU::get_fifo_overflow_count() const
+{
+    return fifo_overflows_;
+}
+
+void IMU::service()
+{
+    if (init_state_ != IMUInitState::READY && init_state_ != IMUInitState::NOT_STARTED) {
+        service_initialization();
+    }
+
+    // No DMA engine: read the registers once per pass here, never from an
+    // interrupt that could land inside another bus transfer
+    if (!async_ && (init_state_ == IMUInitState::STARTING || init_state_ == IMUInitState::READY)) {
+        IMUSample sample;
+        sample.timestamp_us = time_us_64();
+        blocking_read_failed_ = !readIMU(IMU_READ_START_BYTE, sample.data, IMU_DATA_BUFFER_LENGTH);
+        if (!blocking_read_failed_) {
+            publish_sample(sample);
+        }
+    }
+
+    if (!fifo_reset_pending_) {
+        return;
+    }
+
+    // Reset the overflowed FIFO; the queued samples are lost
+    pause_async_reads();
+    writeIMU(USER_CTRL, user_ctrl_ | USER_CTRL_FIFO_RESET);
+    writeIMU(USER_CTRL, user_ctrl_ | USER_CTRL_FIFO_EN);
+    fifo_overflows_++;
+    fifo_reset_pending_ = false;
+    fifo_ready_count_ = 0;
+    resume_async_reads();
+}
@@ -2,15 +2,20 @@
 // Carson Powers
 // Header file for the IMU functionality on the Adafruit Feather RP2040 on the AHSR robot
 
-// IMU: MPU6050
+// IMU: MPU6050 on I2C, or MPU9250 (MPU6500 family) on SPI
 // Datasheet: http://www.invensense.com/wp-content/uploads/2015/02/MPU-6000-Datasheet1.pdf
 // Register Map: http://www.invensense.com/wp-content/uploads/2015/02/MPU-6000-Register-Map1.pdf
+// MPU9250 Register Map: https://invensense.tdk.com/wp-content/uploads/2015/02/RM-MPU-9250A-00-v1.6.pdf
 
 #ifndef IMU_HPP
 #define IMU_HPP
 
 // Standard Libraries
 #include <cstdint>
+#include <cstddef>
+
+// Pico Libraries
+#include "pico/stdlib.h"
 
 // Command Bytes for IMU Operations
 #define RETURN_IMU_DATA_BYTE 0x49 // 'I'
@@ -39,12 +44,213 @@
 #define I2C_SDA_PIN 2
 #define I2C_SCL_PIN 3
 
+// Build with IMU_USE_SPI=1 for an MPU9250 on SPI instead of the MPU6050 on I2C
+#ifndef IMU_USE_SPI
+#define IMU_USE_SPI 0
+#endif
+
+// SPI pins on Feather RP2040 (SCK, MO, MI) and the MPU9250 chip select on D5
+#define IMU_SPI spi0
+#define IMU_SPI_SCK_PIN 18
+#define IMU_SPI_TX_PIN 19
+#define IMU_SPI_RX_PIN 20
+#define IMU_SPI_CS_PIN 7
+
+// The MPU9250 takes reads of the sensor and interrupt registers at up to
+// 20 MHz; writes and every other register, FIFO_COUNT and FIFO_R_W
+// included, are limited to 1 MHz
+#define IMU_SPI_CONFIG_BAUD 1000000
+#define IMU_SPI_READ_BAUD 10000000
+#define IMU_SPI_READ_BIT 0x80
+
+// Configuration Registers
+#define SMPLRT_DIV 0x19
+#define DLPF_CONFIG 0x1A // CONFIG
+#define GYRO_CONFIG 0x1B
+#define ACCEL_CONFIG 0x1C
+#define ACCEL_CONFIG2 0x1D // MPU9250 only
+#define FIFO_EN 0x23
+#define INT_PIN_CFG 0x37
+#define INT_ENABLE 0x38
+#define USER_CTRL 0x6A
+#define PWR_MGMT_1 0x6B
+#define FIFO_COUNTH 0x72
+#define FIFO_COUNTL 0x73
+#define FIFO_R_W 0x74
+#define WHO_AM_I 0x75
+
+// Register Bits
+#define FIFO_EN_ALL_SENSORS 0xF8 // Temperature, gyro X/Y/Z and accel, same layout as 0x3B - 0x48
+#define USER_CTRL_FIFO_EN 0x40
+#define USER_CTRL_FIFO_RESET 0x04
+#define USER_CTRL_I2C_IF_DIS 0x10 // MPU9250: SPI only, set again after every device reset
+#define ACCEL_CONFIG2_FCHOICE_B 0x08 // MPU9250: accelerometer unfiltered at 4 kHz
+#define PWR_MGMT_1_DEVICE_RESET 0x80 // Cleared by the device when the reset is done
+#define MPU6050_WHO_AM_I_VALUE 0x68
+#define MPU6500_WHO_AM_I_VALUE 0x70
+#define MPU9250_WHO_AM_I_VALUE 0x71
+#define MPU9255_WHO_AM_I_VALUE 0x73
+#define FS_SEL_SHIFT 3 // Full scale select in GYRO_CONFIG and ACCEL_CONFIG
+
+// MPU6050 INT pin (data ready) on Feather RP2040 D4
+#define IMU_INT_PIN 6
+
+// Start-up timing from the MPU6050 product specification. Register access
+// is ready at most 100 ms after a reset (usually much sooner, so the reset
+// bit is polled), and gyro output settles 30 ms after waking
+#define IMU_RESET_POLL_US 1000
+#define IMU_RESET_TIMEOUT_US 100000
+#define IMU_GYRO_STARTUP_US 30000
+#define IMU_INIT_RETRY_US 100000 // Wait before retrying a device that did not answer
+
+// Default full scale ranges: gyro 500 dps, accel 4 g
+#define IMU_GYRO_RANGE_DEFAULT 1
+#define IMU_ACCEL_RANGE_DEFAULT 1
+#define IMU_GYRO_LSB_PER_DPS 65.5f
+#define IMU_ACCEL_LSB_PER_G 8192.0f
+
+// Range codes double the range per step from 250 dps and 2 g
+#define IMU_RANGE_MAX 3 // 2000 dps, 16 g
+#define IMU_GYRO_LSB_PER_DPS_MIN_RANGE 131.0f
+#define IMU_ACCEL_LSB_PER_G_MIN_RANGE 16384.0f
+
+// DLPF_CFG codes 1 - 6 filter from 188 Hz down to 5 Hz and run the gyro at
+// 1 kHz; 0 leaves it unfiltered (260 Hz) at 8 kHz
+#define IMU_DLPF_DEFAULT 0
+#define IMU_DLPF_MAX 6
+#define IMU_GYRO_OUTPUT_RATE_HZ 8000
+#define IMU_GYRO_OUTPUT_RATE_DLPF_HZ 1000
+
+// Sample rate divider for 1 kHz data ready interrupts (8 kHz gyro output rate / (1 + 7)).
+// A divider of 0 samples every gyro output; only SPI reads keep up with 8 kHz
+#define IMU_SAMPLE_RATE_DIVIDER 7
+
+// Read samples with DMA on the data ready interrupt. Build with
+// IMU_ASYNC_READS=0 to read the registers with blocking bus reads from service().
+#ifndef IMU_ASYNC_READS
+#define IMU_ASYNC_READS 1
+#endif
+
+// A DMA read still running after this long is aborted and restarted
+#define IMU_DMA_TIMEOUT_US 2000
+
 // IMU Data Buffer Length
 #define IMU_DATA_BUFFER_LENGTH 14
 
+// FIFO mode on I2C: 1 kHz samples through the 188 Hz DLPF, drained in
+// bursts. SPI drains fast enough to queue at the configured rate instead,
+// though at 1 MHz (125 kB/s) 8 kHz samples (112 kB/s) leave little margin
+#define IMU_FIFO_DLPF_CFG 0x01 // 188 Hz DLPF, 1 kHz gyro output rate
+#define IMU_FIFO_SAMPLE_RATE_DIVIDER 0 // 1 kHz / (1 + 0)
+#define IMU_FIFO_SAMPLE_PERIOD_US 1000
+#define IMU_FIFO_SIZE 1024 // MPU6050 FIFO size in bytes
+#define IMU_FIFO_SIZE_MPU9250 512 // MPU9250 FIFO size in bytes
+#define IMU_FIFO_DRAIN_INTERVAL 8 // Data ready interrupts between FIFO drains
+#define IMU_FIFO_MAX_BURST 32 // Max samples read per drain
+#define IMU_FIFO_RING_LENGTH 256 // Samples buffered for the host (power of 2)
+#define IMU_MAX_READ_LENGTH (IMU_FIFO_MAX_BURST * IMU_DATA_BUFFER_LENGTH)
+
+/**
+ * @brief Bus and device behind the IMU class.
+ */
+enum class IMUBus : uint8_t {
+    I2C, // MPU6050 at MPU6050_ADDR on i2c_default, brought up by main().
+    SPI  // MPU9250 on IMU_SPI, brought up by initializeIMU().
+};
+
+/**
+ * @brief One complete IMU register sample.
+ */
+struct IMUSample {
+    uint64_t timestamp_us; // Data ready time in us since boot.
+    uint8_t data[IMU_DATA_BUFFER_LENGTH]; // Registers 0x3B - 0x48, big endian per value.
+};
+
+/**
+ * @brief Sampling configuration of the MPU6050.
+ */
+struct IMUConfig {
+    uint8_t gyro_range; // FS_SEL, 0 - 3: 250, 500, 1000, 2000 dps.
+    uint8_t accel_range; // AFS_SEL, 0 - 3: 2, 4, 8, 16 g.
+    uint8_t dlpf; // DLPF_CFG, 0 - 6.
+    uint8_t sample_rate_divider; // SMPLRT_DIV: sample rate = gyro output rate / (1 + divider).
+};
+
+/**
+ * @brief Gyro scale of a configuration.
+ * @param config The configuration.
+ * @return float Gyro LSB per degree per second.
+ */
+float imu_gyro_lsb_per_dps(const IMUConfig& config);
+
+/**
+ * @brief Accelerometer scale of a configuration.
+ * @param config The configuration.
+ * @return float Accelerometer LSB per g.
+ */
+float imu_accel_lsb_per_g(const IMUConfig& config);
+
+/**
+ * @brief Data ready rate of a configuration (outside FIFO mode).
+ * @param config The configuration.
+ * @return float The sample rate in Hz.
+ */
+float imu_sample_rate_hz(const IMUConfig& config);
+
+/**
+ * @brief Stage of the non-blocking MPU6050 start-up.
+ */
+enum class IMUInitState : uint8_t {
+    NOT_STARTED, // initializeIMU() has not been called.
+    RESETTING,   // Device reset written, polling for it to finish.
+    STARTING,    // Configured and sampling, gyro output still settling.
+    READY,       // Sampling with settled outputs.
+    NOT_FOUND    // The device did not answer or identify; retrying.
+};
+
+/**
+ * @brief Start-up progress of the IMU.
+ */
+struct IMUStatus {
+    IMUInitState state; // Start-up stage.
+    uint16_t attempts; // Reset sequences started since boot.
+    uint64_t started_us; // Time sampling started in us since boot (0 before).
+};
+
+/**
+ * @class IMU
+ * @brief Manages the MPU6050 or MPU9250 IMU.
+ *
+ * Both devices share the register map the class uses, so the bus only
+ * changes how registers are reached: I2C at 400 kHz, which limits full
+ * reads to about 2 kHz, or SPI, where sample reads run at IMU_SPI_READ_BAUD
+ * and keep up with the full 8 kHz gyro output rate.
+ *
+ * initializeIMU() only writes the device reset; service() then walks the
+ * start-up sequence against time deadlines from the acquisition loop, so
+ * boot never sleeps on the IMU and a missing or browned out device is
+ * retried instead of blocking. Samples flow as soon as the device is
+ * configured, a few ms after boot.
+ *
+ * After start_async_reads() every data ready interrupt starts a DMA driven
+ * burst read of registers 0x3B - 0x48 into one of two sample slots. The
+ * slots are swapped when the read completes, so get_latest_sample() copies
+ * the newest complete sample without touching the bus. Without the DMA
+ * engine (IMU_ASYNC_READS=0) service() reads the registers into the slots
+ * instead, once per acquisition loop pass.
+ *
+ * In FIFO mode the device queues every sample in its FIFO instead, and every
+ * IMU_FIFO_DRAIN_INTERVAL data ready interrupts FIFO_COUNT and then the
+ * queued samples are read in one DMA burst into a ring buffer the host can
+ * fetch in bulk with read_fifo_samples().
+ */
 class IMU {
     public:
-        IMU();
+        /**
+         * @brief Construct a new IMU object.
+         * @param bus The bus, and with it the device, to use.
+         */
+        IMU(IMUBus bus);
         int16_t ax, ay, az;
         int16_t gx, gy, gz;
         int16_t temp;
@@ -55,28 +261,290 @@ class IMU {
          * @param reg The register to begin reading from.
          * @param read_buffer The buffer to read into.
          * @param bufferLength The length of the buffer and the number of bytes to read.
+         * @return true if the device acknowledged.
          */
-        void readIMU(uint8_t reg, uint8_t* read_buffer, uint8_t bufferLength);
+        bool readIMU(uint8_t reg, uint8_t* read_buffer, uint8_t bufferLength);
 
         /**
          * @brief Write single byte of data to the IMU
          * 
          * @param reg The register to write to.
          * @param write_buffer The data to write.
+         * @return true if the device acknowledged.
          */
-        void writeIMU(uint8_t reg, uint8_t write_buffer);
+        bool writeIMU(uint8_t reg, uint8_t write_buffer);
 
         /**
-         * @brief Initialize the IMU
-         * 
+         * @brief Start initializing the IMU without blocking.
+         *
+         * Writes the device reset and returns; service() finishes the
+         * start-up and starts the DMA read engine.
          */
         void initializeIMU();
 
+        /**
+         * @brief Get the bus the IMU is read over.
+         * @return IMUBus The bus.
+         */
+        IMUBus get_bus() const;
+
+        /**
+         * @brief Get the start-up progress.
+         * @return IMUStatus The status.
+         */
+        IMUStatus get_status() const;
+
         /**
          * @brief Reset the IMU
          * 
          */
         void resetIMU();
+
+
+        /**
+         * @brief Start a burst read on the data ready interrupt.
+         */
+        void handle_data_ready();
+
+        /**
+         * @brief Copy the latest complete sample.
+         *
+         * @param sample The sample to fill.
+         * @return true if a sample has been read since the device was configured
+         *         (and, without the DMA engine, the last read succeeded).
+         */
+        bool get_latest_sample(IMUSample* sample);
+
+        /**
+         * @brief Get the time between updates of the latest sample.
+         *
+         * In FIFO mode the latest sample only changes when the FIFO is drained.
+         *
+         * @return uint32_t The period in us.
+         */
+        uint32_t get_sample_period_us() const;
+
+        /**
+         * @brief Get the number of data ready interrupts missed while a read was running.
+         * @return uint32_t The overrun count.
+         */
+        uint32_t get_overrun_count() const;
+
+        /**
+         * @brief Set the ranges, DLPF and sample rate without a device reset.
+         *
+         * Applied between reads, or kept for the end of the start-up. FIFO
+         * mode on I2C keeps its own DLPF and sample rate, so changing either
+         * is refused until it is turned off; the ranges can still be set. On
+         * SPI they apply to FIFO mode too.
+         *
+         * @param config The configuration.
+         * @return true if the configuration is valid and was applied.
+         */
+        bool set_config(const IMUConfig& config);
+
+        /**
+         * @brief Get the sampling configuration.
+         * @return IMUConfig The configuration.
+         */
+        IMUConfig get_config() const;
+
+        /**
+         * @brief Enable or disable FIFO mode (requires the DMA engine).
+         *
+         * If a register write fails the device is put back in the mode it
+         * was in and the mode is left unchanged.
+         *
+         * @param enable True to queue samples in the MPU6050 FIFO.
+         * @return true if the mode was applied.
+         */
+        bool set_fifo_mode(bool enable);
+
+        /**
+         * @brief Check whether FIFO mode is enabled.
+         * @return true in FIFO mode.
+         */
+        bool get_fifo_mode() const;
+
+        /**
+         * @brief Move samples from the FIFO ring buffer, oldest first.
+         *
+         * @param samples The samples to fill.
+         * @param max_samples The maximum number of samples to copy.
+         * @return size_t The number of samples copied.
+         */
+        size_t read_fifo_samples(IMUSample* samples, size_t max_samples);
+
+        /**
+         * @brief Get the number of samples dropped because the ring buffer was full.
+         * @return uint32_t The dropped sample count.
+         */
+        uint32_t get_fifo_dropped_count() const;
+
+        /**
+         * @brief Get the number of MPU6050 FIFO overflows (FIFO reset, samples lost).
+         * @return uint32_t The overflow count.
+         */
+        uint32_t get_fifo_overflow_count() const;
+
+        /**
+         * @brief Run deferred bus work (start-up steps, FIFO resets, reads without the DMA engine) from the main loop.
+         */
+        void service();
+
+    private:
+        /**
+         * @brief Write the device reset and start polling for it to finish.
+         */
+        void begin_reset();
+
+        /**
+         * @brief Run the start-up step that is due.
+         */
+        void service_initialization();
+
+        /**
+         * @brief Wake the device, write the sampling configuration and start reading samples.
+         *
+         * If a write fails the device goes back to NOT_FOUND and is retried
+         * after IMU_INIT_RETRY_US.
+         */
+        void configure();
+
+        /**
+         * @brief Write the FIFO, user control, DLPF and sample rate registers of a mode.
+         * @param enable True for FIFO mode.
+         * @return true if every register was written.
+         */
+        bool write_fifo_registers(bool enable);
+
+        /**
+         * @brief Write config_ to the range, DLPF and sample rate registers.
+         * @return true if every register was written.
+         */
+        bool write_config();
+
+        /**
+         * @brief Check a WHO_AM_I value against the devices of the bus.
+         */
+        bool who_am_i_valid(uint8_t who_am_i) const;
+
+        /**
+         * @brief Switch the SPI clock between register access and sensor register reads.
+         * @param read_baud True for IMU_SPI_READ_BAUD, false for IMU_SPI_CONFIG_BAUD.
+         */
+        void set_spi_baud(bool read_baud);
+
+        /**
+         * @brief Start the DMA read engine (no-op when IMU_ASYNC_READS is 0).
+         *
+         * Blocking readIMU()/writeIMU() calls must not be made afterwards. The
+         * caller routes rising edges of IMU_INT_PIN to handle_data_ready().
+         */
+        void start_async_reads();
+
+        /**
+         * @brief Set up the SPI DMA channels for start_async_reads().
+         */
+        void start_spi_async_reads();
+
+        /**
+         * @brief Stage of the running DMA read.
+         */
+        enum class ReadStage : uint8_t {
+            IDLE,       // No read running.
+            SNAPSHOT,   // Reading registers 0x3B - 0x48.
+            FIFO_COUNT, // Reading FIFO_COUNTH/L.
+            FIFO_DATA   // Reading queued samples from FIFO_R_W.
+        };
+
+        /**
+         * @brief DMA completion interrupt handler.
+         */
+        static void dma_irq_handler();
+
+        /**
+         * @brief Start a DMA burst read.
+         *
+         * @param stage The stage to enter.
+         * @param reg The register to start reading at.
+         * @param buffer The destination buffer.
+         * @param length The number of bytes (at most IMU_MAX_READ_LENGTH).
+         */
+        void start_read(ReadStage stage, uint8_t reg, uint8_t* buffer, uint16_t length);
+
+        /**
+         * @brief Handle the completion of the running read.
+         */
+        void handle_read_complete();
+
+        /**
+         * @brief Publish a sample as the latest sample.
+         */
+        void publish_sample(const IMUSample& sample);
+
+        /**
+         * @brief Abort a stuck read (e.g. after an I2C abort).
+         */
+        void abort_read();
+
+        /**
+         * @brief Stop starting reads and wait for the running one, so blocking
+         * register writes can be made.
+         */
+        void pause_async_reads();
+
+        /**
+         * @brief Resume reads after pause_async_reads().
+         */
+        void resume_async_reads();
+
+        static IMU* imu_instance_; // Instance serviced by the DMA interrupt.
+
+        IMUBus bus_; // Bus the device is on.
+        uint8_t user_ctrl_; // USER_CTRL bits kept in every mode (I2C_IF_DIS on SPI).
+        bool spi_read_baud_; // Set while the SPI clock runs at IMU_SPI_READ_BAUD.
+        IMUConfig config_; // Sampling configuration.
+        volatile IMUInitState init_state_; // Start-up stage.
+        uint16_t init_attempts_; // Reset sequences started.
+        uint64_t init_step_us_; // Time the current start-up stage began.
+        uint64_t init_deadline_us_; // Time the next start-up step is due.
+        volatile uint64_t started_us_; // Time sampling started.
+
+        bool async_; // Set once the DMA engine is running.
+        volatile bool paused_; // Set while reads are paused for register writes.
+        int tx_channel_; // DMA channel writing read commands to the bus.
+        int rx_channel_; // DMA channel reading sample bytes from the bus.
+        uint32_t read_commands_[IMU_MAX_READ_LENGTH + 1]; // I2C: register address then one command per byte.
+        uint16_t stop_index_; // I2C: command carrying the stop bit.
+        uint8_t spi_tx_buffer_[IMU_MAX_READ_LENGTH + 1]; // SPI: register address then dummy bytes.
+        uint8_t spi_rx_buffer_[IMU_MAX_READ_LENGTH + 1]; // SPI: the byte clocked in with the address, then data.
+        uint8_t* read_buffer_; // SPI: destination of the running read.
+        uint16_t read_length_; // SPI: length of the running read.
+
+        IMUSample slots_[2]; // Double buffered samples.
+        volatile uint8_t latest_slot_; // Slot holding the latest complete sample.
+        volatile uint32_t sample_count_; // Completed samples.
+        volatile bool blocking_read_failed_; // No DMA engine: the last read in service() failed.
+        volatile ReadStage stage_; // Stage of the running read.
+        volatile uint64_t read_start_us_; // Start time of the running read.
+        volatile uint32_t overrun_count_; // Data ready interrupts missed.
+
+        bool fifo_mode_; // Set in FIFO mode.
+        uint16_t fifo_size_; // Device FIFO size in bytes.
+        uint32_t fifo_sample_period_us_; // Time between queued samples.
+        uint32_t fifo_ready_count_; // Data ready interrupts since the last drain.
+        uint64_t fifo_drain_us_; // Data ready time that started the running drain.
+        uint16_t fifo_burst_samples_; // Samples in the running burst.
+        uint8_t fifo_count_buffer_[2]; // FIFO_COUNTH/L.
+        uint8_t burst_buffer_[IMU_MAX_READ_LENGTH]; // Samples read from FIFO_R_W.
+        volatile bool fifo_reset_pending_; // Set when the FIFO overflowed.
+
+        IMUSample fifo_ring_[IMU_FIFO_RING_LENGTH]; // Samples waiting for the host.
+        volatile uint32_t fifo_head_; // Samples written (DMA interrupt only).
+        volatile uint32_t fifo_tail_; // Samples read (main loop only).
+        volatile uint32_t fifo_dropped_; // Samples dropped on a full ring.
+        volatile uint32_t fifo_overflows_; // MPU6050 FIFO overflows.
 };
 
 #endif
\ No newline at end of file
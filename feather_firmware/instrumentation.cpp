@@ -0,0 +1,156 @@
+// instrumentation.cpp
+// Carson Powers
+// Source file for the interrupt and command latency instrumentation on the Adafruit Feather RP2040 on the AHSR robot
+
+#include "instrumentation.hpp"
+#include "seqlock.hpp"
+
+// Standard Libraries
+#include <cstring>
+
+// Pico Libraries
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+
+#if FEATHER_INSTRUMENTATION
+
+/**
+ * @brief Stats of one probe, updated by a single writer.
+ */
+struct ProbeStats {
+    SequenceCounter sequence; // Odd while the writer updates the stats.
+    volatile bool reset_requested; // Cleared by the writer on its next update.
+    uint32_t count;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint32_t buckets[INSTRUMENTATION_BUCKETS];
+};
+
+/**
+ * @brief A missed or late event counter, updated by a single writer.
+ */
+struct EventStats {
+    volatile bool reset_requested; // Cleared by the writer on its next update.
+    volatile uint32_t count;
+};
+
+static ProbeStats probe_stats[(size_t)Probe::COUNT];
+static EventStats event_stats[(size_t)InstrumentationEvent::COUNT];
+
+static void clear_probe(ProbeStats* stats) {
+    stats->count = 0;
+    stats->min_cycles = 0;
+    stats->max_cycles = 0;
+    memset(stats->buckets, 0, sizeof(stats->buckets));
+    stats->reset_requested = false;
+}
+
+void initializeInstrumentation() {
+    // Count processor clocks from the 24 bit maximum, as in encoder/setup_systick
+    systick_hw->rvr = INSTRUMENTATION_SYSTICK_MASK;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x00000005; // Enable counter and use processor clock
+}
+
+void instrumentation_record(Probe probe, uint32_t start_cycles) {
+    // SysTick counts down
+    uint32_t cycles = (start_cycles - systick_hw->cvr) & INSTRUMENTATION_SYSTICK_MASK;
+    ProbeStats* stats = &probe_stats[(size_t)probe];
+
+    // log2 bucket
+    uint32_t bucket = cycles ? 31 - __builtin_clz(cycles) : 0;
+    if (bucket >= INSTRUMENTATION_BUCKETS) {
+        bucket = INSTRUMENTATION_BUCKETS - 1;
+    }
+
+    stats->sequence.begin_write();
+    if (stats->reset_requested) {
+        clear_probe(stats);
+    }
+    stats->count++;
+    if (stats->count == 1 || cycles < stats->min_cycles) {
+        stats->min_cycles = cycles;
+    }
+    if (cycles > stats->max_cycles) {
+        stats->max_cycles = cycles;
+    }
+    stats->buckets[bucket]++;
+    stats->sequence.end_write();
+}
+
+void instrumentation_count(InstrumentationEvent event) {
+    EventStats* stats = &event_stats[(size_t)event];
+
+    if (stats->reset_requested) {
+        stats->count = 0;
+        stats->reset_requested = false;
+    }
+    stats->count = stats->count + 1;
+}
+
+size_t instrumentation_dump(uint8_t* buffer) {
+    uint32_t clock_hz = clock_get_hz(clk_sys);
+    uint8_t* out = buffer;
+
+    out[0] = INSTRUMENTATION_VERSION;
+    out[1] = (uint8_t)Probe::COUNT;
+    out[2] = INSTRUMENTATION_BUCKETS;
+    out[3] = (uint8_t)InstrumentationEvent::COUNT;
+    memcpy(&out[4], &clock_hz, sizeof(clock_hz));
+    out += INSTRUMENTATION_HEADER_LENGTH;
+
+    for (size_t i = 0; i < (size_t)Probe::COUNT; i++) {
+        const ProbeStats* stats = &probe_stats[i];
+        uint32_t values[3 + INSTRUMENTATION_BUCKETS];
+        uint32_t start;
+
+        // Retry if the writer updated the probe while copying
+        do {
+            start = stats->sequence.read_begin();
+            values[0] = stats->count;
+            values[1] = stats->min_cycles;
+            values[2] = stats->max_cycles;
+            memcpy(&values[3], stats->buckets, sizeof(stats->buckets));
+
+            // A pending reset reads as empty
+            if (stats->reset_requested) {
+                memset(values, 0, sizeof(values));
+            }
+        } while (stats->sequence.read_retry(start));
+
+        memcpy(out, values, sizeof(values));
+        out += INSTRUMENTATION_PROBE_LENGTH;
+    }
+
+    for (size_t i = 0; i < (size_t)InstrumentationEvent::COUNT; i++) {
+        uint32_t count = event_stats[i].reset_requested ? 0 : event_stats[i].count;
+
+        memcpy(out, &count, sizeof(count));
+        out += sizeof(count);
+    }
+
+    return out - buffer;
+}
+
+void instrumentation_reset() {
+    for (size_t i = 0; i < (size_t)Probe::COUNT; i++) {
+        probe_stats[i].reset_requested = true;
+    }
+    for (size_t i = 0; i < (size_t)InstrumentationEvent::COUNT; i++) {
+        event_stats[i].reset_requested = true;
+    }
+}
+
+#else
+
+size_t instrumentation_dump(uint8_t* buffer) {
+    // Header only: no probes or events
+    memset(buffer, 0, INSTRUMENTATION_HEADER_LENGTH);
+    buffer[0] = INSTRUMENTATION_VERSION;
+    return INSTRUMENTATION_HEADER_LENGTH;
+}
+
+void instrumentation_reset() {
+}
+
+#endif
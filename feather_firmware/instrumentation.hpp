@@ -0,0 +1,124 @@
+// instrumentation.hpp
+// Carson Powers
+// Header file for the interrupt and command latency instrumentation on the Adafruit Feather RP2040 on the AHSR robot
+
+// Each probe keeps a count, min, max and a log2 histogram of the SysTick
+// cycles between instrumentation_start() and instrumentation_record(). SysTick
+// is per core and counts processor clocks, so each core that records calls
+// initializeInstrumentation() first. Every probe and event counter must only
+// be written from one core and context; the dump may be read from any core.
+//
+// Stats dump (MSG_GET_STATS, little endian):
+//   [version u8][probe count u8][bucket count u8][event count u8][clk_sys Hz u32]
+//   probe count x [count u32][min cycles u32][max cycles u32][buckets (bucket count x u32)]
+//   event count x [count u32]
+// Bucket i holds durations of 2^i to 2^(i+1) - 1 cycles (bucket 0 also holds
+// 0); the last bucket holds everything longer.
+
+#ifndef INSTRUMENTATION_HPP
+#define INSTRUMENTATION_HPP
+
+// Standard Libraries
+#include <cstdint>
+#include <cstddef>
+
+// Build with FEATHER_INSTRUMENTATION=0 to compile the probes out
+#ifndef FEATHER_INSTRUMENTATION
+#define FEATHER_INSTRUMENTATION 1
+#endif
+
+#if FEATHER_INSTRUMENTATION
+#include "hardware/structs/systick.h"
+#endif
+
+#define INSTRUMENTATION_VERSION 1
+#define INSTRUMENTATION_BUCKETS 16
+#define INSTRUMENTATION_HEADER_LENGTH 8
+#define INSTRUMENTATION_PROBE_LENGTH (12 + 4 * INSTRUMENTATION_BUCKETS)
+#define INSTRUMENTATION_SYSTICK_MASK 0x00FFFFFF // SysTick is a 24 bit down counter
+
+/**
+ * @brief Code paths whose run time is measured.
+ */
+enum class Probe : uint8_t {
+    ENCODER_ISR,        // Encoder GPIO edge interrupt (core1).
+    IMU_DATA_READY_ISR, // MPU6050 data ready GPIO interrupt (core1).
+    IMU_DMA_ISR,        // IMU DMA read complete interrupt (core1).
+    TELEMETRY_TIMER,    // Telemetry timer callback (core1).
+    USB_COMMAND,        // Single byte command or framed request handler (core0).
+    AHRS_UPDATE,        // Attitude filter update for one IMU sample (core1).
+    ODOMETRY_UPDATE,    // Odometry pose and covariance update (core1).
+    MOTOR_CONTROL,      // Wheel speed controller timer callback (core1).
+    COUNT
+};
+
+/**
+ * @brief Missed or late work.
+ */
+enum class InstrumentationEvent : uint8_t {
+    TELEMETRY_DROPPED,   // Telemetry sample lost to a full queue (core1).
+    TELEMETRY_LATE,      // Telemetry callback more than half a period late (core1).
+    VELOCITY_LATE,       // Velocity update a full period late (core1).
+    IMU_OVERRUN,         // Data ready while the previous IMU read was running (core1).
+    MOTOR_TIMEOUT,       // Motors stopped because no setpoint arrived in time (core1).
+    TELEMETRY_USB_FULL,  // Telemetry sample dropped because the host is not reading the USB FIFO (core0).
+    COUNT
+};
+
+#define INSTRUMENTATION_DUMP_LENGTH (INSTRUMENTATION_HEADER_LENGTH + \
+    (size_t)Probe::COUNT * INSTRUMENTATION_PROBE_LENGTH + (size_t)InstrumentationEvent::COUNT * 4)
+
+#if FEATHER_INSTRUMENTATION
+
+/**
+ * @brief Start the SysTick cycle counter of the calling core.
+ */
+void initializeInstrumentation();
+
+/**
+ * @brief Read the cycle counter at the start of a measured section.
+ * @return uint32_t The start value to pass to instrumentation_record().
+ */
+static inline uint32_t instrumentation_start() {
+    return systick_hw->cvr;
+}
+
+/**
+ * @brief Record the cycles since instrumentation_start() in a probe.
+ * @param probe The probe (written from one core and context only).
+ * @param start_cycles The value returned by instrumentation_start().
+ */
+void instrumentation_record(Probe probe, uint32_t start_cycles);
+
+/**
+ * @brief Count a missed or late event.
+ * @param event The event (written from one core and context only).
+ */
+void instrumentation_count(InstrumentationEvent event);
+
+#else
+
+static inline void initializeInstrumentation() {}
+static inline uint32_t instrumentation_start() { return 0; }
+static inline void instrumentation_record(Probe, uint32_t) {}
+static inline void instrumentation_count(InstrumentationEvent) {}
+
+#endif
+
+/**
+ * @brief Serialize every probe and event counter.
+ *
+ * @param buffer The output buffer (at least INSTRUMENTATION_DUMP_LENGTH bytes).
+ * @return size_t The number of bytes written.
+ */
+size_t instrumentation_dump(uint8_t* buffer);
+
+/**
+ * @brief Clear every probe and counter.
+ *
+ * Each one is cleared by its writer on its next update, so it is safe to call
+ * from any core.
+ */
+void instrumentation_reset();
+
+#endif // INSTRUMENTATION_HPP
@@ -17,12 +17,13 @@
 #include "hardware/i2c.h"
 
 int main() {
+    // Initialize TinyUSB. The firmware owns the USB stack, so stdio on the
+    // CDC interface expects it to be up already
+    tusb_init();
+
     // Initialize stdio for USB communication
     stdio_init_all();
 
-    // Initialize TinyUSB
-    tusb_init();
-
     // Initialize I2C
     i2c_init(i2c_default, 400000);
     gpio_set_function(PICO_DEFAULT_I2C_SDA_PIN, GPIO_FUNC_I2C);
@@ -35,15 +36,9 @@ int main() {
     // Create an instance of the Feather class
     Feather feather;
 
-    // Temp byte to wait for
-    uint8_t receivedByte;
-    
-    // Wait for the specific byte
-    do {
-        receivedByte = getchar(); // Blocking read
-    } while (receivedByte != INITIALIZE_SENSORS_BYTE);
-
-    // Initialize the feather (encoders, IMU, etc.)
+    // Initialize the feather (encoders, IMU, etc.) right away. The IMU
+    // finishes starting in the background, so sampling begins within ms of
+    // boot instead of waiting for the host
     feather.initializeFeather();
 
     // Main control loop (infinite loop)
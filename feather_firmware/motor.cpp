@@ -0,0 +1,113 @@
+// motor.cpp
+// Carson Powers
+// Source file for the wheel motor outputs and velocity controllers on the AHSR robot
+
+#include "motor.hpp"
+#include <cmath>
+
+Motor::Motor(uint8_t dir_pin, uint8_t pwm_pin, bool inverted)
+    : dir_pin_(dir_pin), pwm_pin_(pwm_pin), inverted_(inverted), duty_(0.0f) {}
+
+void Motor::initializeMotor() {
+    gpio_init(dir_pin_);
+    gpio_set_dir(dir_pin_, true);
+    gpio_init(pwm_pin_);
+    gpio_set_dir(pwm_pin_, true);
+
+    // Full clk_sys resolution, one slice per motor
+    pwm_config cfg = pwm_get_default_config();
+    pwm_config_set_clkdiv_int(&cfg, 1);
+    pwm_config_set_wrap(&cfg, MOTOR_PWM_WRAP);
+    pwm_init(pwm_gpio_to_slice_num(pwm_pin_), &cfg, true);
+
+    gpio_set_function(pwm_pin_, GPIO_FUNC_PWM);
+    set_duty(0.0f);
+}
+
+void Motor::set_duty(float duty) {
+    if (duty > MOTOR_MAX_DUTY) {
+        duty = MOTOR_MAX_DUTY;
+    } else if (duty < -MOTOR_MAX_DUTY) {
+        duty = -MOTOR_MAX_DUTY;
+    }
+    duty_ = duty;
+
+    // Sign on the direction pin, magnitude on the PWM level
+    bool reverse = (duty < 0.0f) != inverted_;
+    gpio_put(dir_pin_, reverse);
+    pwm_set_gpio_level(pwm_pin_, (uint16_t)(fabsf(duty) * MOTOR_PWM_WRAP));
+}
+
+float Motor::get_duty() const {
+    return duty_;
+}
+
+VelocityPID::VelocityPID() {
+    gains_ = {MOTOR_PID_KP, MOTOR_PID_KI, MOTOR_PID_KD, MOTOR_PID_KFF, MOTOR_PID_KS};
+    reset();
+}
+
+bool VelocityPID::set_gains(const VelocityPIDGains& gains) {
+    const float values[] = {gains.kp, gains.ki, gains.kd, gains.kff, gains.ks};
+
+    // Also rejects NaN
+    for (float value : values) {
+        if (!(value >= 0.0f) || std::isinf(value)) {
+            return false;
+        }
+    }
+
+    gains_ = gains;
+
+    return true;
+}
+
+VelocityPIDGains VelocityPID::get_gains() const {
+    return gains_;
+}
+
+void VelocityPID::reset() {
+    integral_ = 0.0f;
+    last_measured_ = 0.0f;
+    started_ = false;
+}
+
+float VelocityPID::update(float setpoint, float measured, float dt) {
+    float error = setpoint - measured;
+
+    // Feedforward carries the setpoint, feedback only corrects it
+    float output = gains_.kff * setpoint + gains_.kp * error;
+    if (setpoint > 0.0f) {
+        output += gains_.ks;
+    } else if (setpoint < 0.0f) {
+        output -= gains_.ks;
+    }
+
+    // Derivative of the measurement, so setpoint steps do not kick
+    if (started_ && dt > 0.0f) {
+        output -= gains_.kd * (measured - last_measured_) / dt;
+    }
+    last_measured_ = measured;
+    started_ = true;
+
+    // Integrate unless the output is already saturated in the error direction
+    float candidate = integral_ + gains_.ki * error * dt;
+    float total = output + candidate;
+    if ((total <= MOTOR_MAX_DUTY || error < 0.0f) && (total >= -MOTOR_MAX_DUTY || error > 0.0f)) {
+        integral_ = candidate;
+    }
+    if (integral_ > MOTOR_MAX_DUTY) {
+        integral_ = MOTOR_MAX_DUTY;
+    } else if (integral_ < -MOTOR_MAX_DUTY) {
+        integral_ = -MOTOR_MAX_DUTY;
+    }
+
+    output += integral_;
+    if (output > MOTOR_MAX_DUTY) {
+        output = MOTOR_MAX_DUTY;
+    } else if (output < -MOTOR_MAX_DUTY) {
+        output = -MOTOR_MAX_DUTY;
+    }
+
+    return output;
+}
@@ -0,0 +1,145 @@
+// motor.hpp
+// Carson Powers
+// Header file for the wheel motor outputs and velocity controllers on the AHSR robot
+
+#ifndef MOTOR_HPP
+#define MOTOR_HPP
+
+// Standard Libraries
+#include <cstdint>
+
+// Pico Libraries
+#include "pico/stdlib.h"
+#include "hardware/pwm.h"
+
+// Define motor driver pins (direction and PWM per H-bridge channel, on
+// different PWM slices): left motor, right motor
+#define MOTOR1_DIR_PIN 24
+#define MOTOR1_PWM_PIN 25
+#define MOTOR2_DIR_PIN 26
+#define MOTOR2_PWM_PIN 27
+
+// Set for a motor whose encoder counts down at positive duty
+#define MOTOR1_INVERTED false
+#define MOTOR2_INVERTED false
+
+// PWM at clk_sys / MOTOR_PWM_WRAP, 20 kHz at 125 MHz as in pio/quadrature_encoder_substep
+#define MOTOR_PWM_WRAP 6250
+
+// Velocity loop
+#define MOTOR_CONTROL_RATE_HZ 1000 // Controller update rate (1 to 2 kHz)
+#define MOTOR_SETPOINT_TIMEOUT_US 250000 // Motors coast if no setpoint arrives for this long
+#define MOTOR_MAX_DUTY 1.0f
+
+// Default gains, duty per sub-step per second of speed (error). Tune with
+// MSG_SET_MOTOR_GAINS; kff of 1 / (full duty speed) is a good starting point
+#define MOTOR_PID_KP 5.0e-6f
+#define MOTOR_PID_KI 1.0e-4f // Per second
+#define MOTOR_PID_KD 0.0f // Seconds
+#define MOTOR_PID_KFF 2.5e-6f // Speed feedforward
+#define MOTOR_PID_KS 0.0f // Static friction feedforward, duty in the setpoint direction
+
+/**
+ * @class Motor
+ * @brief One H-bridge channel driven by a direction pin and a hardware PWM slice.
+ */
+class Motor {
+    public:
+        /**
+         * @brief Construct a new Motor object.
+         * @param[in] dir_pin The GPIO pin for the direction input (uint8_t).
+         * @param[in] pwm_pin The GPIO pin for the PWM input (uint8_t).
+         * @param[in] inverted Swap the direction so positive duty counts the encoder up.
+         */
+        Motor(uint8_t dir_pin, uint8_t pwm_pin, bool inverted);
+
+        /**
+         * @brief Initialize the pins and PWM slice with the output off.
+         */
+        void initializeMotor();
+
+        /**
+         * @brief Set the output.
+         * @param[in] duty Signed duty from -MOTOR_MAX_DUTY to MOTOR_MAX_DUTY (clamped).
+         */
+        void set_duty(float duty);
+
+        /**
+         * @brief Get the output.
+         * @return float The signed duty last set.
+         */
+        float get_duty() const;
+
+    private:
+        uint8_t dir_pin_; // Direction pin.
+        uint8_t pwm_pin_; // PWM pin.
+        bool inverted_; // Direction is swapped.
+        float duty_; // Signed duty last set.
+};
+
+/**
+ * @brief Gains of a wheel velocity controller.
+ */
+struct VelocityPIDGains {
+    float kp; // Duty per sub-step/s of error.
+    float ki; // Duty per sub-step of integrated error.
+    float kd; // Duty per sub-step/s^2 of speed change.
+    float kff; // Duty per sub-step/s of setpoint.
+    float ks; // Duty added in the setpoint direction.
+};
+
+/**
+ * @class VelocityPID
+ * @brief Wheel speed PID with feedforward and anti-windup.
+ *
+ * The output is kff * setpoint + ks * sign(setpoint) + P + I + D, clamped to
+ * MOTOR_MAX_DUTY. The feedforward does most of the work, so the feedback
+ * terms only correct load and friction. The derivative acts on the measured
+ * speed, so setpoint steps do not kick the output.
+ *
+ * The integral stops growing while the output is saturated in the direction
+ * of the error, and is clamped to the duty range, so it does not wind up
+ * while a wheel is stalled or the setpoint is out of reach.
+ */
+class VelocityPID {
+    public:
+        /**
+         * @brief Construct a new VelocityPID object with the default gains.
+         */
+        VelocityPID();
+
+        /**
+         * @brief Set the gains. Gains must be finite and not negative.
+         * @param gains The gains.
+         * @return true if the gains are valid and were applied.
+         */
+        bool set_gains(const VelocityPIDGains& gains);
+
+        /**
+         * @brief Get the gains.
+         * @return VelocityPIDGains The gains.
+         */
+        VelocityPIDGains get_gains() const;
+
+        /**
+         * @brief Clear the integral and derivative state.
+         */
+        void reset();
+
+        /**
+         * @brief Run one controller step.
+         * @param setpoint The speed setpoint in sub-steps per second.
+         * @param measured The measured speed in sub-steps per second.
+         * @param dt The time since the last step in seconds.
+         * @return float The duty.
+         */
+        float update(float setpoint, float measured, float dt);
+
+    private:
+        VelocityPIDGains gains_; // Controller gains.
+        float integral_; // Integral term in duty.
+        float last_measured_; // Measured speed at the last step.
+        bool started_; // Set once last_measured_ is valid.
+};
+
+#endif // MOTOR_HPP
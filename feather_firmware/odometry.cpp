@@ -0,0 +1,184 @@
+// odometry.cpp
+// Carson Powers
+// Source file for the onboard differential drive odometry on the AHSR robot
+
+#include "odometry.hpp"
+#include <cmath>
+
+Odometry::Odometry() {
+    config_ = {ODOMETRY_WHEEL_RADIUS_M, ODOMETRY_WHEEL_BASE_M, ODOMETRY_FUSE_GYRO_DEFAULT};
+    meters_per_count_ = 2.0f * ODOMETRY_PI * ODOMETRY_WHEEL_RADIUS_M / COUNTS_PER_REVOLUTION;
+    reset();
+}
+
+void Odometry::reset() {
+    started_ = false;
+    last_us_ = 0;
+    last_left_ = 0;
+    last_right_ = 0;
+    x_ = 0.0f;
+    y_ = 0.0f;
+    heading_ = 0.0f;
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            p_[i][j] = 0.0f;
+        }
+    }
+}
+
+void Odometry::restore(const OdometryState& state, int32_t left_position, int32_t right_position) {
+    started_ = true;
+    last_us_ = 0;
+    last_left_ = left_position;
+    last_right_ = right_position;
+    x_ = state.x_m;
+    y_ = state.y_m;
+    heading_ = state.heading_rad;
+
+    // Upper triangle back to the symmetric matrix
+    p_[0][0] = state.covariance[0];
+    p_[0][1] = p_[1][0] = state.covariance[1];
+    p_[0][2] = p_[2][0] = state.covariance[2];
+    p_[1][1] = state.covariance[3];
+    p_[1][2] = p_[2][1] = state.covariance[4];
+    p_[2][2] = state.covariance[5];
+}
+
+bool Odometry::set_config(const OdometryConfig& config) {
+    // Also rejects NaN
+    if (!(config.wheel_radius_m > 0.0f && config.wheel_base_m > 0.0f) ||
+        std::isinf(config.wheel_radius_m) || std::isinf(config.wheel_base_m)) {
+        return false;
+    }
+
+    config_ = config;
+    meters_per_count_ = 2.0f * ODOMETRY_PI * config.wheel_radius_m / COUNTS_PER_REVOLUTION;
+
+    return true;
+}
+
+OdometryConfig Odometry::get_config() const {
+    return config_;
+}
+
+void Odometry::update(uint64_t timestamp_us, int32_t left_position, int32_t right_position,
+                      float gyro_z_rad_s, bool gyro_valid) {
+    if (!started_) {
+        started_ = true;
+        last_us_ = timestamp_us;
+        last_left_ = left_position;
+        last_right_ = right_position;
+        return;
+    }
+
+    uint64_t dt_us = timestamp_us - last_us_;
+    if (dt_us == 0) {
+        return;
+    }
+
+    // Deltas wrap with the counters
+    int32_t left_counts = (int32_t)((uint32_t)left_position - (uint32_t)last_left_) * ODOMETRY_LEFT_DIRECTION;
+    int32_t right_counts = (int32_t)((uint32_t)right_position - (uint32_t)last_right_) * ODOMETRY_RIGHT_DIRECTION;
+    last_us_ = timestamp_us;
+    last_left_ = left_position;
+    last_right_ = right_position;
+
+    float base = config_.wheel_base_m;
+    float left = left_counts * meters_per_count_;
+    float right = right_counts * meters_per_count_;
+
+    // Forward distance and wheel heading change, with their variances
+    float distance = (left + right) * 0.5f;
+    float turn = (right - left) / base;
+    float left_variance = ODOMETRY_WHEEL_VARIANCE * fabsf(left);
+    float right_variance = ODOMETRY_WHEEL_VARIANCE * fabsf(right);
+    float distance_variance = (left_variance + right_variance) * 0.25f;
+    float turn_variance = (left_variance + right_variance) / (base * base);
+    float cross_variance = (right_variance - left_variance) / (2.0f * base);
+
+    // Blend in the gyro turn, weighting each by the other's variance
+    if (config_.fuse_gyro && gyro_valid && dt_us <= ODOMETRY_MAX_DT_US) {
+        float dt = dt_us * 1.0e-6f;
+        float gyro_variance = ODOMETRY_GYRO_VARIANCE * dt;
+        float weight = gyro_variance / (turn_variance + gyro_variance);
+
+        turn = weight * turn + (1.0f - weight) * gyro_z_rad_s * dt;
+        turn_variance *= weight;
+        cross_variance *= weight;
+    }
+
+    if (left_counts == 0 && right_counts == 0 && turn == 0.0f) {
+        return;
+    }
+
+    // Step along the arc midpoint
+    float mid = heading_ + turn * 0.5f;
+    float c = cosf(mid);
+    float s = sinf(mid);
+
+    x_ += distance * c;
+    y_ += distance * s;
+    heading_ += turn;
+    if (heading_ > ODOMETRY_PI) {
+        heading_ -= 2.0f * ODOMETRY_PI;
+    } else if (heading_ < -ODOMETRY_PI) {
+        heading_ += 2.0f * ODOMETRY_PI;
+    }
+
+    // P = F P F^T + G Q G^T, with F the pose Jacobian (identity plus the
+    // heading column) and G the Jacobian in (distance, turn)
+    float f02 = -distance * s;
+    float f12 = distance * c;
+    float g[3][2] = {
+        {c, -0.5f * distance * s},
+        {s, 0.5f * distance * c},
+        {0.0f, 1.0f}
+    };
+    float q[2][2] = {
+        {distance_variance, cross_variance},
+        {cross_variance, turn_variance}
+    };
+
+    // F P: rows 0 and 1 gain f * row 2
+    float fp[3][3];
+    for (int j = 0; j < 3; j++) {
+        fp[0][j] = p_[0][j] + f02 * p_[2][j];
+        fp[1][j] = p_[1][j] + f12 * p_[2][j];
+        fp[2][j] = p_[2][j];
+    }
+
+    // (F P) F^T: columns 0 and 1 gain f * column 2
+    for (int i = 0; i < 3; i++) {
+        p_[i][0] = fp[i][0] + f02 * fp[i][2];
+        p_[i][1] = fp[i][1] + f12 * fp[i][2];
+        p_[i][2] = fp[i][2];
+    }
+
+    for (int i = 0; i < 3; i++) {
+        float gq[2] = {
+            g[i][0] * q[0][0] + g[i][1] * q[1][0],
+            g[i][0] * q[0][1] + g[i][1] * q[1][1]
+        };
+        for (int j = 0; j < 3; j++) {
+            p_[i][j] += gq[0] * g[j][0] + gq[1] * g[j][1];
+        }
+    }
+}
+
+OdometryState Odometry::get_state() const {
+    OdometryState state;
+
+    state.timestamp_us = last_us_;
+    state.x_m = x_;
+    state.y_m = y_;
+    state.heading_rad = heading_;
+    state.covariance[0] = p_[0][0];
+    state.covariance[1] = p_[0][1];
+    state.covariance[2] = p_[0][2];
+    state.covariance[3] = p_[1][1];
+    state.covariance[4] = p_[1][2];
+    state.covariance[5] = p_[2][2];
+
+    return state;
+}
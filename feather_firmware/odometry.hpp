@@ -0,0 +1,147 @@
+// odometry.hpp
+// Carson Powers
+// Header file for the onboard differential drive odometry on the AHSR robot
+
+#ifndef ODOMETRY_HPP
+#define ODOMETRY_HPP
+
+// Standard Libraries
+#include <cstdint>
+
+#include "encoder.hpp"
+
+// Default geometry, overridden at runtime with MSG_SET_ODOMETRY_CONFIG
+#define ODOMETRY_WHEEL_RADIUS_M 0.05f
+#define ODOMETRY_WHEEL_BASE_M 0.30f // Distance between the wheel contact points
+#define ODOMETRY_FUSE_GYRO_DEFAULT true
+
+// Count direction of each wheel when driving forward. Set to -1 for a wheel
+// whose encoder counts down when the robot drives forward
+#define ODOMETRY_LEFT_DIRECTION 1
+#define ODOMETRY_RIGHT_DIRECTION 1
+
+#define ODOMETRY_PI 3.14159265f
+
+// Noise model
+#define ODOMETRY_WHEEL_VARIANCE 1.0e-4f // Wheel travel variance per meter travelled (m^2 / m), slip and scale error
+#define ODOMETRY_GYRO_VARIANCE 1.0e-6f // Heading variance per second of gyro integration (rad^2 / s)
+
+// Pose update period on the acquisition core
+#define ODOMETRY_UPDATE_PERIOD_US 1000
+
+// Longer gaps between updates are not integrated by the gyro
+#define ODOMETRY_MAX_DT_US 100000
+
+/**
+ * @brief Robot geometry and sensor selection for the odometry.
+ */
+struct OdometryConfig {
+    float wheel_radius_m; // Wheel radius in m.
+    float wheel_base_m; // Distance between the wheels in m.
+    bool fuse_gyro; // Blend the gyro z rate into the heading.
+};
+
+/**
+ * @brief Pose estimate at one encoder capture.
+ */
+struct OdometryState {
+    uint64_t timestamp_us; // Encoder capture time of the last update (0 before the first).
+    float x_m; // Position along the heading at the last reset, in m.
+    float y_m; // Position to the left of the heading at the last reset, in m.
+    float heading_rad; // Heading in rad, counterclockwise, wrapped to [-pi, pi].
+    float covariance[6]; // Pose covariance upper triangle: xx, xy, xh, yy, yh, hh.
+};
+
+/**
+ * @class Odometry
+ * @brief Dead reckoning of a differential drive base from wheel encoder counts.
+ *
+ * Each update turns the count deltas since the last update into a forward
+ * distance and a heading change, and advances the pose along the arc
+ * midpoint. Counts are absolute, so a late update only lengthens the step
+ * instead of losing motion.
+ *
+ * When gyro fusion is on, the heading change is the minimum variance blend of
+ * the wheel estimate (variance grows with wheel travel) and the gyro z rate
+ * (variance grows with time). A still or straight driving base then trusts
+ * the wheels, while wheel slip during turns is taken up by the gyro. The
+ * gyro rate should be bias corrected and is taken as the yaw rate, which
+ * holds while the base is level.
+ *
+ * The covariance is propagated with the Jacobians of the motion step.
+ * Updates run every ODOMETRY_UPDATE_PERIOD_US, so the single precision math
+ * (on the ROM float routines, there is no FPU) costs little.
+ */
+class Odometry {
+    public:
+        /**
+         * @brief Construct a new Odometry object with the default geometry.
+         */
+        Odometry();
+
+        /**
+         * @brief Restart at the origin from the next update, with zero covariance.
+         */
+        void reset();
+
+        /**
+         * @brief Continue from a pose saved before a warm restart.
+         *
+         * The next update integrates from the given counts. Capture times
+         * restart at boot, so the pose timestamp is not kept.
+         *
+         * @param state The pose and covariance.
+         * @param left_position The left encoder position the pose was computed at.
+         * @param right_position The right encoder position the pose was computed at.
+         */
+        void restore(const OdometryState& state, int32_t left_position, int32_t right_position);
+
+        /**
+         * @brief Set the geometry and gyro fusion.
+         * @param config The configuration. Radius and base must be positive.
+         * @return true if the configuration is valid and was applied.
+         */
+        bool set_config(const OdometryConfig& config);
+
+        /**
+         * @brief Get the geometry and gyro fusion.
+         * @return OdometryConfig The configuration.
+         */
+        OdometryConfig get_config() const;
+
+        /**
+         * @brief Advance the pose to a new encoder capture.
+         *
+         * The first update after a reset only records the counts.
+         *
+         * @param timestamp_us The encoder capture time.
+         * @param left_position The left encoder position in counts.
+         * @param right_position The right encoder position in counts.
+         * @param gyro_z_rad_s The bias corrected gyro z rate in rad/s.
+         * @param gyro_valid false if there is no fresh gyro sample to fuse.
+         */
+        void update(uint64_t timestamp_us, int32_t left_position, int32_t right_position,
+                    float gyro_z_rad_s, bool gyro_valid);
+
+        /**
+         * @brief Get the current pose estimate.
+         * @return OdometryState The estimate.
+         */
+        OdometryState get_state() const;
+
+    private:
+        OdometryConfig config_; // Geometry and gyro fusion.
+        float meters_per_count_; // Wheel travel per encoder count.
+
+        bool started_; // Set once the first counts were recorded.
+        uint64_t last_us_; // Capture time of the last update.
+        int32_t last_left_; // Left encoder position at the last update.
+        int32_t last_right_; // Right encoder position at the last update.
+
+        float x_; // Pose x in m.
+        float y_; // Pose y in m.
+        float heading_; // Pose heading in rad.
+        float p_[3][3]; // Pose covariance.
+};
+
+#endif // ODOMETRY_HPP
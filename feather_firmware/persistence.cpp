@@ -0,0 +1,94 @@
+// persistence.cpp
+// Carson Powers
+// Source file for the state kept across warm restarts of the Adafruit Feather RP2040 on the AHSR robot
+
+#include "persistence.hpp"
+
+// Standard Libraries
+#include <cstring>
+
+// Pico Libraries
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#define FNV_OFFSET_BASIS 0x811C9DC5u
+#define FNV_PRIME 0x01000193u
+
+/**
+ * @brief One saved record.
+ */
+struct PersistenceSlot {
+    uint32_t magic; // PERSISTENCE_MAGIC once the rest of the slot is written.
+    uint32_t seq; // Save number, the newest valid slot wins.
+    uint32_t length; // Record length.
+    uint32_t checksum; // FNV-1a over seq, length and the record.
+    uint8_t data[PERSISTENCE_MAX_LENGTH]; // Record.
+};
+
+// Not cleared by the runtime at boot
+static PersistenceSlot __uninitialized_ram(persistence_slots)[2];
+
+// Number of the next save (its slot is next_seq % 2)
+static uint32_t next_seq = 0;
+
+static uint32_t fnv1a(uint32_t hash, const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    while (length--) {
+        hash = (hash ^ *bytes++) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint32_t slot_checksum(const PersistenceSlot& slot) {
+    uint32_t hash = fnv1a(FNV_OFFSET_BASIS, &slot.seq, sizeof(slot.seq));
+    hash = fnv1a(hash, &slot.length, sizeof(slot.length));
+    return fnv1a(hash, slot.data, slot.length);
+}
+
+static bool slot_valid(const PersistenceSlot& slot, size_t length) {
+    return slot.magic == PERSISTENCE_MAGIC && slot.length == length && slot_checksum(slot) == slot.checksum;
+}
+
+bool persistence_load(void* data, size_t length) {
+    const PersistenceSlot* newest = nullptr;
+
+    if (length > PERSISTENCE_MAX_LENGTH) {
+        return false;
+    }
+
+    for (const PersistenceSlot& slot : persistence_slots) {
+        // Save numbers wrap, so compare distances
+        if (slot_valid(slot, length) && (!newest || (int32_t)(slot.seq - newest->seq) > 0)) {
+            newest = &slot;
+        }
+    }
+    if (!newest) {
+        next_seq = 0;
+        return false;
+    }
+
+    memcpy(data, newest->data, length);
+    next_seq = newest->seq + 1;
+
+    return true;
+}
+
+void persistence_save(const void* data, size_t length) {
+    if (length > PERSISTENCE_MAX_LENGTH) {
+        return;
+    }
+
+    // The other slot keeps the last record until this one is complete
+    PersistenceSlot& slot = persistence_slots[next_seq % 2];
+    slot.magic = 0;
+    __dmb();
+    slot.seq = next_seq;
+    slot.length = length;
+    memcpy(slot.data, data, length);
+    slot.checksum = slot_checksum(slot);
+    __dmb();
+    slot.magic = PERSISTENCE_MAGIC;
+
+    next_seq++;
+}
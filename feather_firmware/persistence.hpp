@@ -0,0 +1,40 @@
+// persistence.hpp
+// Carson Powers
+// Header file for the state kept across warm restarts of the Adafruit Feather RP2040 on the AHSR robot
+
+// The record lives in RAM the runtime leaves alone at boot
+// (__uninitialized_ram), so it survives watchdog, RUN pin and software
+// resets. A power cycle, or anything else that garbles it, fails the
+// checksum and the firmware starts cold. Two slots are written in turn and
+// a slot is only marked valid once its data and checksum are in place, so a
+// reset in the middle of a save still leaves the previous record.
+
+#ifndef PERSISTENCE_HPP
+#define PERSISTENCE_HPP
+
+// Standard Libraries
+#include <cstdint>
+#include <cstddef>
+
+#define PERSISTENCE_MAX_LENGTH 128 // Largest record
+#define PERSISTENCE_MAGIC 0x57524D53 // Marks a slot whose record is complete
+
+/**
+ * @brief Find the newest intact record and continue numbering saves after it.
+ *
+ * Call once at boot, before the first persistence_save().
+ *
+ * @param data The buffer to fill.
+ * @param length The record length; records of another length are ignored.
+ * @return true if a record was found and copied.
+ */
+bool persistence_load(void* data, size_t length);
+
+/**
+ * @brief Replace the older of the two records (one core only).
+ * @param data The record.
+ * @param length The record length (at most PERSISTENCE_MAX_LENGTH).
+ */
+void persistence_save(const void* data, size_t length);
+
+#endif // PERSISTENCE_HPP
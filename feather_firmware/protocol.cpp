@@ -0,0 +1,359 @@
+// protocol.cpp
+// Carson Powers
+// Source file for the framed USB protocol on the Adafruit Feather RP2040 on the AHSR robot
+
+#include "protocol.hpp"
+
+// Standard Libraries
+#include <cstring>
+
+// Pico Libraries
+#include "pico/stdlib.h"
+#if PROTOCOL_CRC_USE_DMA
+#include "hardware/dma.h"
+#endif
+
+#define CRC32_INIT ((uint32_t)-1l)
+
+#if PROTOCOL_CRC_USE_DMA
+// DMA channel used to sniff the CRC, and the (unchanging) dummy destination
+static int crc_dma_channel = -1;
+static uint8_t crc_dummy_dst[1];
+#endif
+
+// Raw (not COBS encoded) frame, shared by encode_frame and FrameParser::decode
+static uint8_t raw_frame[PROTOCOL_MAX_FRAME];
+
+void initializeProtocol() {
+#if PROTOCOL_CRC_USE_DMA
+    // Get a free channel, panic() if there are none
+    if (crc_dma_channel < 0) {
+        crc_dma_channel = dma_claim_unused_channel(true);
+    }
+#endif
+}
+
+#if PROTOCOL_CRC_USE_DMA
+uint32_t protocol_crc32(const uint8_t* data, size_t length) {
+    // 8 bit transfers, incrementing the read address only, as fast as possible
+    dma_channel_config c = dma_channel_get_default_config(crc_dma_channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+
+    // (bit-reverse) CRC32 sniff set-up, matching the software version below
+    channel_config_set_sniff_enable(&c, true);
+    dma_sniffer_set_data_accumulator(CRC32_INIT);
+    dma_sniffer_set_output_reverse_enabled(true);
+    dma_sniffer_enable(crc_dma_channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+
+    dma_channel_configure(crc_dma_channel, &c, crc_dummy_dst, data, length, true);
+    dma_channel_wait_for_finish_blocking(crc_dma_channel);
+
+    return dma_sniffer_get_data_accumulator();
+}
+#else
+uint32_t protocol_crc32(const uint8_t* data, size_t length) {
+    uint32_t crc = CRC32_INIT;
+
+    // Standard polynomial with the reversed shift direction, as in dma/sniff_crc
+    while (length--) {
+        uint32_t byte32 = (uint32_t)*data++;
+
+        for (uint8_t bit = 8; bit; bit--, byte32 >>= 1) {
+            crc = (crc >> 1) ^ (((crc ^ byte32) & 1ul) ? 0xEDB88320ul : 0ul);
+        }
+    }
+    return crc;
+}
+#endif
+
+/**
+ * @brief COBS encode a buffer (no delimiter is appended).
+ * @return size_t The encoded length.
+ */
+static size_t cobs_encode(const uint8_t* in, size_t length, uint8_t* out) {
+    size_t code_index = 0;
+    size_t out_index = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < length; i++) {
+        if (in[i] == 0) {
+            // End the block at the zero
+            out[code_index] = code;
+            code_index = out_index++;
+            code = 1;
+        } else {
+            out[out_index++] = in[i];
+            code++;
+
+            // Blocks hold at most 254 data bytes
+            if (code == 0xFF) {
+                out[code_index] = code;
+                code_index = out_index++;
+                code = 1;
+            }
+        }
+    }
+    out[code_index] = code;
+
+    return out_index;
+}
+
+/**
+ * @brief COBS decode a buffer (without its delimiter).
+ * @return size_t The decoded length, or 0 if the input is malformed or too long.
+ */
+static size_t cobs_decode(const uint8_t* in, size_t length, uint8_t* out, size_t max_length) {
+    size_t in_index = 0;
+    size_t out_index = 0;
+
+    while (in_index < length) {
+        uint8_t code = in[in_index++];
+        if (code == 0) {
+            return 0;
+        }
+
+        for (uint8_t i = 1; i < code; i++) {
+            if (in_index >= length || out_index >= max_length) {
+                return 0;
+            }
+            out[out_index++] = in[in_index++];
+        }
+
+        // A block shorter than 254 bytes stands for a zero, unless it is the last one
+        if (code != 0xFF && in_index < length) {
+            if (out_index >= max_length) {
+                return 0;
+            }
+            out[out_index++] = 0;
+        }
+    }
+
+    return out_index;
+}
+
+int request_payload_length(uint8_t type) {
+    switch (type) {
+        case MSG_GET_ENCODERS:
+        case MSG_GET_VELOCITIES:
+        case MSG_GET_IMU:
+        case MSG_GET_ALL_SENSORS:
+        case MSG_RESET_SENSORS:
+        case MSG_START_STREAM:
+        case MSG_STOP_STREAM:
+        case MSG_GET_IMU_FIFO:
+        case MSG_GET_ENCODER_SNAPSHOT:
+        case MSG_GET_ENCODER_ERRORS:
+        case MSG_GET_ORIENTATION:
+        case MSG_GET_ODOMETRY:
+        case MSG_GET_MOTORS:
+        case MSG_GET_STATUS:
+        case MSG_GET_IMU_CONFIG:
+            return 0;
+        case MSG_SET_STREAM_RATE:
+            return STREAM_RATE_PAYLOAD_LENGTH;
+        case MSG_SET_IMU_FIFO_MODE:
+            return IMU_FIFO_MODE_PAYLOAD_LENGTH;
+        case MSG_GET_STATS:
+            return STATS_REQUEST_PAYLOAD_LENGTH;
+        case MSG_TIME_SYNC:
+            return TIME_SYNC_REQUEST_PAYLOAD_LENGTH;
+        case MSG_SET_ODOMETRY_CONFIG:
+            return ODOMETRY_CONFIG_PAYLOAD_LENGTH;
+        case MSG_SET_WHEEL_SPEEDS:
+            return WHEEL_SPEEDS_PAYLOAD_LENGTH;
+        case MSG_SET_MOTOR_GAINS:
+            return MOTOR_GAINS_PAYLOAD_LENGTH;
+        case MSG_SET_IMU_CONFIG:
+            return IMU_CONFIG_REQUEST_PAYLOAD_LENGTH;
+        case MSG_GET_HISTORY:
+            return HISTORY_REQUEST_PAYLOAD_LENGTH;
+        case MSG_SET_STREAM_ENCODING:
+            return STREAM_ENCODING_PAYLOAD_LENGTH;
+        default:
+            return -1;
+    }
+}
+
+size_t encode_frame(uint8_t type, uint16_t seq, const uint8_t* payload, uint16_t length, uint8_t* out) {
+    // A truncated body would still carry a valid CRC, so refuse it instead
+    if (length > PROTOCOL_MAX_PAYLOAD) {
+        return 0;
+    }
+
+    // Header
+    raw_frame[0] = type;
+    memcpy(&raw_frame[1], &seq, sizeof(seq));
+    memcpy(&raw_frame[3], &length, sizeof(length));
+
+    // Payload
+    if (length > 0) {
+        memcpy(&raw_frame[PROTOCOL_HEADER_LENGTH], payload, length);
+    }
+
+    // CRC over header and payload
+    size_t raw_length = PROTOCOL_HEADER_LENGTH + length;
+    uint32_t crc = protocol_crc32(raw_frame, raw_length);
+    memcpy(&raw_frame[raw_length], &crc, sizeof(crc));
+    raw_length += PROTOCOL_CRC_LENGTH;
+
+    // Encode and delimit
+    size_t encoded_length = cobs_encode(raw_frame, raw_length, out);
+    out[encoded_length++] = PROTOCOL_DELIMITER;
+
+    return encoded_length;
+}
+
+/**
+ * @brief A field of the MSG_TELEMETRY payload.
+ */
+struct TelemetryField {
+    uint8_t offset; // Offset in the payload.
+    uint8_t size; // 8, 4 (little endian) or 2 (big endian IMU register).
+};
+
+// MSG_TELEMETRY layout, see fill_all_sensors()
+static const TelemetryField telemetry_fields[] = {
+    {0, 8}, {8, 4}, {12, 4}, {16, 4}, {20, 4}, {24, 8},
+    {32, 2}, {34, 2}, {36, 2}, {38, 2}, {40, 2}, {42, 2}, {44, 2}
+};
+
+static uint64_t read_field(const uint8_t* payload, const TelemetryField& field) {
+    const uint8_t* in = &payload[field.offset];
+
+    if (field.size == 2) {
+        return (uint16_t)((in[0] << 8) | in[1]);
+    }
+
+    uint64_t value = 0;
+    memcpy(&value, in, field.size);
+    return value;
+}
+
+static void write_field(uint8_t* payload, const TelemetryField& field, uint64_t value) {
+    uint8_t* out = &payload[field.offset];
+
+    if (field.size == 2) {
+        out[0] = (uint8_t)(value >> 8);
+        out[1] = (uint8_t)value;
+        return;
+    }
+
+    memcpy(out, &value, field.size);
+}
+
+size_t encode_telemetry_delta(const uint8_t* previous, const uint8_t* current, uint8_t* out) {
+    size_t length = 0;
+
+    for (const TelemetryField& field : telemetry_fields) {
+        // Difference in the field's width, sign extended
+        int shift = 64 - 8 * field.size;
+        uint64_t difference = (read_field(current, field) - read_field(previous, field)) << shift;
+        int64_t delta = (int64_t)difference >> shift;
+
+        // Zig-zag: small magnitudes of either sign become small numbers
+        uint64_t value = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+        while (value >= 0x80) {
+            out[length++] = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        out[length++] = (uint8_t)value;
+    }
+
+    return length;
+}
+
+bool decode_telemetry_delta(const uint8_t* previous, const uint8_t* delta, size_t length, uint8_t* current) {
+    size_t index = 0;
+
+    for (const TelemetryField& field : telemetry_fields) {
+        uint64_t value = 0;
+        int bits = 0;
+        uint8_t byte;
+
+        do {
+            if (index >= length || bits >= 64) {
+                return false;
+            }
+            byte = delta[index++];
+            value |= (uint64_t)(byte & 0x7F) << bits;
+            bits += 7;
+        } while (byte & 0x80);
+
+        int64_t difference = (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+        write_field(current, field, read_field(previous, field) + (uint64_t)difference);
+    }
+
+    return index == length;
+}
+
+FrameParser::FrameParser()
+    : length_(0), overflow_(false), error_count_(0) {
+    memset(&frame_, 0, sizeof(frame_));
+}
+
+bool FrameParser::push_byte(uint8_t byte) {
+    if (byte != PROTOCOL_DELIMITER) {
+        // Buffer the byte, dropping the frame if it is too long
+        if (length_ < sizeof(buffer_)) {
+            buffer_[length_++] = byte;
+        } else {
+            overflow_ = true;
+        }
+        return false;
+    }
+
+    // Delimiter: back-to-back delimiters are empty frames and are ignored
+    bool valid = false;
+    if (length_ > 0) {
+        valid = !overflow_ && decode();
+        if (!valid) {
+            error_count_++;
+        }
+    }
+
+    reset();
+    return valid;
+}
+
+const Frame& FrameParser::get_frame() const {
+    return frame_;
+}
+
+uint32_t FrameParser::get_error_count() const {
+    return error_count_;
+}
+
+void FrameParser::reset() {
+    length_ = 0;
+    overflow_ = false;
+}
+
+bool FrameParser::decode() {
+    size_t raw_length = cobs_decode(buffer_, length_, raw_frame, sizeof(raw_frame));
+    if (raw_length < PROTOCOL_HEADER_LENGTH + PROTOCOL_CRC_LENGTH) {
+        return false;
+    }
+
+    // Check the length field against the received size
+    uint16_t length;
+    memcpy(&length, &raw_frame[3], sizeof(length));
+    if ((size_t)(PROTOCOL_HEADER_LENGTH + length + PROTOCOL_CRC_LENGTH) != raw_length) {
+        return false;
+    }
+
+    // Check the CRC
+    uint32_t crc;
+    memcpy(&crc, &raw_frame[PROTOCOL_HEADER_LENGTH + length], sizeof(crc));
+    if (protocol_crc32(raw_frame, PROTOCOL_HEADER_LENGTH + length) != crc) {
+        return false;
+    }
+
+    frame_.type = raw_frame[0];
+    memcpy(&frame_.seq, &raw_frame[1], sizeof(frame_.seq));
+    frame_.length = length;
+    memcpy(frame_.payload, &raw_frame[PROTOCOL_HEADER_LENGTH], length);
+
+    return true;
+}
@@ -0,0 +1,254 @@
+// protocol.hpp
+// Carson Powers
+// Header file for the framed USB protocol on the Adafruit Feather RP2040 on the AHSR robot
+
+// Frame layout (before COBS encoding, all fields little endian, f32 is IEEE 754 single precision):
+//   [type u8][seq u16][length u16][payload (length bytes)][crc32 u32]
+// The CRC covers type through payload and is the reflected CRC-32 (poly
+// 0xEDB88320, init 0xFFFFFFFF, no final XOR) computed by the DMA sniffer as in
+// dma/sniff_crc. Frames are COBS encoded and terminated by a 0x00 delimiter,
+// so the parser resynchronizes on the next delimiter after dropped bytes.
+//
+// Responses echo the request sequence number and use the request type with
+// MSG_RESPONSE_FLAG set.
+//
+// Requests may be pipelined: the host can send several frames without waiting
+// and match the responses by sequence number. Every request that has arrived
+// is answered in order in one pass, and the responses share one USB transfer.
+//
+// Sensor payloads carry the 64 bit device time in us since boot at which they
+// were sampled. To map device time to its own clock, the host sends
+// MSG_TIME_SYNC with its send time t1 and reads its receive time t4. The
+// response holds t1, the device receive time t2 and the device send time t3:
+//   offset = ((t2 - t1) + (t3 - t4)) / 2 (device minus host)
+//   delay = (t4 - t1) - (t3 - t2)
+// Offsets from the lowest delay exchanges are the least affected by USB
+// scheduling; a line fitted through them over time gives the drift.
+//
+// With MSG_SET_STREAM_ENCODING set to STREAM_ENCODING_DELTA, telemetry
+// between keyframes is sent as MSG_TELEMETRY_DELTA: each field of the
+// MSG_TELEMETRY payload (the IMU registers as big endian i16) as the
+// difference from telemetry frame seq - 1, zig-zag mapped to unsigned and
+// written as a LEB128 varint (7 bits per byte, low first, top bit set on all
+// but the last). Keyframes are plain MSG_TELEMETRY frames, sent every
+// keyframe interval frames and after a dropped sample; a host that missed a
+// frame waits for the next one.
+
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+// Standard Libraries
+#include <cstdint>
+#include <cstddef>
+
+// Command Bytes for Protocol Operations (legacy single byte link)
+#define FRAMED_MODE_BYTE 0x46 // 'F' switches the link to framed mode
+
+// Compute the CRC with the DMA sniffer. Build with PROTOCOL_CRC_USE_DMA=0 to
+// use the software implementation instead.
+#ifndef PROTOCOL_CRC_USE_DMA
+#define PROTOCOL_CRC_USE_DMA 1
+#endif
+
+// Frame sizes
+#define PROTOCOL_HEADER_LENGTH 5
+#define PROTOCOL_CRC_LENGTH 4
+#define PROTOCOL_MAX_PAYLOAD 1024
+#define PROTOCOL_MAX_FRAME (PROTOCOL_HEADER_LENGTH + PROTOCOL_MAX_PAYLOAD + PROTOCOL_CRC_LENGTH)
+#define PROTOCOL_MAX_ENCODED_FRAME (PROTOCOL_MAX_FRAME + (PROTOCOL_MAX_FRAME / 254) + 2) // COBS overhead + delimiter
+#define PROTOCOL_DELIMITER 0x00
+
+// Request Message Types (host -> Feather)
+#define MSG_GET_ENCODERS 0x01 // Payload: none
+#define MSG_GET_VELOCITIES 0x02 // Payload: none
+#define MSG_GET_IMU 0x03 // Payload: none
+#define MSG_GET_ALL_SENSORS 0x04 // Payload: none
+#define MSG_RESET_SENSORS 0x05 // Payload: none
+#define MSG_START_STREAM 0x06 // Payload: none
+#define MSG_STOP_STREAM 0x07 // Payload: none
+#define MSG_SET_STREAM_RATE 0x08 // Payload: [rate Hz u16]
+#define MSG_SET_IMU_FIFO_MODE 0x09 // Payload: [enable u8]
+#define MSG_GET_IMU_FIFO 0x0A // Payload: none
+#define MSG_GET_ENCODER_SNAPSHOT 0x0B // Payload: none
+#define MSG_GET_ENCODER_ERRORS 0x0C // Payload: none
+#define MSG_GET_STATS 0x0D // Payload: [reset after reading u8]
+#define MSG_GET_ORIENTATION 0x0E // Payload: none
+#define MSG_TIME_SYNC 0x0F // Payload: [host send time t1 u64]
+#define MSG_GET_ODOMETRY 0x10 // Payload: none
+#define MSG_SET_ODOMETRY_CONFIG 0x11 // Payload: [wheel radius m f32][wheel base m f32][fuse gyro u8]
+#define MSG_SET_WHEEL_SPEEDS 0x12 // Payload: [left i32][right i32] sub-steps per second
+#define MSG_SET_MOTOR_GAINS 0x13 // Payload: [kp f32][ki f32][kd f32][kff f32][ks f32]
+#define MSG_GET_MOTORS 0x14 // Payload: none
+#define MSG_GET_STATUS 0x15 // Payload: none
+#define MSG_SET_IMU_CONFIG 0x16 // Payload: [gyro range u8][accel range u8][dlpf u8][sample rate divider u8]; DLPF and rate changes are refused in I2C FIFO mode
+#define MSG_GET_IMU_CONFIG 0x17 // Payload: none
+#define MSG_GET_HISTORY 0x18 // Payload: [since seq u32][max samples u16, 0 for all]
+#define MSG_SET_STREAM_ENCODING 0x19 // Payload: [encoding u8][keyframe interval u16]
+
+// Response Message Types (Feather -> host)
+#define MSG_RESPONSE_FLAG 0x80 // Set on the request type in its response
+#define MSG_TELEMETRY 0x40 // Unsolicited, seq counts telemetry frames. Payload: TELEMETRY_PAYLOAD_LENGTH
+#define MSG_TELEMETRY_DELTA 0x41 // Unsolicited, same seq as MSG_TELEMETRY. Payload: varint deltas against seq - 1
+#define MSG_ERROR 0xFF // Payload: [request type u8][error code u8]
+
+// Telemetry encodings
+#define STREAM_ENCODING_RAW 0 // Every sample as MSG_TELEMETRY
+#define STREAM_ENCODING_DELTA 1 // MSG_TELEMETRY keyframes, MSG_TELEMETRY_DELTA between them
+#define STREAM_KEYFRAME_INTERVAL_DEFAULT 50 // Frames per keyframe (25 ms at 2 kHz)
+
+// Error Codes
+#define PROTOCOL_ERROR_UNKNOWN_TYPE 0x01
+#define PROTOCOL_ERROR_BAD_LENGTH 0x02
+#define PROTOCOL_ERROR_BAD_VALUE 0x03
+
+// Payload Lengths
+#define ENCODER_SNAPSHOT_PAYLOAD_LENGTH 16 // timestamp us (u64), positions (2 x i32)
+#define ENCODER_ERRORS_PAYLOAD_LENGTH 8 // illegal transitions since boot (2 x u32)
+#define STATS_REQUEST_PAYLOAD_LENGTH 1 // reset after reading (u8)
+#define ORIENTATION_PAYLOAD_LENGTH 36 // sample timestamp us (u64), quaternion w, x, y, z (4 x i32 Q30), gyro bias x, y, z (3 x i32 Q16 rad/s)
+#define VELOCITIES_PAYLOAD_LENGTH 24 // encoder timestamp us (u64), speeds (2 x i32), sub-step positions (2 x i32)
+#define IMU_SAMPLE_PAYLOAD_LENGTH 22 // IMU timestamp us (u64), IMU registers (14)
+#define ALL_SENSORS_PAYLOAD_LENGTH 46 // encoder timestamp us (u64), positions (2 x i32), speeds (2 x i32), IMU timestamp us (u64), IMU registers (14)
+#define TELEMETRY_PAYLOAD_LENGTH ALL_SENSORS_PAYLOAD_LENGTH // Same layout as MSG_GET_ALL_SENSORS
+#define TIME_SYNC_REQUEST_PAYLOAD_LENGTH 8 // host send time t1 (u64, echoed)
+#define TIME_SYNC_PAYLOAD_LENGTH 24 // host send time t1 (u64), device receive us t2 (u64), device send us t3 (u64)
+#define ODOMETRY_PAYLOAD_LENGTH 44 // encoder timestamp us (u64), x m, y m, heading rad (3 x f32), covariance xx, xy, xh, yy, yh, hh (6 x f32)
+#define ODOMETRY_CONFIG_PAYLOAD_LENGTH 9 // wheel radius m (f32), wheel base m (f32), fuse gyro (u8)
+#define WHEEL_SPEEDS_PAYLOAD_LENGTH 8 // speed setpoints (2 x i32, sub-steps per second)
+#define MOTOR_GAINS_PAYLOAD_LENGTH 20 // kp, ki, kd, kff, ks (5 x f32)
+#define MOTORS_PAYLOAD_LENGTH 32 // encoder timestamp us (u64), setpoints (2 x i32), speeds (2 x i32), duty (2 x f32)
+#define IMU_CONFIG_REQUEST_PAYLOAD_LENGTH 4 // gyro range (u8, 0 - 3: 250 - 2000 dps), accel range (u8, 0 - 3: 2 - 16 g), DLPF_CFG (u8, 0 - 6), SMPLRT_DIV (u8)
+#define IMU_CONFIG_PAYLOAD_LENGTH 16 // the request fields (4 x u8), gyro LSB per dps (f32), accel LSB per g (f32), sample rate Hz outside FIFO mode (f32)
+#define STATUS_PAYLOAD_LENGTH 24 // uptime us (u64), IMU state (u8, IMUInitState), IMU init attempts (u16), IMU sampling since us (u64, 0 before), warm restart (u8, 1 if state was restored at boot), warm restarts since the last cold boot (u32)
+#define STREAM_RATE_PAYLOAD_LENGTH 2 // rate Hz (u16)
+#define IMU_FIFO_MODE_PAYLOAD_LENGTH 1 // enable (u8)
+#define IMU_FIFO_HEADER_LENGTH 9 // dropped (u32), FIFO overflows (u32), count (u8)
+#define IMU_FIFO_ENTRY_LENGTH 22 // timestamp us (u64), IMU registers (14)
+#define IMU_FIFO_MAX_ENTRIES ((PROTOCOL_MAX_PAYLOAD - IMU_FIFO_HEADER_LENGTH) / IMU_FIFO_ENTRY_LENGTH)
+#define HISTORY_REQUEST_PAYLOAD_LENGTH 6 // since seq (u32), max samples (u16)
+#define HISTORY_HEADER_LENGTH 6 // first seq (u32), count (u8), more frames follow (u8)
+#define HISTORY_ENTRY_LENGTH 38 // encoder timestamp us (u64), positions (2 x i32), IMU timestamp us (u64), IMU registers (14)
+#define HISTORY_MAX_ENTRIES ((PROTOCOL_MAX_PAYLOAD - HISTORY_HEADER_LENGTH) / HISTORY_ENTRY_LENGTH)
+#define STREAM_ENCODING_PAYLOAD_LENGTH 3 // encoding (u8), keyframe interval in frames (u16)
+#define TELEMETRY_DELTA_MAX_LENGTH 61 // 2 timestamps (10 bytes max), 4 x i32 (5), 7 IMU registers (3)
+
+/**
+ * @brief A decoded protocol frame.
+ */
+struct Frame {
+    uint8_t type; // Message type.
+    uint16_t seq; // Sequence number.
+    uint16_t length; // Payload length in bytes.
+    uint8_t payload[PROTOCOL_MAX_PAYLOAD]; // Payload data.
+};
+
+/**
+ * @brief Initialize the protocol (claims the CRC DMA channel).
+ */
+void initializeProtocol();
+
+/**
+ * @brief Compute the frame CRC of a buffer.
+ *
+ * @param data The data to checksum.
+ * @param length The number of bytes.
+ * @return uint32_t The CRC-32 value.
+ */
+uint32_t protocol_crc32(const uint8_t* data, size_t length);
+
+/**
+ * @brief Get the expected payload length of a request.
+ *
+ * @param type The request message type.
+ * @return int The payload length in bytes, or -1 if the type is unknown.
+ */
+int request_payload_length(uint8_t type);
+
+/**
+ * @brief Build, COBS encode and delimit a frame.
+ *
+ * @param type The message type.
+ * @param seq The sequence number.
+ * @param payload The payload data (may be nullptr if length is 0).
+ * @param length The payload length (at most PROTOCOL_MAX_PAYLOAD).
+ * @param out The output buffer (at least PROTOCOL_MAX_ENCODED_FRAME bytes).
+ * @return size_t The number of bytes written to out, including the delimiter,
+ *         or 0 if the payload is longer than PROTOCOL_MAX_PAYLOAD.
+ */
+size_t encode_frame(uint8_t type, uint16_t seq, const uint8_t* payload, uint16_t length, uint8_t* out);
+
+/**
+ * @brief Delta encode a telemetry payload against the previous one.
+ *
+ * @param previous The previous MSG_TELEMETRY payload.
+ * @param current The MSG_TELEMETRY payload to encode.
+ * @param out The output buffer (at least TELEMETRY_DELTA_MAX_LENGTH bytes).
+ * @return size_t The number of bytes written.
+ */
+size_t encode_telemetry_delta(const uint8_t* previous, const uint8_t* current, uint8_t* out);
+
+/**
+ * @brief Rebuild a telemetry payload from a MSG_TELEMETRY_DELTA payload.
+ *
+ * @param previous The payload of the previous telemetry frame.
+ * @param delta The MSG_TELEMETRY_DELTA payload.
+ * @param length The delta payload length.
+ * @param current The TELEMETRY_PAYLOAD_LENGTH bytes to fill.
+ * @return true if the delta payload was well formed.
+ */
+bool decode_telemetry_delta(const uint8_t* previous, const uint8_t* delta, size_t length, uint8_t* current);
+
+/**
+ * @class FrameParser
+ * @brief Reassembles frames from a byte stream.
+ *
+ * Bytes are buffered until a delimiter, then COBS decoded, length and CRC
+ * checked. Corrupt or truncated frames are dropped and counted.
+ */
+class FrameParser {
+    public:
+        /**
+         * @brief Construct a new FrameParser object.
+         */
+        FrameParser();
+
+        /**
+         * @brief Feed one received byte to the parser.
+         *
+         * @param byte The received byte.
+         * @return true if a valid frame was completed and is available from get_frame().
+         */
+        bool push_byte(uint8_t byte);
+
+        /**
+         * @brief Get the last completed frame.
+         * @return const Frame& The frame.
+         */
+        const Frame& get_frame() const;
+
+        /**
+         * @brief Get the number of dropped frames (bad COBS, length or CRC).
+         * @return uint32_t The error count.
+         */
+        uint32_t get_error_count() const;
+
+        /**
+         * @brief Discard any partially received frame.
+         */
+        void reset();
+
+    private:
+        /**
+         * @brief Decode and validate the buffered frame.
+         * @return true if the frame is valid.
+         */
+        bool decode();
+
+        uint8_t buffer_[PROTOCOL_MAX_ENCODED_FRAME]; // Encoded bytes since the last delimiter.
+        size_t length_; // Number of buffered bytes.
+        bool overflow_; // Set when the current frame exceeded the buffer.
+        uint32_t error_count_; // Dropped frames.
+        Frame frame_; // Last valid frame.
+};
+
+#endif // PROTOCOL_HPP
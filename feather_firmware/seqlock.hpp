@@ -0,0 +1,144 @@
+// seqlock.hpp
+// Carson Powers
+// Header file for the single writer sequence lock used to hand sensor data between cores on the AHSR robot
+
+#ifndef SEQLOCK_HPP
+#define SEQLOCK_HPP
+
+// Standard Libraries
+#include <cstdint>
+
+// Pico Libraries
+#include "hardware/sync.h"
+
+/**
+ * @class SequenceCounter
+ * @brief The sequence number of a seqlock, for data that lives elsewhere.
+ *
+ * The writer calls begin_write() and end_write() around its update. Readers
+ * call read_begin(), copy the data, and retry while read_retry() is true.
+ * Only one core (or context) may write.
+ */
+class SequenceCounter {
+    public:
+        SequenceCounter() : sequence_(0) {}
+
+        /**
+         * @brief Mark the start of an update (single writer only).
+         */
+        void begin_write() {
+            sequence_ = sequence_ + 1;
+            __dmb();
+        }
+
+        /**
+         * @brief Mark the end of an update (single writer only).
+         */
+        void end_write() {
+            __dmb();
+            sequence_ = sequence_ + 1;
+        }
+
+        /**
+         * @brief Start a read.
+         * @return uint32_t The sequence to pass to read_retry().
+         */
+        uint32_t read_begin() const {
+            uint32_t start = sequence_;
+            __dmb();
+            return start;
+        }
+
+        /**
+         * @brief Check whether the data read since read_begin() may be torn.
+         * @param start The sequence returned by read_begin().
+         * @return true if the read must be repeated.
+         */
+        bool read_retry(uint32_t start) const {
+            __dmb();
+            return (start & 1) || start != sequence_;
+        }
+
+        /**
+         * @brief Get the number of completed updates.
+         * @return uint32_t The update count.
+         */
+        uint32_t get_count() const {
+            return sequence_ >> 1;
+        }
+
+    private:
+        volatile uint32_t sequence_; // Odd while an update is in progress.
+};
+
+/**
+ * @class Seqlock
+ * @brief Publishes a value from one writer to any number of readers without locks.
+ *
+ * The writer makes the sequence odd while it copies the value in and even
+ * again when done. Readers copy the value and retry if the sequence changed
+ * or was odd, so they never block the writer and never see a torn value.
+ * Only one core (or context) may call write().
+ *
+ * @tparam T A trivially copyable value type.
+ */
+template <typename T>
+class Seqlock {
+    public:
+        Seqlock() : sequence_(), value_() {}
+
+        /**
+         * @brief Publish a new value (single writer only).
+         * @param value The value to publish.
+         */
+        void write(const T& value) {
+            sequence_.begin_write();
+            value_ = value;
+            sequence_.end_write();
+        }
+
+        /**
+         * @brief Copy the latest published value.
+         * @return T The value.
+         */
+        T read() const {
+            T value;
+            uint32_t start;
+
+            do {
+                start = sequence_.read_begin();
+                value = value_;
+            } while (sequence_.read_retry(start));
+
+            return value;
+        }
+
+        /**
+         * @brief Copy the latest published value unless a write is in progress.
+         *
+         * For readers that can interrupt the writer on its own core, where
+         * read() would spin until the interrupt returned, which it never does.
+         *
+         * @param value Set to the value (possibly torn if false is returned).
+         * @return true if the copy is a complete published value.
+         */
+        bool try_read(T* value) const {
+            uint32_t start = sequence_.read_begin();
+            *value = value_;
+            return !sequence_.read_retry(start);
+        }
+
+        /**
+         * @brief Get the number of values published so far.
+         * @return uint32_t The publish count.
+         */
+        uint32_t get_count() const {
+            return sequence_.get_count();
+        }
+
+    private:
+        SequenceCounter sequence_; // Odd while a write is in progress.
+        T value_; // Published value.
+};
+
+#endif // SEQLOCK_HPP
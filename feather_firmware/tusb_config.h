@@ -0,0 +1,35 @@
+// tusb_config.h
+// Carson Powers
+// TinyUSB configuration for the Feather firmware on the AHSR robot: a CDC
+// serial port for stdio and debug, and a vendor bulk interface for frames
+
+#ifndef TUSB_CONFIG_H
+#define TUSB_CONFIG_H
+
+// CFG_TUSB_MCU and CFG_TUSB_OS are set by the Pico SDK
+
+#ifndef CFG_TUSB_RHPORT0_MODE
+#define CFG_TUSB_RHPORT0_MODE OPT_MODE_DEVICE
+#endif
+
+#define CFG_TUD_ENABLED 1
+#define CFG_TUD_ENDPOINT0_SIZE 64
+
+// Device classes
+#define CFG_TUD_CDC 1
+#define CFG_TUD_VENDOR 1
+#define CFG_TUD_MSC 0
+#define CFG_TUD_HID 0
+#define CFG_TUD_MIDI 0
+
+// CDC buffers (console and legacy single byte commands)
+#define CFG_TUD_CDC_RX_BUFSIZE 256
+#define CFG_TUD_CDC_TX_BUFSIZE 256
+
+// Vendor buffers. The TX FIFO holds several frames, which are sent back to
+// back in full size packets when the firmware flushes once per loop pass
+#define CFG_TUD_VENDOR_EPSIZE 64
+#define CFG_TUD_VENDOR_RX_BUFSIZE 1024
+#define CFG_TUD_VENDOR_TX_BUFSIZE 2048
+
+#endif // TUSB_CONFIG_H
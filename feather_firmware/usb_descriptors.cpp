@@ -0,0 +1,130 @@
+// usb_descriptors.cpp
+// Carson Powers
+// USB descriptors for the Feather firmware on the AHSR robot: CDC for stdio
+// and debug on interfaces 0 and 1, vendor bulk frames on interface 2
+
+// TinyUSB
+#include "tusb.h"
+
+// Pico Libraries
+#include "pico/unique_id.h"
+
+// Standard Libraries
+#include <cstring>
+
+// Raspberry Pi VID with the PID of the SDK's USB serial port
+#define FEATHER_USB_VID 0x2E8A
+#define FEATHER_USB_PID 0x000A
+#define FEATHER_USB_BCD 0x0200 // Device release 2.0: adds the vendor interface
+
+// Interfaces
+enum {
+    ITF_NUM_CDC = 0,
+    ITF_NUM_CDC_DATA,
+    ITF_NUM_VENDOR,
+    ITF_NUM_TOTAL
+};
+
+// Endpoints
+#define EPNUM_CDC_NOTIF 0x81
+#define EPNUM_CDC_OUT 0x02
+#define EPNUM_CDC_IN 0x82
+#define EPNUM_VENDOR_OUT 0x03
+#define EPNUM_VENDOR_IN 0x83
+
+#define CDC_NOTIF_EPSIZE 8
+#define BULK_EPSIZE 64 // Full speed bulk endpoint size
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_VENDOR_DESC_LEN)
+
+// String indices
+enum {
+    STRID_LANGID = 0,
+    STRID_MANUFACTURER,
+    STRID_PRODUCT,
+    STRID_SERIAL,
+    STRID_CDC,
+    STRID_VENDOR
+};
+
+// Interface association is needed for the CDC pair in a composite device
+static const tusb_desc_device_t device_descriptor = {
+    .bLength = sizeof(tusb_desc_device_t),
+    .bDescriptorType = TUSB_DESC_DEVICE,
+    .bcdUSB = 0x0200,
+    .bDeviceClass = TUSB_CLASS_MISC,
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor = FEATHER_USB_VID,
+    .idProduct = FEATHER_USB_PID,
+    .bcdDevice = FEATHER_USB_BCD,
+    .iManufacturer = STRID_MANUFACTURER,
+    .iProduct = STRID_PRODUCT,
+    .iSerialNumber = STRID_SERIAL,
+    .bNumConfigurations = 1
+};
+
+static const uint8_t configuration_descriptor[] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, STRID_CDC, EPNUM_CDC_NOTIF, CDC_NOTIF_EPSIZE, EPNUM_CDC_OUT, EPNUM_CDC_IN, BULK_EPSIZE),
+    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, STRID_VENDOR, EPNUM_VENDOR_OUT, EPNUM_VENDOR_IN, BULK_EPSIZE)
+};
+
+static const char* const string_descriptors[] = {
+    nullptr, // Language ID, sent as English below
+    "AHSR",
+    "AHSR Feather Sensors",
+    nullptr, // Serial number, from the flash unique ID
+    "AHSR Feather Console",
+    "AHSR Feather Frames"
+};
+
+#define STRING_DESCRIPTOR_MAX_CHARS 32
+
+static uint16_t string_buffer[STRING_DESCRIPTOR_MAX_CHARS + 1];
+
+const uint8_t* tud_descriptor_device_cb(void) {
+    return (const uint8_t*)&device_descriptor;
+}
+
+const uint8_t* tud_descriptor_configuration_cb(uint8_t index) {
+    (void)index;
+    return configuration_descriptor;
+}
+
+const uint16_t* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
+    char serial[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+    const char* string;
+    size_t length;
+
+    (void)langid;
+
+    if (index == STRID_LANGID) {
+        string_buffer[1] = 0x0409; // English
+        length = 1;
+    } else {
+        if (index == STRID_SERIAL) {
+            pico_get_unique_board_id_string(serial, sizeof(serial));
+            string = serial;
+        } else if (index < sizeof(string_descriptors) / sizeof(string_descriptors[0])) {
+            string = string_descriptors[index];
+        } else {
+            return nullptr;
+        }
+
+        // ASCII to UTF-16
+        length = strlen(string);
+        if (length > STRING_DESCRIPTOR_MAX_CHARS) {
+            length = STRING_DESCRIPTOR_MAX_CHARS;
+        }
+        for (size_t i = 0; i < length; i++) {
+            string_buffer[1 + i] = string[i];
+        }
+    }
+
+    // First entry is the descriptor length in bytes and type
+    string_buffer[0] = (uint16_t)((TUSB_DESC_STRING << 8) | (2 * length + 2));
+
+    return string_buffer;
+}